@@ -0,0 +1,182 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "aircraft_json.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "common.h"
+
+using namespace airnav::uat;
+
+AircraftJson::AircraftJson(boost::asio::io_service &service, Tracker::Pointer tracker, std::chrono::milliseconds interval, const std::string &path) : tracker_(tracker), timer_(service), interval_(interval), path_(path) {}
+
+void AircraftJson::Start() {
+    tracker_->TrackChanges();
+
+    auto self(shared_from_this());
+    tracker_->Strand().dispatch([this, self]() {
+        Update();
+        ScheduleUpdate();
+    });
+}
+
+void AircraftJson::Stop() { timer_.cancel(); }
+
+AircraftJson::SharedSnapshot AircraftJson::Snapshot() const {
+    auto snapshot = std::atomic_load(&snapshot_);
+    if (!snapshot) {
+        static const SharedSnapshot empty = std::make_shared<const std::string>("{\"aircraft\":[]}\n");
+        return empty;
+    }
+    return snapshot;
+}
+
+void AircraftJson::ScheduleUpdate() {
+    auto self(shared_from_this());
+    timer_.expires_from_now(interval_);
+    timer_.async_wait(tracker_->Strand().wrap([this, self](const boost::system::error_code &ec) {
+        if (!ec) {
+            Update();
+            ScheduleUpdate();
+        }
+    }));
+}
+
+void AircraftJson::Update() {
+    tracker_->TakeChanges(updated_, removed_);
+
+    for (auto key : removed_) {
+        fragments_.erase(key);
+    }
+
+    const auto &aircraft = tracker_->Aircraft();
+    for (auto key : updated_) {
+        if (auto state = aircraft.Find(key)) {
+            fragments_[key] = EncodeAircraft(*state);
+        } else {
+            fragments_.erase(key);
+        }
+    }
+
+    auto snapshot = std::make_shared<std::string>();
+    snapshot->reserve(snapshot_bytes_ + 64);
+
+    std::ostringstream header;
+    header << std::fixed << std::setprecision(1) << "{\"now\":" << (now_millis() / 1000.0) << ",\"messages\":" << tracker_->TotalMessages() << ",\"aircraft\":[";
+    *snapshot += header.str();
+
+    bool first = true;
+    for (const auto &entry : fragments_) {
+        if (!first) {
+            *snapshot += ',';
+        }
+        first = false;
+        *snapshot += entry.second;
+    }
+    *snapshot += "]}\n";
+
+    snapshot_bytes_ = snapshot->size();
+    std::atomic_store(&snapshot_, SharedSnapshot(snapshot));
+
+    if (!path_.empty()) {
+        WriteFile(*snapshot);
+    }
+}
+
+void AircraftJson::WriteFile(const std::string &content) {
+    // write to a temporary file then rename it into place, so readers never see a partial file
+    const std::string temp_path = path_ + ".tmp";
+
+    bool ok;
+    {
+        std::ofstream out(temp_path, std::ios::out | std::ios::trunc | std::ios::binary);
+        out.write(content.data(), content.size());
+        out.close();
+        ok = !out.fail();
+    }
+    if (ok && std::rename(temp_path.c_str(), path_.c_str()) < 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        if (!reported_write_error_) {
+            std::cerr << path_ << ": failed to write aircraft snapshot: " << std::strerror(errno) << std::endl;
+            reported_write_error_ = true;
+        }
+    } else {
+        reported_write_error_ = false;
+    }
+}
+
+std::string AircraftJson::EncodeAircraft(const AircraftState &state) {
+    nlohmann::json o;
+
+    // as in dump1090, non-ICAO addresses get a leading ~
+    const bool icao = (state.address_qualifier == AddressQualifier::ADSB_ICAO || state.address_qualifier == AddressQualifier::TISB_ICAO);
+    std::ostringstream os;
+    os << (icao ? "" : "~") << std::hex << std::setfill('0') << std::setw(6) << state.address;
+    o["hex"] = os.str();
+    o["addr_type"] = state.address_qualifier;
+
+    o["messages"] = state.messages;
+    o["rssi"] = RoundN(state.AverageRssi(), 1);
+    o["seen"] = state.last_message_time / 1000.0;
+
+#define EMIT(name, field)                \
+    do {                                 \
+        if (field) {                     \
+            o[name] = (field).Value();   \
+        }                                \
+    } while (0)
+
+    if (state.position) {
+        o["lat"] = state.position.Value().first;
+        o["lon"] = state.position.Value().second;
+        o["seen_pos"] = state.position.Updated() / 1000.0;
+    }
+
+    EMIT("alt_baro", state.pressure_altitude);
+    EMIT("alt_geom", state.geometric_altitude);
+    EMIT("nic", state.nic);
+    EMIT("rc", state.horizontal_containment);
+    EMIT("airground", state.airground_state);
+    EMIT("gs", state.ground_speed);
+    EMIT("track", state.true_track);
+    EMIT("true_heading", state.true_heading);
+    EMIT("mag_heading", state.magnetic_heading);
+    EMIT("baro_rate", state.vertical_velocity_barometric);
+    EMIT("geom_rate", state.vertical_velocity_geometric);
+
+    const auto &details = state.Details();
+    EMIT("flight", details.callsign);
+    EMIT("squawk", details.flightplan_id);
+    EMIT("emergency", details.emergency);
+    EMIT("version", details.mops_version);
+    EMIT("nac_p", details.nac_p);
+    EMIT("nac_v", details.nac_v);
+    EMIT("nic_baro", details.nic_baro);
+    EMIT("sil", details.sil);
+    EMIT("sda", details.sda);
+    EMIT("gva", details.gva);
+    EMIT("nav_altitude_mcp", details.selected_altitude_mcp);
+    EMIT("nav_altitude_fms", details.selected_altitude_fms);
+    EMIT("nav_qnh", details.barometric_pressure_setting);
+    EMIT("nav_heading", details.selected_heading);
+
+    if (details.emitter_category) {
+        const unsigned category = details.emitter_category.Value();
+        o["category"] = std::string{(char)('A' + (category >> 3)), (char)('0' + (category & 7))};
+    }
+
+#undef EMIT
+
+    return o.dump();
+}
@@ -0,0 +1,69 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_AIRCRAFT_JSON_H
+#define DUMP978_AIRCRAFT_JSON_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "track.h"
+
+namespace airnav::uat {
+    // Periodically produces an aircraft.json-style snapshot of a Tracker's
+    // aircraft table, optionally writing it to a file.
+    //
+    // The snapshot is built incrementally. Each aircraft's JSON object is
+    // cached, and on each update only the aircraft that the tracker reports
+    // as changed since the previous update are re-encoded. Building the
+    // snapshot is then just concatenating the cached objects. To keep the
+    // cached objects valid, they contain only absolute times ("seen",
+    // "seen_pos" are Unix times in seconds), not ages relative to "now".
+    class AircraftJson : public std::enable_shared_from_this<AircraftJson> {
+      public:
+        typedef std::shared_ptr<AircraftJson> Pointer;
+        typedef std::shared_ptr<const std::string> SharedSnapshot;
+
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, Tracker::Pointer tracker, std::chrono::milliseconds interval, const std::string &path = "") { return Pointer(new AircraftJson(service, tracker, interval, path)); }
+
+        void Start();
+        void Stop();
+
+        // The most recent snapshot. May be called from any thread.
+        SharedSnapshot Snapshot() const;
+
+      private:
+        AircraftJson(boost::asio::io_service &service, Tracker::Pointer tracker, std::chrono::milliseconds interval, const std::string &path);
+
+        void ScheduleUpdate();
+        void Update(); // runs on the tracker's strand
+        void WriteFile(const std::string &content);
+
+        static std::string EncodeAircraft(const AircraftState &state);
+
+        Tracker::Pointer tracker_;
+        boost::asio::steady_timer timer_;
+        std::chrono::milliseconds interval_;
+        std::string path_;
+        bool reported_write_error_ = false;
+
+        std::unordered_map<AircraftTable::Key, std::string> fragments_;
+        std::vector<AircraftTable::Key> updated_;
+        std::vector<AircraftTable::Key> removed_;
+        std::size_t snapshot_bytes_ = 0;
+
+        SharedSnapshot snapshot_; // only accessed via std::atomic_load / std::atomic_store
+    };
+}; // namespace airnav::uat
+
+#endif
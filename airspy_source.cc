@@ -0,0 +1,209 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "airspy_source.h"
+#include "exception.h"
+#include "stats.h"
+#include "thread_placement.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace airnav::uat;
+
+class AirspyCategory : public boost::system::error_category {
+  public:
+    const char *name() const noexcept override { return "airspy"; }
+    std::string message(int ev) const override { return airspy_error_name(static_cast<enum airspy_error>(ev)); }
+};
+
+static AirspyCategory airspy_category;
+
+AirspySampleSource::AirspySampleSource(boost::asio::io_service &service, const std::string &device, const boost::program_options::variables_map &options) : timer_(service), device_name_(device), options_(options) {}
+
+AirspySampleSource::~AirspySampleSource() {
+    Stop();
+    if (device_) {
+        airspy_close(device_);
+        device_ = nullptr;
+    }
+}
+
+void AirspySampleSource::Init() {
+    if (options_.count("format") && options_["format"].as<SampleFormat>() != SampleFormat::CS16H) {
+        throw config_error("Airspy devices only provide CS16H samples");
+    }
+
+    int rc;
+    if (device_name_.empty() || device_name_ == "any") {
+        rc = airspy_open(&device_);
+    } else {
+        rc = airspy_open_sn(&device_, std::strtoull(device_name_.c_str(), nullptr, 16));
+    }
+    if (rc != AIRSPY_SUCCESS) {
+        device_ = nullptr;
+        throw config_error(std::string("Failed to open Airspy device (cause: ") + airspy_error_name(static_cast<enum airspy_error>(rc)) + ")");
+    }
+
+    // the lowest supported rate that is at least the demodulator's rate
+    // (which --oversample doubles)
+    const std::uint64_t output_numerator = DEMOD_SAMPLE_RATE_NUMERATOR * (options_.count("oversample") ? 2 : 1);
+
+    std::uint32_t num_rates = 0;
+    airspy_get_samplerates(device_, &num_rates, 0);
+    std::vector<std::uint32_t> rates(num_rates);
+    airspy_get_samplerates(device_, rates.data(), num_rates);
+
+    std::uint32_t rate = 0;
+    for (auto r : rates) {
+        if (std::uint64_t(r) * DEMOD_SAMPLE_RATE_DENOMINATOR >= output_numerator && (rate == 0 || r < rate)) {
+            rate = r;
+        }
+    }
+    if (rate == 0) {
+        throw config_error("Airspy device does not support a sample rate of at least " + std::to_string(output_numerator / DEMOD_SAMPLE_RATE_DENOMINATOR) + " Hz");
+    }
+
+    resampler_.reset(new RationalResampler(output_numerator, rate * DEMOD_SAMPLE_RATE_DENOMINATOR));
+    clock_ = SampleClock(double(output_numerator) / DEMOD_SAMPLE_RATE_DENOMINATOR);
+    std::cerr << "airspy: streaming at " << rate << " Hz, resampling by " << resampler_->Interpolation() << "/" << resampler_->Decimation() << std::endl;
+
+    airspy_set_sample_type(device_, AIRSPY_SAMPLE_INT16_IQ);
+    airspy_set_samplerate(device_, rate);
+    airspy_set_freq(device_, 978000000);
+
+    if (options_.count("sdr-auto-gain")) {
+        std::cerr << "airspy: using automatic gain" << std::endl;
+        airspy_set_lna_agc(device_, 1);
+        airspy_set_mixer_agc(device_, 1);
+    } else {
+        // --sdr-gain selects one of the linearity gain steps, 0-21
+        int gain = 21;
+        if (options_.count("sdr-gain")) {
+            gain = std::max(0L, std::min(21L, std::lround(options_["sdr-gain"].as<double>())));
+            std::cerr << "airspy: using linearity gain " << gain << std::endl;
+        } else {
+            std::cerr << "airspy: using maximum linearity gain " << gain << std::endl;
+        }
+        airspy_set_linearity_gain(device_, gain);
+    }
+
+    if (options_.count("sdr-ppm")) {
+        std::cerr << "airspy: device does not support frequency correction, --sdr-ppm option ignored" << std::endl;
+    }
+    if (options_.count("sdr-antenna") || options_.count("sdr-stream-settings") || options_.count("sdr-device-settings")) {
+        std::cerr << "airspy: --sdr-antenna / --sdr-stream-settings / --sdr-device-settings only apply to SoapySDR devices, ignored" << std::endl;
+    }
+}
+
+void AirspySampleSource::Start() {
+    if (!device_) {
+        Init();
+    }
+
+    // libairspy runs its own rx thread, which calls back with each transfer
+    rx_started_ = false;
+    int rc = airspy_start_rx(device_, &AirspySampleSource::TransferCallback, this);
+    if (rc != AIRSPY_SUCCESS) {
+        throw config_error(std::string("Failed to start Airspy streaming (cause: ") + airspy_error_name(static_cast<enum airspy_error>(rc)) + ")");
+    }
+    started_ = true;
+
+    Keepalive();
+}
+
+void AirspySampleSource::Keepalive() {
+    if (!started_) {
+        return;
+    }
+
+    if (airspy_is_streaming(device_) != AIRSPY_TRUE) {
+        std::cerr << "airspy: streaming stopped unexpectedly" << std::endl;
+        DispatchError(boost::system::error_code{AIRSPY_ERROR_STREAMING_STOPPED, airspy_category});
+        return;
+    }
+
+    // Keep the io_service alive while streaming
+    auto self(shared_from_this());
+    timer_.expires_from_now(std::chrono::milliseconds(1000));
+    timer_.async_wait([self, this](const boost::system::error_code &ec) {
+        if (!ec) {
+            Keepalive();
+        }
+    });
+}
+
+void AirspySampleSource::Stop() {
+    if (started_) {
+        airspy_stop_rx(device_);
+        started_ = false;
+    }
+    timer_.cancel();
+}
+
+int AirspySampleSource::TransferCallback(airspy_transfer *transfer) { return static_cast<AirspySampleSource *>(transfer->ctx)->HandleTransfer(transfer); }
+
+int AirspySampleSource::HandleTransfer(airspy_transfer *transfer) {
+    const auto bytes_per_sample = BytesPerSample(SampleFormat::CS16H);
+    const std::size_t max_output = resampler_->MaxOutput(transfer->sample_count);
+
+    if (!rx_started_) {
+        // first transfer: now we know the transfer size, and are on the rx thread
+        ApplyThreadPlacement(ThreadRole::RX, "978-airspy");
+        ring_ = SampleRing::Create(max_output * bytes_per_sample * 16 + HistorySamples() * bytes_per_sample, HistorySamples() * bytes_per_sample);
+        ring_->Prefault();
+        last_drop_report_ = std::chrono::steady_clock::now();
+        rx_started_ = true;
+    }
+
+    if (transfer->dropped_samples > 0) {
+        ++overflow_count_;
+        stats::Add(stats::Counter::SDR_OVERRUNS);
+        DUMP978_TRACE(SDR_OVERRUN, 0, transfer->dropped_samples, 0);
+        clock_.Skip(transfer->dropped_samples * resampler_->Interpolation() / resampler_->Decimation());
+    }
+
+    // Resample straight into the ring. If the receiver is so far behind
+    // that there is no room, resample into scratch space (to keep the
+    // filter state continuous) and drop the result.
+    const bool have_space = (ring_->WriteSpace() >= max_output * bytes_per_sample);
+    if (!have_space && scratch_.size() < max_output * bytes_per_sample) {
+        scratch_.resize(max_output * bytes_per_sample);
+    }
+
+    auto *out = reinterpret_cast<std::int16_t *>(have_space ? ring_->WritePointer() : scratch_.data());
+    const auto produced = resampler_->Process(static_cast<const std::int16_t *>(transfer->samples), transfer->sample_count, out);
+    const auto sample_index = clock_.Deliver(produced, std::chrono::system_clock::now());
+
+    if (!have_space) {
+        ++dropped_count_;
+        stats::Add(stats::Counter::SDR_DROPPED_BLOCKS);
+        DUMP978_TRACE(SDR_DROPPED_BLOCK, 0, produced, 0);
+    }
+
+    if (overflow_count_ > 0 || dropped_count_ > 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_drop_report_ > std::chrono::seconds(15)) {
+            if (overflow_count_ > 0) {
+                std::cerr << "airspy: " << overflow_count_ << " recent input overruns (sample data dropped)" << std::endl;
+            }
+            if (dropped_count_ > 0) {
+                std::cerr << "airspy: " << dropped_count_ << " recent sample blocks dropped (receiver backlog)" << std::endl;
+            }
+            last_drop_report_ = now;
+            overflow_count_ = 0;
+            dropped_count_ = 0;
+        }
+    }
+
+    if (have_space && produced > 0) {
+        DispatchBlock(ring_->Commit(produced * bytes_per_sample, clock_.Milliseconds(sample_index), sample_index));
+    }
+
+    return 0;
+}
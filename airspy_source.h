@@ -0,0 +1,63 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_AIRSPY_SOURCE_H
+#define DUMP978_AIRSPY_SOURCE_H
+
+#include <chrono>
+#include <memory>
+
+#include <libairspy/airspy.h>
+
+#include "resampler.h"
+#include "sample_clock.h"
+#include "sample_source.h"
+
+namespace airnav::uat {
+    // Reads samples from an Airspy through libairspy directly. The device
+    // streams 16-bit I/Q at its lowest supported rate above the
+    // demodulator's rate (2.083333MHz, or twice that with --oversample),
+    // which is resampled on the fly, straight into the sample ring, to
+    // CS16H at the demodulator's rate.
+    class AirspySampleSource : public SampleSource {
+      public:
+        // `device` is a serial number (hex); empty or "any" selects the first device
+        static SampleSource::Pointer Create(boost::asio::io_service &service, const std::string &device, const boost::program_options::variables_map &options) { return Pointer(new AirspySampleSource(service, device, options)); }
+
+        virtual ~AirspySampleSource();
+
+        void Init() override;
+        void Start() override;
+        void Stop() override;
+        SampleFormat Format() override { return SampleFormat::CS16H; }
+
+      private:
+        AirspySampleSource(boost::asio::io_service &service, const std::string &device, const boost::program_options::variables_map &options);
+
+        void Keepalive();
+        int HandleTransfer(airspy_transfer *transfer);
+        static int TransferCallback(airspy_transfer *transfer);
+
+        boost::asio::steady_timer timer_;
+        std::string device_name_;
+        boost::program_options::variables_map options_;
+
+        struct airspy_device *device_ = nullptr;
+        bool started_ = false; // between airspy_start_rx and airspy_stop_rx
+        std::unique_ptr<RationalResampler> resampler_;
+
+        // libairspy's rx thread only
+        bool rx_started_ = false;
+        SampleRing::Pointer ring_;
+        Bytes scratch_;
+        SampleClock clock_;
+        std::chrono::steady_clock::time_point last_drop_report_;
+        unsigned overflow_count_ = 0;
+        unsigned dropped_count_ = 0;
+    };
+}; // namespace airnav::uat
+
+#endif
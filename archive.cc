@@ -0,0 +1,586 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "archive.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <boost/asio/error.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <unistd.h>
+
+using namespace airnav::uat;
+
+static const std::uint32_t INDEX_MAGIC = 0x31584955;
+static const std::size_t INDEX_HEADER_BYTES = 32;
+static const std::uint64_t BLOCK_MS = 1000;      // receive time covered by each index block
+static const std::uint64_t REALTIME_BATCH_MS = 50; // receive time batched together when replaying in realtime
+static const std::size_t REPLAY_BATCH = 256;       // messages per batch otherwise
+
+static std::uint64_t NowMillis() { return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count(); }
+
+// The receive time used to index a message; messages without one are
+// filed, and stamped, with the time they were archived
+static std::uint64_t IndexTime(const RawMessage &message) { return message.ReceivedAt() ? message.ReceivedAt() : NowMillis(); }
+
+//
+// ArchiveIndexBuilder
+//
+
+void ArchiveIndexBuilder::Add(std::uint64_t offset, std::uint64_t ms, const RawMessage &message) {
+    if (blocks_.empty() || ms >= blocks_.back().first_ms + BLOCK_MS) {
+        blocks_.push_back({offset, ms, ms});
+    } else {
+        auto &block = blocks_.back();
+        block.first_ms = std::min(block.first_ms, ms);
+        block.last_ms = std::max(block.last_ms, ms);
+    }
+
+    if (message.Type() == MessageType::DOWNLINK_SHORT || message.Type() == MessageType::DOWNLINK_LONG) {
+        const std::uint32_t block = blocks_.size() - 1;
+        auto &postings = postings_[message.Field<2, 1, 4, 8>()];
+        if (postings.empty() || postings.back() != block) {
+            postings.push_back(block);
+        }
+    }
+}
+
+ArchiveIndex ArchiveIndexBuilder::Finish(std::uint64_t frames_bytes) const {
+    ArchiveIndex index;
+    index.frames_bytes = frames_bytes;
+    index.blocks = blocks_;
+    for (const auto &entry : postings_) {
+        index.addresses.push_back({entry.first, static_cast<std::uint32_t>(index.postings.size()), static_cast<std::uint32_t>(entry.second.size()), 0});
+        index.postings.insert(index.postings.end(), entry.second.begin(), entry.second.end());
+    }
+    return index;
+}
+
+// Add each complete frame of `size` bytes at `frames` to `builder`;
+// returns the number of bytes of whole, valid frames
+static std::size_t ScanFrames(const std::uint8_t *frames, std::size_t size, ArchiveIndexBuilder &builder) {
+    const std::uint8_t *end = frames + size;
+    const std::uint8_t *i = frames;
+    while (i < end) {
+        const std::size_t frame_size = BinaryFrameSize(i, end);
+        if (!frame_size) {
+            break;
+        }
+        auto message = DecodeBinary(i, frame_size);
+        if (!message) {
+            break;
+        }
+        builder.Add(i - frames, message->ReceivedAt(), *message);
+        i += frame_size;
+    }
+    return i - frames;
+}
+
+//
+// ArchiveIndex
+//
+
+ArchiveIndex ArchiveIndex::Scan(const std::uint8_t *frames, std::size_t size) {
+    ArchiveIndexBuilder builder;
+    return builder.Finish(ScanFrames(frames, size, builder));
+}
+
+bool ArchiveIndex::Read(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::uint32_t header[INDEX_HEADER_BYTES / 4];
+    if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != INDEX_MAGIC) {
+        return false;
+    }
+
+    std::memcpy(&frames_bytes, &header[2], sizeof(frames_bytes));
+    blocks.resize(header[4]);
+    addresses.resize(header[5]);
+    postings.resize(header[6]);
+    file.read(reinterpret_cast<char *>(blocks.data()), blocks.size() * sizeof(Block));
+    file.read(reinterpret_cast<char *>(addresses.data()), addresses.size() * sizeof(Address));
+    file.read(reinterpret_cast<char *>(postings.data()), postings.size() * sizeof(std::uint32_t));
+    if (!file) {
+        return false;
+    }
+
+    // don't trust postings that point outside the index
+    for (const auto &address : addresses) {
+        if (std::uint64_t(address.first_posting) + address.posting_count > postings.size()) {
+            return false;
+        }
+    }
+    for (auto block : postings) {
+        if (block >= blocks.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ArchiveIndex::Write(const std::string &path) const {
+    std::uint32_t header[INDEX_HEADER_BYTES / 4] = {INDEX_MAGIC, 0};
+    std::memcpy(&header[2], &frames_bytes, sizeof(frames_bytes));
+    header[4] = blocks.size();
+    header[5] = addresses.size();
+    header[6] = postings.size();
+
+    // write a new file and rename it into place, so readers never see a
+    // partial index
+    const std::string temp = path + ".tmp";
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(blocks.data()), blocks.size() * sizeof(Block));
+    file.write(reinterpret_cast<const char *>(addresses.data()), addresses.size() * sizeof(Address));
+    file.write(reinterpret_cast<const char *>(postings.data()), postings.size() * sizeof(std::uint32_t));
+    file.close();
+
+    if (!file || std::rename(temp.c_str(), path.c_str()) < 0) {
+        ::unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+//
+// MessageArchive
+//
+
+MessageArchive::MessageArchive(const Options &options) : options_(options), queue_(options.queue_batches) {
+    if (options_.segment.count() <= 0) {
+        throw std::invalid_argument("archive segments must cover at least a second");
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(options_.directory, ec);
+    if (!boost::filesystem::is_directory(options_.directory)) {
+        throw boost::system::system_error(ec ? ec : boost::system::errc::make_error_code(boost::system::errc::not_a_directory), options_.directory);
+    }
+}
+
+MessageArchive::~MessageArchive() { Stop(); }
+
+void MessageArchive::Start() {
+    if (thread_.joinable()) {
+        return; // already running
+    }
+
+    queue_.Reopen();
+    thread_ = std::thread(&MessageArchive::WriterThread, this);
+}
+
+void MessageArchive::Stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+
+    // let the writer thread write out what is already queued
+    Batch sentinel;
+    sentinel.stop = true;
+    queue_.Push(std::move(sentinel));
+    thread_.join();
+
+    queue_.Close();
+
+    if (dropped_batches_ > 0) {
+        std::cerr << "Archive: " << dropped_batches_ << " message batches were not archived because the disk could not keep up" << std::endl;
+    }
+}
+
+void MessageArchive::HandleMessages(SharedMessageVector messages) {
+    Batch batch;
+    batch.messages = messages;
+    if (!queue_.TryPush(std::move(batch))) {
+        ++dropped_batches_;
+    }
+}
+
+void MessageArchive::WriterThread() {
+    Batch batch;
+    while (queue_.Pop(batch) && !batch.stop) {
+        for (const auto &message : *batch.messages) {
+            if (message.Type() != MessageType::METADATA && message.Type() != MessageType::INVALID) {
+                Write(message);
+            }
+        }
+        if (file_.is_open() && !file_.flush()) {
+            // make it visible to a replay of the segment in progress; a full
+            // disk may only show up here
+            CloseSegment();
+        }
+        batch = Batch();
+    }
+
+    CloseSegment();
+}
+
+void MessageArchive::Write(const RawMessage &message) {
+    if (failed_) {
+        return;
+    }
+
+    const std::uint64_t ms = IndexTime(message);
+    const std::uint64_t segment_ms = options_.segment.count() * 1000;
+    if (file_.is_open() && ms >= segment_start_ms_ + segment_ms) {
+        CloseSegment();
+    }
+    // a message from before the open segment (the clock stepped back)
+    // stays in it; the index records the real ranges
+    if (!file_.is_open() && !OpenSegment(ms - ms % segment_ms)) {
+        return;
+    }
+
+    scratch_.clear();
+    if (message.ReceivedAt()) {
+        EncodeBinary(message, scratch_);
+    } else {
+        // archive it with the time it is indexed under, so that replay
+        // selects it by the same time
+        RawMessage stamped(message.Payload(), ms, message.Errors(), message.Rssi(), message.RawTimestamp());
+        stamped.SetCopies(message.Copies());
+        EncodeBinary(stamped, scratch_);
+    }
+    if (scratch_.empty()) {
+        return;
+    }
+
+    file_.write(scratch_.data(), scratch_.size());
+    if (!file_.good()) {
+        CloseSegment(); // reports the error
+        return;
+    }
+
+    index_.Add(file_bytes_, ms, message);
+    file_bytes_ += scratch_.size();
+    ++messages_written_;
+}
+
+bool MessageArchive::OpenSegment(std::uint64_t segment_start_ms) {
+    std::time_t seconds = segment_start_ms / 1000;
+    std::tm tm;
+    ::gmtime_r(&seconds, &tm);
+    char when[32];
+    std::strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &tm);
+
+    path_ = (boost::filesystem::path(options_.directory) / (std::string("uat-") + when)).string();
+    const std::string frames_path = path_ + ".frames";
+    index_ = ArchiveIndexBuilder();
+    file_bytes_ = 0;
+
+    // After a restart, carry on with the segment where it left off,
+    // dropping any partial frame at its end
+    boost::system::error_code ec;
+    if (boost::filesystem::file_size(frames_path, ec) > 0 && !ec) {
+        try {
+            auto existing = MappedFile::Open(frames_path);
+            file_bytes_ = ScanFrames(existing->Data(), existing->Size(), index_);
+            if (file_bytes_ < existing->Size() && ::truncate(frames_path.c_str(), file_bytes_) < 0) {
+                std::cerr << "Archive: could not truncate " << frames_path << ": " << std::strerror(errno) << "; archiving stopped" << std::endl;
+                failed_ = true;
+                return false;
+            }
+        } catch (const boost::system::system_error &err) {
+            std::cerr << "Archive: could not reopen " << frames_path << ": " << err.what() << "; archiving stopped" << std::endl;
+            failed_ = true;
+            return false;
+        }
+    }
+
+    segment_start_ms_ = segment_start_ms;
+    file_.open(frames_path, std::ios::binary | std::ios::app);
+    if (!file_.good()) {
+        std::cerr << "Archive: could not open " << frames_path << ": " << std::strerror(errno) << "; archiving stopped" << std::endl;
+        file_.close();
+        failed_ = true;
+        return false;
+    }
+
+    std::cerr << "Archive: writing messages to " << frames_path << std::endl;
+    return true;
+}
+
+void MessageArchive::CloseSegment() {
+    if (!file_.is_open()) {
+        return;
+    }
+
+    // buffered frames are only written out here, so this is where a full
+    // disk is often noticed
+    file_.flush();
+    file_.close();
+    if (!file_) {
+        std::cerr << "Archive: error writing " << path_ << ".frames: " << std::strerror(errno) << "; archiving stopped" << std::endl;
+        failed_ = true;
+        // no index: replay scans whatever frames reached the disk
+        index_ = ArchiveIndexBuilder();
+        return;
+    }
+
+    const auto index = index_.Finish(file_bytes_);
+    if (!index.Write(path_ + ".index")) {
+        // not fatal: replay indexes the segment itself
+        std::cerr << "Archive: could not write " << path_ << ".index: " << std::strerror(errno) << std::endl;
+    }
+    index_ = ArchiveIndexBuilder();
+}
+
+//
+// ArchiveReplay
+//
+
+ArchiveReplay::ArchiveReplay(const std::string &directory, std::uint64_t from_ms, std::uint64_t to_ms, const MessageFilter &filter, bool realtime) : directory_(directory), from_ms_(from_ms), to_ms_(to_ms), filter_(filter), realtime_(realtime) {
+    if (!boost::filesystem::is_directory(directory_)) {
+        throw std::invalid_argument(directory_ + " is not a directory");
+    }
+}
+
+ArchiveReplay::~ArchiveReplay() {
+    Stop();
+
+    // The replay thread holds a reference, so we can only be destroyed on
+    // another thread once it has finished (and Stop() has joined it), or
+    // on the replay thread itself as it exits, which cannot join itself
+    if (thread_.joinable()) {
+        thread_.detach();
+    }
+}
+
+void ArchiveReplay::Start() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (thread_.joinable() && !stopping_) {
+            return; // already running
+        }
+        stopping_ = false;
+    }
+
+    // a thread left by a Stop() that it called has finished, or will once
+    // it returns from it
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    first_ms_ = 0;
+
+    // the thread keeps us alive until it exits, so it never runs on after
+    // we are destroyed
+    auto self(shared_from_this());
+    thread_ = std::thread([this, self]() { ReplayThread(); });
+}
+
+void ArchiveReplay::Stop() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+
+    // When Stop() is called from the replay thread (e.g. from an error
+    // handler) the thread is left joinable, to be joined by the next
+    // Start() or by the destructor
+    if (thread_.joinable() && thread_.get_id() != std::this_thread::get_id()) {
+        thread_.join();
+    }
+}
+
+std::vector<ArchiveReplay::Selection> ArchiveReplay::Select() {
+    const auto started = std::chrono::steady_clock::now();
+
+    // segment names sort by time
+    std::vector<std::string> paths;
+    for (boost::filesystem::directory_iterator i(directory_), end; i != end; ++i) {
+        const auto name = i->path().filename().string();
+        if (name.compare(0, 4, "uat-") == 0 && i->path().extension() == ".frames") {
+            paths.push_back(i->path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    const auto &addresses = filter_.Addresses();
+    std::vector<Selection> selections;
+    std::size_t segments = 0, scanned = 0, blocks = 0;
+
+    for (const auto &path : paths) {
+        Selection selection;
+        const std::string index_path = path.substr(0, path.size() - 7) + ".index";
+
+        boost::system::error_code ec;
+        const auto frames_bytes = boost::filesystem::file_size(path, ec);
+        if (ec || frames_bytes == 0) {
+            continue;
+        }
+
+        try {
+            selection.file = MappedFile::Open(path);
+        } catch (const boost::system::system_error &err) {
+            std::cerr << "Replay: skipping " << path << ": " << err.what() << std::endl;
+            continue;
+        }
+        ++segments;
+
+        // an index for a shorter file is out of date (the segment was still
+        // being written, or was appended to after a restart)
+        if (!selection.index.Read(index_path) || selection.index.frames_bytes != selection.file->Size()) {
+            selection.index = ArchiveIndex::Scan(selection.file->Data(), selection.file->Size());
+            ++scanned;
+        }
+
+        const auto &index = selection.index;
+        auto overlaps = [this, &index](std::uint32_t block) { return index.blocks[block].last_ms >= from_ms_ && index.blocks[block].first_ms <= to_ms_; };
+
+        if (addresses.empty()) {
+            for (std::uint32_t block = 0; block < index.blocks.size(); ++block) {
+                if (overlaps(block)) {
+                    selection.blocks.push_back(block);
+                }
+            }
+        } else {
+            for (auto address : addresses) {
+                auto entry = std::lower_bound(index.addresses.begin(), index.addresses.end(), address, [](const ArchiveIndex::Address &a, std::uint32_t b) { return a.address < b; });
+                if (entry == index.addresses.end() || entry->address != address) {
+                    continue;
+                }
+                for (std::uint32_t i = 0; i < entry->posting_count; ++i) {
+                    const auto block = index.postings[entry->first_posting + i];
+                    if (overlaps(block)) {
+                        selection.blocks.push_back(block);
+                    }
+                }
+            }
+            std::sort(selection.blocks.begin(), selection.blocks.end());
+            selection.blocks.erase(std::unique(selection.blocks.begin(), selection.blocks.end()), selection.blocks.end());
+        }
+
+        if (!selection.blocks.empty()) {
+            blocks += selection.blocks.size();
+            selections.push_back(std::move(selection));
+        }
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    std::cerr << "Replay: selected " << blocks << " blocks from " << selections.size() << " of " << segments << " segments in " << (elapsed.count() / 1000.0) << "ms";
+    if (scanned) {
+        std::cerr << " (" << scanned << " segments without an up-to-date index were scanned)";
+    }
+    std::cerr << std::endl;
+
+    return selections;
+}
+
+bool ArchiveReplay::Pace(std::uint64_t message_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+        return false;
+    }
+    if (!realtime_) {
+        return true;
+    }
+
+    if (!first_ms_) {
+        first_ms_ = message_ms;
+        first_wall_ = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    const auto due = first_wall_ + std::chrono::milliseconds(message_ms > first_ms_ ? message_ms - first_ms_ : 0);
+    cond_.wait_until(lock, due, [this]() { return stopping_; });
+    return !stopping_;
+}
+
+void ArchiveReplay::ReplayThread() {
+    std::vector<Selection> selections;
+    try {
+        selections = Select();
+    } catch (const boost::filesystem::filesystem_error &err) {
+        std::cerr << "Replay: " << err.what() << std::endl;
+        DispatchError(err.code());
+        return;
+    }
+
+    SharedMessageVector batch;
+    std::uint64_t batch_ms = 0;
+
+    auto flush = [this, &batch]() -> bool {
+        if (!batch || batch->empty()) {
+            return true;
+        }
+        // dispatched when its last message is due
+        if (!Pace(batch->back().ReceivedAt())) {
+            return false;
+        }
+        DispatchMessages(batch);
+        batch.reset();
+        return true;
+    };
+
+    for (const auto &selection : selections) {
+        const auto data = selection.file->Data();
+        const auto &index = selection.index;
+
+        for (auto block : selection.blocks) {
+            const std::uint8_t *i = data + index.blocks[block].offset;
+            const std::uint8_t *end = data + (block + 1 < index.blocks.size() ? index.blocks[block + 1].offset : index.frames_bytes);
+
+            while (i < end) {
+                const std::size_t frame_size = BinaryFrameSize(i, end);
+                if (!frame_size) {
+                    break;
+                }
+                auto message = DecodeBinary(i, frame_size);
+                i += frame_size;
+                if (!message || message->ReceivedAt() < from_ms_ || message->ReceivedAt() > to_ms_ || !filter_.Matches(*message)) {
+                    continue;
+                }
+
+                if (batch && (realtime_ ? message->ReceivedAt() >= batch_ms + REALTIME_BATCH_MS : batch->size() >= REPLAY_BATCH) && !flush()) {
+                    return;
+                }
+                if (!batch) {
+                    batch = MessageVector::Create();
+                    batch_ms = message->ReceivedAt();
+                }
+                batch->push_back(std::move(*message));
+            }
+        }
+    }
+
+    if (!flush()) {
+        return;
+    }
+
+    DispatchError(boost::asio::error::eof);
+}
+
+//
+// ParseUtcTime
+//
+
+std::uint64_t airnav::uat::ParseUtcTime(const std::string &text) {
+    char *end;
+    errno = 0;
+    const auto seconds = std::strtoull(text.c_str(), &end, 10);
+    if (!text.empty() && *end == 0 && errno == 0 && text.find_first_not_of("0123456789") == std::string::npos) {
+        return seconds * 1000;
+    }
+
+    std::tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    char separator = 0;
+    int minutes_end = -1, seconds_end = -1;
+    const int fields = std::sscanf(text.c_str(), "%4d-%2d-%2d%c%2d:%2d%n:%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &separator, &tm.tm_hour, &tm.tm_min, &minutes_end, &tm.tm_sec, &seconds_end);
+    const int length = text.size();
+    if (!((fields == 6 && minutes_end == length) || (fields == 7 && seconds_end == length)) || (separator != ' ' && separator != 'T') || tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60) {
+        throw std::invalid_argument("expected a UTC time as YYYY-MM-DD HH:MM[:SS] or seconds since the epoch, not \"" + text + "\"");
+    }
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return std::uint64_t(::timegm(&tm)) * 1000;
+}
@@ -0,0 +1,209 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_ARCHIVE_H
+#define DUMP978_ARCHIVE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "mapped_file.h"
+#include "message_filter.h"
+#include "message_source.h"
+#include "uat_message.h"
+
+namespace airnav::uat {
+    // A message archive is a directory of append-only segments, one per
+    // period of receive time (an hour by default), each with a sparse index
+    // written when the segment is finished:
+    //
+    //   uat-YYYYMMDD-HHMMSS.frames   every message as a binary frame (see
+    //                                EncodeBinary), back to back, in the
+    //                                order received; metadata is not kept
+    //   uat-YYYYMMDD-HHMMSS.index    the index of the .frames file
+    //
+    // The frames are cut into blocks of at most a second of receive time.
+    // The index (host byte order) is:
+    //
+    //   u32 magic 0x31584955 ("UIX1"), u32 reserved
+    //   u64 size of the .frames file that it covers
+    //   u32 block count, u32 address count, u32 posting count, u32 reserved
+    //   blocks:    u64 offset of the first frame, u64 earliest and
+    //              u64 latest receive time in the block (ms since the epoch)
+    //   addresses: u32 downlink address, u32 index of its first posting,
+    //              u32 posting count, u32 reserved; sorted by address
+    //   postings:  u32 block numbers, ascending, for each address in turn
+    //
+    // so a time range is a scan of the block list and an address is a
+    // binary search and its postings; only the selected blocks are read. A
+    // segment with no index, or an index for a shorter file (the segment in
+    // progress, or after a crash), is indexed by scanning it instead.
+
+    // The sparse index of one segment
+    struct ArchiveIndex {
+        struct Block {
+            std::uint64_t offset;
+            std::uint64_t first_ms;
+            std::uint64_t last_ms;
+        };
+
+        struct Address {
+            std::uint32_t address;
+            std::uint32_t first_posting;
+            std::uint32_t posting_count;
+            std::uint32_t reserved;
+        };
+
+        std::uint64_t frames_bytes = 0;
+        std::vector<Block> blocks;
+        std::vector<Address> addresses;
+        std::vector<std::uint32_t> postings;
+
+        // Read an index file; returns false if it is missing or malformed
+        bool Read(const std::string &path);
+
+        // Write the index file; returns false on error
+        bool Write(const std::string &path) const;
+
+        // Build the index of `size` bytes of frames, stopping at the first
+        // incomplete or malformed frame
+        static ArchiveIndex Scan(const std::uint8_t *frames, std::size_t size);
+    };
+
+    // Builds an ArchiveIndex one frame at a time
+    class ArchiveIndexBuilder {
+      public:
+        // Add the frame at `offset` received at `ms`, for `message`
+        void Add(std::uint64_t offset, std::uint64_t ms, const RawMessage &message);
+
+        // The index of `frames_bytes` bytes of frames
+        ArchiveIndex Finish(std::uint64_t frames_bytes) const;
+
+      private:
+        std::vector<ArchiveIndex::Block> blocks_;
+        std::map<std::uint32_t, std::vector<std::uint32_t>> postings_;
+    };
+
+    // An output that appends every message to an archive. Writing happens
+    // on its own thread; HandleMessages only queues the vector, and drops
+    // it (counted) if the writer is too far behind.
+    class MessageArchive {
+      public:
+        typedef std::shared_ptr<MessageArchive> Pointer;
+
+        struct Options {
+            std::string directory;
+            std::chrono::seconds segment{3600};   // receive time covered by each segment
+            std::size_t queue_batches = 1024;     // vectors to queue before dropping
+        };
+
+        static Pointer Create(const Options &options) { return Pointer(new MessageArchive(options)); }
+
+        ~MessageArchive();
+
+        void Start();
+        void Stop();
+
+        // A MessageDispatch handler
+        void HandleMessages(SharedMessageVector messages);
+
+        std::uint64_t MessagesWritten() const { return messages_written_; }
+        std::uint64_t DroppedBatches() const { return dropped_batches_; }
+
+      private:
+        struct Batch {
+            SharedMessageVector messages;
+            bool stop = false; // sentinel pushed by Stop()
+        };
+
+        MessageArchive(const Options &options);
+
+        void WriterThread();
+        void Write(const RawMessage &message);
+        bool OpenSegment(std::uint64_t segment_start_ms);
+        void CloseSegment();
+
+        Options options_;
+        BoundedQueue<Batch> queue_;
+        std::thread thread_;
+        std::atomic<std::uint64_t> messages_written_{0};
+        std::atomic<std::uint64_t> dropped_batches_{0};
+
+        // writer thread state
+        std::ofstream file_;
+        std::string path_; // of the open segment, without extension
+        std::uint64_t segment_start_ms_ = 0;
+        std::uint64_t file_bytes_ = 0;
+        bool failed_ = false;
+        ArchiveIndexBuilder index_;
+        std::string scratch_;
+    };
+
+    // A message source that replays messages from an archive: those
+    // received within [from_ms, to_ms] that match `filter`, in archive
+    // order, followed by EOF. Addresses in the filter are looked up in the
+    // index, so only the blocks that hold them are read. With `realtime`,
+    // messages are dispatched at the rate they were received; otherwise as
+    // fast as the consumer takes them. Messages archived without a receive
+    // time were stamped with the time they were archived.
+    class ArchiveReplay : public MessageSource, public std::enable_shared_from_this<ArchiveReplay> {
+      public:
+        typedef std::shared_ptr<ArchiveReplay> Pointer;
+
+        static Pointer Create(const std::string &directory, std::uint64_t from_ms, std::uint64_t to_ms, const MessageFilter &filter, bool realtime) { return Pointer(new ArchiveReplay(directory, from_ms, to_ms, filter, realtime)); }
+
+        ~ArchiveReplay();
+
+        void Start() override;
+        void Stop() override;
+
+      private:
+        ArchiveReplay(const std::string &directory, std::uint64_t from_ms, std::uint64_t to_ms, const MessageFilter &filter, bool realtime);
+
+        // A block range of one segment to replay
+        struct Selection {
+            MappedFile::Pointer file;
+            ArchiveIndex index;
+            std::vector<std::uint32_t> blocks;
+        };
+
+        std::vector<Selection> Select();
+        void ReplayThread();
+        bool Pace(std::uint64_t message_ms);
+
+        std::string directory_;
+        std::uint64_t from_ms_;
+        std::uint64_t to_ms_;
+        MessageFilter filter_;
+        bool realtime_;
+
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        bool stopping_ = false;
+        std::thread thread_;
+
+        // replay thread state, for pacing
+        std::uint64_t first_ms_ = 0;
+        std::chrono::steady_clock::time_point first_wall_;
+    };
+
+    // Parse a UTC time given as "YYYY-MM-DD HH:MM[:SS]" (or with a T
+    // between the date and time) or as seconds since the epoch, to ms
+    // since the epoch. Throws std::invalid_argument if it is neither.
+    std::uint64_t ParseUtcTime(const std::string &text);
+}; // namespace airnav::uat
+
+#endif
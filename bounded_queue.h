@@ -0,0 +1,131 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_BOUNDED_QUEUE_H
+#define DUMP978_BOUNDED_QUEUE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace airnav::uat {
+    // A fixed-capacity FIFO queue for handing work between threads.
+    // Any number of threads may push or pop concurrently.
+    template <typename T> class BoundedQueue {
+      public:
+        explicit BoundedQueue(std::size_t capacity) : capacity_(capacity) {}
+
+        BoundedQueue(const BoundedQueue &) = delete;
+        BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+        // Add an item to the queue, waiting for space if the queue is full.
+        // Returns false (and discards the item) if the queue is closed.
+        bool Push(T &&item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+            if (closed_)
+                return false;
+
+            items_.push_back(std::move(item));
+            peak_ = std::max(peak_, items_.size());
+            lock.unlock();
+            not_empty_.notify_one();
+            return true;
+        }
+
+        // Add an item to the queue if there is space, without waiting.
+        // Returns false (leaving `item` untouched) if the queue is full or closed.
+        bool TryPush(T &&item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (closed_ || items_.size() >= capacity_)
+                return false;
+
+            items_.push_back(std::move(item));
+            peak_ = std::max(peak_, items_.size());
+            lock.unlock();
+            not_empty_.notify_one();
+            return true;
+        }
+
+        // Remove the oldest item from the queue, waiting for one to arrive if
+        // the queue is empty. Returns false if the queue is closed.
+        bool Pop(T &item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+            if (closed_)
+                return false;
+
+            item = std::move(items_.front());
+            items_.pop_front();
+            lock.unlock();
+            not_full_.notify_one();
+            return true;
+        }
+
+        // Remove the oldest item from the queue if there is one, without waiting.
+        bool TryPop(T &item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (closed_ || items_.empty())
+                return false;
+
+            item = std::move(items_.front());
+            items_.pop_front();
+            lock.unlock();
+            not_full_.notify_one();
+            return true;
+        }
+
+        // Close the queue: discard anything queued and wake up all waiters.
+        // All subsequent pushes and pops fail.
+        void Close() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            closed_ = true;
+            items_.clear();
+            lock.unlock();
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+        // Reopen a closed queue so it can be reused.
+        void Reopen() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            closed_ = false;
+            peak_ = 0;
+        }
+
+        std::size_t Capacity() const { return capacity_; }
+
+        std::size_t Size() const {
+            std::unique_lock<std::mutex> lock(mutex_);
+            return items_.size();
+        }
+
+        // Return the largest number of items that were queued at once
+        // since the last call to ResetPeak()
+        std::size_t Peak() const {
+            std::unique_lock<std::mutex> lock(mutex_);
+            return peak_;
+        }
+
+        void ResetPeak() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            peak_ = items_.size();
+        }
+
+      private:
+        const std::size_t capacity_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable not_empty_;
+        std::condition_variable not_full_;
+        std::deque<T> items_;
+        std::size_t peak_ = 0;
+        bool closed_ = false;
+    };
+}; // namespace airnav::uat
+
+#endif
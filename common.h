@@ -20,6 +20,13 @@ namespace airnav::uat {
     typedef std::vector<std::uint8_t> Bytes;
     typedef std::vector<std::uint16_t> PhaseBuffer;
 
+    // The sample rate the demodulator is built around, 2 samples per bit at
+    // 1.041667Mbit/s. Exactly, it is 6250000/3 Hz; block and message timing
+    // uses the integer approximation.
+    const unsigned DEMOD_SAMPLE_RATE = 2083333;
+    const unsigned DEMOD_SAMPLE_RATE_NUMERATOR = 6250000;
+    const unsigned DEMOD_SAMPLE_RATE_DENOMINATOR = 3;
+
     inline static double RoundN(double value, unsigned dp) {
         const double scale = std::pow(10, dp);
         return std::round(value * scale) / scale;
@@ -4,10 +4,23 @@
 
 #include "convert.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <cmath>
+#include <cstring>
 #include <stdexcept>
 
+#include "cpu_features.h"
+
+#ifdef DUMP978_X86
+#include <immintrin.h>
+#endif
+
+#if defined(DUMP978_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define DUMP978_NEON_A64 1
+#endif
+
 using namespace airnav::uat;
 
 static inline std::uint16_t scaled_atan2(double y, double x) {
@@ -20,16 +33,6 @@ static inline std::uint16_t scaled_atan2(double y, double x) {
     return scaled_ang < 0 ? 0 : scaled_ang > 65535 ? 65535 : (std::uint16_t)scaled_ang;
 }
 
-static inline std::uint16_t scaled_atan(double x) {
-    double ang = std::atan(x);
-    if (ang < 0) {
-        // atan returns [-pi/2..pi/2], normalize to [0..2*pi]
-        ang += 2 * M_PI;
-    }
-    double scaled_ang = std::round(32768 * ang / M_PI);
-    return scaled_ang < 0 ? 0 : scaled_ang > 65535 ? 65535 : (std::uint16_t)scaled_ang;
-}
-
 static inline double magsq(double i, double q) { return i * i + q * q; }
 
 SampleConverter::Pointer SampleConverter::Create(SampleFormat format) {
@@ -39,36 +42,170 @@ SampleConverter::Pointer SampleConverter::Create(SampleFormat format) {
     case SampleFormat::CS8_:
         return Pointer(new CS8Converter());
     case SampleFormat::CS16H:
-        return Pointer(new CS16HConverter());
+        return Pointer(new CS16HConverter(ConvertKernels::Selected()));
     case SampleFormat::CF32H:
-        return Pointer(new CF32HConverter());
+        return Pointer(new CF32HConverter(ConvertKernels::Selected()));
     default:
         throw std::runtime_error("format not implemented yet");
     }
 }
 
-CU8Converter::CU8Converter() : SampleConverter(SampleFormat::CU8) {
+//
+// Octant phase tables for the 8-bit converters.
+//
+// The table holds round(atan(small / large) * 32768 / pi) for every pair of
+// folded magnitudes 0 <= small <= large < n, packed as a triangle. Folding
+// I and Q to magnitudes and signs and reflecting the looked-up first-octant
+// angle gives the same value as scaled_atan2 on the full I/Q pair: each
+// reflection is an exact integer (16384, 32768 or 65536) minus the angle, so
+// rounding commutes with it.
+//
+
+static inline unsigned TriangleIndex(unsigned small, unsigned large) { return large * (large + 1) / 2 + small; }
+
+template <class F> static std::vector<std::uint16_t> BuildOctantTable(unsigned n, F magnitude) {
+    std::vector<std::uint16_t> table(TriangleIndex(0, n));
+    for (unsigned large = 0; large < n; ++large) {
+        for (unsigned small = 0; small <= large; ++small) {
+            table[TriangleIndex(small, large)] = (magnitude(large) == 0 ? 0 : scaled_atan2(magnitude(small), magnitude(large)));
+        }
+    }
+    return table;
+}
+
+// Branch-free, since the reflections depend on the (random) signs of the
+// noise: each reflection K - phase is done as (phase ^ mask) + (mask & (K + 1))
+static inline std::uint16_t OctantPhase(const std::uint16_t *octant, unsigned ax, bool neg_x, unsigned ay, bool neg_y) {
+    const unsigned swap = -(unsigned)(ay > ax);
+    const unsigned diff = (ax ^ ay) & swap;
+    const unsigned small = ay ^ diff;
+    const unsigned large = ax ^ diff;
+
+    unsigned phase = octant[TriangleIndex(small, large)];
+    phase = (phase ^ swap) + (swap & 16385);
+    const unsigned flip_x = -(unsigned)neg_x;
+    phase = (phase ^ flip_x) + (flip_x & 32769);
+    const unsigned flip_y = -(unsigned)neg_y;
+    phase = (phase ^ flip_y) + (flip_y & 65537);
+    return phase;
+}
+
+// CU8 value v is (v - 127.5) / 128; it folds to index |2v - 255| / 2 (0 .. 127)
+static inline unsigned FoldCU8(std::uint8_t v) { return (v >= 128 ? v - 128 : 127 - v); }
+
+static const std::vector<std::uint16_t> &CU8OctantTable() {
+    static const std::vector<std::uint16_t> table = BuildOctantTable(128, [](unsigned k) { return (2 * k + 1) / 256.0; });
+    return table;
+}
+
+// CS8 value v is v / 128; it folds to index |v| (0 .. 128)
+static inline unsigned FoldCS8(std::int8_t v) { return (v < 0 ? -v : v); }
+
+static const std::vector<std::uint16_t> &CS8OctantTable() {
+    static const std::vector<std::uint16_t> table = BuildOctantTable(129, [](unsigned k) { return k / 128.0; });
+    return table;
+}
+
+static bool UseOctantTable(PhaseTable table) {
+    if (table == PhaseTable::DEFAULT) {
+#ifdef DUMP978_NEON
+        // ARM SBCs typically have small L1/L2 caches where the full table thrashes
+        return true;
+#else
+        return false;
+#endif
+    }
+    return (table == PhaseTable::OCTANT);
+}
+
+//
+// Full phase tables and square tables for the 8-bit converters, also built
+// on first use and shared: startup costs one set of 65536 atan2 calls per
+// format, however many converters (receivers, file workers) there are.
+//
+
+static const std::vector<std::uint16_t> &CU8FullTable() {
+    static const std::vector<std::uint16_t> table = []() {
+        std::vector<std::uint16_t> t(65536);
+        for (unsigned i = 0; i < 256; ++i) {
+            for (unsigned q = 0; q < 256; ++q) {
+                // indexed as cu8_alias::iq16: I in the first byte in memory
+                std::uint8_t iq[2] = {(std::uint8_t)i, (std::uint8_t)q};
+                std::uint16_t index;
+                std::memcpy(&index, iq, sizeof(index));
+                t[index] = scaled_atan2((q - 127.5) / 128.0, (i - 127.5) / 128.0);
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+static const std::array<double, 256> &CU8SquareTable() {
+    static const std::array<double, 256> table = []() {
+        std::array<double, 256> t;
+        for (unsigned i = 0; i < 256; ++i) {
+            double d = (i - 127.5) / 128.0;
+            t[i] = d * d;
+        }
+        return t;
+    }();
+    return table;
+}
 
-    cu8_alias u;
+static const std::vector<std::uint16_t> &CS8FullTable() {
+    static const std::vector<std::uint16_t> table = []() {
+        std::vector<std::uint16_t> t(65536);
+        for (int i = -128; i <= 127; ++i) {
+            for (int q = -128; q <= 127; ++q) {
+                // indexed as cs8_alias::iq16
+                std::int8_t iq[2] = {(std::int8_t)i, (std::int8_t)q};
+                std::uint16_t index;
+                std::memcpy(&index, iq, sizeof(index));
+                t[index] = scaled_atan2(q / 128.0, i / 128.0);
+            }
+        }
+        return t;
+    }();
+    return table;
+}
 
-    unsigned i, q;
-    for (i = 0; i < 256; ++i) {
-        double d_i = (i - 127.5) / 128.0;
-        for (q = 0; q < 256; ++q) {
-            double d_q = (q - 127.5) / 128.0;
-            u.iq[0] = i;
-            u.iq[1] = q;
-            lookup_phase_[u.iq16] = scaled_atan2(d_q, d_i);
-            lookup_magsq_[u.iq16] = magsq(d_i, d_q);
+static const std::array<double, 256> &CS8SquareTable() {
+    static const std::array<double, 256> table = []() {
+        std::array<double, 256> t;
+        for (int i = -128; i <= 127; ++i) {
+            double d = i / 128.0;
+            t[(std::uint8_t)i] = d * d;
         }
+        return t;
+    }();
+    return table;
+}
+
+CU8Converter::CU8Converter(PhaseTable table) : SampleConverter(SampleFormat::CU8), lookup_phase_(nullptr), octant_(nullptr), lookup_square_(CU8SquareTable().data()) {
+    if (UseOctantTable(table)) {
+        octant_ = &CU8OctantTable();
+    } else {
+        lookup_phase_ = CU8FullTable().data();
     }
 }
 
-void CU8Converter::ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) {
-    const cu8_alias *in_iq = reinterpret_cast<const cu8_alias *>(&*begin);
+void CU8Converter::ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) {
+    const cu8_alias *in_iq = reinterpret_cast<const cu8_alias *>(begin);
 
-    // unroll the loop
     const auto n = std::distance(begin, end) / 2;
+
+    if (octant_) {
+        const std::uint16_t *octant = octant_->data();
+        for (auto i = 0; i < n; ++i, ++in_iq) {
+            const auto s_i = in_iq->iq[0];
+            const auto s_q = in_iq->iq[1];
+            *out++ = OctantPhase(octant, FoldCU8(s_i), s_i < 128, FoldCU8(s_q), s_q < 128);
+        }
+        return;
+    }
+
+    // unroll the loop
     const auto n8 = n / 8;
     const auto n7 = n & 7;
 
@@ -87,8 +224,8 @@ void CU8Converter::ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterat
     }
 }
 
-void CU8Converter::ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) {
-    const cu8_alias *in_iq = reinterpret_cast<const cu8_alias *>(&*begin);
+void CU8Converter::ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) {
+    const cu8_alias *in_iq = reinterpret_cast<const cu8_alias *>(begin);
 
     // unroll the loop
     const auto n = std::distance(begin, end) / 2;
@@ -96,41 +233,55 @@ void CU8Converter::ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterat
     const auto n7 = n & 7;
 
     for (auto i = 0; i < n8; ++i, in_iq += 8) {
-        *out++ = lookup_magsq_[in_iq[0].iq16];
-        *out++ = lookup_magsq_[in_iq[1].iq16];
-        *out++ = lookup_magsq_[in_iq[2].iq16];
-        *out++ = lookup_magsq_[in_iq[3].iq16];
-        *out++ = lookup_magsq_[in_iq[4].iq16];
-        *out++ = lookup_magsq_[in_iq[5].iq16];
-        *out++ = lookup_magsq_[in_iq[6].iq16];
-        *out++ = lookup_magsq_[in_iq[7].iq16];
+        *out++ = MagSq(in_iq[0]);
+        *out++ = MagSq(in_iq[1]);
+        *out++ = MagSq(in_iq[2]);
+        *out++ = MagSq(in_iq[3]);
+        *out++ = MagSq(in_iq[4]);
+        *out++ = MagSq(in_iq[5]);
+        *out++ = MagSq(in_iq[6]);
+        *out++ = MagSq(in_iq[7]);
     }
     for (auto i = 0; i < n7; ++i, ++in_iq) {
-        *out++ = lookup_magsq_[in_iq[0].iq16];
+        *out++ = MagSq(in_iq[0]);
     }
 }
 
-CS8Converter::CS8Converter() : SampleConverter(SampleFormat::CS8_) {
-    cs8_alias u;
+double CU8Converter::SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) {
+    const cu8_alias *in_iq = reinterpret_cast<const cu8_alias *>(begin);
 
-    int i, q;
-    for (i = -128; i <= 127; ++i) {
-        double d_i = i / 128.0;
-        for (q = -128; q <= 127; ++q) {
-            double d_q = q / 128.0;
-            u.iq[0] = i;
-            u.iq[1] = q;
-            lookup_phase_[u.iq16] = scaled_atan2(d_q, d_i);
-            lookup_magsq_[u.iq16] = magsq(d_i, d_q);
-        }
+    const auto n = std::distance(begin, end) / 2;
+    double total = 0;
+    for (auto i = 0; i < n; ++i) {
+        total += MagSq(in_iq[i]);
+    }
+    return total;
+}
+
+CS8Converter::CS8Converter(PhaseTable table) : SampleConverter(SampleFormat::CS8_), lookup_phase_(nullptr), octant_(nullptr), lookup_square_(CS8SquareTable().data()) {
+    if (UseOctantTable(table)) {
+        octant_ = &CS8OctantTable();
+    } else {
+        lookup_phase_ = CS8FullTable().data();
     }
 }
 
-void CS8Converter::ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) {
-    auto in_iq = reinterpret_cast<const cs8_alias *>(&*begin);
+void CS8Converter::ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) {
+    auto in_iq = reinterpret_cast<const cs8_alias *>(begin);
 
-    // unroll the loop
     const auto n = std::distance(begin, end) / 2;
+
+    if (octant_) {
+        const std::uint16_t *octant = octant_->data();
+        for (auto i = 0; i < n; ++i, ++in_iq) {
+            const auto s_i = in_iq->iq[0];
+            const auto s_q = in_iq->iq[1];
+            *out++ = OctantPhase(octant, FoldCS8(s_i), s_i < 0, FoldCS8(s_q), s_q < 0);
+        }
+        return;
+    }
+
+    // unroll the loop
     const auto n8 = n / 8;
     const auto n7 = n & 7;
 
@@ -149,8 +300,8 @@ void CS8Converter::ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterat
     }
 }
 
-void CS8Converter::ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) {
-    auto in_iq = reinterpret_cast<const cs8_alias *>(&*begin);
+void CS8Converter::ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) {
+    auto in_iq = reinterpret_cast<const cs8_alias *>(begin);
 
     // unroll the loop
     const auto n = std::distance(begin, end) / 2;
@@ -158,20 +309,31 @@ void CS8Converter::ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterat
     const auto n7 = n & 7;
 
     for (auto i = 0; i < n8; ++i, in_iq += 8) {
-        *out++ = lookup_magsq_[in_iq[0].iq16];
-        *out++ = lookup_magsq_[in_iq[1].iq16];
-        *out++ = lookup_magsq_[in_iq[2].iq16];
-        *out++ = lookup_magsq_[in_iq[3].iq16];
-        *out++ = lookup_magsq_[in_iq[4].iq16];
-        *out++ = lookup_magsq_[in_iq[5].iq16];
-        *out++ = lookup_magsq_[in_iq[6].iq16];
-        *out++ = lookup_magsq_[in_iq[7].iq16];
+        *out++ = MagSq(in_iq[0]);
+        *out++ = MagSq(in_iq[1]);
+        *out++ = MagSq(in_iq[2]);
+        *out++ = MagSq(in_iq[3]);
+        *out++ = MagSq(in_iq[4]);
+        *out++ = MagSq(in_iq[5]);
+        *out++ = MagSq(in_iq[6]);
+        *out++ = MagSq(in_iq[7]);
     }
     for (auto i = 0; i < n7; ++i, ++in_iq) {
-        *out++ = lookup_magsq_[in_iq[0].iq16];
+        *out++ = MagSq(in_iq[0]);
     }
 }
 
+double CS8Converter::SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) {
+    auto in_iq = reinterpret_cast<const cs8_alias *>(begin);
+
+    const auto n = std::distance(begin, end) / 2;
+    double total = 0;
+    for (auto i = 0; i < n; ++i) {
+        total += MagSq(in_iq[i]);
+    }
+    return total;
+}
+
 static inline std::int16_t PhaseDifference(std::uint16_t from, std::uint16_t to) {
     int32_t difference = to - from; // lies in the range -65535 .. +65535
     if (difference >= 32768)        //   +32768..+65535
@@ -181,145 +343,448 @@ static inline std::int16_t PhaseDifference(std::uint16_t from, std::uint16_t to)
     else
         return difference;
 }
-CS16HConverter::CS16HConverter() : SampleConverter(SampleFormat::CS16H) {
-    // atan lookup, positive values only, 8-bit fixed point covering 0.0 .. 256.0
-    for (std::size_t i = 0; i < lookup_atan_.size(); ++i) {
-        lookup_atan_[i] = scaled_atan(i / 256.0);
+//
+// Polynomial atan2 for the CS16H / CF32H converters.
+//
+// The angle is reduced to the first octant (0 <= a = min/max <= 1), where
+// atan(a) is approximated by an odd degree-11 polynomial (max error about
+// 1e-6 radians, or 0.01 of an output LSB), then mapped back to the right
+// octant using the signs and relative magnitude of I and Q. The final angle
+// in -pi .. pi is scaled to -32768 .. +32768, rounded to nearest, and the
+// low 16 bits are kept, which gives the same 0 .. 2*pi wrapping as
+// scaled_atan2. The scalar and vector versions perform the same float
+// operations in the same order so that they produce identical results.
+//
+
+static const float ATAN_C1 = 0.99997726f;
+static const float ATAN_C3 = -0.33262347f;
+static const float ATAN_C5 = 0.19354346f;
+static const float ATAN_C7 = -0.11643287f;
+static const float ATAN_C9 = 0.05265332f;
+static const float ATAN_C11 = -0.01172120f;
+
+static const float PI_F = 3.14159265f;
+static const float HALF_PI_F = 1.57079633f;
+static const float PHASE_SCALE = 32768.0f / 3.14159265f;
+
+// smallest positive normal float, used to avoid dividing 0 by 0
+static const float TINY_F = 1.17549435e-38f;
+
+static inline std::uint16_t FastAtan2(float y, float x) {
+    const float ax = std::fabs(x);
+    const float ay = std::fabs(y);
+    const float mx = std::max(std::max(ax, ay), TINY_F);
+    const float mn = std::min(ax, ay);
+
+    const float a = mn / mx;
+    const float s = a * a;
+    float r = ((((ATAN_C11 * s + ATAN_C9) * s + ATAN_C7) * s + ATAN_C5) * s + ATAN_C3) * s;
+    r = r * a + ATAN_C1 * a;
+
+    if (ay > ax)
+        r = HALF_PI_F - r;
+    if (std::signbit(x))
+        r = PI_F - r;
+    if (std::signbit(y))
+        r = -r;
+
+    return (std::uint16_t)(std::int32_t)std::nearbyint(r * PHASE_SCALE);
+}
+
+static void PhaseCS16Generic(const std::int16_t *iq, std::size_t n, std::uint16_t *out) {
+    for (std::size_t k = 0; k < n; ++k, iq += 2) {
+        out[k] = FastAtan2(iq[1], iq[0]);
     }
 }
 
-// caution, expects unsigned (positive) input only
-inline std::uint16_t CS16HConverter::TableAtan(std::uint32_t r) {
-    if (r > lookup_atan_.size())
-        return 16384; // pi/2
-    else
-        return lookup_atan_[r];
-}
-
-inline std::uint16_t CS16HConverter::TableAtan2(std::int16_t y, std::int16_t x) {
-    // atan2 using the atan lookup table
-    // we rely on unsigned 16-bit integer overflow/wrap semantics
-    // max error is about 0.2 degrees
-    if (x == 0) {
-        if (y >= 0) {
-            return 16384; // pi/2
-        } else {
-            return 49152; // 3/2 pi
-        }
+static void MagSqCS16Generic(const std::int16_t *iq, std::size_t n, double *out) {
+    for (std::size_t k = 0; k < n; ++k, iq += 2) {
+        out[k] = magsq(iq[1], iq[0]) / 32768.0 / 32768.0;
     }
+}
 
-    const std::int32_t r = (std::int32_t)(256 * y) / x;
-    if (x < 0) {
-        if (y < 0) {
-            // x < 0, y < 0   => y/x > 0
-            // atan2(y,x) = pi + atan(y/x)
-            return (std::uint16_t)32768 + TableAtan((std::uint32_t)r);
-        } else {
-            // x < 0, y >= 0  => y/x <= 0
-            // atan2(y,x) = -pi + atan(y/x) = -pi - atan(-y/x)
-            return (std::uint16_t)32768 - TableAtan((std::uint32_t)-r);
-        }
-    } else {
-        if (y < 0) {
-            // x > 0, y < 0   => y/x < 0
-            // atan2(y,x) = atan(y/x) = -atan(-y/x)
-            return (std::uint16_t)0 - TableAtan((std::uint32_t)-r);
-        } else {
-            // x > 0, y >= 0  => y/x >= 0
-            // atan2(y,x) = atan(y/x)
-            return TableAtan((std::uint32_t)r);
-        }
+static double SumMagSqCS16Generic(const std::int16_t *iq, std::size_t n) {
+    std::uint64_t total = 0;
+    for (std::size_t k = 0; k < 2 * n; ++k) {
+        total += (std::uint32_t)((std::int32_t)iq[k] * iq[k]);
     }
+    return total / 32768.0 / 32768.0;
 }
 
-void CS16HConverter::ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) {
-    auto in_iq = reinterpret_cast<const std::int16_t *>(&*begin);
+static void PhaseCF32Generic(const float *iq, std::size_t n, std::uint16_t *out) {
+    for (std::size_t k = 0; k < n; ++k, iq += 2) {
+        out[k] = FastAtan2(iq[1], iq[0]);
+    }
+}
 
-    // unroll the loop
-    const auto n = std::distance(begin, end) / 4;
-    const auto n8 = n / 8;
-    const auto n7 = n & 7;
+static void MagSqCF32Generic(const float *iq, std::size_t n, double *out) {
+    for (std::size_t k = 0; k < n; ++k, iq += 2) {
+        out[k] = magsq(iq[1], iq[0]);
+    }
+}
 
-    for (auto i = 0; i < n8; ++i, in_iq += 16) {
-        *out++ = TableAtan2(in_iq[1], in_iq[0]);
-        *out++ = TableAtan2(in_iq[3], in_iq[2]);
-        *out++ = TableAtan2(in_iq[5], in_iq[4]);
-        *out++ = TableAtan2(in_iq[7], in_iq[6]);
-        *out++ = TableAtan2(in_iq[9], in_iq[8]);
-        *out++ = TableAtan2(in_iq[11], in_iq[10]);
-        *out++ = TableAtan2(in_iq[13], in_iq[12]);
-        *out++ = TableAtan2(in_iq[15], in_iq[14]);
+static double SumMagSqCF32Generic(const float *iq, std::size_t n) {
+    double total = 0;
+    for (std::size_t k = 0; k < 2 * n; ++k) {
+        total += (double)iq[k] * iq[k];
     }
-    for (auto i = 0; i < n7; ++i, in_iq += 2) {
-        *out++ = TableAtan2(in_iq[1], in_iq[0]);
+    return total;
+}
+
+#ifdef DUMP978_X86
+
+// SSE4.1: 4 samples per step
+
+__attribute__((target("sse4.1"))) static inline __m128i FastAtan2SSE41(__m128 y, __m128 x) {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 ax = _mm_andnot_ps(sign, x);
+    const __m128 ay = _mm_andnot_ps(sign, y);
+    const __m128 mx = _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(TINY_F));
+    const __m128 mn = _mm_min_ps(ax, ay);
+
+    const __m128 a = _mm_div_ps(mn, mx);
+    const __m128 s = _mm_mul_ps(a, a);
+    __m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ATAN_C11), s), _mm_set1_ps(ATAN_C9));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(ATAN_C7));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(ATAN_C5));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(ATAN_C3));
+    r = _mm_mul_ps(r, s);
+    r = _mm_add_ps(_mm_mul_ps(r, a), _mm_mul_ps(_mm_set1_ps(ATAN_C1), a));
+
+    r = _mm_blendv_ps(r, _mm_sub_ps(_mm_set1_ps(HALF_PI_F), r), _mm_cmpgt_ps(ay, ax));
+    r = _mm_blendv_ps(r, _mm_sub_ps(_mm_set1_ps(PI_F), r), x); // selects on the sign bit of x
+    r = _mm_xor_ps(r, _mm_and_ps(y, sign));
+
+    const __m128i scaled = _mm_cvtps_epi32(_mm_mul_ps(r, _mm_set1_ps(PHASE_SCALE)));
+    return _mm_and_si128(scaled, _mm_set1_epi32(0xFFFF));
+}
+
+__attribute__((target("sse4.1"))) static void PhaseCS16SSE41(const std::int16_t *iq, std::size_t n, std::uint16_t *out) {
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)(iq + 2 * k));
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(iq + 2 * k + 8));
+        // I is the low half of each 32-bit lane, Q the high half
+        const __m128 x0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v0, 16), 16));
+        const __m128 y0 = _mm_cvtepi32_ps(_mm_srai_epi32(v0, 16));
+        const __m128 x1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v1, 16), 16));
+        const __m128 y1 = _mm_cvtepi32_ps(_mm_srai_epi32(v1, 16));
+        _mm_storeu_si128((__m128i *)(out + k), _mm_packus_epi32(FastAtan2SSE41(y0, x0), FastAtan2SSE41(y1, x1)));
     }
+    PhaseCS16Generic(iq + 2 * k, n - k, out + k);
 }
 
-void CS16HConverter::ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) {
-    auto in_iq = reinterpret_cast<const std::int16_t *>(&*begin);
+__attribute__((target("sse4.1"))) static void PhaseCF32SSE41(const float *iq, std::size_t n, std::uint16_t *out) {
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const __m128 v0 = _mm_loadu_ps(iq + 2 * k);
+        const __m128 v1 = _mm_loadu_ps(iq + 2 * k + 4);
+        const __m128 v2 = _mm_loadu_ps(iq + 2 * k + 8);
+        const __m128 v3 = _mm_loadu_ps(iq + 2 * k + 12);
+        const __m128 x0 = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 y0 = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m128 x1 = _mm_shuffle_ps(v2, v3, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 y1 = _mm_shuffle_ps(v2, v3, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_si128((__m128i *)(out + k), _mm_packus_epi32(FastAtan2SSE41(y0, x0), FastAtan2SSE41(y1, x1)));
+    }
+    PhaseCF32Generic(iq + 2 * k, n - k, out + k);
+}
 
-    // unroll the loop
-    const auto n = std::distance(begin, end) / 4;
-    const auto n8 = n / 8;
-    const auto n7 = n & 7;
+__attribute__((target("sse4.1"))) static void MagSqCS16SSE41(const std::int16_t *iq, std::size_t n, double *out) {
+    const __m128d scale = _mm_set1_pd(1.0 / 32768.0 / 32768.0);
+    const __m128d wrap = _mm_set1_pd(4294967296.0);
+
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        // I*I + Q*Q as a 32-bit integer; this is exact, but the one value
+        // that does not fit (-32768, -32768) wraps negative, so fix it up
+        const __m128i v = _mm_loadu_si128((const __m128i *)(iq + 2 * k));
+        const __m128i m = _mm_madd_epi16(v, v);
+        __m128d lo = _mm_cvtepi32_pd(m);
+        __m128d hi = _mm_cvtepi32_pd(_mm_unpackhi_epi64(m, m));
+        lo = _mm_add_pd(lo, _mm_and_pd(_mm_cmplt_pd(lo, _mm_setzero_pd()), wrap));
+        hi = _mm_add_pd(hi, _mm_and_pd(_mm_cmplt_pd(hi, _mm_setzero_pd()), wrap));
+        _mm_storeu_pd(out + k, _mm_mul_pd(lo, scale));
+        _mm_storeu_pd(out + k + 2, _mm_mul_pd(hi, scale));
+    }
+    MagSqCS16Generic(iq + 2 * k, n - k, out + k);
+}
 
-    for (auto i = 0; i < n8; ++i, in_iq += 16) {
-        *out++ = magsq(in_iq[1], in_iq[0]) / 32768.0 / 32768.0;
-        *out++ = magsq(in_iq[3], in_iq[2]) / 32768.0 / 32768.0;
-        *out++ = magsq(in_iq[5], in_iq[4]) / 32768.0 / 32768.0;
-        *out++ = magsq(in_iq[7], in_iq[6]) / 32768.0 / 32768.0;
-        *out++ = magsq(in_iq[9], in_iq[8]) / 32768.0 / 32768.0;
-        *out++ = magsq(in_iq[11], in_iq[10]) / 32768.0 / 32768.0;
-        *out++ = magsq(in_iq[13], in_iq[12]) / 32768.0 / 32768.0;
-        *out++ = magsq(in_iq[15], in_iq[14]) / 32768.0 / 32768.0;
+__attribute__((target("sse4.1"))) static void MagSqCF32SSE41(const float *iq, std::size_t n, double *out) {
+    std::size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        const __m128 v = _mm_loadu_ps(iq + 2 * k);
+        const __m128d lo = _mm_cvtps_pd(v);                    // I0 Q0
+        const __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v)); // I1 Q1
+        const __m128d i = _mm_unpacklo_pd(lo, hi);
+        const __m128d q = _mm_unpackhi_pd(lo, hi);
+        _mm_storeu_pd(out + k, _mm_add_pd(_mm_mul_pd(q, q), _mm_mul_pd(i, i)));
     }
-    for (auto i = 0; i < n7; ++i, in_iq += 2) {
-        *out++ = magsq(in_iq[1], in_iq[0]) / 32768.0 / 32768.0;
+    MagSqCF32Generic(iq + 2 * k, n - k, out + k);
+}
+
+__attribute__((target("sse4.1"))) static double SumMagSqCS16SSE41(const std::int16_t *iq, std::size_t n) {
+    // I*I + Q*Q fits in an unsigned 32-bit lane; accumulate in two 64-bit lanes
+    __m128i acc = _mm_setzero_si128();
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(iq + 2 * k));
+        const __m128i m = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_cvtepu32_epi64(m));
+        acc = _mm_add_epi64(acc, _mm_cvtepu32_epi64(_mm_unpackhi_epi64(m, m)));
     }
+
+    std::uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    std::uint64_t total = lanes[0] + lanes[1];
+    for (; k < n; ++k) {
+        // each square fits in an int32_t, but (-32768, -32768) overflows their sum
+        total += (std::uint32_t)((std::int32_t)iq[2 * k] * iq[2 * k]) + (std::uint32_t)((std::int32_t)iq[2 * k + 1] * iq[2 * k + 1]);
+    }
+    return total / 32768.0 / 32768.0;
 }
 
-void CF32HConverter::ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) {
-    auto in_iq = reinterpret_cast<const float *>(&*begin);
+// AVX2: 8 samples per step
+
+__attribute__((target("avx2"))) static inline __m256i FastAtan2AVX2(__m256 y, __m256 x) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 ax = _mm256_andnot_ps(sign, x);
+    const __m256 ay = _mm256_andnot_ps(sign, y);
+    const __m256 mx = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(TINY_F));
+    const __m256 mn = _mm256_min_ps(ax, ay);
+
+    const __m256 a = _mm256_div_ps(mn, mx);
+    const __m256 s = _mm256_mul_ps(a, a);
+    __m256 r = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(ATAN_C11), s), _mm256_set1_ps(ATAN_C9));
+    r = _mm256_add_ps(_mm256_mul_ps(r, s), _mm256_set1_ps(ATAN_C7));
+    r = _mm256_add_ps(_mm256_mul_ps(r, s), _mm256_set1_ps(ATAN_C5));
+    r = _mm256_add_ps(_mm256_mul_ps(r, s), _mm256_set1_ps(ATAN_C3));
+    r = _mm256_mul_ps(r, s);
+    r = _mm256_add_ps(_mm256_mul_ps(r, a), _mm256_mul_ps(_mm256_set1_ps(ATAN_C1), a));
+
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(HALF_PI_F), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(PI_F), r), x); // selects on the sign bit of x
+    r = _mm256_xor_ps(r, _mm256_and_ps(y, sign));
+
+    const __m256i scaled = _mm256_cvtps_epi32(_mm256_mul_ps(r, _mm256_set1_ps(PHASE_SCALE)));
+    return _mm256_and_si256(scaled, _mm256_set1_epi32(0xFFFF));
+}
 
-    // unroll the loop
-    const auto n = std::distance(begin, end) / 8;
-    const auto n8 = n / 8;
-    const auto n7 = n & 7;
+// pack 2x8 32-bit phase values (each 0 .. 65535) into 16 16-bit values, in order
+__attribute__((target("avx2"))) static inline __m256i PackPhaseAVX2(__m256i p0, __m256i p1) { return _mm256_permute4x64_epi64(_mm256_packus_epi32(p0, p1), _MM_SHUFFLE(3, 1, 2, 0)); }
+
+__attribute__((target("avx2"))) static void PhaseCS16AVX2(const std::int16_t *iq, std::size_t n, std::uint16_t *out) {
+    std::size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        const __m256i v0 = _mm256_loadu_si256((const __m256i *)(iq + 2 * k));
+        const __m256i v1 = _mm256_loadu_si256((const __m256i *)(iq + 2 * k + 16));
+        const __m256 x0 = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v0, 16), 16));
+        const __m256 y0 = _mm256_cvtepi32_ps(_mm256_srai_epi32(v0, 16));
+        const __m256 x1 = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v1, 16), 16));
+        const __m256 y1 = _mm256_cvtepi32_ps(_mm256_srai_epi32(v1, 16));
+        _mm256_storeu_si256((__m256i *)(out + k), PackPhaseAVX2(FastAtan2AVX2(y0, x0), FastAtan2AVX2(y1, x1)));
+    }
+    PhaseCS16SSE41(iq + 2 * k, n - k, out + k);
+}
+
+// deinterleave 8 I/Q float pairs into I and Q vectors, in sample order
+__attribute__((target("avx2"))) static inline void DeinterleaveAVX2(const float *iq, __m256 &x, __m256 &y) {
+    const __m256 v0 = _mm256_loadu_ps(iq);
+    const __m256 v1 = _mm256_loadu_ps(iq + 8);
+    // shuffle_ps works within 128-bit lanes, giving samples 0 1 4 5 2 3 6 7
+    const __m256 xs = _mm256_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m256 ys = _mm256_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1));
+    x = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(xs), _MM_SHUFFLE(3, 1, 2, 0)));
+    y = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(ys), _MM_SHUFFLE(3, 1, 2, 0)));
+}
 
-    for (auto i = 0; i < n8; ++i, in_iq += 16) {
-        *out++ = scaled_atan2(in_iq[1], in_iq[0]);
-        *out++ = scaled_atan2(in_iq[3], in_iq[2]);
-        *out++ = scaled_atan2(in_iq[5], in_iq[4]);
-        *out++ = scaled_atan2(in_iq[7], in_iq[6]);
-        *out++ = scaled_atan2(in_iq[9], in_iq[8]);
-        *out++ = scaled_atan2(in_iq[11], in_iq[10]);
-        *out++ = scaled_atan2(in_iq[13], in_iq[12]);
-        *out++ = scaled_atan2(in_iq[15], in_iq[14]);
+__attribute__((target("avx2"))) static void PhaseCF32AVX2(const float *iq, std::size_t n, std::uint16_t *out) {
+    std::size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m256 x0, y0, x1, y1;
+        DeinterleaveAVX2(iq + 2 * k, x0, y0);
+        DeinterleaveAVX2(iq + 2 * k + 16, x1, y1);
+        _mm256_storeu_si256((__m256i *)(out + k), PackPhaseAVX2(FastAtan2AVX2(y0, x0), FastAtan2AVX2(y1, x1)));
     }
-    for (auto i = 0; i < n7; ++i, in_iq += 2) {
-        *out++ = scaled_atan2(in_iq[1], in_iq[0]);
+    PhaseCF32SSE41(iq + 2 * k, n - k, out + k);
+}
+
+__attribute__((target("avx2"))) static void MagSqCS16AVX2(const std::int16_t *iq, std::size_t n, double *out) {
+    const __m256d scale = _mm256_set1_pd(1.0 / 32768.0 / 32768.0);
+    const __m256d wrap = _mm256_set1_pd(4294967296.0);
+
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        // see MagSqCS16SSE41 for the (-32768, -32768) fixup
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(iq + 2 * k));
+        const __m256i m = _mm256_madd_epi16(v, v);
+        __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(m));
+        __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(m, 1));
+        lo = _mm256_add_pd(lo, _mm256_and_pd(_mm256_cmp_pd(lo, _mm256_setzero_pd(), _CMP_LT_OQ), wrap));
+        hi = _mm256_add_pd(hi, _mm256_and_pd(_mm256_cmp_pd(hi, _mm256_setzero_pd(), _CMP_LT_OQ), wrap));
+        _mm256_storeu_pd(out + k, _mm256_mul_pd(lo, scale));
+        _mm256_storeu_pd(out + k + 4, _mm256_mul_pd(hi, scale));
     }
+    MagSqCS16SSE41(iq + 2 * k, n - k, out + k);
 }
 
-void CF32HConverter::ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) {
-    auto in_iq = reinterpret_cast<const float *>(&*begin);
+__attribute__((target("avx2"))) static void MagSqCF32AVX2(const float *iq, std::size_t n, double *out) {
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256 x, y;
+        DeinterleaveAVX2(iq + 2 * k, x, y);
+        const __m256d i0 = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+        const __m256d i1 = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+        const __m256d q0 = _mm256_cvtps_pd(_mm256_castps256_ps128(y));
+        const __m256d q1 = _mm256_cvtps_pd(_mm256_extractf128_ps(y, 1));
+        _mm256_storeu_pd(out + k, _mm256_add_pd(_mm256_mul_pd(q0, q0), _mm256_mul_pd(i0, i0)));
+        _mm256_storeu_pd(out + k + 4, _mm256_add_pd(_mm256_mul_pd(q1, q1), _mm256_mul_pd(i1, i1)));
+    }
+    MagSqCF32SSE41(iq + 2 * k, n - k, out + k);
+}
 
-    // unroll the loop
-    const auto n = std::distance(begin, end) / 8;
-    const auto n8 = n / 8;
-    const auto n7 = n & 7;
+__attribute__((target("avx2"))) static double SumMagSqCS16AVX2(const std::int16_t *iq, std::size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(iq + 2 * k));
+        const __m256i m = _mm256_madd_epi16(v, v);
+        acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(m)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(m, 1)));
+    }
+
+    const __m128i acc2 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    std::uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc2);
+    std::uint64_t total = lanes[0] + lanes[1];
+    for (; k < n; ++k) {
+        // each square fits in an int32_t, but (-32768, -32768) overflows their sum
+        total += (std::uint32_t)((std::int32_t)iq[2 * k] * iq[2 * k]) + (std::uint32_t)((std::int32_t)iq[2 * k + 1] * iq[2 * k + 1]);
+    }
+    return total / 32768.0 / 32768.0;
+}
 
-    for (auto i = 0; i < n8; ++i, in_iq += 16) {
-        *out++ = magsq(in_iq[1], in_iq[0]);
-        *out++ = magsq(in_iq[3], in_iq[2]);
-        *out++ = magsq(in_iq[5], in_iq[4]);
-        *out++ = magsq(in_iq[7], in_iq[6]);
-        *out++ = magsq(in_iq[9], in_iq[8]);
-        *out++ = magsq(in_iq[11], in_iq[10]);
-        *out++ = magsq(in_iq[13], in_iq[12]);
-        *out++ = magsq(in_iq[15], in_iq[14]);
+__attribute__((target("avx2"))) static double SumMagSqCF32AVX2(const float *iq, std::size_t n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        const __m256 v = _mm256_loadu_ps(iq + 2 * k);
+        const __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+        const __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(lo, lo));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(hi, hi));
     }
-    for (auto i = 0; i < n7; ++i, in_iq += 2) {
-        *out++ = magsq(in_iq[1], in_iq[0]);
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SumMagSqCF32Generic(iq + 2 * k, n - k);
+}
+
+#endif
+
+#ifdef DUMP978_NEON_A64
+
+// NEON (aarch64 only, for vdivq_f32 and vcvtnq_s32_f32): 4 samples per step
+
+static inline uint32x4_t FastAtan2Neon(float32x4_t y, float32x4_t x) {
+    const float32x4_t ax = vabsq_f32(x);
+    const float32x4_t ay = vabsq_f32(y);
+    const float32x4_t mx = vmaxq_f32(vmaxq_f32(ax, ay), vdupq_n_f32(TINY_F));
+    const float32x4_t mn = vminq_f32(ax, ay);
+
+    const float32x4_t a = vdivq_f32(mn, mx);
+    const float32x4_t s = vmulq_f32(a, a);
+    float32x4_t r = vaddq_f32(vmulq_f32(vdupq_n_f32(ATAN_C11), s), vdupq_n_f32(ATAN_C9));
+    r = vaddq_f32(vmulq_f32(r, s), vdupq_n_f32(ATAN_C7));
+    r = vaddq_f32(vmulq_f32(r, s), vdupq_n_f32(ATAN_C5));
+    r = vaddq_f32(vmulq_f32(r, s), vdupq_n_f32(ATAN_C3));
+    r = vmulq_f32(r, s);
+    r = vaddq_f32(vmulq_f32(r, a), vmulq_f32(vdupq_n_f32(ATAN_C1), a));
+
+    const uint32x4_t sign = vdupq_n_u32(0x80000000);
+    const uint32x4_t x_negative = vtstq_u32(vreinterpretq_u32_f32(x), sign);
+    r = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32(HALF_PI_F), r), r);
+    r = vbslq_f32(x_negative, vsubq_f32(vdupq_n_f32(PI_F), r), r);
+    r = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(r), vandq_u32(vreinterpretq_u32_f32(y), sign)));
+
+    const int32x4_t scaled = vcvtnq_s32_f32(vmulq_f32(r, vdupq_n_f32(PHASE_SCALE)));
+    return vandq_u32(vreinterpretq_u32_s32(scaled), vdupq_n_u32(0xFFFF));
+}
+
+static void PhaseCS16Neon(const std::int16_t *iq, std::size_t n, std::uint16_t *out) {
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const int16x8x2_t v = vld2q_s16(iq + 2 * k); // val[0] = I, val[1] = Q
+        const float32x4_t x0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[0])));
+        const float32x4_t x1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[0])));
+        const float32x4_t y0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[1])));
+        const float32x4_t y1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[1])));
+        vst1q_u16(out + k, vcombine_u16(vmovn_u32(FastAtan2Neon(y0, x0)), vmovn_u32(FastAtan2Neon(y1, x1))));
     }
+    PhaseCS16Generic(iq + 2 * k, n - k, out + k);
 }
+
+static void PhaseCF32Neon(const float *iq, std::size_t n, std::uint16_t *out) {
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const float32x4x2_t v0 = vld2q_f32(iq + 2 * k);
+        const float32x4x2_t v1 = vld2q_f32(iq + 2 * k + 8);
+        vst1q_u16(out + k, vcombine_u16(vmovn_u32(FastAtan2Neon(v0.val[1], v0.val[0])), vmovn_u32(FastAtan2Neon(v1.val[1], v1.val[0]))));
+    }
+    PhaseCF32Generic(iq + 2 * k, n - k, out + k);
+}
+
+#endif
+
+static ConvertKernels ChooseConvertKernels() {
+#ifdef DUMP978_X86
+    if (CpuHasAVX2())
+        return {"avx2", PhaseCS16AVX2, MagSqCS16AVX2, SumMagSqCS16AVX2, PhaseCF32AVX2, MagSqCF32AVX2, SumMagSqCF32AVX2};
+    if (CpuHasSSE41())
+        return {"sse4.1", PhaseCS16SSE41, MagSqCS16SSE41, SumMagSqCS16SSE41, PhaseCF32SSE41, MagSqCF32SSE41, SumMagSqCF32Generic};
+#endif
+#ifdef DUMP978_NEON_A64
+    if (CpuHasNeon())
+        return {"neon", PhaseCS16Neon, MagSqCS16Generic, SumMagSqCS16Generic, PhaseCF32Neon, MagSqCF32Generic, SumMagSqCF32Generic};
+#endif
+    return ConvertKernels::Generic();
+}
+
+const ConvertKernels &ConvertKernels::Generic() {
+    static const ConvertKernels kernels = {"generic", PhaseCS16Generic, MagSqCS16Generic, SumMagSqCS16Generic, PhaseCF32Generic, MagSqCF32Generic, SumMagSqCF32Generic};
+    return kernels;
+}
+
+const ConvertKernels &ConvertKernels::Selected() {
+    static const ConvertKernels kernels = ChooseConvertKernels();
+    return kernels;
+}
+
+void CS16HConverter::ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) {
+    const std::size_t n = std::distance(begin, end) / 4;
+    if (n > 0)
+        kernels_.phase_cs16(reinterpret_cast<const std::int16_t *>(begin), n, &*out);
+}
+
+void CS16HConverter::ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) {
+    const std::size_t n = std::distance(begin, end) / 4;
+    if (n > 0)
+        kernels_.magsq_cs16(reinterpret_cast<const std::int16_t *>(begin), n, &*out);
+}
+
+void CF32HConverter::ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) {
+    const std::size_t n = std::distance(begin, end) / 8;
+    if (n > 0)
+        kernels_.phase_cf32(reinterpret_cast<const float *>(begin), n, &*out);
+}
+
+void CF32HConverter::ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) {
+    const std::size_t n = std::distance(begin, end) / 8;
+    if (n > 0)
+        kernels_.magsq_cf32(reinterpret_cast<const float *>(begin), n, &*out);
+}
+
+double CS16HConverter::SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) { return kernels_.sum_magsq_cs16(reinterpret_cast<const std::int16_t *>(begin), std::distance(begin, end) / 4); }
+
+double CF32HConverter::SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) { return kernels_.sum_magsq_cf32(reinterpret_cast<const float *>(begin), std::distance(begin, end) / 8); }
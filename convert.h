@@ -7,7 +7,10 @@
 #ifndef DUMP978_CONVERT_H
 #define DUMP978_CONVERT_H
 
+#include <array>
+#include <cstddef>
 #include <memory>
+#include <vector>
 
 #include "common.h"
 
@@ -48,12 +51,16 @@ namespace airnav::uat {
         // Read samples from `begin` .. `end` and write one phase value per sample to
         // `out`. The input buffer should contain an integral number of samples
         // (trailing partial samples are ignored, not buffered).
-        virtual void ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) = 0;
+        virtual void ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) = 0;
 
         // Read samples from `begin` .. `end` and write one magnitude-squared value
         // per sample to `out`. The input buffer should contain an integral number of
         // samples (trailing partial samples are ignored, not buffered).
-        virtual void ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) = 0;
+        virtual void ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) = 0;
+
+        // Return the sum of the magnitude-squared values of the samples in
+        // `begin` .. `end`, without converting them to a buffer first.
+        virtual double SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) = 0;
 
         SampleFormat Format() const { return format_; }
         unsigned BytesPerSample() const { return bytes_per_sample_; }
@@ -66,12 +73,22 @@ namespace airnav::uat {
         unsigned bytes_per_sample_;
     };
 
-    class CU8Converter : public SampleConverter {
+    // How the 8-bit converters look up phase. FULL indexes a 65536-entry
+    // (128kB) table by the raw I/Q pair; OCTANT folds I and Q into the first
+    // octant, looks up a ~16kB table of atan(min/max), and reflects the
+    // result back. Both give identical results, but the octant table fits in
+    // L1 cache, which is what matters on small cores with small caches (e.g.
+    // Cortex-A53); DEFAULT picks whichever is expected to be faster on the
+    // build target.
+    enum class PhaseTable { FULL, OCTANT, DEFAULT };
+
+    class CU8Converter final : public SampleConverter {
       public:
-        CU8Converter();
+        CU8Converter(PhaseTable table = PhaseTable::DEFAULT);
 
-        void ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) override;
-        void ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) override;
+        void ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) override;
+        void ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) override;
+        double SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) override;
 
       private:
         union cu8_alias {
@@ -79,16 +96,21 @@ namespace airnav::uat {
             std::uint16_t iq16;
         };
 
-        std::array<std::uint16_t, 65536> lookup_phase_;
-        std::array<double, 65536> lookup_magsq_;
+        double MagSq(cu8_alias s) const { return lookup_square_[s.iq[0]] + lookup_square_[s.iq[1]]; }
+
+        // The tables are built once per process and shared by all converters
+        const std::uint16_t *lookup_phase_;        // FULL: phase indexed by cu8_alias::iq16; null when using octant_
+        const std::vector<std::uint16_t> *octant_; // OCTANT: octant table; null when using lookup_phase_
+        const double *lookup_square_;              // square of the scaled I or Q value, so magsq = square[I] + square[Q]
     };
 
-    class CS8Converter : public SampleConverter {
+    class CS8Converter final : public SampleConverter {
       public:
-        CS8Converter();
+        CS8Converter(PhaseTable table = PhaseTable::DEFAULT);
 
-        void ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) override;
-        void ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) override;
+        void ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) override;
+        void ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) override;
+        double SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) override;
 
       private:
         union cs8_alias {
@@ -96,27 +118,55 @@ namespace airnav::uat {
             std::uint16_t iq16;
         };
 
-        std::array<std::uint16_t, 65536> lookup_phase_;
-        std::array<double, 65536> lookup_magsq_;
+        double MagSq(cs8_alias s) const { return lookup_square_[(std::uint8_t)s.iq[0]] + lookup_square_[(std::uint8_t)s.iq[1]]; }
+
+        // The tables are built once per process and shared by all converters
+        const std::uint16_t *lookup_phase_;        // FULL: phase indexed by cs8_alias::iq16; null when using octant_
+        const std::vector<std::uint16_t> *octant_; // OCTANT: octant table; null when using lookup_phase_
+        const double *lookup_square_;              // indexed by the raw (unsigned) byte value
     };
 
-    class CS16HConverter : public SampleConverter {
+    // Inner loops for the CS16H / CF32H converters. Each kernel converts
+    // `n` interleaved I/Q samples from `iq` to `out`. Phase is computed with
+    // a float polynomial approximation of atan2 that is within 1 LSB of the
+    // exact, double-precision result; magnitudes are exact, as are CS16
+    // magnitude sums (accumulated as integers).
+    struct ConvertKernels {
+        const char *name;
+        void (*phase_cs16)(const std::int16_t *iq, std::size_t n, std::uint16_t *out);
+        void (*magsq_cs16)(const std::int16_t *iq, std::size_t n, double *out);
+        double (*sum_magsq_cs16)(const std::int16_t *iq, std::size_t n);
+        void (*phase_cf32)(const float *iq, std::size_t n, std::uint16_t *out);
+        void (*magsq_cf32)(const float *iq, std::size_t n, double *out);
+        double (*sum_magsq_cf32)(const float *iq, std::size_t n);
+
+        // Plain C++ implementation, available everywhere
+        static const ConvertKernels &Generic();
+
+        // Fastest implementation supported by this CPU (chosen at runtime)
+        static const ConvertKernels &Selected();
+    };
+
+    class CS16HConverter final : public SampleConverter {
       public:
-        CS16HConverter();
-        void ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) override;
-        void ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) override;
+        CS16HConverter(const ConvertKernels &kernels = ConvertKernels::Generic()) : SampleConverter(SampleFormat::CS16H), kernels_(kernels) {}
+        void ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) override;
+        void ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) override;
+        double SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) override;
 
       private:
-        std::uint16_t TableAtan(std::uint32_t r);
-        std::uint16_t TableAtan2(std::int16_t y, std::int16_t x);
-        std::array<std::uint16_t, 65536> lookup_atan_;
+        const ConvertKernels &kernels_;
     };
 
-    class CF32HConverter : public SampleConverter {
+    class CF32HConverter final : public SampleConverter {
       public:
-        CF32HConverter() : SampleConverter(SampleFormat::CF32H) {}
-        void ConvertPhase(Bytes::const_iterator begin, Bytes::const_iterator end, PhaseBuffer::iterator out) override;
-        void ConvertMagSq(Bytes::const_iterator begin, Bytes::const_iterator end, std::vector<double>::iterator out) override;
+        CF32HConverter(const ConvertKernels &kernels = ConvertKernels::Generic()) : SampleConverter(SampleFormat::CF32H), kernels_(kernels) {}
+        void ConvertPhase(const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) override;
+        void ConvertMagSq(const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) override;
+        double SumMagSq(const std::uint8_t *begin, const std::uint8_t *end) override;
+
+      private:
+        const ConvertKernels &kernels_;
     };
 }; // namespace airnav::uat
 
@@ -0,0 +1,282 @@
+#include "convert.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace airnav::uat;
+
+static unsigned failures = 0;
+
+// Phase of (x, y), from double-precision atan2, scaled to 0 .. 65535 as
+// the converters do (-pi and pi are both 32768)
+static std::uint16_t reference_phase(double y, double x) { return (std::uint16_t)(std::int32_t)std::lround(std::atan2(y, x) * 32768 / M_PI); }
+
+// Distance between two phase values, allowing for wrapping at 65536
+static int phase_distance(std::uint16_t a, std::uint16_t b) { return std::abs((int)(std::int16_t)(a - b)); }
+
+// Convert `samples` (of `bytes_per_sample` each) with `converter`, in
+// chunks of every length from 0 to 40 samples, so that each vector width
+// and each tail length is seen at many offsets
+template <class T, class F> static std::vector<T> convert_in_chunks(const std::vector<std::uint8_t> &samples, unsigned bytes_per_sample, F convert) {
+    const std::size_t n = samples.size() / bytes_per_sample;
+    std::vector<T> out(n);
+    for (std::size_t offset = 0, length = 0; offset < n; offset += length, length = (length + 1) % 41) {
+        const std::size_t count = std::min(length, n - offset);
+        convert(samples.data() + offset * bytes_per_sample, samples.data() + (offset + count) * bytes_per_sample, out.begin() + offset);
+    }
+    return out;
+}
+
+template <class T> static std::vector<std::uint8_t> as_bytes(const std::vector<T> &iq) {
+    std::vector<std::uint8_t> bytes(iq.size() * sizeof(T));
+    std::memcpy(bytes.data(), iq.data(), bytes.size());
+    return bytes;
+}
+
+// Compare the phase and magnitudes from the Selected() and Generic()
+// kernels, which should be identical, and the phase from each against
+// double-precision atan2, which should be within 1 LSB
+template <class Converter, class T> static void check_kernels(const std::string &desc, const std::vector<T> &iq, double scale) {
+    unsigned mismatches = 0;
+
+    const auto samples = as_bytes(iq);
+    const std::size_t n = iq.size() / 2;
+    Converter selected(ConvertKernels::Selected());
+    Converter generic(ConvertKernels::Generic());
+
+    PhaseBuffer generic_phase(n);
+    generic.ConvertPhase(samples.data(), samples.data() + samples.size(), generic_phase.begin());
+
+    PhaseBuffer selected_phase(n);
+    selected.ConvertPhase(samples.data(), samples.data() + samples.size(), selected_phase.begin());
+    const auto chunked_phase = convert_in_chunks<std::uint16_t>(samples, selected.BytesPerSample(), [&](const std::uint8_t *begin, const std::uint8_t *end, PhaseBuffer::iterator out) { selected.ConvertPhase(begin, end, out); });
+
+    for (std::size_t k = 0; k < n; ++k) {
+        const auto expected = reference_phase(iq[2 * k + 1] / scale, iq[2 * k] / scale);
+        const bool same = (selected_phase[k] == generic_phase[k] && chunked_phase[k] == generic_phase[k]);
+        const bool close = (phase_distance(generic_phase[k], expected) <= 1 && phase_distance(selected_phase[k], expected) <= 1);
+        if (!same || !close) {
+            if (++mismatches <= 5) {
+                std::cerr << desc << ": phase of (" << iq[2 * k] << ", " << iq[2 * k + 1] << "): " << ConvertKernels::Selected().name << " " << selected_phase[k] << " (" << chunked_phase[k] << " in chunks), generic " << generic_phase[k] << ", atan2 " << expected << std::endl;
+            }
+        }
+    }
+
+    std::vector<double> generic_magsq(n);
+    generic.ConvertMagSq(samples.data(), samples.data() + samples.size(), generic_magsq.begin());
+    const auto chunked_magsq = convert_in_chunks<double>(samples, selected.BytesPerSample(), [&](const std::uint8_t *begin, const std::uint8_t *end, std::vector<double>::iterator out) { selected.ConvertMagSq(begin, end, out); });
+
+    for (std::size_t k = 0; k < n; ++k) {
+        const double i = iq[2 * k] / scale;
+        const double q = iq[2 * k + 1] / scale;
+        const double expected = i * i + q * q;
+        if (generic_magsq[k] != expected || chunked_magsq[k] != expected) {
+            if (++mismatches <= 5) {
+                std::cerr << desc << ": magnitude of (" << iq[2 * k] << ", " << iq[2 * k + 1] << "): " << ConvertKernels::Selected().name << " " << chunked_magsq[k] << ", generic " << generic_magsq[k] << ", expected " << expected << std::endl;
+            }
+        }
+    }
+
+    std::cerr << desc << ", " << ConvertKernels::Selected().name << " vs generic vs atan2: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// CS16 edge values: the extremes (including -32768, which has no positive
+// counterpart), zero and its neighbours
+static const std::int16_t CS16_EDGES[] = {-32768, -32767, -16384, -2, -1, 0, 1, 2, 16384, 32766, 32767};
+
+void test_cs16h_kernels() {
+    std::vector<std::int16_t> iq;
+
+    // every pair of edge values, including zeros and the axes
+    for (auto i : CS16_EDGES) {
+        for (auto q : CS16_EDGES) {
+            iq.push_back(i);
+            iq.push_back(q);
+        }
+    }
+
+    // every value against each edge value, in both positions
+    for (auto edge : CS16_EDGES) {
+        for (int v = -32768; v <= 32767; ++v) {
+            iq.push_back(edge);
+            iq.push_back(v);
+            iq.push_back(v);
+            iq.push_back(edge);
+        }
+    }
+
+    // the diagonals, where the octant reflection changes
+    for (int v = -32768; v <= 32767; ++v) {
+        iq.push_back(v);
+        iq.push_back(v);
+        iq.push_back(v);
+        iq.push_back(v == -32768 ? 32767 : -v);
+    }
+
+    std::mt19937 rng(1);
+    for (unsigned k = 0; k < 2000000; ++k) {
+        iq.push_back((std::int16_t)(rng() & 0xFFFF));
+    }
+
+    check_kernels<CS16HConverter>("CS16H", iq, 32768.0);
+}
+
+void test_cf32h_kernels() {
+    std::vector<float> iq;
+
+    // every pair of edge values: signed zeros, the axes, the smallest
+    // normal floats and extremes of magnitude
+    const float edges[] = {0.0f, -0.0f, 1.0f, -1.0f, 0.5f, -0.5f, 1.0f / 32768, -1.0f / 32768, FLT_MIN, -FLT_MIN, 1e-30f, -1e-30f, 1e30f, -1e30f, 0.70710678f, -0.70710678f};
+    for (auto i : edges) {
+        for (auto q : edges) {
+            iq.push_back(i);
+            iq.push_back(q);
+        }
+    }
+
+    // CS16 samples as floats, as a CS16 source converted to CF32 would give
+    for (auto edge : CS16_EDGES) {
+        for (int v = -32768; v <= 32767; ++v) {
+            iq.push_back(edge / 32768.0f);
+            iq.push_back(v / 32768.0f);
+            iq.push_back(v / 32768.0f);
+            iq.push_back(edge / 32768.0f);
+        }
+    }
+
+    // noise at a wide range of scales
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0, 1);
+    std::uniform_real_distribution<float> exponent(-20, 20);
+    for (unsigned k = 0; k < 1000000; ++k) {
+        const float scale = std::pow(10.0f, exponent(rng));
+        iq.push_back(noise(rng) * scale);
+        iq.push_back(noise(rng) * scale);
+    }
+
+    check_kernels<CF32HConverter>("CF32H", iq, 1.0);
+}
+
+// Magnitude sums must match the sum of the individual magnitudes: exactly
+// for CS16 (summed as integers) and for CF32 values that sum exactly in any
+// order; otherwise the vector kernels add in a different order, so CF32
+// sums may differ in the last few bits
+void test_sum_magsq() {
+    unsigned mismatches = 0;
+
+    std::mt19937 rng(1);
+    std::vector<std::int16_t> cs16(2 * 100000);
+    for (auto &v : cs16) {
+        v = (std::int16_t)(rng() & 0xFFFF);
+    }
+    cs16[0] = cs16[1] = -32768;
+
+    std::vector<float> exact_cf32(cs16.size());
+    for (std::size_t k = 0; k < cs16.size(); ++k) {
+        exact_cf32[k] = cs16[k] / 32768.0f;
+    }
+
+    std::normal_distribution<float> noise(0, 1);
+    std::vector<float> cf32(cs16.size());
+    for (auto &v : cf32) {
+        v = noise(rng);
+    }
+
+    CS16HConverter cs16_selected(ConvertKernels::Selected()), cs16_generic(ConvertKernels::Generic());
+    CF32HConverter cf32_selected(ConvertKernels::Selected()), cf32_generic(ConvertKernels::Generic());
+    const auto cs16_bytes = as_bytes(cs16);
+    const auto exact_cf32_bytes = as_bytes(exact_cf32);
+    const auto cf32_bytes = as_bytes(cf32);
+
+    // every length up to 40 samples, then the whole buffer
+    std::vector<std::size_t> lengths;
+    for (std::size_t n = 0; n <= 40; ++n) {
+        lengths.push_back(n);
+    }
+    lengths.push_back(cs16.size() / 2);
+
+    for (auto n : lengths) {
+        double expected = 0;
+        for (std::size_t k = 0; k < 2 * n; ++k) {
+            expected += (double)cs16[k] * cs16[k];
+        }
+        expected = expected / 32768.0 / 32768.0;
+
+        const double cs16_results[] = {cs16_selected.SumMagSq(cs16_bytes.data(), cs16_bytes.data() + n * 4), cs16_generic.SumMagSq(cs16_bytes.data(), cs16_bytes.data() + n * 4), cf32_selected.SumMagSq(exact_cf32_bytes.data(), exact_cf32_bytes.data() + n * 8), cf32_generic.SumMagSq(exact_cf32_bytes.data(), exact_cf32_bytes.data() + n * 8)};
+        for (auto result : cs16_results) {
+            if (result != expected) {
+                std::cerr << "magnitude sums of " << n << " samples: expected " << expected << ", got " << result << std::endl;
+                ++mismatches;
+            }
+        }
+
+        const double selected = cf32_selected.SumMagSq(cf32_bytes.data(), cf32_bytes.data() + n * 8);
+        const double generic = cf32_generic.SumMagSq(cf32_bytes.data(), cf32_bytes.data() + n * 8);
+        if (std::fabs(selected - generic) > 1e-12 * generic) {
+            std::cerr << "CF32 magnitude sums of " << n << " samples: " << ConvertKernels::Selected().name << " " << selected << ", generic " << generic << std::endl;
+            ++mismatches;
+        }
+    }
+
+    std::cerr << "magnitude sums, " << ConvertKernels::Selected().name << " vs generic: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// The octant phase tables must give exactly the same phase as the full
+// tables, for every one of the 65536 I/Q pairs; `value` gives the signed
+// value of one raw byte
+template <class Converter, class F> static void check_phase_tables(const std::string &desc, F value) {
+    unsigned mismatches = 0;
+
+    std::vector<std::uint8_t> samples;
+    for (unsigned i = 0; i < 256; ++i) {
+        for (unsigned q = 0; q < 256; ++q) {
+            samples.push_back(i);
+            samples.push_back(q);
+        }
+    }
+
+    Converter full(PhaseTable::FULL);
+    Converter octant(PhaseTable::OCTANT);
+    PhaseBuffer full_phase(65536), octant_phase(65536);
+    full.ConvertPhase(samples.data(), samples.data() + samples.size(), full_phase.begin());
+    octant.ConvertPhase(samples.data(), samples.data() + samples.size(), octant_phase.begin());
+
+    for (std::size_t k = 0; k < 65536; ++k) {
+        const double i = value(samples[2 * k]);
+        const double q = value(samples[2 * k + 1]);
+        if (octant_phase[k] != full_phase[k] || phase_distance(full_phase[k], reference_phase(q, i)) > 1) {
+            if (++mismatches <= 5) {
+                std::cerr << desc << ": phase of (" << (unsigned)samples[2 * k] << ", " << (unsigned)samples[2 * k + 1] << "): octant " << octant_phase[k] << ", full " << full_phase[k] << ", atan2 " << reference_phase(q, i) << std::endl;
+            }
+        }
+    }
+
+    std::cerr << desc << ", octant vs full phase table, all I/Q pairs: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+void test_phase_tables() {
+    check_phase_tables<CU8Converter>("CU8", [](std::uint8_t v) { return v - 127.5; });
+    check_phase_tables<CS8Converter>("CS8", [](std::uint8_t v) { return (double)(std::int8_t)v; });
+}
+
+int main(int argc, char **argv) {
+    test_cs16h_kernels();
+    test_cf32h_kernels();
+    test_sum_magsq();
+    test_phase_tables();
+
+    if (failures) {
+        std::cerr << failures << " failures" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_CPU_FEATURES_H
+#define DUMP978_CPU_FEATURES_H
+
+// Runtime checks for optional instruction set extensions, used to pick
+// between alternative implementations of the hot loops. Code for the
+// extensions is compiled with per-function target attributes, so the rest
+// of the build does not need any special compiler flags.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DUMP978_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DUMP978_NEON 1
+#endif
+
+namespace airnav::uat {
+    inline bool CpuHasSSSE3() {
+#ifdef DUMP978_X86
+        return __builtin_cpu_supports("ssse3");
+#else
+        return false;
+#endif
+    }
+
+    inline bool CpuHasSSE41() {
+#ifdef DUMP978_X86
+        return __builtin_cpu_supports("sse4.1");
+#else
+        return false;
+#endif
+    }
+
+    inline bool CpuHasSSE42() {
+#ifdef DUMP978_X86
+        return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+#else
+        return false;
+#endif
+    }
+
+    inline bool CpuHasAVX2() {
+#ifdef DUMP978_X86
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#else
+        return false;
+#endif
+    }
+
+    // NEON is a compile-time choice: it is either part of the target
+    // architecture (aarch64, armhf built with -mfpu=neon) or not available
+    inline bool CpuHasNeon() {
+#ifdef DUMP978_NEON
+        return true;
+#else
+        return false;
+#endif
+    }
+}; // namespace airnav::uat
+
+#endif
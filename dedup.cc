@@ -0,0 +1,205 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "dedup.h"
+
+#include <cstring>
+#include <new>
+
+using namespace airnav::uat;
+
+Deduplicator::Deduplicator(boost::asio::io_service &service, MessageSource::Pointer upstream, std::chrono::milliseconds hold, std::chrono::milliseconds window, unsigned table_bits) : service_(service), strand_(service), timer_(service), upstream_(upstream), hold_(hold), window_(window), epoch_(std::chrono::steady_clock::now()), mask_((std::uint64_t(1) << table_bits) - 1) {
+    const std::size_t bytes = sizeof(Bucket) << table_bits;
+    void *table;
+    if (posix_memalign(&table, alignof(Bucket), bytes) != 0) {
+        throw std::bad_alloc();
+    }
+    std::memset(table, 0, bytes);
+    table_.reset(static_cast<Bucket *>(table));
+}
+
+void Deduplicator::Start() {
+    // nothing is on the strand until upstream delivers something
+    stopped_ = false;
+
+    std::weak_ptr<Deduplicator> weak(shared_from_this());
+    upstream_->SetConsumer([weak](SharedMessageVector messages) {
+        if (auto self = weak.lock())
+            self->HandleMessages(messages);
+    });
+    upstream_->SetErrorHandler([weak](const boost::system::error_code &ec) {
+        if (auto self = weak.lock())
+            self->HandleError(ec);
+    });
+    upstream_->Start();
+}
+
+void Deduplicator::Stop() {
+    upstream_->Stop();
+
+    auto self(shared_from_this());
+    auto stop = [this, self]() {
+        stopped_ = true;
+        timer_.cancel();
+        // pass on everything still held rather than discarding it
+        Flush(Time::max());
+    };
+
+    if (service_.stopped()) {
+        // e.g. at shutdown, once io_service.run() has returned: no handler
+        // can be running on the strand, and a posted one would never run
+        stop();
+    } else {
+        strand_.dispatch(stop);
+    }
+}
+
+void Deduplicator::HandleMessages(SharedMessageVector messages) {
+    const Time now = std::chrono::steady_clock::now();
+    const Time received = (messages->timing.received == Time() ? now : messages->timing.received);
+
+    auto self(shared_from_this());
+    strand_.dispatch([this, self, messages, now, received]() {
+        const std::uint32_t source_bit = UINT32_C(1) << (messages->source % 32);
+        for (const auto &message : *messages) {
+            HandleMessage(RawMessage(message), source_bit, received, now);
+        }
+        ScheduleFlush();
+    });
+}
+
+void Deduplicator::HandleError(const boost::system::error_code &ec) {
+    auto self(shared_from_this());
+    strand_.dispatch([this, self, ec]() {
+        // pass on everything still held before the error
+        Flush(Time::max());
+        DispatchError(ec);
+    });
+}
+
+void Deduplicator::HandleMessage(RawMessage &&message, std::uint32_t source_bit, Time received, Time now) {
+    if (message.Type() != MessageType::DOWNLINK_SHORT && message.Type() != MessageType::DOWNLINK_LONG && message.Type() != MessageType::UPLINK) {
+        pending_.push_back({std::move(message), 0, received, now + hold_});
+        return;
+    }
+
+    const std::uint64_t hash = Hash(message);
+    const std::uint32_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - epoch_).count();
+    Bucket &bucket = table_[hash & mask_];
+
+    // a slot is live until `expires`; compare as a signed difference so the
+    // millisecond clock can wrap
+    auto remaining = [&bucket, now_ms](unsigned slot) { return static_cast<std::int32_t>(bucket.expires[slot] - now_ms); };
+
+    // the earliest live copy that this source has not already sent
+    int match = -1;
+    for (unsigned slot = 0; slot < SLOTS_PER_BUCKET; ++slot) {
+        if (bucket.hash[slot] == hash && remaining(slot) > 0 && !(bucket.sources[slot] & source_bit)) {
+            if (match < 0 || remaining(slot) < remaining(match)) {
+                match = slot;
+            }
+        }
+    }
+
+    if (match >= 0) {
+        const unsigned slot = match;
+        bucket.sources[slot] |= source_bit;
+
+        ++duplicate_messages_;
+        const std::uint32_t index = bucket.sequence[slot] - first_sequence_;
+        if (index < pending_.size() && pending_[index].hash == hash) {
+            auto &held = pending_[index].message;
+            const unsigned copies = held.Copies() + message.Copies();
+            if (Better(message, held)) {
+                held = std::move(message);
+            }
+            held.SetCopies(copies);
+        }
+        // otherwise the message has already been passed on; drop this copy
+        return;
+    }
+
+    // a new message: take an empty or expired slot, or else the one that
+    // would expire soonest
+    unsigned victim = 0;
+    for (unsigned slot = 0; slot < SLOTS_PER_BUCKET; ++slot) {
+        if (bucket.hash[slot] == 0 || remaining(slot) <= 0) {
+            victim = slot;
+            break;
+        }
+        if (remaining(slot) < remaining(victim)) {
+            victim = slot;
+        }
+    }
+
+    bucket.hash[victim] = hash;
+    bucket.expires[victim] = now_ms + static_cast<std::uint32_t>(window_.count());
+    bucket.sequence[victim] = first_sequence_ + static_cast<std::uint32_t>(pending_.size());
+    bucket.sources[victim] = source_bit;
+
+    ++unique_messages_;
+    pending_.push_back({std::move(message), hash, received, now + hold_});
+}
+
+void Deduplicator::Flush(Time now) {
+    if (pending_.empty() || pending_.front().flush_at > now) {
+        return;
+    }
+
+    auto messages = MessageVector::Create();
+    messages->timing.received = pending_.front().received;
+    while (!pending_.empty() && pending_.front().flush_at <= now) {
+        messages->emplace_back(std::move(pending_.front().message));
+        pending_.pop_front();
+        ++first_sequence_;
+    }
+
+    DispatchMessages(messages);
+}
+
+void Deduplicator::ScheduleFlush() {
+    if (stopped_) {
+        // nothing will flush later
+        Flush(Time::max());
+        return;
+    }
+
+    if (flush_scheduled_ || pending_.empty()) {
+        return;
+    }
+
+    flush_scheduled_ = true;
+    auto self(shared_from_this());
+    timer_.expires_at(pending_.front().flush_at);
+    timer_.async_wait(strand_.wrap([this, self](const boost::system::error_code &ec) {
+        flush_scheduled_ = false;
+        if (ec) {
+            return;
+        }
+        Flush(std::chrono::steady_clock::now());
+        ScheduleFlush();
+    }));
+}
+
+std::uint64_t Deduplicator::Hash(const RawMessage &message) {
+    // FNV-1a over the type and payload; 0 is reserved for empty slots
+    std::uint64_t hash = UINT64_C(14695981039346656037);
+    auto mix = [&hash](std::uint8_t byte) {
+        hash ^= byte;
+        hash *= UINT64_C(1099511628211);
+    };
+
+    mix(static_cast<std::uint8_t>(message.Type()));
+    for (auto byte : message.Payload()) {
+        mix(byte);
+    }
+    return (hash ? hash : 1);
+}
+
+bool Deduplicator::Better(const RawMessage &a, const RawMessage &b) {
+    if (a.Errors() != b.Errors()) {
+        return a.Errors() < b.Errors();
+    }
+    return a.Rssi() > b.Rssi();
+}
@@ -0,0 +1,117 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_DEDUP_H
+#define DUMP978_DEDUP_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "message_source.h"
+
+namespace airnav::uat {
+    // Suppresses duplicate messages when several receivers that can hear
+    // the same transmissions are merged into one feed.
+    //
+    // Each message is hashed by type and payload and looked up in a
+    // fixed-size table of recently seen hashes. The first copy of a message
+    // is held for `hold`; copies that arrive meanwhile are merged into it,
+    // keeping whichever copy has the fewest errors and then the highest
+    // RSSI, and counted in its Copies(). Held messages are then passed on,
+    // in arrival order. Copies that arrive after that, but within `window`
+    // of the first, are dropped.
+    //
+    // Only copies from different receivers (by MessageVector::source) are
+    // duplicates: a ground station or a stationary aircraft can send the
+    // same payload twice within the window, and a receiver that hears both
+    // passes both on.
+    //
+    // Metadata messages are passed through (in order) without being
+    // deduplicated. Messages still held when the deduplicator is stopped
+    // are passed on then.
+    class Deduplicator : public MessageSource, public std::enable_shared_from_this<Deduplicator> {
+      public:
+        typedef std::shared_ptr<Deduplicator> Pointer;
+
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, MessageSource::Pointer upstream, std::chrono::milliseconds hold = std::chrono::milliseconds(200), std::chrono::milliseconds window = std::chrono::seconds(1), unsigned table_bits = 12) { return Pointer(new Deduplicator(service, upstream, hold, window, table_bits)); }
+
+        void Start() override;
+        void Stop() override;
+
+        // These may be read from any thread
+        std::uint64_t UniqueMessages() const { return unique_messages_; }
+        std::uint64_t DuplicateMessages() const { return duplicate_messages_; }
+
+      private:
+        typedef std::chrono::steady_clock::time_point Time;
+
+        Deduplicator(boost::asio::io_service &service, MessageSource::Pointer upstream, std::chrono::milliseconds hold, std::chrono::milliseconds window, unsigned table_bits);
+
+        // One cache line of the table: three recently seen hashes, when they
+        // stop counting as duplicates (in milliseconds since the table was
+        // created, which wraps after 49 days), the sequence number of their
+        // pending entry, if still held, and a bit for each source (modulo
+        // 32) that has sent a copy. A zero hash is an empty slot.
+        static const unsigned SLOTS_PER_BUCKET = 3;
+        struct alignas(64) Bucket {
+            std::uint64_t hash[SLOTS_PER_BUCKET];
+            std::uint32_t expires[SLOTS_PER_BUCKET];
+            std::uint32_t sequence[SLOTS_PER_BUCKET];
+            std::uint32_t sources[SLOTS_PER_BUCKET];
+        };
+        static_assert(sizeof(Bucket) == 64, "a table bucket should fill exactly one cache line");
+
+        struct Pending {
+            RawMessage message;
+            std::uint64_t hash; // 0 for messages that are not deduplicated
+            Time received;      // timing.received of the first copy's vector
+            Time flush_at;
+        };
+
+        struct FreeDeleter {
+            void operator()(Bucket *p) const { std::free(p); }
+        };
+
+        void HandleMessages(SharedMessageVector messages);
+        void HandleMessage(RawMessage &&message, std::uint32_t source_bit, Time received, Time now);
+        void HandleError(const boost::system::error_code &ec);
+        void Flush(Time now);
+        void ScheduleFlush();
+
+        static std::uint64_t Hash(const RawMessage &message);
+        static bool Better(const RawMessage &a, const RawMessage &b);
+
+        boost::asio::io_service &service_;
+        boost::asio::io_service::strand strand_;
+        boost::asio::steady_timer timer_;
+        MessageSource::Pointer upstream_;
+        std::chrono::milliseconds hold_;
+        std::chrono::milliseconds window_;
+
+        Time epoch_;
+        std::uint64_t mask_;
+        std::unique_ptr<Bucket[], FreeDeleter> table_; // 2^table_bits buckets
+
+        std::deque<Pending> pending_;
+        std::uint32_t first_sequence_ = 0; // sequence number of pending_.front()
+        bool flush_scheduled_ = false;
+        bool stopped_ = false; // once stopped, held messages are passed on at once
+
+        std::atomic<std::uint64_t> unique_messages_{0};
+        std::atomic<std::uint64_t> duplicate_messages_{0};
+    };
+}; // namespace airnav::uat
+
+#endif
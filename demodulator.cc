@@ -5,146 +5,638 @@
 
 #include "demodulator.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include <boost/asio/error.hpp>
+
+#include "stats.h"
+#include "thread_placement.h"
+#include "trace.h"
 
 using namespace airnav::uat;
 
-SingleThreadReceiver::SingleThreadReceiver(SampleFormat format) : converter_(SampleConverter::Create(format)), demodulator_(new TwoMegDemodulator()) {}
+// Build a message vector from the output of Demodulate. `samples` holds the
+// raw sample data that the demodulator's phase buffer (`phase`) was converted
+// from, which is the `previous_samples` of history before the data of
+// `block`. The block provides the timestamps: messages are timed by their
+// offset in samples from the block's first sample, and if `raw_timestamps`
+// is set their raw timestamp is the index of their first sample, in
+// DEMOD_SAMPLE_RATE units whatever `samples_per_bit` the samples are at.
+template <class ConverterType> static SharedMessageVector BuildMessages(ConverterType &converter, std::vector<Demodulator::Message> &messages, const std::uint8_t *samples, PhaseBuffer::const_iterator phase, const SampleBlock &block, std::size_t previous_samples, bool raw_timestamps, unsigned samples_per_bit) {
+    const std::int64_t rate = static_cast<std::int64_t>(DEMOD_SAMPLE_RATE) * samples_per_bit / 2;
+
+    SharedMessageVector dispatch = MessageVector::Create();
+    dispatch->reserve(messages.size());
+    unsigned corrected_errors = 0;
+    for (auto &message : messages) {
+        auto begin_sample = samples + std::distance(phase, message.begin) * converter.BytesPerSample();
+        auto end_sample = samples + std::distance(phase, message.end) * converter.BytesPerSample();
+
+        auto total_power = converter.SumMagSq(begin_sample, end_sample);
+        auto rssi = (total_power == 0 ? -1000 : 10 * std::log10(total_power / std::distance(message.begin, message.end)));
+
+        // offset from the block's first sample; negative within the history
+        const std::int64_t offset = std::distance(phase, message.begin) - static_cast<std::int64_t>(previous_samples);
+        const std::int64_t offset_ms = (offset >= 0 ? offset * 1000 / rate : -((-offset * 1000 + rate - 1) / rate));
+        const std::uint64_t message_timestamp = block.timestamp + offset_ms;
+        const std::uint64_t raw_timestamp = (raw_timestamps ? (block.sample_index + offset) * 2 / samples_per_bit : 0);
+
+        corrected_errors += message.corrected_errors;
+        dispatch->emplace_back(message.payload, message_timestamp, message.corrected_errors, rssi, raw_timestamp);
+        stats::Add(dispatch->back().Type() == MessageType::UPLINK ? stats::Counter::UPLINK_MESSAGES : stats::Counter::DOWNLINK_MESSAGES);
+    }
+    stats::Add(stats::Counter::CORRECTED_ERRORS, corrected_errors);
 
-// Handle samples in 'buffer' by:
-//   converting them to a phase buffer
-//   demodulating the phase buffer
-//   dispatching any demodulated messages
-//   preserving the end of the phase buffer for reuse in the next call
-void SingleThreadReceiver::HandleSamples(std::uint64_t timestamp, Bytes::const_iterator begin, Bytes::const_iterator end) {
-    assert(converter_);
+    dispatch->timing.received = block.received;
+    dispatch->timing.demodulated = std::chrono::steady_clock::now();
+    stats::Record(stats::Latency::DEMODULATED, dispatch->timing.demodulated - block.received);
 
-    const auto buffer_bytes = std::distance(begin, end);
-    const auto buffer_samples = buffer_bytes / converter_->BytesPerSample();
+    return dispatch;
+}
 
-    const auto previous_samples = saved_samples_;
-    const auto previous_bytes = previous_samples * converter_->BytesPerSample();
+// Convert the samples in each of `regions` to the same positions in `phase`
+template <class ConverterType> static void ConvertRegions(ConverterType &converter, const std::uint8_t *samples, const std::vector<EnergyGate::Region> &regions, PhaseBuffer &phase) {
+    const auto bytes_per_sample = converter.BytesPerSample();
+    for (const auto &region : regions) {
+        converter.ConvertPhase(samples + region.begin * bytes_per_sample, samples + region.end * bytes_per_sample, phase.begin() + region.begin);
+    }
+}
 
-    const auto total_samples = buffer_samples + previous_samples;
-    const auto total_bytes = total_samples * converter_->BytesPerSample();
+// Demodulate each of `regions` of `phase`, in order
+template <class DemodulatorType> static std::vector<Demodulator::Message> DemodulateRegions(DemodulatorType &demodulator, const PhaseBuffer &phase, const std::vector<EnergyGate::Region> &regions) {
+    if (regions.size() == 1) {
+        return demodulator.Demodulate(phase.cbegin() + regions[0].begin, phase.cbegin() + regions[0].end);
+    }
+
+    std::vector<Demodulator::Message> messages;
+    for (const auto &region : regions) {
+        auto found = demodulator.Demodulate(phase.cbegin() + region.begin, phase.cbegin() + region.end);
+        std::move(found.begin(), found.end(), std::back_inserter(messages));
+    }
+    return messages;
+}
+
+Receiver::~Receiver() {
+    if (gate_ && gate_->TotalSamples() > 0) {
+        std::cerr << "Energy gate: skipped " << std::fixed << std::setprecision(1) << (100.0 * gate_->SkippedSamples() / gate_->TotalSamples()) << "% of all samples" << std::endl;
+    }
+}
 
-    if (samples_.size() < total_bytes) {
-        samples_.resize(total_bytes);
+void Receiver::FindRegions(SampleConverter &converter, const std::uint8_t *samples, std::size_t count, std::vector<EnergyGate::Region> &regions) {
+    stats::Add(stats::Counter::SAMPLES, count);
+    if (!gate_) {
+        regions.assign(1, {0, count});
+        return;
     }
 
-    // TODO: rearrange things to avoid this copy
-    std::copy(begin, end, samples_.begin() + previous_bytes);
+    gate_->FindRegions(converter, samples, count, regions);
+
+    std::size_t passed = 0;
+    for (const auto &region : regions) {
+        passed += region.end - region.begin;
+    }
+    stats::Add(stats::Counter::SAMPLES_SKIPPED, count - passed);
+
+    const auto report_interval = std::chrono::seconds(60);
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_gate_report_ >= report_interval) {
+        const std::uint64_t total = gate_->TotalSamples() - reported_total_;
+        const std::uint64_t skipped = gate_->SkippedSamples() - reported_skipped_;
+        if (total > 0) {
+            std::cerr << "Energy gate: skipped " << std::fixed << std::setprecision(1) << (100.0 * skipped / total) << "% of samples" << std::endl;
+        }
+        last_gate_report_ = now;
+        reported_total_ += total;
+        reported_skipped_ += skipped;
+    }
+}
+
+// Convert and demodulate each of `regions` of `samples`, via `phase`
+template <class ConverterType, class DemodulatorType> static std::vector<Demodulator::Message> ConvertAndDemodulate(ConverterType &converter, DemodulatorType &demodulator, const std::uint8_t *samples, const std::vector<EnergyGate::Region> &regions, PhaseBuffer &phase) {
+    {
+        stats::StageTimer timer(stats::Stage::CONVERT);
+        ConvertRegions(converter, samples, regions, phase);
+    }
+    return DemodulateRegions(demodulator, phase, regions);
+}
+
+// At 2 samples per bit, conversion is fused into the demodulator's tiled sync search
+template <class ConverterType> static std::vector<Demodulator::Message> ConvertAndDemodulate(ConverterType &converter, TwoMegDemodulator &demodulator, const std::uint8_t *samples, const std::vector<EnergyGate::Region> &regions, PhaseBuffer &phase) {
+    const auto bytes_per_sample = converter.BytesPerSample();
+    std::vector<Demodulator::Message> messages;
+    for (const auto &region : regions) {
+        auto found = demodulator.DemodulateSamples(converter, samples + region.begin * bytes_per_sample, region.end - region.begin, phase.begin() + region.begin);
+        if (messages.empty()) {
+            messages = std::move(found);
+        } else {
+            std::move(found.begin(), found.end(), std::back_inserter(messages));
+        }
+    }
+    return messages;
+}
+
+namespace {
+    template <class ConverterType, class DemodulatorType> class SpecializedSingleThreadReceiver final : public SingleThreadReceiver {
+      public:
+        template <class... Args> SpecializedSingleThreadReceiver(Args &&... args) : converter_(std::forward<Args>(args)...) {}
+
+        void HandleSamples(const SampleBlock &block) override;
+        unsigned NumTrailingSamples() override { return demodulator_.NumTrailingSamples(); }
+        void EnableSoftDecision(double retries_per_second) override { demodulator_.EnableSoftDecision(retries_per_second); }
+
+      private:
+        ConverterType converter_;
+        DemodulatorType demodulator_;
+
+        PhaseBuffer phase_;
+        std::vector<EnergyGate::Region> regions_;
+    };
+}; // namespace
+
+// Handle samples in 'block' by:
+//   converting them, and the history before them, to a phase buffer
+//   demodulating the phase buffer
+//   dispatching any demodulated messages
+template <class ConverterType, class DemodulatorType> void SpecializedSingleThreadReceiver<ConverterType, DemodulatorType>::HandleSamples(const SampleBlock &block) {
+    const auto bytes_per_sample = converter_.BytesPerSample();
+    const auto previous_samples = std::min<std::size_t>(block.history / bytes_per_sample, demodulator_.NumTrailingSamples());
+    const auto total_samples = previous_samples + block.size / bytes_per_sample;
+    const auto samples = block.data - previous_samples * bytes_per_sample;
+    DUMP978_TRACE(SAMPLE_BLOCK, block.size / bytes_per_sample, block.timestamp, block.sample_index);
 
     if (phase_.size() < total_samples) {
         phase_.resize(total_samples);
     }
 
-    converter_->ConvertPhase(samples_.begin(), samples_.begin() + total_bytes, phase_.begin());
-    auto messages = demodulator_->Demodulate(phase_.begin(), phase_.begin() + total_samples);
+    {
+        stats::StageTimer timer(stats::Stage::CONVERT);
+        FindRegions(converter_, samples, total_samples, regions_);
+    }
 
-    if (!messages.empty()) {
-        SharedMessageVector dispatch = std::make_shared<MessageVector>();
-        dispatch->reserve(messages.size());
-        for (auto &message : messages) {
-            std::vector<double> magsq;
-            magsq.resize(std::distance(message.begin, message.end));
+    SharedMessageVector dispatch;
+    {
+        stats::StageTimer timer(stats::Stage::DEMOD);
+        auto messages = ConvertAndDemodulate(converter_, demodulator_, samples, regions_, phase_);
+        if (!messages.empty()) {
+            dispatch = BuildMessages(converter_, messages, samples, phase_.cbegin(), block, previous_samples, RawTimestamps(), demodulator_.SamplesPerBit());
+        }
+    }
 
-            auto begin_sample = samples_.begin() + std::distance(phase_.cbegin(), message.begin) * converter_->BytesPerSample();
-            auto end_sample = samples_.begin() + std::distance(phase_.cbegin(), message.end) * converter_->BytesPerSample();
+    if (dispatch) {
+        DispatchMessages(dispatch);
+    }
+}
 
-            converter_->ConvertMagSq(begin_sample, end_sample, magsq.begin());
+template <class DemodulatorType> static SingleThreadReceiver::Pointer CreateSingleThreadReceiver(SampleFormat format) {
+    switch (format) {
+    case SampleFormat::CU8:
+        return std::make_shared<SpecializedSingleThreadReceiver<CU8Converter, DemodulatorType>>();
+    case SampleFormat::CS8_:
+        return std::make_shared<SpecializedSingleThreadReceiver<CS8Converter, DemodulatorType>>();
+    case SampleFormat::CS16H:
+        return std::make_shared<SpecializedSingleThreadReceiver<CS16HConverter, DemodulatorType>>(ConvertKernels::Selected());
+    case SampleFormat::CF32H:
+        return std::make_shared<SpecializedSingleThreadReceiver<CF32HConverter, DemodulatorType>>(ConvertKernels::Selected());
+    default:
+        throw std::runtime_error("format not implemented yet");
+    }
+}
 
-            auto total_power = 0.0;
-            for (auto m : magsq) {
-                total_power += m;
-            }
+SingleThreadReceiver::Pointer SingleThreadReceiver::Create(SampleFormat format, unsigned samples_per_bit) {
+    switch (samples_per_bit) {
+    case 2:
+        return CreateSingleThreadReceiver<TwoMegDemodulator>(format);
+    case 4:
+        return CreateSingleThreadReceiver<FourMegDemodulator>(format);
+    default:
+        throw std::invalid_argument("unsupported samples per bit: " + std::to_string(samples_per_bit));
+    }
+}
 
-            auto rssi = (total_power == 0 ? -1000 : 10 * std::log10(total_power / magsq.size()));
-            std::uint64_t message_timestamp = timestamp - (1000 * previous_samples / 2083333) + (1000 * std::distance(phase_.cbegin(), message.begin) / 2083333);
+//
+// PipelinedReceiver
+//
 
-            dispatch->emplace_back(std::move(message.payload), message_timestamp, message.corrected_errors, rssi);
+PipelinedReceiver::PipelinedReceiver(SampleFormat format, bool drop_when_full, std::size_t queue_depth, unsigned samples_per_bit)
+    : converter_(SampleConverter::Create(format)), demodulator_(Demodulator::Create(samples_per_bit)), drop_when_full_(drop_when_full), conversion_queue_(queue_depth), demod_queue_(queue_depth), dispatch_queue_(queue_depth), free_demod_work_(queue_depth), dropped_blocks_(0) {}
+
+PipelinedReceiver::~PipelinedReceiver() {
+    Stop();
+
+    // Our threads hold references, so we are only destroyed once they have
+    // all left their loops; if that is on one of them, as it drops the
+    // last reference on the way out, it cannot join itself
+    for (auto t : {&conversion_thread_, &demod_thread_, &dispatch_thread_}) {
+        if (t->joinable()) {
+            t->detach();
         }
+    }
+}
 
-        DispatchMessages(dispatch);
+void PipelinedReceiver::Start() {
+    if (running_) {
+        return;
     }
 
-    // preserve the tail of the sample buffer for next time
-    const auto tail_size = demodulator_->NumTrailingSamples();
-    if (total_samples > tail_size) {
-        std::copy(samples_.end() - tail_size * converter_->BytesPerSample(), samples_.end(), samples_.begin());
-        saved_samples_ = tail_size;
+    // threads left by a Stop() that one of them called have finished, or
+    // will once they return from it
+    JoinThreads();
+
+    running_ = true;
+    conversion_queue_.Reopen();
+    demod_queue_.Reopen();
+    dispatch_queue_.Reopen();
+    free_demod_work_.Reopen();
+    last_depth_report_ = std::chrono::steady_clock::now();
+
+    // each thread keeps us alive until it exits, so a callback that drops
+    // the last outside reference cannot destroy the queues under them
+    auto self(shared_from_this());
+    conversion_thread_ = std::thread([this, self]() { ConversionThread(); });
+    demod_thread_ = std::thread([this, self]() { DemodThread(); });
+    dispatch_thread_ = std::thread([this, self]() { DispatchThread(); });
+}
+
+void PipelinedReceiver::Stop() {
+    running_ = false;
+
+    // closing the queues discards any pending work and
+    // wakes up any stage that is waiting on a queue
+    conversion_queue_.Close();
+    demod_queue_.Close();
+    dispatch_queue_.Close();
+    free_demod_work_.Close();
+
+    JoinThreads();
+}
+
+void PipelinedReceiver::JoinThreads() {
+    for (auto t : {&conversion_thread_, &demod_thread_, &dispatch_thread_}) {
+        // When Stop() is called from one of our own threads (e.g. from an
+        // error handler) that thread is left joinable, to be joined by the
+        // next Start() or by the destructor
+        if (t->joinable() && t->get_id() != std::this_thread::get_id()) {
+            t->join();
+        }
+    }
+}
+
+void PipelinedReceiver::HandleSamples(const SampleBlock &block) {
+    DUMP978_TRACE(SAMPLE_BLOCK, block.size / converter_->BytesPerSample(), block.timestamp, block.sample_index);
+
+    ConversionWork work;
+    work.block = block;
+
+    if (drop_when_full_) {
+        if (!conversion_queue_.TryPush(std::move(work))) {
+            ++dropped_blocks_;
+        }
     } else {
-        saved_samples_ = total_samples;
+        conversion_queue_.Push(std::move(work));
     }
+
+    MaybeReportDepths();
 }
 
-static inline std::int16_t PhaseDifference(std::uint16_t from, std::uint16_t to) {
-    int32_t difference = to - from; // lies in the range -65535 .. +65535
-    if (difference >= 32768)        //   +32768..+65535
-        return difference - 65536;  //   -> -32768..-1: always in range
-    else if (difference < -32768)   //   -65535..-32769
-        return difference + 65536;  //   -> +1..32767: always in range
-    else
-        return difference;
+void PipelinedReceiver::HandleError(const boost::system::error_code &ec) {
+    ConversionWork work;
+    work.error = ec;
+    conversion_queue_.Push(std::move(work));
 }
 
-static inline bool SyncWordMatch(std::uint64_t word, std::uint64_t expected) {
-    std::uint64_t diff;
+void PipelinedReceiver::MaybeReportDepths() {
+    const auto report_interval = std::chrono::milliseconds(15000);
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_depth_report_ < report_interval) {
+        return;
+    }
 
-    if (word == expected)
-        return 1;
+    last_depth_report_ = now;
 
-    diff = word ^ expected; // guaranteed nonzero
+    // Only log when the pipeline is under pressure
+    const std::uint64_t dropped = dropped_blocks_;
+    auto conversion = ConversionQueueDepth();
+    auto demod = DemodQueueDepth();
+    auto dispatch = DispatchQueueDepth();
+    if (dropped != reported_dropped_blocks_ || conversion.peak * 2 > conversion.capacity || demod.peak * 2 > demod.capacity || dispatch.peak * 2 > dispatch.capacity) {
+        std::cerr << "Receiver pipeline: peak queue depths conversion " << conversion.peak << "/" << conversion.capacity << ", demodulation " << demod.peak << "/" << demod.capacity << ", dispatch " << dispatch.peak << "/" << dispatch.capacity << "; " << (dropped - reported_dropped_blocks_) << " sample blocks dropped" << std::endl;
+    }
 
-    // This is a bit-twiddling popcount
-    // hack, tweaked as we only care about
-    // "<N" or ">=N" set bits for fixed N -
-    // so we can bail out early after seeing N
-    // set bits.
-    //
-    // It relies on starting with a nonzero value
-    // with zero or more trailing clear bits
-    // after the last set bit:
-    //
-    //    010101010101010000
-    //                 ^
-    // Subtracting one, will flip the
-    // bits starting at the last set bit:
-    //
-    //    010101010101001111
-    //                 ^
-    // then we can use that as a bitwise-and
-    // mask to clear the lowest set bit:
-    //
-    //    010101010101000000
-    //                 ^
-    // And repeat until the value is zero
-    // or we have seen too many set bits.
+    reported_dropped_blocks_ = dropped;
+    conversion_queue_.ResetPeak();
+    demod_queue_.ResetPeak();
+    dispatch_queue_.ResetPeak();
+}
+
+void PipelinedReceiver::ConversionThread() {
+    ApplyThreadPlacement(ThreadRole::DEMOD, "978-convert");
+
+    const auto bytes_per_sample = converter_->BytesPerSample();
+    const auto tail_size = demodulator_->NumTrailingSamples();
+
+    ConversionWork in;
+    while (conversion_queue_.Pop(in)) {
+        DemodWork out;
+        free_demod_work_.TryPop(out); // reuse old buffers if we can
 
-    // >= 1 bit
-    diff &= (diff - 1); // clear lowest set bit
-    if (!diff)
-        return 1; // 1 bit error
+        if (in.error) {
+            out.error = in.error;
+            out.total_samples = 0;
+            demod_queue_.Push(std::move(out));
+            continue;
+        }
 
-    // >= 2 bits
-    diff &= (diff - 1); // clear lowest set bit
-    if (!diff)
-        return 1; // 2 bits error
+        // the block's history provides the overlap with the previous block
+        const auto previous_samples = std::min<std::size_t>(in.block.history / bytes_per_sample, tail_size);
+        const auto total_samples = previous_samples + in.block.size / bytes_per_sample;
 
-    // >= 3 bits
-    diff &= (diff - 1); // clear lowest set bit
-    if (!diff)
-        return 1; // 3 bits error
+        out.error = {};
+        out.previous_samples = previous_samples;
+        out.total_samples = total_samples;
+        out.samples = in.block.data - previous_samples * bytes_per_sample;
+        out.block = std::move(in.block);
+        in.block = SampleBlock();
 
-    // >= 4 bits
-    diff &= (diff - 1); // clear lowest set bit
-    if (!diff)
-        return 1; // 4 bits error
+        if (out.phase.size() < total_samples) {
+            out.phase.resize(total_samples);
+        }
+        {
+            stats::StageTimer timer(stats::Stage::CONVERT);
+            FindRegions(*converter_, out.samples, total_samples, out.regions);
+            ConvertRegions(*converter_, out.samples, out.regions, out.phase);
+        }
 
-    // > 4 bits in error, give up
-    return 0;
+        if (!demod_queue_.Push(std::move(out))) {
+            return;
+        }
+    }
+}
+
+void PipelinedReceiver::DemodThread() {
+    ApplyThreadPlacement(ThreadRole::DEMOD, "978-demod");
+
+    DemodWork in;
+    while (demod_queue_.Pop(in)) {
+        DispatchWork out;
+        if (in.error) {
+            out.error = in.error;
+        } else {
+            stats::StageTimer timer(stats::Stage::DEMOD);
+            auto messages = DemodulateRegions(*demodulator_, in.phase, in.regions);
+            if (!messages.empty()) {
+                out.messages = BuildMessages(*converter_, messages, in.samples, in.phase.cbegin(), in.block, in.previous_samples, RawTimestamps(), demodulator_->SamplesPerBit());
+            }
+        }
+
+        // release the sample data now, but keep the phase buffer for reuse
+        in.samples = nullptr;
+        in.block = SampleBlock();
+        free_demod_work_.TryPush(std::move(in));
+        in = DemodWork();
+
+        if (!out.messages && !out.error) {
+            continue;
+        }
+
+        if (!dispatch_queue_.Push(std::move(out))) {
+            return;
+        }
+    }
+}
+
+void PipelinedReceiver::DispatchThread() {
+    ApplyThreadPlacement(ThreadRole::IO, "978-dispatch");
+
+    DispatchWork work;
+    while (dispatch_queue_.Pop(work)) {
+        if (work.messages) {
+            DispatchMessages(work.messages);
+        }
+        if (work.error) {
+            DispatchError(work.error);
+        }
+    }
+}
+
+//
+// ParallelFileReceiver
+//
+
+ParallelFileReceiver::ParallelFileReceiver(SampleFormat format, MappedFile::Pointer file, unsigned threads, std::size_t samples_per_block) : format_(format), file_(file), threads_(std::max(1U, threads)), bytes_per_sample_(BytesPerSample(format)), samples_per_block_(samples_per_block) {
+    trailing_samples_ = TwoMegDemodulator().NumTrailingSamples();
+    const std::size_t total_samples = file_->Size() / bytes_per_sample_;
+    total_blocks_ = (total_samples + samples_per_block_ - 1) / samples_per_block_;
+}
+
+ParallelFileReceiver::~ParallelFileReceiver() {
+    Stop();
+
+    // As for PipelinedReceiver: our threads hold references, so we are
+    // only destroyed once they have all finished, possibly by the last of
+    // them on its way out, which cannot join itself
+    for (auto &t : workers_) {
+        t.detach(); // only a calling thread is left by Stop()
+    }
+    if (merge_thread_.joinable()) {
+        merge_thread_.detach();
+    }
+}
+
+void ParallelFileReceiver::Start() {
+    if (running_) {
+        return;
+    }
+
+    // threads left by a Stop() that one of them called have finished, or
+    // will once they return from it
+    JoinThreads();
+
+    running_ = true;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = false;
+        next_block_ = next_dispatch_ = 0;
+        results_.clear();
+    }
+
+    // each thread keeps us alive until it exits, so a callback that drops
+    // the last outside reference cannot destroy the receiver under them
+    auto self(shared_from_this());
+    for (unsigned i = 0; i < threads_; ++i) {
+        workers_.emplace_back([this, self]() { WorkerThread(); });
+    }
+    merge_thread_ = std::thread([this, self]() { MergeThread(); });
+}
+
+void ParallelFileReceiver::Stop() {
+    running_ = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+
+    JoinThreads();
+}
+
+void ParallelFileReceiver::JoinThreads() {
+    std::vector<std::thread *> threads;
+    for (auto &t : workers_) {
+        threads.push_back(&t);
+    }
+    threads.push_back(&merge_thread_);
+
+    for (auto t : threads) {
+        // When Stop() is called from one of our own threads (e.g. the merge
+        // thread, from an error handler) that thread is left joinable, to
+        // be joined by the next Start() or by the destructor
+        if (t->joinable() && t->get_id() != std::this_thread::get_id()) {
+            t->join();
+        }
+    }
+    workers_.erase(std::remove_if(workers_.begin(), workers_.end(), [](const std::thread &t) { return !t.joinable(); }), workers_.end());
+}
+
+void ParallelFileReceiver::WorkerThread() {
+    ApplyThreadPlacement(ThreadRole::DEMOD, "978-demod");
+
+    auto converter = SampleConverter::Create(format_);
+    TwoMegDemodulator demodulator;
+    if (soft_decision_budget_ >= 0) {
+        demodulator.EnableSoftDecision(soft_decision_budget_);
+    }
+    PhaseBuffer phase;
+
+    const std::size_t total_samples = file_->Size() / bytes_per_sample_;
+
+    for (;;) {
+        std::size_t block;
+        {
+            // don't run too far ahead of the merge thread, so that the
+            // results waiting to be dispatched stay bounded
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return stopping_ || next_block_ >= total_blocks_ || next_block_ < next_dispatch_ + threads_ * 4; });
+            if (stopping_ || next_block_ >= total_blocks_) {
+                return;
+            }
+            block = next_block_++;
+        }
+
+        // each block starts with the trailing samples of the previous block
+        // as its overlap, exactly as a SampleSource's history would provide
+        const std::size_t first = block * samples_per_block_;
+        const std::size_t previous_samples = std::min(first, trailing_samples_);
+        const std::size_t count = previous_samples + std::min(samples_per_block_, total_samples - first);
+        const std::uint8_t *samples = file_->Data() + (first - previous_samples) * bytes_per_sample_;
+
+        // what FileSampleSource would have delivered for this block
+        SampleBlock origin;
+        origin.sample_index = first;
+        origin.timestamp = BlockTimestamp(block);
+        origin.received = std::chrono::steady_clock::now();
+
+        if (phase.size() < count) {
+            phase.resize(count);
+        }
+        {
+            stats::StageTimer timer(stats::Stage::CONVERT);
+            stats::Add(stats::Counter::SAMPLES, count);
+            converter->ConvertPhase(samples, samples + count * bytes_per_sample_, phase.begin());
+        }
+
+        SharedMessageVector result;
+        {
+            stats::StageTimer timer(stats::Stage::DEMOD);
+            auto messages = demodulator.Demodulate(phase.cbegin(), phase.cbegin() + count);
+            if (!messages.empty()) {
+                result = BuildMessages(*converter, messages, samples, phase.cbegin(), origin, previous_samples, raw_timestamps_, demodulator.SamplesPerBit());
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            results_[block] = std::move(result);
+        }
+        cond_.notify_all();
+    }
+}
+
+// Remove messages from the overlap at the start of `messages` (those received
+// before `block_start`) that were already delivered from the previous block.
+// The demodulator does not search the trailing samples of a block, so this
+// should not normally find anything; it guards the "exactly once" guarantee
+// at block borders.
+static void RemoveDuplicates(const MessageVector &previous, MessageVector &messages, std::uint64_t block_start) {
+    auto is_duplicate = [&previous, block_start](const RawMessage &message) {
+        if (message.ReceivedAt() >= block_start) {
+            return false;
+        }
+        for (auto i = previous.rbegin(); i != previous.rend(); ++i) {
+            if (i->ReceivedAt() + 1 < message.ReceivedAt()) {
+                break;
+            }
+            if (i->Type() == message.Type() && i->ReceivedAt() <= message.ReceivedAt() + 1 && i->Payload() == message.Payload()) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    messages.erase(std::remove_if(messages.begin(), messages.end(), is_duplicate), messages.end());
+}
+
+void ParallelFileReceiver::MergeThread() {
+    ApplyThreadPlacement(ThreadRole::IO, "978-merge");
+
+    SharedMessageVector previous;
+
+    for (;;) {
+        SharedMessageVector messages;
+        std::size_t block;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return stopping_ || next_dispatch_ >= total_blocks_ || results_.count(next_dispatch_); });
+            if (stopping_) {
+                return;
+            }
+            if (next_dispatch_ >= total_blocks_) {
+                break;
+            }
+
+            block = next_dispatch_++;
+            auto i = results_.find(block);
+            messages = std::move(i->second);
+            results_.erase(i);
+        }
+        cond_.notify_all();
+
+        if (messages && previous) {
+            RemoveDuplicates(*previous, *messages, BlockTimestamp(block));
+        }
+        if (messages && !messages->empty()) {
+            DispatchMessages(messages);
+        }
+        previous = messages;
+    }
+
+    DispatchError(boost::asio::error::eof);
+}
+
+static inline std::int16_t PhaseDifference(std::uint16_t from, std::uint16_t to) {
+    int32_t difference = to - from; // lies in the range -65535 .. +65535
+    if (difference >= 32768)        //   +32768..+65535
+        return difference - 65536;  //   -> -32768..-1: always in range
+    else if (difference < -32768)   //   -65535..-32769
+        return difference + 65536;  //   -> +1..32767: always in range
+    else
+        return difference;
 }
 
 #ifdef AUTO_CENTER
@@ -197,16 +689,13 @@ static inline std::pair<bool, std::int16_t> CheckSyncWord(PhaseBuffer::const_ite
 }
 #endif
 
-// demodulate 'bytes' bytes from samples at 'phase' using 'center' as the bit
-// slicing threshold
-static inline std::pair<Bytes, std::vector<std::size_t>> DemodBits(PhaseBuffer::const_iterator phase, unsigned bytes, std::int16_t zero_slice, std::int16_t one_slice) {
-    std::pair<Bytes, std::vector<std::size_t>> result_pair;
-    auto &result = result_pair.first;
-    auto &erasures = result_pair.second;
+// demodulate N bytes from samples at 'phase' into 'result', using
+// 'zero_slice' and 'one_slice' as the bit slicing thresholds; bytes with any
+// bits between the thresholds are added to 'erasures'
+template <std::size_t N, std::size_t E> static inline void DemodBits(PhaseBuffer::const_iterator phase, std::array<std::uint8_t, N> &result, ErasureList<E> &erasures, std::int16_t zero_slice, std::int16_t one_slice) {
+    erasures.clear();
 
-    result.reserve(bytes);
-
-    for (unsigned i = 0; i < bytes; ++i) {
+    for (unsigned i = 0; i < N; ++i) {
         std::uint8_t b = 0;
         bool erasure = false;
         if (PhaseDifference(phase[0], phase[1]) > one_slice)
@@ -241,13 +730,22 @@ static inline std::pair<Bytes, std::vector<std::size_t>> DemodBits(PhaseBuffer::
             b |= 0x01;
         else if (PhaseDifference(phase[14], phase[15]) > zero_slice)
             erasure = true;
-        result.push_back(b);
+        result[i] = b;
         if (erasure)
             erasures.push_back(i);
         phase += 16;
     }
+}
 
-    return result_pair;
+std::unique_ptr<Demodulator> Demodulator::Create(unsigned samples_per_bit) {
+    switch (samples_per_bit) {
+    case 2:
+        return std::unique_ptr<Demodulator>(new TwoMegDemodulator());
+    case 4:
+        return std::unique_ptr<Demodulator>(new FourMegDemodulator());
+    default:
+        throw std::invalid_argument("unsupported samples per bit: " + std::to_string(samples_per_bit));
+    }
 }
 
 unsigned TwoMegDemodulator::NumTrailingSamples() { return (SYNC_BITS + UPLINK_BITS) * 2; }
@@ -259,16 +757,21 @@ unsigned TwoMegDemodulator::NumTrailingSamples() { return (SYNC_BITS + UPLINK_BI
 std::vector<Demodulator::Message> TwoMegDemodulator::Demodulate(PhaseBuffer::const_iterator begin, PhaseBuffer::const_iterator end) {
     // We expect samples at twice the UAT bitrate.
     // We look at phase difference between pairs of adjacent samples, i.e.
-    //  sample 1 - sample 0   -> sync0
-    //  sample 2 - sample 1   -> sync1
-    //  sample 3 - sample 2   -> sync0
-    //  sample 4 - sample 3   -> sync1
+    //  sample 1 - sample 0   -> even bit 0
+    //  sample 2 - sample 1   -> odd bit 0
+    //  sample 3 - sample 2   -> even bit 1
+    //  sample 4 - sample 3   -> odd bit 1
     // ...
     //
-    // We accumulate bits into two buffers, sync0 and sync1.
-    // Then we compare those buffers to the expected 36-bit sync word that
-    // should be at the start of each UAT frame. When (if) we find it,
-    // that tells us which sample to start decoding from.
+    // SyncSearch slices the whole buffer into those two bit streams at once
+    // and finds the offsets where either stream has something close to the
+    // expected 36-bit sync word that should be at the start of each UAT
+    // frame. When (if) we find it, that tells us which sample to start
+    // decoding from.
+    //
+    // Candidates are visited in pairs of adjacent offsets, in the same
+    // order that a sample-by-sample search would see them, and searching
+    // resumes at the end of each message that is successfully decoded.
 
     // Stop when we run out of remaining samples for a max-sized frame.
     // Arrange for our caller to pass the trailing data back to us next time;
@@ -282,142 +785,366 @@ std::vector<Demodulator::Message> TwoMegDemodulator::Demodulate(PhaseBuffer::con
         return messages;
     }
 
-    const auto limit = end - trailing_samples;
-
-    unsigned sync_bits = 0;
-    std::uint64_t sync0 = 0, sync1 = 0;
-    const std::uint64_t SYNC_MASK = ((((std::uint64_t)1) << SYNC_BITS) - 1);
+    // sync words may start at offsets 0 .. last_pair (inclusive)
+    const std::size_t limit = std::distance(begin, end) - trailing_samples;
+    if (limit <= (SYNC_BITS - 1) * 2) {
+        return messages;
+    }
+    const std::size_t last_pair = limit - (SYNC_BITS - 1) * 2;
 
-    for (auto probe = begin; probe < limit; probe += 2) {
-        auto d0 = PhaseDifference(probe[0], probe[1]);
-        auto d1 = PhaseDifference(probe[1], probe[2]);
+    AddSoftBudget(std::distance(begin, end));
+    sync_search_.Prepare(&begin[0], last_pair + SYNC_BITS * 2 + 1);
+    return DemodulateCandidates(begin, last_pair, [](std::size_t) {});
+}
 
-        sync0 = ((sync0 << 1) | (d0 > 0 ? 1 : 0)) & SYNC_MASK;
-        sync1 = ((sync1 << 1) | (d1 > 0 ? 1 : 0)) & SYNC_MASK;
+template <class BeforeCandidate> std::vector<Demodulator::Message> TwoMegDemodulator::DemodulateCandidates(PhaseBuffer::const_iterator begin, std::size_t last_pair, BeforeCandidate before_candidate) {
+    std::vector<Demodulator::Message> messages;
 
-        if (++sync_bits < SYNC_BITS)
-            continue; // haven't fully populated sync0/1 yet
+    std::size_t offset = 0;
+    while ((offset = sync_search_.NextCandidatePair(offset, last_pair)) < last_pair) {
+        before_candidate(offset);
 
-        // see if we have (the start of) a valid sync word
         // when we find a match, try to demodulate both with that match
         // and with the next position, and pick the one with fewer
         // errors.
-        if (SyncWordMatch(sync0, DOWNLINK_SYNC_WORD)) {
-            auto start = probe - SYNC_BITS * 2 + 2;
-            auto message = DemodBest(start, true /* downlink */);
-            if (message) {
-                probe = message->end - 2;
-                sync_bits = 0;
-                messages.emplace_back(std::move(message.value()));
-                continue;
-            }
+        boost::optional<Message> message;
+        if (sync_search_.Match(offset, DOWNLINK_SYNC_WORD))
+            message = DemodBest(begin + offset, true /* downlink */);
+        if (!message && sync_search_.Match(offset + 1, DOWNLINK_SYNC_WORD))
+            message = DemodBest(begin + offset + 1, true /* downlink */);
+        if (!message && sync_search_.Match(offset, UPLINK_SYNC_WORD))
+            message = DemodBest(begin + offset, false /* !downlink */);
+        if (!message && sync_search_.Match(offset + 1, UPLINK_SYNC_WORD))
+            message = DemodBest(begin + offset + 1, false /* !downlink */);
+
+        if (message) {
+            offset = std::distance(begin, message->end);
+            messages.emplace_back(std::move(message.value()));
+        } else {
+            offset += 2;
         }
+    }
 
-        if (SyncWordMatch(sync1, DOWNLINK_SYNC_WORD)) {
-            auto start = probe - SYNC_BITS * 2 + 3;
-            auto message = DemodBest(start, true /* downlink */);
-            if (message) {
-                probe = message->end - 2;
-                sync_bits = 0;
-                messages.emplace_back(std::move(message.value()));
-                continue;
-            }
+    return messages;
+}
+
+// The same search as Demodulate(), but the phase data for the sync search is
+// converted a tile at a time into tile_, which stays in cache, and sliced
+// from there; the whole-buffer phase data is never written or read back.
+// Only the frames around candidates are converted into `phase`, once each,
+// so memory traffic is little more than one read of the raw samples.
+template <class ConverterType> std::vector<Demodulator::Message> TwoMegDemodulator::DemodulateSamples(ConverterType &converter, const std::uint8_t *samples, std::size_t count, PhaseBuffer::iterator phase) {
+    const int trailing_samples = (SYNC_BITS + UPLINK_BITS) * 2;
+    if (count < static_cast<std::size_t>(trailing_samples)) {
+        return {};
+    }
+
+    const std::size_t limit = count - trailing_samples;
+    if (limit <= (SYNC_BITS - 1) * 2) {
+        return {};
+    }
+    const std::size_t last_pair = limit - (SYNC_BITS - 1) * 2;
+
+    AddSoftBudget(count);
+    const auto bytes_per_sample = converter.BytesPerSample();
+    static_assert(TILE_SAMPLES % (2 * SyncSearch::TILE_ALIGNMENT) == 0, "tiles must be aligned for SyncSearch");
+
+    // each tile holds one extra sample, the end of the last odd pair
+    tile_.resize(TILE_SAMPLES + 1);
+    sync_search_.Begin(last_pair + SYNC_BITS * 2 + 1);
+    const std::size_t pairs = sync_search_.Pairs();
+    for (std::size_t first = 0; first < pairs; first += TILE_SAMPLES / 2) {
+        const std::size_t tile_pairs = std::min<std::size_t>(TILE_SAMPLES / 2, pairs - first);
+        const std::uint8_t *tile_samples = samples + first * 2 * bytes_per_sample;
+        converter.ConvertPhase(tile_samples, tile_samples + (tile_pairs * 2 + 1) * bytes_per_sample, tile_.begin());
+        sync_search_.SliceTile(tile_.data(), first, tile_pairs);
+    }
+    sync_search_.Finish();
+
+    // Convert the samples that DemodBest may read for a candidate at
+    // `offset`: both timings of the longest frame. Candidates arrive in
+    // increasing order, so each sample is converted at most once.
+    const std::size_t frame_samples = (SYNC_BITS + UPLINK_BITS) * 2 + 2;
+    std::size_t converted = 0;
+    auto convert_frame = [&](std::size_t offset) {
+        const std::size_t from = std::max(offset, converted);
+        const std::size_t to = std::min(offset + frame_samples, count);
+        if (from < to) {
+            converter.ConvertPhase(samples + from * bytes_per_sample, samples + to * bytes_per_sample, phase + from);
+            converted = to;
         }
+    };
 
-        if (SyncWordMatch(sync0, UPLINK_SYNC_WORD)) {
-            auto start = probe - SYNC_BITS * 2 + 2;
-            auto message = DemodBest(start, false /* !downlink */);
-            if (message) {
-                probe = message->end - 2;
-                sync_bits = 0;
-                messages.emplace_back(std::move(message.value()));
-                continue;
-            }
+    return DemodulateCandidates(phase, last_pair, convert_frame);
+}
+
+template std::vector<Demodulator::Message> TwoMegDemodulator::DemodulateSamples(CU8Converter &, const std::uint8_t *, std::size_t, PhaseBuffer::iterator);
+template std::vector<Demodulator::Message> TwoMegDemodulator::DemodulateSamples(CS8Converter &, const std::uint8_t *, std::size_t, PhaseBuffer::iterator);
+template std::vector<Demodulator::Message> TwoMegDemodulator::DemodulateSamples(CS16HConverter &, const std::uint8_t *, std::size_t, PhaseBuffer::iterator);
+template std::vector<Demodulator::Message> TwoMegDemodulator::DemodulateSamples(CF32HConverter &, const std::uint8_t *, std::size_t, PhaseBuffer::iterator);
+template std::vector<Demodulator::Message> TwoMegDemodulator::DemodulateSamples(SampleConverter &, const std::uint8_t *, std::size_t, PhaseBuffer::iterator);
+
+std::vector<Demodulator::Message> FourMegDemodulator::Demodulate(PhaseBuffer::const_iterator begin, PhaseBuffer::const_iterator end) {
+    // Phase samples 0, 2, 4, .. and 1, 3, 5, .. are each a stream at twice
+    // the bitrate, a quarter of a bit apart
+    const std::size_t n = std::distance(begin, end);
+    std::vector<Demodulator::Message> messages;
+    for (unsigned s = 0; s < 2; ++s) {
+        auto &split = streams_[s];
+        split.resize(n / 2);
+        for (std::size_t i = 0; i < split.size(); ++i) {
+            split[i] = begin[i * 2 + s];
+        }
+
+        for (auto &m : two_meg_.Demodulate(split.cbegin(), split.cend())) {
+            m.begin = begin + 2 * std::distance(split.cbegin(), m.begin) + s;
+            m.end = begin + 2 * std::distance(split.cbegin(), m.end) + s;
+            messages.emplace_back(std::move(m));
         }
+    }
 
-        if (SyncWordMatch(sync1, UPLINK_SYNC_WORD)) {
-            auto start = probe - SYNC_BITS * 2 + 3;
-            auto message = DemodBest(start, false /* !downlink */);
-            if (message) {
-                probe = message->end - 2;
-                sync_bits = 0;
-                messages.emplace_back(std::move(message.value()));
-                continue;
+    // the same message is usually found in both streams; keep the better copy
+    std::sort(messages.begin(), messages.end(), [](const Message &a, const Message &b) { return a.begin < b.begin; });
+    std::vector<Demodulator::Message> merged;
+    for (auto &m : messages) {
+        if (!merged.empty() && m.begin < merged.back().end) {
+            if (m.corrected_errors < merged.back().corrected_errors) {
+                merged.back() = std::move(m);
             }
+        } else {
+            merged.emplace_back(std::move(m));
         }
     }
 
-    return messages;
+    return merged;
 }
 
+// Demodulate at `start` and at `start + 1`, and return the one with fewer
+// errors. Only the chosen message is copied out of the fixed buffers, so sync
+// matches that fail error correction never allocate.
 boost::optional<Demodulator::Message> TwoMegDemodulator::DemodBest(PhaseBuffer::const_iterator start, bool downlink) {
-    auto message0 = downlink ? DemodOneDownlink(start) : DemodOneUplink(start);
-    auto message1 = downlink ? DemodOneDownlink(start + 1) : DemodOneUplink(start + 1);
+    stats::Add(stats::Counter::SYNC_CANDIDATES);
+    DUMP978_TRACE(SYNC_CANDIDATE, downlink ? 1 : 0, 0, 0);
+    if (downlink) {
+        bool ok0 = DemodOneDownlink(start, downlink_[0]);
+        bool ok1 = DemodOneDownlink(start + 1, downlink_[1]);
+
+        if (!ok0 && !ok1 && soft_decision_) {
+            ok0 = SoftRetryDownlink(start, downlink_[0]);
+            ok1 = !ok0 && SoftRetryDownlink(start + 1, downlink_[1]);
+        }
 
-    if (!message0 && !message1)
-        return boost::none;
+        if (!ok0 && !ok1)
+            return boost::none;
 
-    unsigned errors0 = (message0 ? message0->corrected_errors : 9999);
-    unsigned errors1 = (message1 ? message1->corrected_errors : 9999);
+        unsigned errors0 = (ok0 ? downlink_[0].errors : 9999);
+        unsigned errors1 = (ok1 ? downlink_[1].errors : 9999);
+        unsigned best = (errors0 <= errors1 ? 0 : 1);
 
-    if (errors0 <= errors1)
-        return message0; // should be move-eligible
-    else
-        return message1; // should be move-eligible
+        const auto &attempt = downlink_[best];
+        auto bits = (attempt.data_bytes == DOWNLINK_LONG_DATA_BYTES ? DOWNLINK_LONG_BITS : DOWNLINK_SHORT_BITS);
+        auto message_start = start + best;
+        return Demodulator::Message{MessagePayload(attempt.data.begin(), attempt.data.begin() + attempt.data_bytes), attempt.errors, message_start, message_start + (SYNC_BITS + bits) * 2};
+    } else {
+        bool ok0 = DemodOneUplink(start, uplink_[0]);
+        bool ok1 = DemodOneUplink(start + 1, uplink_[1]);
+
+        if (!ok0 && !ok1 && soft_decision_) {
+            ok0 = SoftRetryUplink(start, uplink_[0]);
+            ok1 = !ok0 && SoftRetryUplink(start + 1, uplink_[1]);
+        }
+
+        if (!ok0 && !ok1)
+            return boost::none;
+
+        unsigned errors0 = (ok0 ? uplink_[0].errors : 9999);
+        unsigned errors1 = (ok1 ? uplink_[1].errors : 9999);
+        unsigned best = (errors0 <= errors1 ? 0 : 1);
+
+        const auto &attempt = uplink_[best];
+        auto message_start = start + best;
+        return Demodulator::Message{MessagePayload(attempt.data.begin(), attempt.data.end()), attempt.errors, message_start, message_start + (SYNC_BITS + UPLINK_BITS) * 2};
+    }
 }
 
-boost::optional<Demodulator::Message> TwoMegDemodulator::DemodOneDownlink(PhaseBuffer::const_iterator start) {
+bool TwoMegDemodulator::DemodOneDownlink(PhaseBuffer::const_iterator start, DownlinkAttempt &attempt) {
 #ifdef AUTO_CENTER
     auto sync = CheckSyncWord(start, DOWNLINK_SYNC_WORD);
     if (!sync.first) {
         // Sync word had errors
-        return boost::none;
+        return false;
     }
 
-    auto result = DemodBits(start + SYNC_BITS * 2, DOWNLINK_LONG_BYTES, sync.second, sync.second);
+    DemodBits(start + SYNC_BITS * 2, attempt.data, attempt.erasures, sync.second, sync.second);
 #else
-    auto result = DemodBits(start + SYNC_BITS * 2, DOWNLINK_LONG_BYTES, 0, 0);
+    DemodBits(start + SYNC_BITS * 2, attempt.data, attempt.erasures, 0, 0);
 #endif
-    auto &raw = result.first;
-    auto &erasures = result.second;
 
+    const auto fec_start = std::chrono::steady_clock::now();
     bool success;
-    Bytes corrected;
-    unsigned errors;
-    std::tie(success, corrected, errors) = fec_.CorrectDownlink(raw, erasures);
-    if (!success) {
-        // Error correction failed
-        return boost::none;
+    std::tie(success, attempt.data_bytes, attempt.errors) = fec_.CorrectDownlink(attempt.data, attempt.erasures);
+    const auto fec_elapsed = std::chrono::steady_clock::now() - fec_start;
+    stats::Record(stats::Stage::FEC, fec_elapsed);
+    DUMP978_TRACE(DOWNLINK_FEC, success ? 1 : 0, success ? attempt.errors : 0, std::chrono::duration_cast<std::chrono::nanoseconds>(fec_elapsed).count());
+    stats::Add(stats::Counter::DOWNLINK_FEC_ATTEMPTS);
+    if (success) {
+        stats::Add(stats::Counter::DOWNLINK_FEC_SUCCESSES);
     }
-
-    auto bits = (corrected.size() == DOWNLINK_LONG_DATA_BYTES ? DOWNLINK_LONG_BITS : DOWNLINK_SHORT_BITS);
-    return Demodulator::Message{std::move(corrected), errors, start, start + (SYNC_BITS + bits) * 2};
+    return success;
 }
 
-boost::optional<Demodulator::Message> TwoMegDemodulator::DemodOneUplink(PhaseBuffer::const_iterator start) {
+bool TwoMegDemodulator::DemodOneUplink(PhaseBuffer::const_iterator start, UplinkAttempt &attempt) {
 #ifdef AUTO_CENTER
     auto sync = CheckSyncWord(start, UPLINK_SYNC_WORD);
     if (!sync.first) {
         // Sync word had errors
-        return boost::none;
+        return false;
     }
 
-    auto result = DemodBits(start + SYNC_BITS * 2, UPLINK_BYTES, sync.second, sync.second);
+    DemodBits(start + SYNC_BITS * 2, attempt.raw, attempt.erasures, sync.second, sync.second);
 #else
-    auto result = DemodBits(start + SYNC_BITS * 2, UPLINK_BYTES, 0, 0);
+    DemodBits(start + SYNC_BITS * 2, attempt.raw, attempt.erasures, 0, 0);
 #endif
-    auto &raw = result.first;
-    auto &erasures = result.second;
 
+    const auto fec_start = std::chrono::steady_clock::now();
     bool success;
-    Bytes corrected;
-    unsigned errors;
-    std::tie(success, corrected, errors) = fec_.CorrectUplink(raw, erasures);
+    std::tie(success, attempt.errors) = fec_.CorrectUplink(attempt.raw, attempt.erasures, attempt.data);
+    const auto fec_elapsed = std::chrono::steady_clock::now() - fec_start;
+    stats::Record(stats::Stage::FEC, fec_elapsed);
+    DUMP978_TRACE(UPLINK_FEC, success ? 1 : 0, success ? attempt.errors : 0, std::chrono::duration_cast<std::chrono::nanoseconds>(fec_elapsed).count());
+    stats::Add(stats::Counter::UPLINK_FEC_ATTEMPTS);
+    if (success) {
+        stats::Add(stats::Counter::UPLINK_FEC_SUCCESSES);
+    }
+    return success;
+}
 
-    if (!success) {
-        // Error correction failed
-        return boost::none;
+//
+// Soft-decision retries
+//
+// A frame that fails hard-decision correction is retried with the bytes
+// whose weakest bit had the smallest phase difference (the bits most
+// likely to be wrong) marked as erasures, first a few and then up to half
+// of the code's parity symbols. Reed-Solomon corrects e erasures and t
+// errors when e + 2t <= parity symbols, so each erasure that is right costs
+// half what an unknown error does. Filling the whole erasure budget would
+// let any received word "correct", so half of it is always left for errors
+// and detection.
+//
+
+// The confidence of each hard-decided byte: the smallest |phase difference| of its 8 bits
+template <std::size_t N> static inline void ByteConfidence(PhaseBuffer::const_iterator phase, std::array<std::uint16_t, N> &confidence) {
+    for (unsigned i = 0; i < N; ++i) {
+        int least = 32768;
+        for (unsigned b = 0; b < 8; ++b) {
+            least = std::min(least, std::abs(static_cast<int>(PhaseDifference(phase[b * 2], phase[b * 2 + 1]))));
+        }
+        confidence[i] = least;
+        phase += 16;
+    }
+}
+
+// Erasures to try per code word: a few, then half the parity symbols
+static const unsigned SOFT_FIRST_ERASURES = 4;
+
+void TwoMegDemodulator::EnableSoftDecision(double retries_per_second) {
+    soft_decision_ = true;
+    soft_tokens_per_sample_ = retries_per_second / DEMOD_SAMPLE_RATE;
+    soft_max_tokens_ = soft_tokens_ = retries_per_second;
+}
+
+bool TwoMegDemodulator::SpendSoftRetry() {
+    if (soft_tokens_ < 1) {
+        stats::Add(stats::Counter::SOFT_RETRIES_SKIPPED);
+        return false;
+    }
+    soft_tokens_ -= 1;
+    stats::Add(stats::Counter::SOFT_RETRIES);
+    return true;
+}
+
+bool TwoMegDemodulator::SoftRetryDownlink(PhaseBuffer::const_iterator start, DownlinkAttempt &attempt) {
+    const auto bits = start + SYNC_BITS * 2;
+
+    DownlinkBuffer raw;
+    DemodBits(bits, raw, attempt.erasures, 0, 0);
+    std::array<std::uint16_t, DOWNLINK_LONG_BYTES> confidence;
+    ByteConfidence(bits, confidence);
+
+    // A short frame is followed by silence, which would look like the least
+    // confident bytes of all; going by the (hard-decided) payload type, pick
+    // erasures only from the bytes that the frame covers
+    const bool short_frame = ((raw[0] >> 3) == 0);
+    const unsigned frame_bytes = (short_frame ? DOWNLINK_SHORT_BYTES : DOWNLINK_LONG_BYTES);
+    const unsigned max_erasures = (short_frame ? fec::DOWNLINK_SHORT_ROOTS : fec::DOWNLINK_LONG_ROOTS) / 2;
+
+    std::array<std::uint8_t, DOWNLINK_LONG_BYTES> order;
+    for (unsigned i = 0; i < frame_bytes; ++i) {
+        order[i] = i;
+    }
+    std::partial_sort(order.begin(), order.begin() + max_erasures, order.begin() + frame_bytes, [&confidence](std::uint8_t a, std::uint8_t b) { return confidence[a] < confidence[b]; });
+
+    for (unsigned erasures : {SOFT_FIRST_ERASURES, max_erasures}) {
+        if (!SpendSoftRetry()) {
+            return false;
+        }
+
+        attempt.data = raw;
+        attempt.erasures.clear();
+        for (unsigned i = 0; i < erasures; ++i) {
+            attempt.erasures.push_back(order[i]);
+        }
+
+        stats::StageTimer timer(stats::Stage::FEC);
+        bool success;
+        std::tie(success, attempt.data_bytes, attempt.errors) = fec_.CorrectDownlink(attempt.data, attempt.erasures);
+        if (success) {
+            stats::Add(stats::Counter::SOFT_SUCCESSES);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool TwoMegDemodulator::SoftRetryUplink(PhaseBuffer::const_iterator start, UplinkAttempt &attempt) {
+    const auto bits = start + SYNC_BITS * 2;
+
+    DemodBits(bits, attempt.raw, attempt.erasures, 0, 0);
+    std::array<std::uint16_t, UPLINK_BYTES> confidence;
+    ByteConfidence(bits, confidence);
+
+    // the blocks are interleaved: byte j of block b is raw byte j * 6 + b
+    const unsigned max_erasures = fec::UPLINK_BLOCK_ROOTS / 2;
+    std::array<std::array<std::uint16_t, UPLINK_BLOCK_BYTES>, UPLINK_BLOCKS_PER_FRAME> order;
+    for (unsigned b = 0; b < UPLINK_BLOCKS_PER_FRAME; ++b) {
+        auto &block = order[b];
+        for (unsigned j = 0; j < UPLINK_BLOCK_BYTES; ++j) {
+            block[j] = j * UPLINK_BLOCKS_PER_FRAME + b;
+        }
+        std::partial_sort(block.begin(), block.begin() + max_erasures, block.end(), [&confidence](std::uint16_t x, std::uint16_t y) { return confidence[x] < confidence[y]; });
+    }
+
+    for (unsigned erasures : {SOFT_FIRST_ERASURES, max_erasures}) {
+        if (!SpendSoftRetry()) {
+            return false;
+        }
+
+        attempt.erasures.clear();
+        for (const auto &block : order) {
+            for (unsigned i = 0; i < erasures; ++i) {
+                attempt.erasures.push_back(block[i]);
+            }
+        }
+
+        stats::StageTimer timer(stats::Stage::FEC);
+        bool success;
+        std::tie(success, attempt.errors) = fec_.CorrectUplink(attempt.raw, attempt.erasures, attempt.data);
+        if (success) {
+            stats::Add(stats::Counter::SOFT_SUCCESSES);
+            return true;
+        }
     }
 
-    return Demodulator::Message{std::move(corrected), errors, start, start + (SYNC_BITS + UPLINK_BITS) * 2};
+    return false;
 }
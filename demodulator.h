@@ -7,13 +7,25 @@
 #ifndef DUMP978_DEMODULATOR_H
 #define DUMP978_DEMODULATOR_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+#include "bounded_queue.h"
 #include "common.h"
 #include "convert.h"
+#include "energy_gate.h"
 #include "fec.h"
+#include "mapped_file.h"
 #include "message_source.h"
+#include "sample_ring.h"
+#include "sync_search.h"
 #include "uat_message.h"
 
 namespace airnav::uat {
@@ -21,7 +33,7 @@ namespace airnav::uat {
       public:
         // Return value of Demodulate
         struct Message {
-            Bytes payload;
+            MessagePayload payload;
             unsigned corrected_errors;
             PhaseBuffer::const_iterator begin;
             PhaseBuffer::const_iterator end;
@@ -32,44 +44,304 @@ namespace airnav::uat {
 
         virtual unsigned NumTrailingSamples() = 0;
 
+        // Samples per bit of the phase data this demodulator expects (at
+        // DEMOD_SAMPLE_RATE * samples per bit / 2)
+        virtual unsigned SamplesPerBit() const = 0;
+
+        // When a frame fails error correction with hard decisions, retry it
+        // with its least confident bytes marked as erasures, spending on
+        // average at most `retries_per_second` retries per second of samples
+        // (with bursts of up to a second's worth)
+        virtual void EnableSoftDecision(double retries_per_second) = 0;
+
+        // Return a new demodulator for 2 or 4 samples per bit
+        static std::unique_ptr<Demodulator> Create(unsigned samples_per_bit);
+
       protected:
         FEC fec_;
     };
 
-    class TwoMegDemodulator : public Demodulator {
+    class TwoMegDemodulator final : public Demodulator {
       public:
+        // As SyncSearch: `generic_sync_search` selects its plain C++
+        // implementation rather than the one chosen for this CPU
+        explicit TwoMegDemodulator(bool generic_sync_search = false) : sync_search_(generic_sync_search) {}
+
         std::vector<Message> Demodulate(PhaseBuffer::const_iterator begin, PhaseBuffer::const_iterator end) override;
         unsigned NumTrailingSamples() override;
+        unsigned SamplesPerBit() const override { return 2; }
+        void EnableSoftDecision(double retries_per_second) override;
+
+        // As Demodulate(), but reading the `count` samples at `samples`
+        // directly. Conversion for the sync search is done a cache-sized
+        // tile at a time; only the samples around sync candidates are
+        // converted into `phase` (at the same offsets, so it needs room for
+        // `count` values), and the returned messages point into it. The
+        // rest of `phase` is left untouched. Instantiated for SampleConverter
+        // and each of its concrete subclasses.
+        template <class ConverterType> std::vector<Message> DemodulateSamples(ConverterType &converter, const std::uint8_t *samples, std::size_t count, PhaseBuffer::iterator phase);
+
+        // samples converted per tile by DemodulateSamples
+        static const std::size_t TILE_SAMPLES = 8192;
 
       private:
+        // Fixed-size working space for demodulating one frame
+        struct DownlinkAttempt {
+            DownlinkBuffer data; // raw data, corrected in place
+            DownlinkErasures erasures;
+            std::size_t data_bytes = 0;
+            unsigned errors = 0;
+        };
+
+        struct UplinkAttempt {
+            UplinkBuffer raw;
+            UplinkErasures erasures;
+            UplinkDataBuffer data; // deinterleaved, corrected data
+            unsigned errors = 0;
+        };
+
+        // Visit the sync candidates prepared in sync_search_, in order,
+        // calling `before_candidate(offset)` before the phase data from
+        // `offset` onwards is read
+        template <class BeforeCandidate> std::vector<Message> DemodulateCandidates(PhaseBuffer::const_iterator begin, std::size_t last_pair, BeforeCandidate before_candidate);
+
         boost::optional<Message> DemodBest(PhaseBuffer::const_iterator begin, bool downlink);
-        boost::optional<Message> DemodOneDownlink(PhaseBuffer::const_iterator begin);
-        boost::optional<Message> DemodOneUplink(PhaseBuffer::const_iterator begin);
+        bool DemodOneDownlink(PhaseBuffer::const_iterator begin, DownlinkAttempt &attempt);
+        bool DemodOneUplink(PhaseBuffer::const_iterator begin, UplinkAttempt &attempt);
+        bool SoftRetryDownlink(PhaseBuffer::const_iterator begin, DownlinkAttempt &attempt);
+        bool SoftRetryUplink(PhaseBuffer::const_iterator begin, UplinkAttempt &attempt);
+
+        // soft-decision retry budget, in retries
+        void AddSoftBudget(std::size_t samples) { soft_tokens_ = std::min(soft_max_tokens_, soft_tokens_ + samples * soft_tokens_per_sample_); }
+        bool SpendSoftRetry();
+
+        // the two attempts made by DemodBest, at offsets 0 and +1
+        DownlinkAttempt downlink_[2];
+        UplinkAttempt uplink_[2];
+
+        SyncSearch sync_search_;
+        PhaseBuffer tile_; // DemodulateSamples' phase data for one tile
+
+        bool soft_decision_ = false;
+        double soft_tokens_per_sample_ = 0;
+        double soft_max_tokens_ = 0;
+        double soft_tokens_ = 0;
+    };
+
+    // Demodulates at 4 samples per bit. The phase data is split into its two
+    // interleaved 2-samples-per-bit streams, a quarter of a bit apart, and
+    // each is demodulated as by TwoMegDemodulator (which tries two adjacent
+    // offsets itself), so each message is tried at four timings a quarter of
+    // a bit apart rather than two a half bit apart. Where both streams decode
+    // a message, the copy with fewer corrected errors is kept.
+    class FourMegDemodulator final : public Demodulator {
+      public:
+        std::vector<Message> Demodulate(PhaseBuffer::const_iterator begin, PhaseBuffer::const_iterator end) override;
+        unsigned NumTrailingSamples() override { return two_meg_.NumTrailingSamples() * 2; }
+        unsigned SamplesPerBit() const override { return 4; }
+        // the budget is shared between the two streams
+        void EnableSoftDecision(double retries_per_second) override { two_meg_.EnableSoftDecision(retries_per_second / 2); }
+
+      private:
+        TwoMegDemodulator two_meg_;
+        PhaseBuffer streams_[2];
     };
 
     class Receiver : public MessageSource {
       public:
-        virtual void HandleSamples(std::uint64_t timestamp, Bytes::const_iterator begin, Bytes::const_iterator end) = 0;
+        ~Receiver();
+
+        // Handle a block of samples. The receiver reads the block's history
+        // in place as the overlap with the previous block, so the sample
+        // source should be told to retain NumTrailingSamples() of history.
+        virtual void HandleSamples(const SampleBlock &block) = 0;
+
+        // Number of samples of history the receiver needs before each block
+        virtual unsigned NumTrailingSamples() = 0;
 
         virtual void HandleError(const boost::system::error_code &ec) { DispatchError(ec); }
+
+        // Only convert and demodulate the parts of each block that an
+        // EnergyGate with the given threshold passes. Call before Start().
+        void EnableEnergyGate(double threshold_db) { gate_.reset(new EnergyGate(threshold_db, NumTrailingSamples())); }
+
+        // Set each message's raw timestamp to the index of its first sample
+        // (SampleBlock::sample_index), counted at 2.083333MHz whatever the
+        // demodulator's rate. Call before Start().
+        void EnableRawTimestamps() { raw_timestamps_ = true; }
+
+        // As Demodulator::EnableSoftDecision. Call before Start().
+        virtual void EnableSoftDecision(double retries_per_second) = 0;
+
+      protected:
+        bool RawTimestamps() const { return raw_timestamps_; }
+
+        // Set `regions` to the parts of the `count` samples at `samples` that
+        // should be demodulated: all of them, unless the energy gate is on
+        void FindRegions(SampleConverter &converter, const std::uint8_t *samples, std::size_t count, std::vector<EnergyGate::Region> &regions);
+
+      private:
+        std::unique_ptr<EnergyGate> gate_;
+        bool raw_timestamps_ = false;
+        std::chrono::steady_clock::time_point last_gate_report_ = std::chrono::steady_clock::now();
+        std::uint64_t reported_total_ = 0;
+        std::uint64_t reported_skipped_ = 0;
     };
 
+    // A receiver that converts, demodulates and dispatches each block on the
+    // thread that delivers it. Create() returns an instance specialized for
+    // the sample format and demodulator, which holds them by value, so the
+    // per-block conversion and demodulation calls are direct rather than
+    // through SampleConverter / Demodulator pointers.
     class SingleThreadReceiver : public Receiver {
       public:
-        SingleThreadReceiver(SampleFormat format);
+        typedef std::shared_ptr<SingleThreadReceiver> Pointer;
+
+        static Pointer Create(SampleFormat format, unsigned samples_per_bit = 2);
+    };
+
+    // A receiver that runs sample conversion, demodulation/FEC and message
+    // dispatch on separate threads, joined by bounded queues, so that a slow
+    // stage does not hold up the thread that delivers samples.
+    //
+    // It must be owned by a shared_ptr: once started, its threads hold a
+    // reference, so it is only destroyed after Stop().
+    class PipelinedReceiver : public Receiver, public std::enable_shared_from_this<PipelinedReceiver> {
+      public:
+        // If `drop_when_full` is set, sample blocks that arrive while the
+        // conversion stage is backed up are discarded rather than making the
+        // caller wait (use this for realtime sources, e.g. SDRs)
+        PipelinedReceiver(SampleFormat format, bool drop_when_full, std::size_t queue_depth = 8, unsigned samples_per_bit = 2);
+        ~PipelinedReceiver();
+
+        void Start() override;
+        void Stop() override;
+
+        void HandleSamples(const SampleBlock &block) override;
+        unsigned NumTrailingSamples() override { return demodulator_->NumTrailingSamples(); }
+        void EnableSoftDecision(double retries_per_second) override { demodulator_->EnableSoftDecision(retries_per_second); }
+
+        // Errors are passed through the pipeline so that they are reported
+        // after any messages from samples that were delivered before the error
+        void HandleError(const boost::system::error_code &ec) override;
+
+        struct QueueDepth {
+            std::size_t current;  // items queued right now
+            std::size_t peak;     // most items queued since the last depth report
+            std::size_t capacity; // maximum items that can be queued
+        };
+
+        QueueDepth ConversionQueueDepth() const { return Depth(conversion_queue_); }
+        QueueDepth DemodQueueDepth() const { return Depth(demod_queue_); }
+        QueueDepth DispatchQueueDepth() const { return Depth(dispatch_queue_); }
 
-        void HandleSamples(std::uint64_t timestamp, Bytes::const_iterator begin, Bytes::const_iterator end) override;
+        // Number of sample blocks discarded because the pipeline was full
+        std::uint64_t DroppedBlocks() const { return dropped_blocks_; }
 
       private:
+        struct ConversionWork {
+            SampleBlock block;
+            boost::system::error_code error;
+        };
+
+        struct DemodWork {
+            std::size_t previous_samples = 0;
+            std::size_t total_samples = 0;
+            const std::uint8_t *samples = nullptr; // start of the converted samples, including history
+            SampleBlock block;                     // keeps `samples` valid
+            PhaseBuffer phase;                     // converted samples, valid within `regions`
+            std::vector<EnergyGate::Region> regions;
+            boost::system::error_code error;
+        };
+
+        struct DispatchWork {
+            SharedMessageVector messages;
+            boost::system::error_code error;
+        };
+
+        template <typename T> static QueueDepth Depth(const BoundedQueue<T> &queue) { return {queue.Size(), queue.Peak(), queue.Capacity()}; }
+
+        void ConversionThread();
+        void DemodThread();
+        void DispatchThread();
+        void MaybeReportDepths();
+        void JoinThreads();
+
         SampleConverter::Pointer converter_;
         std::unique_ptr<Demodulator> demodulator_;
+        bool drop_when_full_;
 
-        Bytes samples_;
-        std::size_t saved_samples_ = 0;
+        BoundedQueue<ConversionWork> conversion_queue_;
+        BoundedQueue<DemodWork> demod_queue_;
+        BoundedQueue<DispatchWork> dispatch_queue_;
 
-        PhaseBuffer phase_;
+        // used phase buffers, handed back upstream for reuse
+        BoundedQueue<DemodWork> free_demod_work_;
+
+        std::thread conversion_thread_;
+        std::thread demod_thread_;
+        std::thread dispatch_thread_;
+        std::atomic<bool> running_{false};
+
+        std::atomic<std::uint64_t> dropped_blocks_;
+        std::uint64_t reported_dropped_blocks_ = 0;
+        std::chrono::steady_clock::time_point last_depth_report_;
     };
 
+    // An offline receiver for a complete capture file, which decodes faster
+    // than realtime on several threads. The file is cut into blocks that
+    // overlap by NumTrailingSamples(), the same blocks and synthetic
+    // timestamps that FileSampleSource plus a receiver would produce; blocks
+    // are demodulated in parallel, and the results are dispatched in file
+    // order from a separate merge thread, followed by EOF. Once started,
+    // its threads hold a reference until they finish or Stop() is called.
+    class ParallelFileReceiver : public MessageSource, public std::enable_shared_from_this<ParallelFileReceiver> {
+      public:
+        typedef std::shared_ptr<ParallelFileReceiver> Pointer;
+
+        static Pointer Create(SampleFormat format, MappedFile::Pointer file, unsigned threads, std::size_t samples_per_block = 524288) { return Pointer(new ParallelFileReceiver(format, file, threads, samples_per_block)); }
+
+        ~ParallelFileReceiver();
+
+        void Start() override;
+        void Stop() override;
+
+        // As Receiver::EnableRawTimestamps
+        void EnableRawTimestamps() { raw_timestamps_ = true; }
+
+        // As Receiver::EnableSoftDecision; the budget applies to each worker
+        void EnableSoftDecision(double retries_per_second) { soft_decision_budget_ = retries_per_second; }
+
+      private:
+        ParallelFileReceiver(SampleFormat format, MappedFile::Pointer file, unsigned threads, std::size_t samples_per_block);
+
+        void WorkerThread();
+        void MergeThread();
+        void JoinThreads();
+
+        std::uint64_t BlockTimestamp(std::size_t block) const { return 1 + block * samples_per_block_ * 1000 / DEMOD_SAMPLE_RATE; }
+
+        SampleFormat format_;
+        MappedFile::Pointer file_;
+        unsigned threads_;
+        std::size_t bytes_per_sample_;
+        std::size_t samples_per_block_;
+        std::size_t trailing_samples_;
+        std::size_t total_blocks_;
+        bool raw_timestamps_ = false;
+        double soft_decision_budget_ = -1; // negative: disabled
+
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        bool stopping_ = false;
+        std::size_t next_block_ = 0;                         // next block for a worker to claim
+        std::size_t next_dispatch_ = 0;                      // next block for the merge thread to dispatch
+        std::map<std::size_t, SharedMessageVector> results_; // finished blocks waiting to be dispatched
+
+        std::vector<std::thread> workers_;
+        std::thread merge_thread_;
+        std::atomic<bool> running_{false};
+    };
 }; // namespace airnav::uat
 
 #endif
@@ -0,0 +1,385 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+// dump978-bench: measures the throughput of each stage of the receive and
+// output pipeline, using the messages in sample-data.txt.gz and IQ captures
+// synthesized from them in each sample format.
+//
+//   dump978-bench [--sample-data path/to/sample-data.txt.gz] [--messages N]
+//
+// (the two may also be given positionally, in that order)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "convert.h"
+#include "demodulator.h"
+#include "fec.h"
+#include "resampler.h"
+#include "test_signals.h"
+#include "uat_message.h"
+#include "uat_protocol.h"
+
+using namespace airnav::uat;
+namespace po = boost::program_options;
+
+//
+// allocation counting
+//
+
+static std::atomic<std::uint64_t> allocations(0);
+
+// Kept out of line so that the compiler does not pair the replaced
+// operator new/delete with malloc/free and warn about a mismatch
+__attribute__((noinline)) static void *CountedAllocate(std::size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) static void CountedFree(void *p) { std::free(p); }
+
+void *operator new(std::size_t size) { return CountedAllocate(size); }
+void *operator new[](std::size_t size) { return CountedAllocate(size); }
+void operator delete(void *p) noexcept { CountedFree(p); }
+void operator delete[](void *p) noexcept { CountedFree(p); }
+void operator delete(void *p, std::size_t) noexcept { CountedFree(p); }
+void operator delete[](void *p, std::size_t) noexcept { CountedFree(p); }
+
+//
+// measurement and reporting
+//
+
+struct Measurement {
+    double seconds;          // time per pass
+    std::uint64_t allocated; // allocations per pass
+};
+
+// Run `fn` repeatedly for at least `min_seconds` and return the per-pass cost
+template <class F> static Measurement Measure(F fn, double min_seconds = 0.5) {
+    fn(); // warm up caches and lazily-built tables
+
+    unsigned passes = 0;
+    const std::uint64_t start_allocations = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    double elapsed;
+    do {
+        fn();
+        ++passes;
+        elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < min_seconds);
+
+    return {elapsed / passes, (allocations - start_allocations) / passes};
+}
+
+static void ReportHeader() { std::cout << std::left << std::setw(36) << "stage" << std::right << std::setw(16) << "throughput" << std::setw(14) << "ns/item" << std::setw(14) << "allocs/item" << std::endl; }
+
+// `items` are processed per pass; throughput is reported in `unit`, which is
+// items/s divided by `unit_scale`
+static void Report(const std::string &stage, double items, const std::string &unit, const Measurement &m, double unit_scale = 1.0) {
+    std::ostringstream rate;
+    rate << std::fixed << std::setprecision(unit_scale == 1.0 ? 0 : 1) << (items / m.seconds / unit_scale) << ' ' << unit;
+
+    std::cout << std::left << std::setw(36) << stage << std::right << std::setw(16) << rate.str() << std::fixed << std::setprecision(1) << std::setw(14) << (m.seconds * 1e9 / items) << std::setprecision(3) << std::setw(14) << (m.allocated / items) << std::endl;
+}
+
+//
+// stages
+//
+
+static void BenchConvert(SampleConverter &converter, const std::string &label, const std::vector<std::uint8_t> &iq, PhaseBuffer &phase) {
+    const std::size_t samples = iq.size() / converter.BytesPerSample();
+    phase.resize(samples);
+
+    auto m = Measure([&]() { converter.ConvertPhase(iq.data(), iq.data() + iq.size(), phase.begin()); });
+    Report("ConvertPhase " + label, samples, "Msps", m, 1e6);
+}
+
+static void BenchResample(const std::vector<std::uint8_t> &iq, unsigned interpolation, unsigned decimation) {
+    RationalResampler resampler(interpolation, decimation);
+    const std::size_t samples = iq.size() / BytesPerSample(SampleFormat::CS16H);
+    std::vector<std::int16_t> out(resampler.MaxOutput(samples) * 2);
+
+    auto m = Measure([&]() { resampler.Process(reinterpret_cast<const std::int16_t *>(iq.data()), samples, out.data()); });
+    Report("Resample " + std::to_string(resampler.Interpolation()) + "/" + std::to_string(resampler.Decimation()) + " (" + RationalResampler::Implementation() + ")", samples, "Msps", m, 1e6);
+}
+
+// Setting up a receiver: converters, demodulator and FEC share their tables
+// process-wide, so only the first instance builds them
+static void BenchStartup() {
+    auto m = Measure([&]() {
+        CU8Converter full(PhaseTable::FULL);
+        CS8Converter octant(PhaseTable::OCTANT);
+        TwoMegDemodulator demodulator;
+        FEC fec;
+    });
+    Report("Create converters + demodulator + FEC", 1, "/s", m);
+}
+
+static void BenchDemodulate(const PhaseBuffer &phase, std::size_t sent) {
+    TwoMegDemodulator demodulator;
+    std::size_t found = 0;
+
+    auto m = Measure([&]() { found = demodulator.Demodulate(phase.begin(), phase.end()).size(); });
+    Report("Demodulate (per sample)", phase.size(), "Msps", m, 1e6);
+    Report("Demodulate (per message)", found, "msg/s", m);
+    std::cout << "  (demodulated " << found << " of " << sent << " messages)" << std::endl;
+}
+
+static void BenchFused(const std::vector<std::uint8_t> &iq, std::size_t sent) {
+    CU8Converter converter;
+    TwoMegDemodulator demodulator;
+    const std::size_t samples = iq.size() / converter.BytesPerSample();
+    PhaseBuffer phase(samples);
+    std::size_t found = 0;
+
+    auto m = Measure([&]() { found = demodulator.DemodulateSamples(converter, iq.data(), samples, phase.begin()).size(); });
+    Report("Convert+demodulate CU8, tiled", samples, "Msps", m, 1e6);
+    std::cout << "  (demodulated " << found << " of " << sent << " messages)" << std::endl;
+}
+
+// Hard against soft decision on a capture noisy enough that some frames need it
+static void BenchSoftDecision(const std::vector<EncodedFrame> &frames, double sigma) {
+    const auto iq = Modulate(frames, SampleFormat::CU8, sigma);
+    CU8Converter converter;
+    PhaseBuffer phase(iq.size() / converter.BytesPerSample());
+    converter.ConvertPhase(iq.data(), iq.data() + iq.size(), phase.begin());
+
+    for (bool soft : {false, true}) {
+        TwoMegDemodulator demodulator;
+        if (soft) {
+            demodulator.EnableSoftDecision(1e9); // unlimited
+        }
+
+        std::size_t found = 0;
+        auto m = Measure([&]() { found = demodulator.Demodulate(phase.begin(), phase.end()).size(); });
+        Report(std::string("Demodulate, noisy, ") + (soft ? "soft" : "hard"), phase.size(), "Msps", m, 1e6);
+        std::cout << "  (demodulated " << found << " of " << frames.size() << " messages)" << std::endl;
+    }
+}
+
+static void BenchFEC(const std::vector<EncodedFrame> &frames, unsigned errors, const std::string &label) {
+    std::mt19937 rng(2);
+    std::vector<DownlinkBuffer> downlink;
+    std::vector<UplinkBuffer> uplink;
+
+    for (const auto &frame : frames) {
+        if (frame.type == MessageType::UPLINK) {
+            UplinkBuffer buf;
+            std::copy(frame.data.begin(), frame.data.end(), buf.begin());
+            for (unsigned e = 0; e < errors * UPLINK_BLOCKS_PER_FRAME; ++e)
+                buf[rng() % buf.size()] ^= (1 + rng() % 255);
+            uplink.push_back(buf);
+        } else {
+            DownlinkBuffer buf;
+            std::copy(frame.data.begin(), frame.data.end(), buf.begin());
+            const std::size_t length = (frame.type == MessageType::DOWNLINK_SHORT ? DOWNLINK_SHORT_BYTES : DOWNLINK_LONG_BYTES);
+            for (unsigned e = 0; e < errors; ++e)
+                buf[rng() % length] ^= (1 + rng() % 255);
+            downlink.push_back(buf);
+        }
+    }
+
+    FEC fec;
+    if (!downlink.empty()) {
+        std::vector<DownlinkBuffer> working;
+        const DownlinkErasures no_erasures{};
+        auto m = Measure([&]() {
+            working = downlink;
+            for (auto &buf : working)
+                fec.CorrectDownlink(buf, no_erasures);
+        });
+        Report("CorrectDownlink, " + label, downlink.size(), "msg/s", m);
+    }
+
+    if (!uplink.empty()) {
+        UplinkDataBuffer corrected;
+        const UplinkErasures no_erasures{};
+        auto m = Measure([&]() {
+            for (const auto &buf : uplink)
+                fec.CorrectUplink(buf, no_erasures, corrected);
+        });
+        Report("CorrectUplink, " + label, uplink.size(), "msg/s", m);
+    }
+}
+
+// Batching messages as the receivers do: a vector per block, dropped after delivery
+static void BenchMessageBatches(const std::vector<RawMessage> &messages, std::size_t batch) {
+    auto m = Measure([&]() {
+        for (std::size_t i = 0; i < messages.size(); i += batch) {
+            auto vector = MessageVector::Create();
+            for (std::size_t j = i; j < std::min(messages.size(), i + batch); ++j)
+                vector->emplace_back(messages[j]);
+        }
+    });
+    Report("MessageVector batches of " + std::to_string(batch), messages.size(), "msg/s", m);
+}
+
+static void BenchDecodeAndEncode(const std::vector<RawMessage> &messages) {
+    std::vector<RawMessage> downlink;
+    for (const auto &message : messages) {
+        if (message.Type() == MessageType::DOWNLINK_SHORT || message.Type() == MessageType::DOWNLINK_LONG)
+            downlink.push_back(message);
+    }
+
+    std::vector<CompactAdsbMessage> decoded;
+    for (const auto &message : downlink)
+        decoded.emplace_back(message);
+
+    unsigned sink = 0;
+    auto m = Measure([&]() {
+        for (const auto &message : downlink)
+            sink += AdsbMessage(message).address;
+    });
+    Report("AdsbMessage decode", downlink.size(), "msg/s", m);
+
+    m = Measure([&]() {
+        for (const auto &message : downlink)
+            sink += CompactAdsbMessage(message).address;
+    });
+    Report("CompactAdsbMessage decode", downlink.size(), "msg/s", m);
+
+    std::string out;
+    m = Measure([&]() {
+        out.clear();
+        for (const auto &message : messages) {
+            EncodeRaw(message, out);
+            out += '\n';
+        }
+    });
+    Report("EncodeRaw", messages.size(), "msg/s", m);
+
+    m = Measure([&]() {
+        out.clear();
+        for (const auto &message : decoded) {
+            message.EncodeJson(out);
+            out += '\n';
+        }
+    });
+    Report("EncodeJson", decoded.size(), "msg/s", m);
+
+    m = Measure([&]() {
+        for (const auto &message : decoded)
+            sink += AdsbMessage(message).ToJson().dump().size();
+    });
+    Report("ToJson().dump() (reference)", decoded.size(), "msg/s", m);
+
+    if (sink == 0)
+        std::cout << "(no output)" << std::endl;
+}
+
+static int realmain(int argc, char **argv) {
+    // clang-format off
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("sample-data", po::value<std::string>()->default_value("sample-data.txt.gz"), "messages to benchmark with, and to synthesize IQ captures from")
+        ("messages", po::value<std::size_t>()->default_value(5000), "the most messages to read from --sample-data");
+    // clang-format on
+
+    po::positional_options_description positional;
+    positional.add("sample-data", 1);
+    positional.add("messages", 1);
+
+    po::variables_map opts;
+
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), opts);
+        po::notify(opts);
+    } catch (boost::program_options::error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 2;
+    }
+
+    if (opts.count("help")) {
+        std::cerr << desc << std::endl;
+        return 2;
+    }
+
+    const std::string path = opts["sample-data"].as<std::string>();
+    const std::size_t limit = opts["messages"].as<std::size_t>();
+    if (!std::ifstream(path)) {
+        std::cerr << "dump978-bench: can't read " << path << "; give the sample data with --sample-data" << std::endl;
+        std::cerr << desc << std::endl;
+        return 2;
+    }
+
+    auto messages = LoadSampleData(path, limit);
+    if (messages.empty()) {
+        std::cerr << "no messages could be read from " << path << std::endl;
+        return 1;
+    }
+
+    FrameEncoder encoder;
+    std::vector<EncodedFrame> frames;
+    for (const auto &message : messages)
+        frames.push_back(encoder.Encode(message));
+
+    std::cout << "dump978-bench: " << messages.size() << " messages from " << path << std::endl << std::endl;
+    ReportHeader();
+
+    PhaseBuffer cu8_phase;
+    std::vector<std::uint8_t> cu8_iq;
+    for (auto format : {SampleFormat::CU8, SampleFormat::CS8_, SampleFormat::CS16H, SampleFormat::CF32H}) {
+        auto iq = Modulate(frames, format);
+        PhaseBuffer phase;
+        if (format == SampleFormat::CU8) {
+            // both 8-bit phase lookups, whichever is the default
+            CU8Converter full(PhaseTable::FULL), octant(PhaseTable::OCTANT);
+            BenchConvert(full, "CU8 (full table)", iq, phase);
+            BenchConvert(octant, "CU8 (octant table)", iq, phase);
+        } else if (format == SampleFormat::CS8_) {
+            CS8Converter full(PhaseTable::FULL), octant(PhaseTable::OCTANT);
+            BenchConvert(full, "CS8 (full table)", iq, phase);
+            BenchConvert(octant, "CS8 (octant table)", iq, phase);
+        } else {
+            BenchConvert(*SampleConverter::Create(format), FormatName(format), iq, phase);
+        }
+        if (format == SampleFormat::CS16H) {
+            // e.g. 2.5MHz and 10MHz inputs (per input sample)
+            BenchResample(iq, 5, 6);
+            BenchResample(iq, 5, 24);
+        }
+        if (format == SampleFormat::CU8) {
+            cu8_phase = std::move(phase);
+            cu8_iq = std::move(iq);
+        }
+    }
+
+    BenchStartup();
+    BenchDemodulate(cu8_phase, messages.size());
+    BenchFused(cu8_iq, messages.size());
+    BenchSoftDecision(frames, 0.18);
+    BenchFEC(frames, 0, "clean");
+    BenchFEC(frames, 3, "3 errors/block");
+    BenchMessageBatches(messages, 8);
+    BenchDecodeAndEncode(messages);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    try {
+        return realmain(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << "dump978-bench: " << e.what() << std::endl;
+        return 2;
+    }
+}
@@ -0,0 +1,444 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+// dump978-compare: decodes the same CU8 captures with dump978-rb and with
+// the original C decoder (legacy/dump978) and compares the messages each
+// finds and the CPU time each takes. The captures are synthesized from
+// sample-data.txt.gz at several signal-to-noise ratios, plus any real
+// captures named on the command line.
+//
+// With --baseline, it fails (exit status 1) if, for any capture listed
+// in the baseline, dump978-rb decodes more than --max-decode-loss percent
+// fewer messages, or its CPU time relative to the legacy decoder's grows
+// by more than --max-cpu-increase percent. Comparing against the legacy
+// decoder on the same machine, rather than against absolute times, keeps
+// the baseline meaningful across machines. --save-baseline writes the
+// results of this run as a new baseline.
+//
+//   dump978-compare [options] [capture.CU8 ...]
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include "test_signals.h"
+#include "uat_message.h"
+
+using namespace airnav::uat;
+namespace po = boost::program_options;
+
+// A decoder's output for one capture
+struct Decode {
+    std::vector<std::string> messages; // "+hex" / "-hex", sorted
+    double cpu_seconds;                // user + system, least of all runs
+};
+
+// The comparison for one capture
+struct Result {
+    std::string name;
+    std::size_t samples = 0;
+    std::size_t sent = 0; // messages in a synthesized capture; 0 for a real one
+    Decode legacy;
+    Decode cxx;
+    std::size_t common = 0;
+
+    double CpuRatio() const { return legacy.cpu_seconds > 0 ? cxx.cpu_seconds / legacy.cpu_seconds : 0; }
+};
+
+// Payloads of the decoded messages in raw-format `output`, without the
+// trailing metadata that only dump978-rb writes
+static std::vector<std::string> ParseMessages(const std::string &output) {
+    std::vector<std::string> messages;
+    std::istringstream in(output);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || (line[0] != '-' && line[0] != '+'))
+            continue;
+        messages.push_back(line.substr(0, line.find(';')));
+    }
+    std::sort(messages.begin(), messages.end());
+    return messages;
+}
+
+// Run `argv` with stdin read from `stdin_path` (unless empty), returning
+// its stdout and setting `cpu_seconds` to its CPU time. Throws if it could
+// not be run or did not exit successfully.
+static std::string Run(const std::vector<std::string> &argv, const std::string &stdin_path, double &cpu_seconds) {
+    int pipefd[2];
+    if (::pipe(pipefd) < 0) {
+        throw std::runtime_error(std::string("pipe: ") + std::strerror(errno));
+    }
+
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error(std::string("fork: ") + std::strerror(errno));
+    }
+
+    if (pid == 0) {
+        int in = (stdin_path.empty() ? ::open("/dev/null", O_RDONLY) : ::open(stdin_path.c_str(), O_RDONLY));
+        int null = ::open("/dev/null", O_WRONLY);
+        if (in < 0 || null < 0) {
+            ::_exit(126);
+        }
+        ::dup2(in, 0);
+        ::dup2(pipefd[1], 1);
+        ::dup2(null, 2);
+        ::close(pipefd[0]);
+
+        std::vector<char *> args;
+        for (const auto &arg : argv)
+            args.push_back(const_cast<char *>(arg.c_str()));
+        args.push_back(nullptr);
+        ::execv(args[0], args.data());
+        ::_exit(127);
+    }
+
+    ::close(pipefd[1]);
+    std::string output;
+    char buf[65536];
+    for (;;) {
+        const ssize_t n = ::read(pipefd[0], buf, sizeof(buf));
+        if (n > 0) {
+            output.append(buf, n);
+        } else if (n == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    ::close(pipefd[0]);
+
+    int status;
+    struct rusage usage;
+    while (::wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            throw std::runtime_error(std::string("wait4: ") + std::strerror(errno));
+        }
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::ostringstream message;
+        message << argv[0] << " failed (" << (WIFEXITED(status) ? "exit status " + std::to_string(WEXITSTATUS(status)) : "signal " + std::to_string(WTERMSIG(status))) << ")";
+        throw std::runtime_error(message.str());
+    }
+
+    cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    return output;
+}
+
+// Decode a capture `runs` times, keeping the least CPU time: the output
+// is the same each time, but other load on the machine only adds time
+static Decode RunDecoder(const std::vector<std::string> &argv, const std::string &stdin_path, unsigned runs) {
+    Decode decode;
+    for (unsigned run = 0; run < runs; ++run) {
+        double cpu_seconds;
+        const auto output = Run(argv, stdin_path, cpu_seconds);
+        if (run == 0 || cpu_seconds < decode.cpu_seconds) {
+            decode.cpu_seconds = cpu_seconds;
+        }
+        if (run == 0) {
+            decode.messages = ParseMessages(output);
+        }
+    }
+    return decode;
+}
+
+static std::size_t CountCommon(const std::vector<std::string> &a, const std::vector<std::string> &b) {
+    std::vector<std::string> common;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(common));
+    return common.size();
+}
+
+static bool WriteFile(const std::string &path, const std::vector<std::uint8_t> &data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    file.close();
+    return !!file;
+}
+
+static std::string Basename(const std::string &path) {
+    const auto slash = path.rfind('/');
+    return (slash == std::string::npos ? path : path.substr(slash + 1));
+}
+
+static std::string FormatSnr(double snr) {
+    std::ostringstream name;
+    name << "snr-" << snr << "dB";
+    return name.str();
+}
+
+//
+// baselines
+//
+
+struct BaselineEntry {
+    std::size_t cxx_messages;
+    double cpu_ratio;
+};
+
+typedef std::map<std::string, BaselineEntry> Baseline;
+
+static Baseline ReadBaseline(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("cannot read baseline " + path);
+    }
+
+    Baseline baseline;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name;
+        BaselineEntry entry;
+        if (!(fields >> name >> entry.cxx_messages >> entry.cpu_ratio)) {
+            throw std::runtime_error("malformed line in baseline " + path + ": " + line);
+        }
+        baseline[name] = entry;
+    }
+    return baseline;
+}
+
+static void WriteBaseline(const std::string &path, const std::vector<Result> &results) {
+    std::ofstream file(path, std::ios::trunc);
+    file << "# dump978-compare baseline, written by --save-baseline" << std::endl;
+    file << "# capture, messages decoded by dump978-rb, dump978-rb CPU time / legacy CPU time" << std::endl;
+    for (const auto &result : results) {
+        file << result.name << ' ' << result.cxx.messages.size() << ' ' << std::fixed << std::setprecision(3) << result.CpuRatio() << std::endl;
+    }
+    file.close();
+    if (!file) {
+        throw std::runtime_error("cannot write baseline " + path);
+    }
+}
+
+// Compare the results against the baseline, describing each regression
+// on stderr; returns false if there were any
+static bool CheckBaseline(const Baseline &baseline, const std::vector<Result> &results, double max_decode_loss, double max_cpu_increase) {
+    bool ok = true;
+    for (const auto &result : results) {
+        auto i = baseline.find(result.name);
+        if (i == baseline.end()) {
+            std::cerr << result.name << ": not in the baseline, not checked" << std::endl;
+            continue;
+        }
+
+        const auto &entry = i->second;
+        const double decoded = result.cxx.messages.size();
+        if (decoded < entry.cxx_messages * (1 - max_decode_loss / 100)) {
+            std::cerr << result.name << ": REGRESSION: dump978-rb decoded " << result.cxx.messages.size() << " messages, baseline " << entry.cxx_messages << std::endl;
+            ok = false;
+        }
+        if (result.CpuRatio() > entry.cpu_ratio * (1 + max_cpu_increase / 100)) {
+            std::cerr << result.name << ": REGRESSION: dump978-rb used " << std::fixed << std::setprecision(3) << result.CpuRatio() << "x the legacy decoder's CPU time, baseline " << entry.cpu_ratio << "x" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+//
+// reporting
+//
+
+static void ReportHeader() {
+    std::cout << std::left << std::setw(16) << "capture" << std::right << std::setw(10) << "Msamples" << std::setw(8) << "sent" << std::setw(8) << "legacy" << std::setw(8) << "c++" << std::setw(10) << "only-leg" << std::setw(10) << "only-c++" << std::setw(14) << "legacy ms/Ms" << std::setw(12) << "c++ ms/Ms" << std::setw(10) << "cpu ratio" << std::endl;
+}
+
+static void Report(const Result &result) {
+    const double msamples = result.samples / 1e6;
+    std::cout << std::left << std::setw(16) << result.name << std::right << std::fixed << std::setprecision(1) << std::setw(10) << msamples << std::setw(8) << (result.sent ? std::to_string(result.sent) : std::string("-")) << std::setw(8) << result.legacy.messages.size() << std::setw(8) << result.cxx.messages.size() << std::setw(10) << (result.legacy.messages.size() - result.common) << std::setw(10) << (result.cxx.messages.size() - result.common) << std::setw(14) << (result.legacy.cpu_seconds * 1e3 / msamples) << std::setw(12) << (result.cxx.cpu_seconds * 1e3 / msamples) << std::setprecision(3) << std::setw(10) << result.CpuRatio() << std::endl;
+}
+
+static int realmain(int argc, char **argv) {
+    // clang-format off
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("sample-data", po::value<std::string>()->default_value("sample-data.txt.gz"), "messages to synthesize captures from")
+        ("messages", po::value<std::size_t>()->default_value(5000), "the most messages to read from --sample-data for each synthesized capture")
+        ("snr", po::value<std::vector<double>>()->multitoken(), "signal-to-noise ratios in dB to synthesize captures at (default 20 12 10 8 6)")
+        ("capture", po::value<std::vector<std::string>>(), "also compare this CU8 capture at 2.083333Msps; may be given more than once")
+        ("dump978-rb", po::value<std::string>()->default_value("./dump978-rb"), "dump978-rb binary to test")
+        ("legacy", po::value<std::string>()->default_value("legacy/dump978"), "legacy decoder binary to compare against")
+        ("runs", po::value<unsigned>()->default_value(3), "decode each capture this many times, keeping the least CPU time")
+        ("baseline", po::value<std::string>(), "fail if the results are worse than this baseline")
+        ("save-baseline", po::value<std::string>(), "write the results to this file as a new baseline")
+        ("max-decode-loss", po::value<double>()->default_value(1.0), "with --baseline, the percentage fewer messages dump978-rb may decode")
+        ("max-cpu-increase", po::value<double>()->default_value(20.0), "with --baseline, the percentage by which dump978-rb's CPU time relative to the legacy decoder's may grow");
+    // clang-format on
+
+    po::positional_options_description positional;
+    positional.add("capture", -1);
+
+    po::variables_map opts;
+
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), opts);
+        po::notify(opts);
+    } catch (boost::program_options::error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 2;
+    }
+
+    if (opts.count("help")) {
+        std::cerr << desc << std::endl;
+        return 2;
+    }
+
+    const auto cxx_binary = opts["dump978-rb"].as<std::string>();
+    const auto legacy_binary = opts["legacy"].as<std::string>();
+    const unsigned runs = std::max(1u, opts["runs"].as<unsigned>());
+
+    Baseline baseline;
+    if (opts.count("baseline")) {
+        baseline = ReadBaseline(opts["baseline"].as<std::string>());
+    }
+
+    const std::vector<double> snrs = (opts.count("snr") ? opts["snr"].as<std::vector<double>>() : std::vector<double>{20, 12, 10, 8, 6});
+    std::vector<EncodedFrame> frames;
+    std::vector<std::string> sent;
+    if (!snrs.empty()) {
+        const auto path = opts["sample-data"].as<std::string>();
+        const auto messages = LoadSampleData(path, opts["messages"].as<std::size_t>());
+        if (messages.empty()) {
+            std::cerr << "no messages could be read from " << path << std::endl;
+            return 2;
+        }
+
+        FrameEncoder encoder;
+        for (const auto &message : messages) {
+            frames.push_back(encoder.Encode(message));
+            std::string raw;
+            EncodeRaw(message, raw);
+            sent.push_back(raw.substr(0, raw.find(';')));
+        }
+        std::sort(sent.begin(), sent.end());
+    }
+
+    char temp_template[] = "/tmp/dump978-compare-XXXXXX";
+    const char *temp_dir = ::mkdtemp(temp_template);
+    if (!temp_dir) {
+        std::cerr << "cannot create a temporary directory: " << std::strerror(errno) << std::endl;
+        return 2;
+    }
+
+    struct Capture {
+        std::string name;
+        std::string path;
+        bool synthesized;
+    };
+
+    std::vector<Capture> captures;
+    for (auto snr : snrs) {
+        captures.push_back({FormatSnr(snr), std::string(temp_dir) + "/" + FormatSnr(snr) + ".CU8", true});
+    }
+    if (opts.count("capture")) {
+        for (const auto &path : opts["capture"].as<std::vector<std::string>>()) {
+            captures.push_back({Basename(path), path, false});
+        }
+    }
+
+    std::cout << "dump978-compare: " << cxx_binary << " against " << legacy_binary << ", least CPU time of " << runs << " runs" << std::endl << std::endl;
+    ReportHeader();
+
+    std::vector<Result> results;
+    bool failed = false;
+    for (std::size_t k = 0; k < captures.size(); ++k) {
+        const auto &capture = captures[k];
+        Result result;
+        result.name = capture.name;
+        bool ok = true;
+
+        try {
+            if (capture.synthesized) {
+                const auto iq = Modulate(frames, SampleFormat::CU8, NoiseSigma(snrs[k]));
+                if (!WriteFile(capture.path, iq)) {
+                    throw std::runtime_error("cannot write " + capture.path);
+                }
+                result.samples = iq.size() / 2;
+                result.sent = frames.size();
+            } else {
+                struct stat st;
+                if (::stat(capture.path.c_str(), &st) < 0) {
+                    throw std::runtime_error(capture.path + ": " + std::strerror(errno));
+                }
+                result.samples = st.st_size / 2;
+            }
+
+            result.legacy = RunDecoder({legacy_binary}, capture.path, runs);
+            result.cxx = RunDecoder({cxx_binary, "--file", capture.path, "--format", "CU8", "--raw-stdout"}, "", runs);
+            result.common = CountCommon(result.legacy.messages, result.cxx.messages);
+        } catch (const std::exception &e) {
+            std::cerr << capture.name << ": " << e.what() << std::endl;
+            ok = false;
+        }
+
+        if (capture.synthesized) {
+            ::unlink(capture.path.c_str());
+        }
+
+        if (!ok) {
+            failed = true;
+            continue;
+        }
+
+        Report(result);
+        if (result.sent) {
+            std::cout << "  (of the messages sent, legacy decoded " << CountCommon(sent, result.legacy.messages) << ", dump978-rb " << CountCommon(sent, result.cxx.messages) << ")" << std::endl;
+        }
+        results.push_back(std::move(result));
+    }
+
+    ::rmdir(temp_dir);
+
+    if (failed) {
+        return 2;
+    }
+
+    std::cout << std::endl;
+
+    if (opts.count("save-baseline")) {
+        WriteBaseline(opts["save-baseline"].as<std::string>(), results);
+        std::cout << "baseline written to " << opts["save-baseline"].as<std::string>() << std::endl;
+    }
+
+    if (opts.count("baseline")) {
+        if (!CheckBaseline(baseline, results, opts["max-decode-loss"].as<double>(), opts["max-cpu-increase"].as<double>())) {
+            std::cout << "FAILED: worse than the baseline " << opts["baseline"].as<std::string>() << std::endl;
+            return 1;
+        }
+        std::cout << "OK: no worse than the baseline " << opts["baseline"].as<std::string>() << std::endl;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    try {
+        return realmain(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << "dump978-compare: " << e.what() << std::endl;
+        return 2;
+    }
+}
@@ -9,26 +9,58 @@
 #include <boost/program_options.hpp>
 #include <boost/regex.hpp>
 
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <thread>
 
+#include "aircraft_json.h"
+#include "archive.h"
+#ifdef DUMP978_AIRSPY
+#include "airspy_source.h"
+#endif
 #include "convert.h"
+#include "dedup.h"
 #include "demodulator.h"
 #include "exception.h"
+#include "io_pool.h"
+#include "mapped_file.h"
 #include "message_dispatch.h"
+#include "message_filter.h"
+#ifdef DUMP978_RTLSDR
+#include "rtlsdr_source.h"
+#endif
+#include "sample_recorder.h"
 #include "sample_source.h"
 #include "soapy_source.h"
+#include "socket_input.h"
+#include "shm_output.h"
 #include "socket_output.h"
+#include "stats.h"
+#include "stats_server.h"
 #include "stratux_serial.h"
+#include "thread_placement.h"
+#include "trace.h"
+#include "track.h"
+#include "udp_output.h"
 
 using namespace airnav::uat;
 
 namespace po = boost::program_options;
 using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
 
 struct listen_option {
     std::string host;
     std::string port;
+    MessageFilter filter; // [host:]port/filter, output ports only
+};
+
+// --raw-connect / --binary-connect host:port
+struct connect_option {
+    std::string host;
+    std::string port;
 };
 
 SampleFormat format;
@@ -38,12 +70,34 @@ void validate(boost::any &v, const std::vector<std::string> &values, listen_opti
     po::validators::check_first_occurrence(v);
     const std::string &s = po::validators::get_single_string(values);
 
-    static const boost::regex r("(?:([^:]+):)?(\\d+)");
+    static const boost::regex r("(?:([^:/]+):)?(\\d+)(?:/(.*))?");
     boost::smatch match;
     if (boost::regex_match(s, match, r)) {
         listen_option o;
         o.host = match[1];
         o.port = match[2];
+        try {
+            o.filter = MessageFilter::Parse(match[3]);
+        } catch (const std::invalid_argument &err) {
+            throw po::invalid_option_value(s + ": " + err.what());
+        }
+        v = boost::any(o);
+    } else {
+        throw po::validation_error(po::validation_error::invalid_option_value);
+    }
+}
+
+// Specialization of validate for --raw-connect / --binary-connect
+void validate(boost::any &v, const std::vector<std::string> &values, connect_option *target_type, int) {
+    po::validators::check_first_occurrence(v);
+    const std::string &s = po::validators::get_single_string(values);
+
+    static const boost::regex r("(.+):([^:]+)");
+    boost::smatch match;
+    if (boost::regex_match(s, match, r)) {
+        connect_option o;
+        o.host = match[1];
+        o.port = match[2];
         v = boost::any(o);
     } else {
         throw po::validation_error(po::validation_error::invalid_option_value);
@@ -71,10 +125,55 @@ namespace airnav::uat {
 
         v = boost::any(entry->second);
     }
+
+    // Specializations of validate for --slow-client-policy
+    void validate(boost::any &v, const std::vector<std::string> &values, OutputQueueLimits::Policy *target_type, int) {
+        po::validators::check_first_occurrence(v);
+        const std::string &s = po::validators::get_single_string(values);
+
+        // clang-format off
+        static std::map<std::string, OutputQueueLimits::Policy> policies = {
+            {"drop-oldest", OutputQueueLimits::Policy::DROP_OLDEST},
+            {"drop-newest", OutputQueueLimits::Policy::DROP_NEWEST},
+            {"disconnect", OutputQueueLimits::Policy::DISCONNECT}
+        };
+        // clang-format on
+
+        auto entry = policies.find(s);
+        if (entry == policies.end())
+            throw po::validation_error(po::validation_error::invalid_option_value);
+
+        v = boost::any(entry->second);
+    }
 } // namespace airnav::uat
 
 #define EXIT_NO_RESTART (64)
 
+// Find interpolation / decimation (in lowest terms) that resamples
+// `input_rate` to the demodulator's rate at `samples_per_bit`. A rate
+// within 1Hz of a multiple of 2.083333MHz is taken to be exactly that
+// multiple.
+static void DemodResampleRatio(double input_rate, unsigned samples_per_bit, unsigned &interpolation, unsigned &decimation) {
+    const double base = double(DEMOD_SAMPLE_RATE_NUMERATOR) / DEMOD_SAMPLE_RATE_DENOMINATOR;
+    const double multiple = std::round(input_rate / base);
+
+    interpolation = DEMOD_SAMPLE_RATE_NUMERATOR * samples_per_bit / 2;
+    if (multiple >= 1 && std::fabs(input_rate - multiple * base) < 1.0) {
+        decimation = DEMOD_SAMPLE_RATE_NUMERATOR * static_cast<unsigned>(multiple);
+    } else {
+        decimation = static_cast<unsigned>(std::lround(input_rate)) * DEMOD_SAMPLE_RATE_DENOMINATOR;
+    }
+
+    unsigned a = interpolation, b = decimation;
+    while (b) {
+        const unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    interpolation /= a;
+    decimation /= a;
+}
+
 static int realmain(int argc, char **argv) {
     boost::asio::io_service io_service;
 
@@ -89,7 +188,12 @@ static int realmain(int argc, char **argv) {
         ("stdin", "read sample data from stdin")
         ("file", po::value<std::string>(), "read sample data from a file")
         ("file-throttle", "throttle file input to realtime")
-        ("sdr", po::value<std::string>(), "read sample data from named SDR device")
+        ("file-threads", po::value<unsigned>(), "decode --file input faster than realtime on this many threads (0: one per CPU)")
+        ("sample-rate", po::value<double>(), "sample rate in Hz of --file / --stdin data, or to request from --sdr / --rtlsdr devices; other rates than 2083333 are resampled to the demodulator's rate (default 2083333)")
+        ("oversample", "demodulate at 4 samples per bit (4.166667MHz) rather than 2, resampling the input as needed; trying more bit timings per message costs about twice the CPU")
+        ("sdr", po::value<std::vector<std::string>>(), "read sample data from named SDR device; may be given more than once to receive from several devices (e.g. diversity antennas) in one process, with duplicates merged as by --dedup")
+        ("rtlsdr", po::value<std::vector<std::string>>(), "read sample data from an RTL-SDR (by index or serial number) directly through librtlsdr rather than SoapySDR; may be given more than once, and combined with --sdr / --airspy")
+        ("airspy", po::value<std::vector<std::string>>(), "read sample data from an Airspy (by hex serial number, or \"any\") directly through libairspy, resampled from its native rate; may be given more than once, and combined with --sdr / --rtlsdr")
         ("sdr-auto-gain", "enable SDR AGC")
         ("sdr-gain", po::value<double>(), "set SDR gain in dB")
         ("sdr-ppm", po::value<double>(), "set SDR frequency correction in PPM")
@@ -97,9 +201,60 @@ static int realmain(int argc, char **argv) {
         ("sdr-stream-settings", po::value<std::string>(), "set SDR stream key-value settings")
         ("sdr-device-settings", po::value<std::string>(), "set SDR device key-value settings")
         ("stratuxv3", po::value<std::string>(), "read messages from Stratux v3 UAT dongle on given serial port")
-        ("raw-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port and provide raw messages")
-        ("raw-legacy-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port and provide raw messages, with no initial metadata header")
-        ("json-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port and provide decoded json");
+        ("raw-connect", po::value<std::vector<connect_option>>(), "connect to host:port and read raw messages from it, reconnecting if the connection is lost; may be given more than once to merge several receivers")
+        ("binary-connect", po::value<std::vector<connect_option>>(), "connect to host:port and read binary frames (as from --binary-port) from it, like --raw-connect; may be combined with --raw-connect")
+        ("replay-archive", po::value<std::string>(), "replay messages from an --archive directory, then exit")
+        ("replay-from", po::value<std::string>(), "with --replay-archive, start at this UTC time (YYYY-MM-DD HH:MM[:SS], or seconds since the epoch)")
+        ("replay-to", po::value<std::string>(), "with --replay-archive, stop at this UTC time")
+        ("replay-filter", po::value<std::string>(), "with --replay-archive, only replay messages that match this filter (as for output ports, e.g. address=a1b2c3); addresses are looked up in the archive index")
+        ("replay-realtime", "with --replay-archive, replay messages at the rate they were received rather than as fast as possible")
+        ("dedup", "merge duplicate copies of a message received within a short time, e.g. from several --raw-connect receivers, passing on the best copy with a dup= count")
+        ("dedup-hold", po::value<double>(), "seconds to hold the first copy of a message while waiting for duplicates (default 0.2)")
+        ("dedup-window", po::value<double>(), "seconds after the first copy within which later copies are duplicates (default 1)")
+        ("record", po::value<std::string>(), "record raw sample data to files named with this path prefix")
+        ("record-packed", "record CS16H sample data in a losslessly packed format")
+        ("record-rotate", po::value<unsigned>(), "start a new recording file after this many seconds of samples")
+        ("record-trigger", po::value<unsigned>(), "only record this many seconds of samples before and after each SIGUSR1 (which also writes a --trace-file)")
+        ("trace-events", po::value<std::size_t>(), "keep this many recent trace events (sample blocks, sync candidates, FEC attempts, dispatches, SDR overruns) per thread for --trace-file and /trace (default 32768; 0 disables tracing)")
+        ("trace-seconds", po::value<double>(), "write the trace events of this many recent seconds on SIGUSR1, or for /trace on --stats-port (default 10)")
+        ("trace-file", po::value<std::string>(), "on SIGUSR1, write recent trace events to a file named with this path prefix (default /tmp/dump978-trace)")
+        ("sample-timestamps", "give each message a raw timestamp (rt=) counting samples at 2.083333MHz since the sample source started")
+        ("energy-gate", po::value<double>(), "only demodulate samples at least this many dB above the adaptive noise floor")
+        ("soft-decision", "retry frames that fail error correction with their least confident bytes marked as erasures")
+        ("soft-decision-budget", po::value<double>()->default_value(200), "the most --soft-decision retries per second of samples")
+        ("pipelined-receiver", "run sample conversion, demodulation and dispatch on separate threads")
+        ("async-dispatch", "deliver messages to output clients on a separate thread")
+        ("rx-cpus", po::value<std::string>(), "pin SDR rx threads to these CPUs (e.g. \"2\" or \"2-3\"), one CPU per thread in turn")
+        ("demod-cpus", po::value<std::string>(), "pin conversion and demodulation worker threads to these CPUs, one CPU per thread in turn")
+        ("io-cpus", po::value<std::string>(), "pin the network / output thread and dispatch threads to these CPUs, one CPU per thread in turn")
+        ("io-threads", po::value<unsigned>(), "serve --raw-port / --json-port / etc client connections on this many extra threads, sharing the connections out between them (default 0: serve them on the network thread)")
+        ("rx-fifo-priority", po::value<int>(), "run SDR rx threads with SCHED_FIFO realtime scheduling at this priority (1-99)")
+        ("mlockall", "lock all memory, so the rx path never waits for a page fault")
+        ("track", "maintain a table of aircraft state built from received downlink messages")
+        ("track-timeout", po::value<unsigned>(), "forget tracked aircraft after this many seconds without a message (default 300)")
+        ("aircraft-json", po::value<std::string>(), "track aircraft and periodically write an aircraft.json-style snapshot to this file (also served at /aircraft.json on --stats-port)")
+        ("aircraft-json-interval", po::value<double>(), "seconds between aircraft snapshots (default 1)")
+        ("raw-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port[/filter] and provide raw messages. On any output port, the optional filter (e.g. 30978/type=downlink,max-errors=2) selects messages by type=, aq=, address=, min-rssi= and max-errors=; clients can also send a \"filter <spec>\" line")
+        ("raw-latency", "add a lat= field to raw output: microseconds from sample delivery to message encoding")
+        ("raw-legacy-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port[/filter] and provide raw messages, with no initial metadata header")
+        ("binary-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port[/filter] and provide messages as compact length-prefixed binary frames")
+        ("beast-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port[/filter] and provide downlinks converted to 1090ES frames in Beast binary form, for dump1090 / readsb (as legacy/uat2esnt does; use e.g. /aq=0+1+4+5+6+7 to leave out TIS-B); only in builds made with make BEAST=yes")
+        ("udp-raw", po::value<std::vector<connect_option>>(), "send raw messages as UDP datagrams to host:port (unicast or multicast); may be given more than once")
+        ("udp-binary", po::value<std::vector<connect_option>>(), "send binary frames (as for --binary-port) as UDP datagrams to host:port; may be given more than once")
+        ("udp-max-datagram", po::value<std::size_t>(), "pack messages into UDP datagrams of at most this many bytes (default 1400)")
+        ("udp-multicast-ttl", po::value<unsigned>(), "hop limit for multicast UDP output (default 1)")
+        ("shm-output", po::value<std::string>(), "publish binary frames into a shared-memory ring at this path (e.g. /dev/shm/dump978) for local readers; see shm_output.h for the layout")
+        ("shm-slots", po::value<std::size_t>(), "messages the shared-memory ring holds (default 8192)")
+        ("archive", po::value<std::string>(), "append all messages to an indexed archive in this directory, for --replay-archive; see archive.h for the format")
+        ("archive-segment-minutes", po::value<unsigned>(), "start a new archive segment after this many minutes of receive time (default 60)")
+        ("json-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port[/filter] and provide decoded json")
+        ("nexrad-port", po::value<std::vector<listen_option>>(), "listen for connections on [host:]port and provide NEXRAD image blocks assembled from FIS-B uplinks")
+        ("output-queue-bytes", po::value<std::size_t>(), "maximum bytes of output to queue for a slow network client")
+        ("output-queue-age", po::value<double>(), "maximum age in seconds of output queued for a slow network client")
+        ("output-coalesce-time", po::value<double>(), "hold output for a network client for up to this many milliseconds, to send it in fewer, larger writes (default 0: send immediately)")
+        ("output-coalesce-bytes", po::value<std::size_t>(), "with --output-coalesce-time, send as soon as this many bytes are waiting (default 16384)")
+        ("slow-client-policy", po::value<OutputQueueLimits::Policy>(), "what to do when a network client's output queue is over its limits: drop-oldest (default), drop-newest, disconnect")
+        ("stats-port", po::value<std::vector<listen_option>>(), "listen for HTTP connections on [host:]port and provide receiver statistics (Prometheus format at /metrics, JSON at /stats.json)");
     // clang-format on
 
     po::variables_map opts;
@@ -124,33 +279,206 @@ static int realmain(int argc, char **argv) {
         return EXIT_NO_RESTART;
     }
 
+    // thread placement must be configured before any threads start
+    const std::pair<const char *, ThreadRole> cpu_options[] = {{"rx-cpus", ThreadRole::RX}, {"demod-cpus", ThreadRole::DEMOD}, {"io-cpus", ThreadRole::IO}};
+    for (const auto &option : cpu_options) {
+        ThreadPlacement placement;
+        if (opts.count(option.first)) {
+            try {
+                placement.cpus = ParseCpuList(opts[option.first].as<std::string>());
+            } catch (const std::invalid_argument &err) {
+                std::cerr << "--" << option.first << ": " << err.what() << std::endl;
+                return EXIT_NO_RESTART;
+            }
+        }
+        if (option.second == ThreadRole::RX && opts.count("rx-fifo-priority")) {
+            placement.fifo_priority = opts["rx-fifo-priority"].as<int>();
+            if (placement.fifo_priority < 1 || placement.fifo_priority > 99) {
+                std::cerr << "--rx-fifo-priority must be between 1 and 99" << std::endl;
+                return EXIT_NO_RESTART;
+            }
+        }
+        SetThreadPlacement(option.second, placement);
+    }
+
+    if (opts.count("mlockall")) {
+        LockMemory();
+    }
+
+    // likewise for the trace rings, which threads create as they start
+    if (opts.count("trace-events")) {
+        trace::SetRingSize(opts["trace-events"].as<std::size_t>());
+    }
+    std::chrono::milliseconds trace_window = std::chrono::seconds(10);
+    if (opts.count("trace-seconds")) {
+        const double seconds = opts["trace-seconds"].as<double>();
+        if (seconds <= 0) {
+            std::cerr << "--trace-seconds must be positive" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+        trace_window = std::chrono::milliseconds(std::llround(seconds * 1000));
+    }
+    const std::string trace_prefix = (opts.count("trace-file") ? opts["trace-file"].as<std::string>() : "/tmp/dump978-trace");
+
+    // created before the dispatcher, so it outlives the connections that
+    // the dispatcher holds
+    IoServicePool::Pointer io_pool;
+    if (opts.count("io-threads") && opts["io-threads"].as<unsigned>() > 0) {
+        io_pool = IoServicePool::Create(opts["io-threads"].as<unsigned>());
+    }
+
     MessageDispatch dispatch;
-    SampleSource::Pointer sample_source;
+    std::vector<SampleSource::Pointer> sample_sources;
+    std::vector<std::string> sample_source_names; // stats labels, when there is more than one source
     MessageSource::Pointer message_source;
 
     tcp::resolver resolver(io_service);
 
-    if (opts.count("stdin") + opts.count("file") + opts.count("sdr") + opts.count("stratuxv3") != 1) {
-        std::cerr << "Exactly one of --stdin, --file, --sdr, or --stratuxv3 must be used" << std::endl;
+    const bool network_input = (opts.count("raw-connect") > 0 || opts.count("binary-connect") > 0);
+    const bool sdr_input = (opts.count("sdr") > 0 || opts.count("rtlsdr") > 0 || opts.count("airspy") > 0);
+    if (opts.count("stdin") + opts.count("file") + opts.count("stratuxv3") + opts.count("replay-archive") + (sdr_input ? 1 : 0) + (network_input ? 1 : 0) != 1) {
+        std::cerr << "Exactly one of --stdin, --file, --sdr/--rtlsdr/--airspy, --stratuxv3, --replay-archive, or --raw-connect/--binary-connect must be used" << std::endl;
         return EXIT_NO_RESTART;
     }
 
+    const unsigned samples_per_bit = (opts.count("oversample") ? 4 : 2);
+    double input_rate = DEMOD_SAMPLE_RATE;
+    if (opts.count("sample-rate")) {
+        input_rate = opts["sample-rate"].as<double>();
+        if (input_rate < 1e6 || input_rate > 100e6) {
+            std::cerr << "--sample-rate must be between 1MHz and 100MHz" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+    }
+
     if (opts.count("stdin")) {
-        sample_source = StdinSampleSource::Create(io_service, opts);
+        sample_sources.push_back(StdinSampleSource::Create(io_service, opts, std::lround(input_rate)));
+    } else if (opts.count("file") && opts.count("file-threads")) {
+        if (!opts.count("format")) {
+            std::cerr << "--format must be specified when using a file input" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+        if (opts.count("file-throttle")) {
+            std::cerr << "--file-threads cannot be used with --file-throttle" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+        if (opts.count("pipelined-receiver")) {
+            std::cerr << "--file-threads cannot be used with --pipelined-receiver" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+        if (opts.count("record")) {
+            std::cerr << "--file-threads cannot be used with --record" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+        if (opts.count("sample-rate") || opts.count("oversample")) {
+            std::cerr << "--file-threads cannot be used with --sample-rate or --oversample" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+        if (opts.count("energy-gate")) {
+            std::cerr << "--file-threads cannot be used with --energy-gate" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+
+        auto threads = opts["file-threads"].as<unsigned>();
+        if (threads == 0) {
+            threads = std::max(1U, std::thread::hardware_concurrency());
+        }
+
+        MappedFile::Pointer file;
+        try {
+            file = MappedFile::Open(opts["file"].as<std::string>());
+        } catch (const boost::system::system_error &err) {
+            std::cerr << "--file: " << err.what() << std::endl;
+            return 1;
+        }
+        if (file->Size() >= sizeof(PACKED_MAGIC) && std::equal(PACKED_MAGIC, PACKED_MAGIC + sizeof(PACKED_MAGIC), file->Data())) {
+            std::cerr << "--file-threads cannot read packed sample files, use --file alone" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+        auto receiver = ParallelFileReceiver::Create(opts["format"].as<SampleFormat>(), file, threads);
+        if (opts.count("sample-timestamps")) {
+            receiver->EnableRawTimestamps();
+        }
+        if (opts.count("soft-decision")) {
+            receiver->EnableSoftDecision(opts["soft-decision-budget"].as<double>());
+        }
+        message_source = receiver;
     } else if (opts.count("file")) {
         boost::filesystem::path path(opts["file"].as<std::string>());
-        sample_source = FileSampleSource::Create(io_service, path, opts);
-    } else if (opts.count("sdr")) {
-        auto device = opts["sdr"].as<std::string>();
-        sample_source = SoapySampleSource::Create(io_service, device, opts);
+        sample_sources.push_back(FileSampleSource::Create(io_service, path, opts, std::lround(input_rate)));
+    } else if (sdr_input) {
+        // each device has its own rx thread and receiver
+        if (opts.count("sdr")) {
+            for (const auto &device : opts["sdr"].as<std::vector<std::string>>()) {
+                sample_sources.push_back(SoapySampleSource::Create(io_service, device, opts));
+                sample_source_names.push_back(device);
+            }
+        }
+        if (opts.count("rtlsdr")) {
+#ifdef DUMP978_RTLSDR
+            for (const auto &device : opts["rtlsdr"].as<std::vector<std::string>>()) {
+                sample_sources.push_back(RtlSdrSampleSource::Create(io_service, device, opts));
+                sample_source_names.push_back("rtlsdr:" + device);
+            }
+#else
+            std::cerr << "--rtlsdr: this build does not include librtlsdr support (build with make RTLSDR=yes)" << std::endl;
+            return EXIT_NO_RESTART;
+#endif
+        }
+        if (opts.count("airspy")) {
+#ifdef DUMP978_AIRSPY
+            for (const auto &device : opts["airspy"].as<std::vector<std::string>>()) {
+                sample_sources.push_back(AirspySampleSource::Create(io_service, device, opts));
+                sample_source_names.push_back("airspy:" + device);
+            }
+#else
+            std::cerr << "--airspy: this build does not include libairspy support (build with make AIRSPY=yes)" << std::endl;
+            return EXIT_NO_RESTART;
+#endif
+        }
+        if (sample_sources.size() < 2) {
+            sample_source_names.clear();
+        }
     } else if (opts.count("stratuxv3")) {
         auto path = opts["stratuxv3"].as<std::string>();
         message_source = StratuxSerial::Create(io_service, path);
+    } else if (network_input) {
+        std::vector<MessageSource::Pointer> inputs;
+        if (opts.count("raw-connect")) {
+            for (const auto &c : opts["raw-connect"].as<std::vector<connect_option>>()) {
+                inputs.push_back(RawInput::Create(io_service, c.host, c.port, std::chrono::seconds(15)));
+            }
+        }
+        if (opts.count("binary-connect")) {
+            for (const auto &c : opts["binary-connect"].as<std::vector<connect_option>>()) {
+                inputs.push_back(BinaryInput::Create(io_service, c.host, c.port, std::chrono::seconds(15)));
+            }
+        }
+        message_source = MergedMessageSource::Create(inputs);
+    } else if (opts.count("replay-archive")) {
+        std::uint64_t from_ms = 0, to_ms = std::numeric_limits<std::uint64_t>::max();
+        MessageFilter filter;
+        try {
+            if (opts.count("replay-from")) {
+                from_ms = ParseUtcTime(opts["replay-from"].as<std::string>());
+            }
+            if (opts.count("replay-to")) {
+                to_ms = ParseUtcTime(opts["replay-to"].as<std::string>());
+            }
+            if (opts.count("replay-filter")) {
+                filter = MessageFilter::Parse(opts["replay-filter"].as<std::string>());
+            }
+            message_source = ArchiveReplay::Create(opts["replay-archive"].as<std::string>(), from_ms, to_ms, filter, opts.count("replay-realtime") > 0);
+        } catch (const std::invalid_argument &err) {
+            std::cerr << "--replay-archive: " << err.what() << std::endl;
+            return EXIT_NO_RESTART;
+        }
     } else {
         assert("impossible case" && false);
     }
 
-    auto create_output_port = [&](std::string option, SocketListener::ConnectionFactory factory) -> bool {
+    // call `listen` for each address of each [host:]port given for `option`
+    auto create_listeners = [&](std::string option, std::function<void(const tcp::endpoint &, const MessageFilter &)> listen) -> bool {
         if (!opts.count(option)) {
             return true;
         }
@@ -166,9 +494,12 @@ static int realmain(int argc, char **argv) {
                 const auto &endpoint = i->endpoint();
 
                 try {
-                    auto listener = SocketListener::Create(io_service, endpoint, dispatch, factory);
-                    listener->Start();
-                    std::cerr << option << ": listening for connections on " << endpoint << std::endl;
+                    listen(endpoint, l.filter);
+                    std::cerr << option << ": listening for connections on " << endpoint;
+                    if (!l.filter.PassesEverything()) {
+                        std::cerr << " (filter \"" << l.filter.ToString() << "\")";
+                    }
+                    std::cerr << std::endl;
                     success = true;
                 } catch (boost::system::system_error &err) {
                     std::cerr << option << ": could not listen on " << endpoint << ": " << err.what() << std::endl;
@@ -185,10 +516,52 @@ static int realmain(int argc, char **argv) {
         return ok;
     };
 
+    Tracker::Pointer tracker;
+    AircraftJson::Pointer aircraft_json;
+    if (opts.count("track") || opts.count("track-timeout") || opts.count("aircraft-json")) {
+        std::chrono::milliseconds timeout = std::chrono::seconds(300);
+        if (opts.count("track-timeout")) {
+            timeout = std::chrono::seconds(opts["track-timeout"].as<unsigned>());
+        }
+        if (timeout.count() <= 0) {
+            std::cerr << "--track-timeout must be positive" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+
+        // file input has timestamps that count from the start of the file, and
+        // archived messages are not contemporaneous, so neither is system time
+        tracker = Tracker::Create(io_service, timeout, opts.count("file") == 0 && opts.count("replay-archive") == 0);
+        dispatch.AddClient(std::bind(&Tracker::HandleMessages, tracker, std::placeholders::_1));
+        stats::AddCollector([tracker](std::vector<stats::Metric> &metrics) {
+            metrics.push_back({"tracked_aircraft", {}, (double)tracker->NumAircraft(), false});
+            metrics.push_back({"tracker_messages_total", {}, (double)tracker->TotalMessages(), true});
+            metrics.push_back({"tracker_discarded_messages_total", {}, (double)tracker->DiscardedMessages(), true});
+        });
+
+        std::chrono::milliseconds interval = std::chrono::seconds(1);
+        if (opts.count("aircraft-json-interval")) {
+            interval = std::chrono::milliseconds(static_cast<std::int64_t>(opts["aircraft-json-interval"].as<double>() * 1000));
+        }
+        if (interval.count() <= 0) {
+            std::cerr << "--aircraft-json-interval must be positive" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+
+        aircraft_json = AircraftJson::Create(io_service, tracker, interval, opts.count("aircraft-json") ? opts["aircraft-json"].as<std::string>() : std::string());
+    }
+
+
+    auto create_output_port = [&](std::string option, SocketListener::ConnectionFactory factory) -> bool {
+        return create_listeners(option, [&](const tcp::endpoint &endpoint, const MessageFilter &filter) {
+            auto listener = SocketListener::Create(io_service, endpoint, dispatch, factory, io_pool, filter);
+            listener->Start();
+        });
+    };
+
     // Emit initial metadata-only message advertising our version etc
     SharedMessageVector header;
     if (!opts.count("raw-disable-header")) {
-        header = std::make_shared<MessageVector>();
+        header = MessageVector::Create();
 
         // clang-format off
         RawMessage::MetadataMap metadata = {
@@ -200,48 +573,330 @@ static int realmain(int argc, char **argv) {
         header->push_back(RawMessage(std::move(metadata)));
     }
 
-    auto raw_factory = std::bind(&RawOutput::Create, std::placeholders::_1, std::placeholders::_2, header);
+    OutputQueueLimits output_limits;
+    if (opts.count("output-queue-bytes")) {
+        output_limits.max_bytes = opts["output-queue-bytes"].as<std::size_t>();
+    }
+    if (opts.count("output-queue-age")) {
+        output_limits.max_age = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(opts["output-queue-age"].as<double>()));
+    }
+    if (opts.count("slow-client-policy")) {
+        output_limits.policy = opts["slow-client-policy"].as<OutputQueueLimits::Policy>();
+    }
+    if (opts.count("output-coalesce-time")) {
+        const double ms = opts["output-coalesce-time"].as<double>();
+        if (ms < 0) {
+            std::cerr << "--output-coalesce-time must not be negative" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+        output_limits.coalesce_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(ms));
+    }
+    if (opts.count("output-coalesce-bytes")) {
+        output_limits.coalesce_bytes = opts["output-coalesce-bytes"].as<std::size_t>();
+    }
+
+    const bool raw_latency = (opts.count("raw-latency") > 0);
+    auto raw_factory = std::bind(&RawOutput::Create, std::placeholders::_1, std::placeholders::_2, output_limits, header, raw_latency);
     auto raw_ok = create_output_port("raw-port", raw_factory);
 
-    auto raw_legacy_factory = std::bind(&RawOutput::Create, std::placeholders::_1, std::placeholders::_2, SharedMessageVector());
+    auto raw_legacy_factory = std::bind(&RawOutput::Create, std::placeholders::_1, std::placeholders::_2, output_limits, SharedMessageVector(), raw_latency);
     auto raw_legacy_ok = create_output_port("raw-legacy-port", raw_legacy_factory);
 
-    auto json_ok = create_output_port("json-port", &JsonOutput::Create);
-    if (!raw_ok || !raw_legacy_ok || !json_ok) {
+    auto binary_factory = std::bind(&BinaryOutput::Create, std::placeholders::_1, std::placeholders::_2, output_limits, header);
+    auto binary_ok = create_output_port("binary-port", binary_factory);
+
+    auto json_factory = std::bind(&JsonOutput::Create, std::placeholders::_1, std::placeholders::_2, output_limits);
+    auto json_ok = create_output_port("json-port", json_factory);
+
+#ifdef DUMP978_BEAST
+    auto beast_factory = std::bind(&BeastOutput::Create, std::placeholders::_1, std::placeholders::_2, output_limits);
+    auto beast_ok = create_output_port("beast-port", beast_factory);
+#else
+    if (opts.count("beast-port")) {
+        std::cerr << "--beast-port: this build does not include 1090ES conversion (build with make BEAST=yes)" << std::endl;
+        return EXIT_NO_RESTART;
+    }
+    const bool beast_ok = true;
+#endif
+
+    bool nexrad_ok = true;
+    if (opts.count("nexrad-port")) {
+        // the cache is a client of its own, so the images are kept up to date while no one is connected
+        auto nexrad = NexradCache::Create();
+        dispatch.AddClient([nexrad](SharedMessageVector messages) { nexrad->Update(messages); });
+        stats::AddCollector([nexrad](std::vector<stats::Metric> &metrics) {
+            metrics.push_back({"nexrad_blocks", {}, (double)nexrad->NumBlocks(), false});
+            metrics.push_back({"nexrad_apdus_total", {}, (double)nexrad->TotalApdus(), true});
+            metrics.push_back({"nexrad_repeated_apdus_total", {}, (double)nexrad->RepeatedApdus(), true});
+        });
+
+        auto nexrad_factory = std::bind(&NexradOutput::Create, std::placeholders::_1, std::placeholders::_2, output_limits, nexrad);
+        nexrad_ok = create_output_port("nexrad-port", nexrad_factory);
+    }
+
+    // one dispatch client per format, sending to every destination given for it
+    auto create_udp_output = [&](std::string option, UdpOutput::Format format) -> bool {
+        if (!opts.count(option)) {
+            return true;
+        }
+
+        std::vector<udp::endpoint> destinations;
+        udp::resolver udp_resolver(io_service);
+        for (const auto &c : opts[option].as<std::vector<connect_option>>()) {
+            boost::system::error_code ec;
+            udp::resolver::iterator end;
+            auto i = udp_resolver.resolve(udp::resolver::query(c.host, c.port), ec);
+            if (ec || i == end) {
+                std::cerr << option << ": could not resolve " << c.host << ":" << c.port << ": " << ec.message() << std::endl;
+                return false;
+            }
+            destinations.push_back(i->endpoint());
+            std::cerr << option << ": sending to " << i->endpoint() << std::endl;
+        }
+
+        const std::size_t max_datagram = (opts.count("udp-max-datagram") ? opts["udp-max-datagram"].as<std::size_t>() : 1400);
+        const unsigned ttl = (opts.count("udp-multicast-ttl") ? opts["udp-multicast-ttl"].as<unsigned>() : 1);
+        UdpOutput::Pointer output;
+        try {
+            output = UdpOutput::Create(io_service, destinations, format, max_datagram, ttl);
+        } catch (boost::system::system_error &err) {
+            std::cerr << option << ": " << err.what() << std::endl;
+            return false;
+        }
+
+        dispatch.AddClient(std::bind(&UdpOutput::HandleMessages, output, std::placeholders::_1));
+        stats::AddCollector([option, output](std::vector<stats::Metric> &metrics) {
+            const std::map<std::string, std::string> labels = {{"output", option}};
+            metrics.push_back({"udp_datagrams_total", labels, (double)output->DatagramsSent(), true});
+            metrics.push_back({"udp_bytes_total", labels, (double)output->BytesSent(), true});
+            metrics.push_back({"udp_dropped_datagrams_total", labels, (double)output->DatagramsDropped(), true});
+        });
+        return true;
+    };
+
+    auto udp_raw_ok = create_udp_output("udp-raw", UdpOutput::Format::RAW);
+    auto udp_binary_ok = create_udp_output("udp-binary", UdpOutput::Format::BINARY);
+
+    bool shm_ok = true;
+    if (opts.count("shm-output")) {
+        const auto path = opts["shm-output"].as<std::string>();
+        const std::size_t slots = (opts.count("shm-slots") ? opts["shm-slots"].as<std::size_t>() : 8192);
+        try {
+            auto ring = ShmRingOutput::Create(path, slots);
+            dispatch.AddClient(std::bind(&ShmRingOutput::HandleMessages, ring, std::placeholders::_1));
+            // weak, so that the ring is closed (and its readers told) when the dispatch goes away
+            std::weak_ptr<ShmRingOutput> weak_ring = ring;
+            stats::AddCollector([weak_ring](std::vector<stats::Metric> &metrics) {
+                if (auto ring = weak_ring.lock()) {
+                    metrics.push_back({"shm_messages_total", {}, (double)ring->MessagesWritten(), true});
+                    metrics.push_back({"shm_wakeups_total", {}, (double)ring->Wakeups(), true});
+                }
+            });
+            std::cerr << "shm-output: publishing to " << path << std::endl;
+        } catch (boost::system::system_error &err) {
+            std::cerr << "shm-output: " << err.what() << std::endl;
+            shm_ok = false;
+        }
+    }
+
+    bool archive_ok = true;
+    MessageArchive::Pointer archive;
+    if (opts.count("archive")) {
+        MessageArchive::Options archive_options;
+        archive_options.directory = opts["archive"].as<std::string>();
+        if (opts.count("archive-segment-minutes")) {
+            archive_options.segment = std::chrono::minutes(opts["archive-segment-minutes"].as<unsigned>());
+        }
+        try {
+            archive = MessageArchive::Create(archive_options);
+            dispatch.AddClient(std::bind(&MessageArchive::HandleMessages, archive, std::placeholders::_1));
+            stats::AddCollector([archive](std::vector<stats::Metric> &metrics) {
+                metrics.push_back({"archive_messages_total", {}, (double)archive->MessagesWritten(), true});
+                metrics.push_back({"archive_dropped_batches_total", {}, (double)archive->DroppedBatches(), true});
+            });
+        } catch (const std::invalid_argument &err) {
+            std::cerr << "--archive: " << err.what() << std::endl;
+            archive_ok = false;
+        } catch (const boost::system::system_error &err) {
+            std::cerr << "--archive: " << err.what() << std::endl;
+            archive_ok = false;
+        }
+    }
+
+    auto stats_ok = create_listeners("stats-port", [&](const tcp::endpoint &endpoint, const MessageFilter &) {
+        auto server = StatsServer::Create(io_service, endpoint);
+        if (aircraft_json) {
+            server->AddRoute("/aircraft.json", "application/json", [aircraft_json] { return *aircraft_json->Snapshot(); });
+        }
+        server->AddRoute("/trace", "text/plain", [trace_window] { return trace::Format(trace_window); });
+        server->Start();
+    });
+    if (!raw_ok || !raw_legacy_ok || !binary_ok || !json_ok || !beast_ok || !udp_raw_ok || !udp_binary_ok || !shm_ok || !archive_ok || !nexrad_ok || !stats_ok) {
         return 1;
     }
 
+    stats::AddCollector(&SocketOutput::CollectStats);
+    stats::AddCollector([&dispatch](std::vector<stats::Metric> &metrics) { metrics.push_back({"dispatch_dropped_messages_total", {}, (double)dispatch.DroppedMessages(), true}); });
+
     if (opts.count("raw-stdout")) {
-        dispatch.AddClient([](SharedMessageVector messages) {
-            for (const auto &message : *messages) {
-                std::cout << message << std::endl;
-            }
+        dispatch.AddClient([raw_latency](SharedMessageVector messages) {
+            std::string out;
+            EncodeRawLines(*messages, out, raw_latency);
+            std::cout << out << std::flush;
         });
     }
 
     if (opts.count("json-stdout")) {
         dispatch.AddClient([](SharedMessageVector messages) {
-            for (const auto &message : *messages) {
-                if (message.Type() == MessageType::DOWNLINK_SHORT || message.Type() == MessageType::DOWNLINK_LONG) {
-                    std::cout << AdsbMessage(message).ToJson() << std::endl;
-                }
+            std::string out;
+            for (const auto &message : messages->DecodedDownlink()) {
+                message.EncodeJson(out);
+                out += '\n';
             }
+            std::cout << out << std::flush;
         });
     }
 
     bool saw_error = false;
+    SampleRecorder::Pointer recorder;
+
+    if (opts.count("record") && sample_sources.size() > 1) {
+        std::cerr << "--record can only be used with a single sample source" << std::endl;
+        return EXIT_NO_RESTART;
+    }
+
+    std::vector<MessageSource::Pointer> receivers;
+    for (std::size_t i = 0; i < sample_sources.size(); ++i) {
+        auto sample_source = sample_sources[i];
+        std::map<std::string, std::string> source_labels;
+        if (!sample_source_names.empty()) {
+            source_labels["sdr"] = sample_source_names[i];
+        }
 
-    if (sample_source) {
         sample_source->Init();
+
+        if (auto soapy = std::dynamic_pointer_cast<SoapySampleSource>(sample_source)) {
+            stats::AddCollector([soapy, source_labels](std::vector<stats::Metric> &metrics) {
+                metrics.push_back({"sdr_read_samples", source_labels, (double)soapy->ReadSamples(), false});
+                metrics.push_back({"sdr_read_size_changes_total", source_labels, (double)soapy->ReadSizeChanges(), true});
+                metrics.push_back({"sdr_backlogged_reads_total", source_labels, (double)soapy->BackloggedReads(), true});
+                metrics.push_back({"sdr_ring_bytes", source_labels, (double)soapy->RingCapacity(), false});
+                metrics.push_back({"sdr_ring_used_bytes", source_labels, (double)soapy->RingUsed(), false});
+            });
+        }
+
+        // resample to the demodulator's rate, unless the source already
+        // delivers it (Airspy devices resample themselves)
+        bool native_rate = false;
+#ifdef DUMP978_AIRSPY
+        native_rate = (std::dynamic_pointer_cast<AirspySampleSource>(sample_source) != nullptr);
+#endif
+        unsigned interpolation, decimation;
+        DemodResampleRatio(input_rate, samples_per_bit, interpolation, decimation);
+        if (!native_rate && interpolation != decimation) {
+            if (interpolation > 4096) {
+                std::cerr << "--sample-rate: cannot resample " << input_rate << " Hz to the demodulator's rate (ratio " << interpolation << "/" << decimation << " is too complex)" << std::endl;
+                return EXIT_NO_RESTART;
+            }
+            std::cerr << "Resampling " << input_rate << " Hz input by " << interpolation << "/" << decimation << " (" << RationalResampler::Implementation() << ")" << std::endl;
+            sample_source = ResampledSampleSource::Create(sample_source, input_rate, interpolation, decimation);
+            sample_sources[i] = sample_source;
+        }
+
         auto format = sample_source->Format();
 
-        auto receiver = std::make_shared<SingleThreadReceiver>(format);
+        std::shared_ptr<Receiver> receiver;
+        if (opts.count("pipelined-receiver")) {
+            // only drop data when reading from a realtime source
+            receiver = std::make_shared<PipelinedReceiver>(format, sdr_input, 8, samples_per_bit);
+        } else {
+            receiver = SingleThreadReceiver::Create(format, samples_per_bit);
+        }
 
-        sample_source->SetConsumer([receiver](std::uint64_t timestamp, const Bytes &buffer) { receiver->HandleSamples(timestamp, buffer.begin(), buffer.end()); });
+        if (auto pipelined = std::dynamic_pointer_cast<PipelinedReceiver>(receiver)) {
+            stats::AddCollector([pipelined, source_labels](std::vector<stats::Metric> &metrics) {
+                const std::pair<const char *, PipelinedReceiver::QueueDepth> queues[] = {{"conversion", pipelined->ConversionQueueDepth()}, {"demod", pipelined->DemodQueueDepth()}, {"dispatch", pipelined->DispatchQueueDepth()}};
+                for (const auto &queue : queues) {
+                    auto labels = source_labels;
+                    labels["queue"] = queue.first;
+                    metrics.push_back({"pipeline_queue_depth", labels, (double)queue.second.current, false});
+                    metrics.push_back({"pipeline_queue_capacity", labels, (double)queue.second.capacity, false});
+                }
+                metrics.push_back({"pipeline_dropped_blocks_total", source_labels, (double)pipelined->DroppedBlocks(), true});
+            });
+        }
 
-        sample_source->SetErrorHandler(std::bind(&SingleThreadReceiver::HandleError, receiver, std::placeholders::_1));
+        if (opts.count("energy-gate")) {
+            receiver->EnableEnergyGate(opts["energy-gate"].as<double>());
+        }
+        if (opts.count("sample-timestamps")) {
+            receiver->EnableRawTimestamps();
+        }
+        if (opts.count("soft-decision")) {
+            receiver->EnableSoftDecision(opts["soft-decision-budget"].as<double>());
+        }
+
+        sample_source->SetHistory(receiver->NumTrailingSamples());
+        if (opts.count("record")) {
+            SampleRecorder::Options record_options;
+            record_options.prefix = opts["record"].as<std::string>();
+            record_options.pack = (opts.count("record-packed") > 0);
+            record_options.samples_per_second = DEMOD_SAMPLE_RATE * samples_per_bit / 2;
+            if (opts.count("record-rotate"))
+                record_options.rotate = std::chrono::seconds(opts["record-rotate"].as<unsigned>());
+            if (opts.count("record-trigger"))
+                record_options.trigger = std::chrono::seconds(opts["record-trigger"].as<unsigned>());
+
+            try {
+                recorder = SampleRecorder::Create(format, record_options);
+            } catch (const std::runtime_error &err) {
+                std::cerr << "--record: " << err.what() << std::endl;
+                return EXIT_NO_RESTART;
+            }
+
+            stats::AddCollector([recorder](std::vector<stats::Metric> &metrics) { metrics.push_back({"recorder_dropped_blocks_total", {}, (double)recorder->DroppedBlocks(), true}); });
+
+            // the recorder only copies the block, it never waits
+            sample_source->SetConsumer([receiver, recorder](const SampleBlock &block) {
+                recorder->HandleSamples(block);
+                receiver->HandleSamples(block);
+            });
+        } else {
+            sample_source->SetConsumer(std::bind(&Receiver::HandleSamples, receiver, std::placeholders::_1));
+        }
+
+        sample_source->SetErrorHandler(std::bind(&Receiver::HandleError, receiver, std::placeholders::_1));
 
-        message_source = std::static_pointer_cast<MessageSource>(receiver);
+        receivers.push_back(std::static_pointer_cast<MessageSource>(receiver));
+    }
+
+    if (receivers.size() == 1) {
+        message_source = receivers[0];
+    } else if (receivers.size() > 1) {
+        message_source = MergedMessageSource::Create(receivers);
+    }
+
+    // several SDRs in one process hear the same messages
+    if (opts.count("dedup") || sample_sources.size() > 1) {
+        auto hold = std::chrono::milliseconds(200);
+        if (opts.count("dedup-hold")) {
+            hold = std::chrono::milliseconds((long)(opts["dedup-hold"].as<double>() * 1000));
+        }
+        auto window = std::chrono::milliseconds(1000);
+        if (opts.count("dedup-window")) {
+            window = std::chrono::milliseconds((long)(opts["dedup-window"].as<double>() * 1000));
+        }
+        if (hold.count() < 0 || window < hold) {
+            std::cerr << "--dedup-hold must be between zero and --dedup-window" << std::endl;
+            return EXIT_NO_RESTART;
+        }
+
+        auto dedup = Deduplicator::Create(io_service, message_source, hold, window);
+        stats::AddCollector([dedup](std::vector<stats::Metric> &metrics) {
+            metrics.push_back({"dedup_unique_messages_total", {}, (double)dedup->UniqueMessages(), true});
+            metrics.push_back({"dedup_duplicate_messages_total", {}, (double)dedup->DuplicateMessages(), true});
+        });
+        message_source = dedup;
     }
 
     message_source->SetConsumer(std::bind(&MessageDispatch::Dispatch, &dispatch, std::placeholders::_1));
@@ -262,17 +917,76 @@ static int realmain(int argc, char **argv) {
         io_service.stop();
     });
 
+    boost::asio::signal_set trigger_signals(io_service);
+    const bool trigger_recording = (recorder && opts.count("record-trigger"));
+    std::function<void(const boost::system::error_code &, int)> handle_trigger = [&](const boost::system::error_code &ec, int) {
+        if (ec) {
+            return;
+        }
+        if (trigger_recording) {
+            std::cerr << "Caught SIGUSR1, triggering recording" << std::endl;
+            recorder->Trigger();
+        }
+        const auto filename = trace::Dump(trace_prefix, trace_window);
+        if (!filename.empty()) {
+            std::cerr << "Caught SIGUSR1, wrote recent trace events to " << filename << std::endl;
+        }
+        trigger_signals.async_wait(handle_trigger);
+    };
+    trigger_signals.add(SIGUSR1);
+    trigger_signals.async_wait(handle_trigger);
+
+    if (opts.count("async-dispatch")) {
+        // only drop messages when reading from a realtime source
+        dispatch.StartAsync(64, sdr_input || opts.count("stratuxv3") > 0 || network_input);
+    }
+
+    if (tracker) {
+        tracker->Start();
+    }
+    if (aircraft_json) {
+        aircraft_json->Start();
+    }
+    if (archive) {
+        archive->Start();
+    }
     message_source->Start();
-    if (sample_source) {
+    if (recorder) {
+        recorder->Start();
+    }
+    for (const auto &sample_source : sample_sources) {
         sample_source->Start();
     }
 
+    if (io_pool) {
+        io_pool->Start();
+    }
+
+    // after starting everything else, so no other thread inherits this placement
+    ApplyThreadPlacement(ThreadRole::IO, nullptr);
     io_service.run();
 
-    if (sample_source) {
+    for (const auto &sample_source : sample_sources) {
         sample_source->Stop();
     }
+    if (recorder) {
+        recorder->Stop();
+    }
     message_source->Stop();
+    dispatch.StopAsync();
+    if (archive) {
+        // after everything that feeds it, so the segment's index covers all of it
+        archive->Stop();
+    }
+    if (io_pool) {
+        io_pool->Stop();
+    }
+    if (aircraft_json) {
+        aircraft_json->Stop();
+    }
+    if (tracker) {
+        tracker->Stop();
+    }
 
     if (saw_error) {
         std::cerr << "Abnormal exit" << std::endl;
@@ -0,0 +1,346 @@
+#include "uat_message.h"
+#include "uat_protocol.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <boost/io/ios_state.hpp>
+
+using namespace airnav::uat;
+
+static unsigned failures = 0;
+
+// The iostream-based raw line formatter that EncodeRaw replaced, kept
+// here as the reference for the expected output
+static void reference_raw(std::ostream &os, const RawMessage &message) {
+    boost::io::ios_flags_saver ifs(os);
+
+    switch (message.Type()) {
+    case MessageType::DOWNLINK_SHORT:
+    case MessageType::DOWNLINK_LONG:
+        os << '-';
+        break;
+    case MessageType::UPLINK:
+        os << '+';
+        break;
+    default:
+        os << '!';
+        break;
+    }
+
+    if (message.Type() != MessageType::METADATA) {
+        os << std::setfill('0');
+        for (auto b : message.Payload()) {
+            os << std::hex << std::setw(2) << (int)b;
+        }
+
+        os << ";";
+    }
+
+    if (message.Errors() > 0) {
+        os << "rs=" << std::dec << std::setw(0) << message.Errors() << ';';
+    }
+    if (message.Rssi() != 0) {
+        os << "rssi=" << std::dec << std::setprecision(1) << std::fixed << message.Rssi() << ';';
+    }
+    if (message.ReceivedAt() != 0) {
+        os << "t=" << std::dec << std::setw(0) << (message.ReceivedAt() / 1000) << '.' << std::setfill('0') << std::setw(3) << (message.ReceivedAt() % 1000) << ';';
+    }
+    if (message.RawTimestamp() != 0) {
+        os << "rt=" << std::dec << std::setw(0) << message.RawTimestamp() << ';';
+    }
+    if (message.Copies() > 1) {
+        os << "dup=" << std::dec << std::setw(0) << message.Copies() << ';';
+    }
+    for (auto &i : message.Metadata()) {
+        os << i.first << '=' << i.second << ';';
+    }
+}
+
+static std::vector<RawMessage> random_messages(unsigned seed, unsigned count) {
+    srand(seed);
+
+    std::vector<RawMessage> messages;
+    for (unsigned i = 0; i < count; ++i) {
+        std::size_t length;
+        switch (std::rand() % 4) {
+        case 0:
+            length = DOWNLINK_SHORT_DATA_BYTES;
+            break;
+        case 3:
+            length = UPLINK_DATA_BYTES;
+            break;
+        default:
+            length = DOWNLINK_LONG_DATA_BYTES;
+            break;
+        }
+
+        Bytes payload(length);
+        for (auto &b : payload) {
+            b = std::rand() & 0xFF;
+        }
+        if (length == DOWNLINK_SHORT_DATA_BYTES) {
+            payload[0] &= 0x07; // short messages are always payload type 0
+        }
+
+        // mostly realistic metadata, with some zero / extreme values
+        std::uint64_t received_at = (i % 10 == 0 ? 0 : (std::rand() % 2 ? 1546300800000ULL : 0) + std::rand());
+        unsigned errors = (i % 3 == 0 ? 0 : std::rand() % 12);
+        float rssi = (i % 7 == 0 ? 0.0f : (i % 11 == 0 ? -1000.0f : -(std::rand() % 40000) / 1000.0f));
+        if (i % 13 == 0)
+            rssi = -0.04f;
+        std::uint64_t raw_timestamp = (i % 2 == 0 ? 0 : ((std::uint64_t)std::rand() << 20) + std::rand());
+
+        messages.emplace_back(std::move(payload), received_at, errors, rssi, raw_timestamp);
+        if (i % 17 == 0)
+            messages.back().SetCopies(2 + i % 3);
+    }
+
+    RawMessage::MetadataMap metadata;
+    metadata["program"] = "encode_tests";
+    metadata["version"] = "1";
+    messages.emplace_back(std::move(metadata));
+
+    return messages;
+}
+
+void test_raw(const std::vector<RawMessage> &messages) {
+    unsigned mismatches = 0;
+    for (const auto &message : messages) {
+        std::ostringstream expected;
+        reference_raw(expected, message);
+
+        std::string actual;
+        EncodeRaw(message, actual);
+
+        if (actual != expected.str()) {
+            if (++mismatches <= 3)
+                std::cerr << "raw: expected " << expected.str() << std::endl << "      got " << actual << std::endl;
+        }
+    }
+
+    std::cerr << "raw encoding: " << messages.size() << " messages, " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+void test_json(const std::vector<RawMessage> &messages) {
+    unsigned mismatches = 0;
+    unsigned count = 0;
+    for (const auto &message : messages) {
+        if (message.Type() != MessageType::DOWNLINK_SHORT && message.Type() != MessageType::DOWNLINK_LONG)
+            continue;
+
+        ++count;
+        CompactAdsbMessage compact(message);
+        auto expected = AdsbMessage(compact).ToJson().dump();
+
+        std::string actual;
+        compact.EncodeJson(actual);
+
+        if (actual != expected) {
+            if (++mismatches <= 3)
+                std::cerr << "json: expected " << expected << std::endl << "       got " << actual << std::endl;
+        }
+    }
+
+    std::cerr << "json encoding: " << count << " messages, " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// Every message should survive a round trip through the binary framing,
+// with RSSI rounded to centi-dB and clamped to its 16-bit range
+void test_binary(const std::vector<RawMessage> &messages) {
+    std::string frames;
+    for (const auto &message : messages) {
+        EncodeBinary(message, frames);
+    }
+
+    unsigned mismatches = 0;
+    auto p = reinterpret_cast<const std::uint8_t *>(frames.data());
+    auto end = p + frames.size();
+    for (const auto &expected : messages) {
+        auto size = BinaryFrameSize(p, end);
+        auto actual = (size ? DecodeBinary(p, size) : boost::none);
+        p += size;
+
+        const float rssi = std::round(std::max(-327.68f, std::min(327.67f, expected.Rssi())) * 100.0f) / 100.0f;
+        if (!actual || actual->Type() != expected.Type() || actual->Payload() != expected.Payload() || actual->Errors() != expected.Errors() || std::fabs(actual->Rssi() - rssi) > 0.001f || actual->ReceivedAt() != expected.ReceivedAt() || actual->RawTimestamp() != expected.RawTimestamp() || actual->Copies() != expected.Copies() || actual->Metadata() != expected.Metadata()) {
+            if (++mismatches <= 3)
+                std::cerr << "binary: expected " << expected << std::endl << "         got " << (actual && actual->Type() != MessageType::INVALID ? *actual : RawMessage(RawMessage::MetadataMap{{"invalid", "frame"}})) << std::endl;
+        }
+        if (!size)
+            break;
+    }
+    if (p != end) {
+        std::cerr << "binary: " << (end - p) << " bytes left over" << std::endl;
+        ++mismatches;
+    }
+
+    std::cerr << "binary framing: " << messages.size() << " messages, " << frames.size() << " bytes, " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// INVALID messages (e.g. from a malformed input line) are skipped by the
+// vector encoders rather than thrown on
+void test_invalid() {
+    MessageVector messages;
+    messages.emplace_back(RawMessage());
+    const std::uint8_t payload[2] = {0x00, 0x11};
+    messages.emplace_back(RawMessage(payload, sizeof(payload), 0, 0, 0));
+
+    unsigned mismatches = 0;
+    try {
+        std::string raw, binary;
+        EncodeRawLines(messages, raw, true);
+        EncodeBinaryFrames(messages, binary);
+        if (!raw.empty() || !binary.empty()) {
+            std::cerr << "invalid: encoded " << raw.size() << " raw and " << binary.size() << " binary bytes" << std::endl;
+            ++mismatches;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "invalid: " << e.what() << std::endl;
+        ++mismatches;
+    }
+
+    std::cerr << "invalid messages: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// An uplink with a hand-built header and information frames
+void test_uplink() {
+    unsigned mismatches = 0;
+    auto check = [&mismatches](bool ok, const char *what) {
+        if (!ok) {
+            ++mismatches;
+            std::cerr << "uplink: " << what << " is wrong" << std::endl;
+        }
+    };
+
+    Bytes payload(UPLINK_DATA_BYTES, 0);
+    // lat 45.0 (raw 0x200000, 23 bits), lon -90.0 (raw 0xC00000, 24 bits), position valid
+    payload[0] = 0x40;
+    payload[2] = 0x01;
+    payload[3] = 0x80;
+    payload[5] = 0x01;
+    payload[6] = 0x80 | 0x20 | 17; // utc coupled, app data valid, slot 17
+    payload[7] = 0x90;             // site 9
+
+    // frame 1: APDU, product 413, t_opt 1 (hours, minutes, seconds), DLAC "HI"
+    std::uint8_t *f = &payload[8];
+    const unsigned frame1_length = 5 + 2;
+    f[0] = frame1_length >> 1;
+    f[1] = (frame1_length & 1) << 7; // type 0
+    f[2] = 0x80 | (413 >> 6);
+    f[3] = (413 & 0x3F) << 2;              // t_opt high bit 0
+    f[4] = 0x80 | (12 << 2) | (34 >> 4);   // t_opt low bit 1, hours 12
+    f[5] = ((34 & 0x0F) << 4) | (56 >> 2); // minutes 34
+    f[6] = (56 & 0x03) << 6;               // seconds 56
+    f[7] = (8 << 2) | (9 >> 4);            // 'H' = 8, 'I' = 9
+    f[8] = (9 & 0x0F) << 4;
+
+    // frame 2: TIS-B management frame, type 15, 3 bytes
+    f += 2 + frame1_length;
+    f[0] = 3 >> 1;
+    f[1] = ((3 & 1) << 7) | 15;
+
+    MessageVector messages;
+    messages.emplace_back(std::move(payload), 1000, 0, -10.0f);
+    const auto &uplinks = messages.DecodedUplink();
+
+    check(uplinks.size() == 1, "uplink count");
+    if (uplinks.size() == 1) {
+        const auto &uplink = uplinks[0];
+        check(uplink.position_valid && uplink.latitude == 45.0 && uplink.longitude == -90.0, "position");
+        check(uplink.utc_coupled && uplink.app_data_valid && uplink.slot_id == 17 && uplink.tisb_site_id == 9, "header");
+        check(uplink.InfoFrames().size() == 2 && uplink.InfoFrames()[1].type == 15 && uplink.InfoFrames()[1].length == 3, "info frames");
+        check(uplink.Apdus().size() == 1, "apdu count");
+        if (uplink.Apdus().size() == 1) {
+            const auto &apdu = uplink.Apdus()[0];
+            check(apdu.product_id == 413 && apdu.a_flag && !apdu.g_flag && !apdu.s_flag, "apdu flags");
+            check(!apdu.monthday_valid && apdu.seconds_valid && apdu.hours == 12 && apdu.minutes == 34 && apdu.seconds == 56, "apdu time");
+            check(apdu.length == 2 && apdu.DecodeText() == "HI", "apdu text");
+        }
+    }
+
+    unsigned delivered = 0;
+    FisbProducts products({8, 413}, [&delivered](const UplinkMessage &, const FisbApdu &) { ++delivered; });
+    products(messages);
+    FisbProducts other_products({63, 64}, [&delivered](const UplinkMessage &, const FisbApdu &) { ++delivered; });
+    other_products(messages);
+    check(delivered == 1, "product subscription");
+
+    std::cerr << "uplink decoding: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+template <class F> double messages_per_second(const std::vector<RawMessage> &messages, unsigned passes, F fn) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t total = 0;
+    for (unsigned pass = 0; pass < passes; ++pass) {
+        for (const auto &message : messages) {
+            total += fn(message);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // keep the compiler from discarding the work
+    if (total == 0)
+        std::cerr << "(no output)" << std::endl;
+
+    return messages.size() * passes / std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+}
+
+void benchmark(const std::vector<RawMessage> &messages) {
+    std::vector<RawMessage> downlink;
+    for (const auto &message : messages) {
+        if (message.Type() == MessageType::DOWNLINK_SHORT || message.Type() == MessageType::DOWNLINK_LONG)
+            downlink.push_back(message);
+    }
+
+    auto raw_old = messages_per_second(messages, 20, [](const RawMessage &message) {
+        std::ostringstream os;
+        reference_raw(os, message);
+        return os.str().size();
+    });
+    auto raw_new = messages_per_second(messages, 20, [](const RawMessage &message) {
+        std::string out;
+        EncodeRaw(message, out);
+        return out.size();
+    });
+
+    auto json_old = messages_per_second(downlink, 5, [](const RawMessage &message) { return AdsbMessage(message).ToJson().dump().size(); });
+    auto json_new = messages_per_second(downlink, 5, [](const RawMessage &message) {
+        std::string out;
+        CompactAdsbMessage(message).EncodeJson(out);
+        return out.size();
+    });
+
+    std::cerr << std::fixed << std::setprecision(0);
+    std::cerr << "raw messages/s (one core): iostream " << raw_old << ", EncodeRaw " << raw_new << " (" << std::setprecision(1) << (raw_new / raw_old) << "x)" << std::endl;
+    std::cerr << std::setprecision(0);
+    std::cerr << "json messages/s (one core, including decode): nlohmann " << json_old << ", EncodeJson " << json_new << " (" << std::setprecision(1) << (json_new / json_old) << "x)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    auto messages = random_messages(1, 20000);
+
+    test_raw(messages);
+    test_json(messages);
+    test_binary(messages);
+    test_invalid();
+    test_uplink();
+    benchmark(messages);
+
+    if (failures) {
+        std::cerr << failures << " failures" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "energy_gate.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace airnav::uat;
+
+EnergyGate::EnergyGate(double threshold_db, std::size_t margin) : threshold_(std::pow(10.0, threshold_db / 10.0)), margin_(margin), total_samples_(0), skipped_samples_(0) {}
+
+void EnergyGate::FindRegions(SampleConverter &converter, const std::uint8_t *samples, std::size_t count, std::vector<Region> &regions) {
+    // per-window rates at which the floor follows quieter / louder windows
+    const double FALL_RATE = 0.05;
+    const double RISE_RATE = 0.002;
+
+    regions.clear();
+    const auto bytes_per_sample = converter.BytesPerSample();
+
+    for (std::size_t window = 0; window < count; window += WINDOW_SAMPLES) {
+        const std::size_t probe = std::min(PROBE_SAMPLES, count - window);
+        const std::uint8_t *start = samples + window * bytes_per_sample;
+        const double power = converter.SumMagSq(start, start + probe * bytes_per_sample) / probe;
+
+        if (floor_ < 0) {
+            floor_ = power;
+        }
+
+        const bool active = (power > floor_ * threshold_);
+        floor_ += (power - floor_) * (power < floor_ ? FALL_RATE : RISE_RATE);
+
+        if (!active) {
+            continue;
+        }
+
+        const std::size_t begin = (window >= WINDOW_SAMPLES ? window - WINDOW_SAMPLES : 0);
+        const std::size_t end = std::min(count, window + WINDOW_SAMPLES + margin_);
+        if (!regions.empty() && begin <= regions.back().end) {
+            regions.back().end = end;
+        } else {
+            regions.push_back({begin, end});
+        }
+    }
+
+    std::size_t gated = 0;
+    for (const auto &region : regions) {
+        gated += region.end - region.begin;
+    }
+    total_samples_ += count;
+    skipped_samples_ += count - gated;
+}
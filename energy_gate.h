@@ -0,0 +1,59 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_ENERGY_GATE_H
+#define DUMP978_ENERGY_GATE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "convert.h"
+
+namespace airnav::uat {
+    // A cheap pre-pass that finds the parts of a sample buffer that might
+    // hold a message, so that quiet stretches of the channel can skip phase
+    // conversion and demodulation entirely.
+    //
+    // The buffer is cut into windows of WINDOW_SAMPLES. The mean power of
+    // the first PROBE_SAMPLES of each window is compared against a noise
+    // floor that tracks the quiet windows (falling quickly, rising slowly).
+    // Windows more than the threshold above the floor are active; each run
+    // of active windows is widened by one window before it and by `margin`
+    // samples after it (enough for a whole frame to be demodulated), and
+    // overlapping runs are merged.
+    class EnergyGate {
+      public:
+        static const std::size_t WINDOW_SAMPLES = 128;
+        static const std::size_t PROBE_SAMPLES = 32;
+
+        // A range of sample indexes, begin .. end
+        struct Region {
+            std::size_t begin;
+            std::size_t end;
+        };
+
+        EnergyGate(double threshold_db, std::size_t margin);
+
+        // Replace `regions` with the regions of the `count` samples at
+        // `samples` (in `converter`'s format) that should be demodulated
+        void FindRegions(SampleConverter &converter, const std::uint8_t *samples, std::size_t count, std::vector<Region> &regions);
+
+        // Samples examined, and samples that were outside any region
+        std::uint64_t TotalSamples() const { return total_samples_; }
+        std::uint64_t SkippedSamples() const { return skipped_samples_; }
+
+      private:
+        double threshold_;
+        std::size_t margin_;
+        double floor_ = -1; // mean power per sample of a quiet window; negative until the first window is seen
+
+        std::atomic<std::uint64_t> total_samples_;
+        std::atomic<std::uint64_t> skipped_samples_;
+    };
+}; // namespace airnav::uat
+
+#endif
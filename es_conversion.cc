@@ -0,0 +1,446 @@
+// Copyright 2015, Oliver Jowett <oliver@mutability.co.uk>
+// Copyright (c) 2019, FlightAware LLC.
+//
+// Ported from legacy/uat2esnt.c and, like it, licensed under the GNU
+// General Public License, version 2 or later; see legacy/LICENSE
+
+#include "es_conversion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace airnav::uat;
+
+// Set bits `first` to `last` (1-based, MSB first) of `frame` to `value`
+static void SetBits(EsFrame &frame, unsigned first, unsigned last, std::uint32_t value) {
+    for (unsigned bit = first; bit <= last; ++bit) {
+        const unsigned index = bit - 1;
+        const std::uint8_t mask = 0x80 >> (index & 7);
+        if ((value >> (last - bit)) & 1)
+            frame[index >> 3] |= mask;
+        else
+            frame[index >> 3] &= ~mask;
+    }
+}
+
+// The same, with bits numbered within the 56-bit ME field
+static void SetME(EsFrame &frame, unsigned first, unsigned last, std::uint32_t value) { SetBits(frame, first + 32, last + 32, value); }
+
+static std::uint32_t Crc(const EsFrame &frame) {
+    // Mode S parity, a table of the CRC of each single byte
+    static const auto table = []() {
+        std::array<std::uint32_t, 256> t;
+        for (unsigned i = 0; i < 256; ++i) {
+            std::uint32_t c = i << 16;
+            for (unsigned j = 0; j < 8; ++j) {
+                c = (c & 0x800000) ? (c << 1) ^ 0xFFF409 : (c << 1);
+            }
+            t[i] = c & 0xFFFFFF;
+        }
+        return t;
+    }();
+
+    std::uint32_t rem = 0;
+    for (std::size_t i = 0; i < frame.size() - 3; ++i) {
+        rem = ((rem << 8) ^ table[frame[i] ^ ((rem & 0xFF0000) >> 16)]) & 0xFFFFFF;
+    }
+    return rem;
+}
+
+static void Finish(EsFrame &frame, std::vector<EsFrame> &out) {
+    const auto parity = Crc(frame);
+    frame[11] = parity >> 16;
+    frame[12] = parity >> 8;
+    frame[13] = parity;
+    out.push_back(frame);
+}
+
+static int EncodeAltitude(int ft) {
+    int i = std::max(0, std::min(0x7FF, (ft + 1000) / 25));
+    return (i & 0x000F) | 0x0010 | ((i & 0x07F0) << 1);
+}
+
+static int EncodeGroundSpeed(int kt) {
+    if (kt > 175)
+        return 124;
+    if (kt > 100)
+        return (kt - 100) / 5 + 108;
+    if (kt > 70)
+        return (kt - 70) / 2 + 93;
+    if (kt > 15)
+        return (kt - 15) + 38;
+    if (kt > 2)
+        return (kt - 2) * 2 + 11;
+    if (kt == 2)
+        return 12;
+    if (kt == 1)
+        return 8;
+    return 1;
+}
+
+static int EncodeAirSpeed(int kt, bool supersonic) {
+    const int sign = (kt < 0 ? 0x0400 : 0);
+    kt = std::abs(kt);
+    if (supersonic)
+        kt = kt / 4;
+    return std::min(kt + 1, 1023) | sign;
+}
+
+static int EncodeVerticalRate(int rate) {
+    const int sign = (rate < 0 ? 0x200 : 0);
+    return std::min(std::abs(rate) / 64 + 1, 511) | sign;
+}
+
+static double CprMod(double a, double b) {
+    double res = std::fmod(a, b);
+    return (res < 0 ? res + b : res);
+}
+
+static int CprNL(double lat) {
+    // latitudes of the zone boundaries, from 1.0 (59 zones) towards the pole
+    static const double boundaries[] = {10.47047130, 14.82817437, 18.18626357, 21.02939493, 23.54504487, 25.82924707, 27.93898710, 29.91135686, 31.77209708, 33.53993436, 35.22899598, 36.85025108, 38.41241892, 39.92256684, 41.38651832, 42.80914012, 44.19454951, 45.54626723, 46.86733252, 48.16039128, 49.42776439, 50.67150166, 51.89342469, 53.09516153, 54.27817472, 55.44378444, 56.59318756, 57.72747354, 58.84763776, 59.95459277, 61.04917774, 62.13216659, 63.20427479, 64.26616523, 65.31845310, 66.36171008, 67.39646774, 68.42322022, 69.44242631, 70.45451075, 71.45986473, 72.45884545, 73.45177442, 74.43893416, 75.42056257, 76.39684391, 77.36789461, 78.33374083, 79.29428225, 80.24923213, 81.19801349, 82.13956981, 83.07199445, 83.99173563, 84.89166191, 85.75541621, 86.53536998, 87.00000000};
+    const auto zone = std::upper_bound(std::begin(boundaries), std::end(boundaries), std::fabs(lat)) - std::begin(boundaries);
+    return 59 - zone;
+}
+
+static int CprN(double lat, bool odd) { return std::max(1, CprNL(lat) - (odd ? 1 : 0)); }
+
+static int EncodeCprLat(double lat, bool odd, bool surface) {
+    const int nb = (surface ? 1 << 19 : 1 << 17);
+    const double dlat = 360.0 / (odd ? 59 : 60);
+    const int yz = std::floor(nb * CprMod(lat, dlat) / dlat + 0.5);
+    return yz & 0x1FFFF; // always a 17-bit field
+}
+
+static int EncodeCprLon(double lat, double lon, bool odd, bool surface) {
+    const int nb = (surface ? 1 << 19 : 1 << 17);
+    const double dlat = 360.0 / (odd ? 59 : 60);
+    const int yz = std::floor(nb * CprMod(lat, dlat) / dlat + 0.5);
+
+    const double rlat = dlat * (1.0 * yz / nb + std::floor(lat / dlat));
+    const double dlon = 360.0 / CprN(rlat, odd);
+    const int xz = std::floor(nb * CprMod(lon, dlon) / dlon + 0.5);
+    return xz & 0x1FFFF; // always a 17-bit field
+}
+
+// The CF field of DF 18: whether this is TIS-B, an ADS-B rebroadcast, etc
+static int EncodeCF(AddressQualifier aq) {
+    switch (aq) {
+    case AddressQualifier::ADSB_ICAO:
+        return 6; // ADS-B rebroadcast, with IMF=0
+    case AddressQualifier::TISB_ICAO:
+    case AddressQualifier::TISB_TRACKFILE:
+        return 2; // fine TIS-B, with IMF=0 / IMF=1
+    default:
+        return 1; // national, fixed beacon, vehicle, reserved: ES/NT devices with other addressing
+    }
+}
+
+// The IMF bit: 0 for a 24-bit ICAO address, 1 for anything else
+static int EncodeIMF(AddressQualifier aq) { return (aq == AddressQualifier::ADSB_ICAO || aq == AddressQualifier::TISB_ICAO) ? 0 : 1; }
+
+static EsFrame StartFrame(const CompactAdsbMessage &decoded) {
+    EsFrame frame = {};
+    SetBits(frame, 1, 5, 18);                                  // DF=18, ES/NT
+    SetBits(frame, 6, 8, EncodeCF(decoded.address_qualifier)); // CF
+    SetBits(frame, 9, 32, decoded.address);                    // AA
+    return frame;
+}
+
+static std::uint8_t CharToAis(char ch) {
+    static const char charset[] = "@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_ !\"#$%&'()*+,-./0123456789:;<=>?";
+    const char *match = (ch ? std::strchr(charset, ch) : nullptr);
+    return match ? (match - charset) : 32;
+}
+
+static unsigned EncodeSquawk(const std::string &squawk_digits) {
+    const unsigned squawk = std::strtoul(squawk_digits.c_str(), nullptr, 16);
+    unsigned encoded = 0;
+
+    if (squawk & 0x1000)
+        encoded |= 0x0800; // A1
+    if (squawk & 0x2000)
+        encoded |= 0x0200; // A2
+    if (squawk & 0x4000)
+        encoded |= 0x0080; // A4
+
+    if (squawk & 0x0100)
+        encoded |= 0x0020; // B1
+    if (squawk & 0x0200)
+        encoded |= 0x0008; // B2
+    if (squawk & 0x0400)
+        encoded |= 0x0002; // B4
+
+    if (squawk & 0x0010)
+        encoded |= 0x1000; // C1
+    if (squawk & 0x0020)
+        encoded |= 0x0400; // C2
+    if (squawk & 0x0040)
+        encoded |= 0x0100; // C4
+
+    if (squawk & 0x0001)
+        encoded |= 0x0010; // D1
+    if (squawk & 0x0002)
+        encoded |= 0x0004; // D2
+    if (squawk & 0x0004)
+        encoded |= 0x0001; // D4
+
+    return encoded;
+}
+
+static int SquawkToEmergency(const std::string &squawk) {
+    if (squawk == "7500")
+        return 5; // unlawful interference
+    if (squawk == "7600")
+        return 4; // no communications
+    if (squawk == "7700")
+        return 1; // general emergency
+    return 0;
+}
+
+namespace {
+    // The fields of a downlink that the conversion needs, read from the
+    // shared decode plus the few that it does not keep
+    struct Source {
+        Source(const RawMessage &raw, const CompactAdsbMessage &decoded) : decoded(decoded) {
+            // 2.2.4.5.2.1: the full-precision position
+            if (decoded.Has(CompactAdsbMessage::POSITION)) {
+                lat = raw.Field<5, 1, 7, 7>() * 360.0 / 16777216.0;
+                if (lat > 90)
+                    lat -= 180;
+                lon = raw.Field<7, 8, 10, 7>() * 360.0 / 16777216.0;
+                if (lon > 180)
+                    lon -= 360;
+            }
+
+            // 2.2.4.5.2.2: which altitude the state vector carries (the
+            // auxiliary state vector carries the other)
+            const bool primary_geometric = raw.Bit<10, 8>();
+            primary = (primary_geometric ? decoded.geometric_altitude() : decoded.pressure_altitude());
+            secondary = (primary_geometric ? decoded.pressure_altitude() : decoded.geometric_altitude());
+            primary_is_baro = !primary_geometric;
+        }
+
+        const CompactAdsbMessage &decoded;
+        double lat = 0;
+        double lon = 0;
+        boost::optional<int> primary;
+        boost::optional<int> secondary;
+        bool primary_is_baro;
+    };
+}; // namespace
+
+static void AltitudeOnly(const Source &source, std::vector<EsFrame> &out) {
+    const auto &decoded = source.decoded;
+
+    int raw_alt = 0;
+    if (source.primary && source.primary_is_baro)
+        raw_alt = EncodeAltitude(*source.primary);
+    else if (source.secondary && !source.primary_is_baro)
+        raw_alt = EncodeAltitude(*source.secondary);
+
+    auto frame = StartFrame(decoded);
+    SetME(frame, 1, 5, 0);                                     // FORMAT TYPE CODE = 0, barometric altitude with no position
+    SetME(frame, 6, 7, 0);                                     // SURVEILLANCE STATUS normal
+    SetME(frame, 8, 8, EncodeIMF(decoded.address_qualifier));  // IMF
+    SetME(frame, 9, 20, raw_alt);                              // ALTITUDE
+    SetME(frame, 21, 56, 0);                                   // TIME, CPR FORMAT, ENCODED LATITUDE / LONGITUDE
+    Finish(frame, out);
+}
+
+static void SurfacePosition(const Source &source, std::vector<EsFrame> &out) {
+    const auto &decoded = source.decoded;
+    if (decoded.airground_state() != AirGroundState::ON_GROUND || !decoded.Has(CompactAdsbMessage::POSITION))
+        return;
+
+    auto frame = StartFrame(decoded);
+    SetME(frame, 1, 5, 8); // FORMAT TYPE CODE = 8, surface position (NUCp=6)
+
+    auto speed = decoded.ground_speed();
+    SetME(frame, 6, 12, speed ? EncodeGroundSpeed(*speed) : 0); // MOVEMENT
+
+    auto track = decoded.true_track();
+    SetME(frame, 13, 13, track ? 1 : 0);                                           // STATUS for ground track
+    SetME(frame, 14, 20, track ? std::lround(*track * 128 / 360) % 128 : 0); // GROUND TRACK (TRUE)
+
+    SetME(frame, 21, 21, EncodeIMF(decoded.address_qualifier)); // IMF
+
+    for (bool odd : {false, true}) {
+        SetME(frame, 22, 22, odd);                                           // CPR FORMAT (F)
+        SetME(frame, 23, 39, EncodeCprLat(source.lat, odd, true));           // ENCODED LATITUDE
+        SetME(frame, 40, 56, EncodeCprLon(source.lat, source.lon, odd, true)); // ENCODED LONGITUDE
+        Finish(frame, out);
+    }
+}
+
+static void AirbornePosition(const Source &source, std::vector<EsFrame> &out) {
+    const auto &decoded = source.decoded;
+    const auto state = decoded.airground_state();
+    if (state != AirGroundState::AIRBORNE_SUBSONIC && state != AirGroundState::AIRBORNE_SUPERSONIC)
+        return;
+
+    if (!decoded.Has(CompactAdsbMessage::POSITION)) {
+        AltitudeOnly(source, out);
+        return;
+    }
+
+    auto frame = StartFrame(decoded);
+    if (source.primary) {
+        SetME(frame, 1, 5, source.primary_is_baro ? 18 : 22); // FORMAT TYPE CODE = 18 / 22, airborne position (baro / GNSS alt)
+        SetME(frame, 9, 20, EncodeAltitude(*source.primary)); // ALTITUDE
+    } else {
+        SetME(frame, 1, 5, 18);  // FORMAT TYPE CODE = 18, airborne position (baro alt)
+        SetME(frame, 9, 20, 0);  // ALTITUDE unavailable
+    }
+
+    SetME(frame, 6, 7, 0);                                     // SURVEILLANCE STATUS normal
+    SetME(frame, 8, 8, EncodeIMF(decoded.address_qualifier));  // IMF
+    SetME(frame, 21, 21, 0);                                   // TIME (T)
+
+    for (bool odd : {false, true}) {
+        SetME(frame, 22, 22, odd);                                            // CPR FORMAT (F)
+        SetME(frame, 23, 39, EncodeCprLat(source.lat, odd, false));           // ENCODED LATITUDE
+        SetME(frame, 40, 56, EncodeCprLon(source.lat, source.lon, odd, false)); // ENCODED LONGITUDE
+        Finish(frame, out);
+    }
+}
+
+static void AirborneVelocity(const Source &source, std::vector<EsFrame> &out) {
+    const auto &decoded = source.decoded;
+    const auto state = decoded.airground_state();
+    if (state != AirGroundState::AIRBORNE_SUBSONIC && state != AirGroundState::AIRBORNE_SUPERSONIC)
+        return;
+
+    const auto ew = decoded.east_velocity();
+    const auto ns = decoded.north_velocity();
+    const auto vv_baro = decoded.vertical_velocity_barometric();
+    const auto vv_geo = decoded.vertical_velocity_geometric();
+    if (!ew && !ns && !vv_baro && !vv_geo)
+        return; // not really any point sending this
+
+    const bool supersonic = (state == AirGroundState::AIRBORNE_SUPERSONIC);
+
+    auto frame = StartFrame(decoded);
+    SetME(frame, 1, 5, 19);                                     // FORMAT TYPE CODE = 19, airborne velocity
+    SetME(frame, 6, 8, supersonic ? 2 : 1);                     // SUBTYPE = 1 / 2, subsonic / supersonic, speed over ground
+    SetME(frame, 9, 9, EncodeIMF(decoded.address_qualifier));   // IMF
+    SetME(frame, 10, 10, 0);                                    // IFR
+    SetME(frame, 11, 13, 0);                                    // NAVIGATIONAL UNCERTAINTY CATEGORY FOR VELOCITY
+    SetME(frame, 14, 24, ew ? EncodeAirSpeed(*ew, supersonic) : 0); // EAST/WEST DIRECTION BIT + EAST/WEST VELOCITY
+    SetME(frame, 25, 35, ns ? EncodeAirSpeed(*ns, supersonic) : 0); // NORTH/SOUTH DIRECTION BIT + NORTH/SOUTH VELOCITY
+
+    if (vv_baro) {
+        SetME(frame, 36, 36, 0);                             // SOURCE = BARO
+        SetME(frame, 37, 46, EncodeVerticalRate(*vv_baro));  // SIGN BIT FOR VERTICAL RATE + VERTICAL RATE
+    } else if (vv_geo) {
+        SetME(frame, 36, 36, 1);                             // SOURCE = GNSS
+        SetME(frame, 37, 46, EncodeVerticalRate(*vv_geo));   // SIGN BIT FOR VERTICAL RATE + VERTICAL RATE
+    } else {
+        SetME(frame, 36, 46, 0);                             // no vertical rate information
+    }
+
+    SetME(frame, 47, 48, 0); // RESERVED FOR TURN INDICATOR
+
+    if (source.primary && source.secondary) {
+        // GNSS altitude relative to baro altitude
+        const int primary = *source.primary, secondary = *source.secondary;
+        int delta, sign;
+        if (primary < secondary) {
+            delta = secondary - primary;
+            sign = source.primary_is_baro ? 0 : 1;
+        } else {
+            delta = primary - secondary;
+            sign = source.primary_is_baro ? 1 : 0;
+        }
+        SetME(frame, 49, 49, sign);                         // DIFFERENCE SIGN BIT
+        SetME(frame, 50, 56, std::min(delta / 25 + 1, 127)); // GNSS ALT DIFFERENCE FROM BARO ALT
+    } else {
+        SetME(frame, 49, 56, 0); // no difference information
+    }
+
+    Finish(frame, out);
+}
+
+static void Identification(const Source &source, std::vector<EsFrame> &out) {
+    const auto &decoded = source.decoded;
+    const int imf = EncodeIMF(decoded.address_qualifier);
+
+    if (auto callsign = decoded.callsign()) {
+        if (imf)
+            return; // not sent with non-ICAO addresses
+
+        auto frame = StartFrame(decoded);
+        const unsigned category = decoded.emitter_category().value_or(0);
+        if (category <= 31) {
+            SetME(frame, 1, 5, 4 - category / 8); // FORMAT TYPE CODE = 4 / 3 / 2 / 1, aircraft category set A / B / C / D
+            SetME(frame, 6, 8, category & 7);     // AIRCRAFT CATEGORY
+        } else {
+            SetME(frame, 1, 5, 4); // reserved, map to A0
+            SetME(frame, 6, 8, 0);
+        }
+
+        callsign->resize(8, '\0');
+        for (unsigned i = 0; i < 8; ++i) {
+            SetME(frame, 9 + i * 6, 14 + i * 6, CharToAis((*callsign)[i]));
+        }
+        Finish(frame, out);
+    } else if (auto squawk = decoded.flightplan_id()) {
+        auto frame = StartFrame(decoded);
+        SetME(frame, 1, 5, 28);                        // FORMAT TYPE CODE = 28, aircraft status
+        SetME(frame, 6, 8, 1);                         // SUBTYPE = 1, emergency/priority status
+        SetME(frame, 9, 11, SquawkToEmergency(*squawk)); // EMERGENCY STATE
+        SetME(frame, 12, 24, EncodeSquawk(*squawk));   // MODE A CODE
+        SetME(frame, 25, 55, 0);                       // reserved
+        SetME(frame, 56, 56, imf);                     // IMF
+        Finish(frame, out);
+    }
+}
+
+void airnav::uat::ConvertToEs(const RawMessage &raw, const CompactAdsbMessage &decoded, std::vector<EsFrame> &out) {
+    const Source source(raw, decoded);
+    SurfacePosition(source, out);
+    AirbornePosition(source, out);
+    AirborneVelocity(source, out);
+    Identification(source, out);
+}
+
+void airnav::uat::EncodeBeast(const EsFrame &frame, float rssi, std::string &out) {
+    // signal: the amplitude relative to full scale, scaled to 0-255
+    const auto signal = static_cast<std::uint8_t>(std::max(0.0, std::min(255.0, std::round(std::pow(10.0, rssi / 20.0) * 255.0))));
+
+    out += '\x1a';
+    out += '3';
+
+    // 0x1a within the frame is escaped by doubling it
+    auto put = [&out](std::uint8_t b) {
+        out += static_cast<char>(b);
+        if (b == 0x1a)
+            out += static_cast<char>(b);
+    };
+
+    for (unsigned i = 0; i < 6; ++i)
+        put(0); // 12MHz timestamp
+    put(signal);
+    for (auto b : frame)
+        put(b);
+}
+
+void airnav::uat::EncodeBeastFrames(const MessageVector &messages, std::string &out) {
+    const auto &decoded = messages.DecodedDownlink();
+    auto next = decoded.begin();
+
+    std::vector<EsFrame> frames;
+    for (const auto &message : messages) {
+        if (message.Type() != MessageType::DOWNLINK_SHORT && message.Type() != MessageType::DOWNLINK_LONG)
+            continue;
+
+        // DecodedDownlink holds one entry per downlink, in order
+        const auto &adsb = *next++;
+        frames.clear();
+        ConvertToEs(message, adsb, frames);
+        for (const auto &frame : frames)
+            EncodeBeast(frame, message.Rssi(), out);
+    }
+}
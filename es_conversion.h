@@ -0,0 +1,41 @@
+// -*- c++ -*-
+
+// Copyright 2015, Oliver Jowett <oliver@mutability.co.uk>
+// Copyright (c) 2019, FlightAware LLC.
+//
+// Ported from legacy/uat2esnt.c and, like it, licensed under the GNU
+// General Public License, version 2 or later; see legacy/LICENSE
+
+#ifndef DUMP978_ES_CONVERSION_H
+#define DUMP978_ES_CONVERSION_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "uat_message.h"
+
+namespace airnav::uat {
+    // A 112-bit Mode S extended squitter, including its parity
+    typedef std::array<std::uint8_t, 14> EsFrame;
+
+    // Append the 1090ES frames (DF 18, ES/NT) that carry the contents of
+    // one UAT downlink to `out`, as legacy/uat2esnt does: surface or
+    // airborne position (an even and an odd CPR frame), airborne velocity,
+    // and identification or squawk. `decoded` must have been decoded from
+    // `raw`; the position is reread from `raw` at full precision, as the
+    // decoded position is rounded more coarsely than a surface CPR step.
+    void ConvertToEs(const RawMessage &raw, const CompactAdsbMessage &decoded, std::vector<EsFrame> &out);
+
+    // Append `frame` in Beast binary form (a type '3' long Mode S frame) to
+    // `out`. The 12MHz timestamp is zero, as UAT times are on a different
+    // clock; the signal level is derived from `rssi` (dBFS).
+    void EncodeBeast(const EsFrame &frame, float rssi, std::string &out);
+
+    // Append the Beast frames for every downlink in `messages` to `out`,
+    // using the vector's shared decode (see MessageVector::DecodedDownlink)
+    void EncodeBeastFrames(const MessageVector &messages, std::string &out);
+}; // namespace airnav::uat
+
+#endif
@@ -3,36 +3,24 @@
 // Licensed under the 2-clause BSD license; see the LICENSE file
 
 #include "fec.h"
+
+#include <cstring>
+
+#include "cpu_features.h"
 #include "uat_protocol.h"
 
-extern "C" {
-#include "fec/rs.h"
-}
+#ifdef DUMP978_X86
+#include <immintrin.h>
+#endif
+
+#if defined(DUMP978_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define DUMP978_NEON_TBL 1
+#endif
 
 using namespace airnav::uat;
 using namespace airnav::uat::fec;
 
-FEC::FEC(void) {
-    rs_downlink_short_ = ::init_rs_char(
-        /* symsize */ 8, /* gfpoly */ DOWNLINK_SHORT_POLY, /* fcr */ 120,
-        /* prim */ 1, /* nroots */ DOWNLINK_SHORT_ROOTS,
-        /* pad */ DOWNLINK_SHORT_PAD);
-    rs_downlink_long_ = ::init_rs_char(
-        /* symsize */ 8, /* gfpoly */ DOWNLINK_LONG_POLY, /* fcr */ 120,
-        /* prim */ 1, /* nroots */ DOWNLINK_LONG_ROOTS,
-        /* pad */ DOWNLINK_LONG_PAD);
-    rs_uplink_ = ::init_rs_char(/* symsize */ 8, /* gfpoly */ UPLINK_BLOCK_POLY,
-                                /* fcr */ 120, /* prim */ 1,
-                                /* nroots */ UPLINK_BLOCK_ROOTS,
-                                /* pad */ UPLINK_BLOCK_PAD);
-}
-
-FEC::~FEC(void) {
-    ::free_rs_char(rs_downlink_short_);
-    ::free_rs_char(rs_downlink_long_);
-    ::free_rs_char(rs_uplink_);
-}
-
 std::tuple<bool, Bytes, unsigned> FEC::CorrectDownlink(const Bytes &raw, const std::vector<std::size_t> &erasures) {
     using R = std::tuple<bool, Bytes, unsigned>;
 
@@ -45,29 +33,53 @@ std::tuple<bool, Bytes, unsigned> FEC::CorrectDownlink(const Bytes &raw, const s
         return R{false, {}, 0};
     }
 
-    // Try decoding as a Long UAT.
-    Bytes corrected;
-    std::copy(raw.begin(), raw.end(), std::back_inserter(corrected));
+    DownlinkBuffer data;
+    std::copy(raw.begin(), raw.end(), data.begin());
+
+    DownlinkErasures fixed_erasures;
+    for (auto e : erasures) {
+        fixed_erasures.push_back(e);
+    }
+
+    bool success;
+    std::size_t data_bytes;
+    unsigned n_corrected;
+    std::tie(success, data_bytes, n_corrected) = CorrectDownlink(data, fixed_erasures);
+    if (!success) {
+        return R{false, {}, 0};
+    }
 
+    return R{true, Bytes(data.begin(), data.begin() + data_bytes), n_corrected};
+}
+
+std::tuple<bool, std::size_t, unsigned> FEC::CorrectDownlink(DownlinkBuffer &data, const DownlinkErasures &erasures) {
+    using R = std::tuple<bool, std::size_t, unsigned>;
+
+    if (erasures.overflow()) {
+        // too many
+        return R{false, 0, 0};
+    }
+
+    // Try decoding as a Long UAT.
     int erasures_array[DOWNLINK_LONG_ROOTS];
-    for (std::size_t i = 0; i < erasures.size(); ++i) {
-        erasures_array[i] = erasures[i];
-        corrected[erasures[i]] = 0;
+    for (std::size_t i = 0; i < erasures.count; ++i) {
+        erasures_array[i] = erasures.index[i];
+        data[erasures.index[i]] = 0;
     }
-    int n_corrected = ::decode_rs_char(rs_downlink_long_, corrected.data(), erasures_array, erasures.size());
-    if (n_corrected >= 0 && n_corrected <= DOWNLINK_LONG_ROOTS && (corrected[0] >> 3) != 0) {
+    int n_corrected = rs_downlink_long_.Decode(data.data(), erasures_array, erasures.count);
+    if (n_corrected >= 0 && n_corrected <= DOWNLINK_LONG_ROOTS && (data[0] >> 3) != 0) {
         // Valid long frame.
-        corrected.resize(DOWNLINK_LONG_DATA_BYTES);
-        return R{true, std::move(corrected), n_corrected};
+        return R{true, DOWNLINK_LONG_DATA_BYTES, n_corrected};
     }
 
     // Retry as Basic UAT
-    // We rely on decode_rs_char not modifying the data if there were
+    // We rely on Decode not modifying the data if there were
     // uncorrectable errors in the previous step.
 
     // Only pass in erasures that lie within the short message length
     int short_erasures = 0;
-    for (auto e : erasures) {
+    for (std::size_t i = 0; i < erasures.count; ++i) {
+        std::size_t e = erasures.index[i];
         if (e < DOWNLINK_SHORT_BYTES) {
             if (short_erasures < DOWNLINK_SHORT_ROOTS) {
                 erasures_array[short_erasures] = e;
@@ -78,18 +90,17 @@ std::tuple<bool, Bytes, unsigned> FEC::CorrectDownlink(const Bytes &raw, const s
 
     if (short_erasures > DOWNLINK_SHORT_ROOTS) {
         // too many
-        return R{false, {}, 0};
+        return R{false, 0, 0};
     }
 
-    n_corrected = ::decode_rs_char(rs_downlink_short_, corrected.data(), erasures_array, short_erasures);
-    if (n_corrected >= 0 && n_corrected <= DOWNLINK_SHORT_ROOTS && (corrected[0] >> 3) == 0) {
+    n_corrected = rs_downlink_short_.Decode(data.data(), erasures_array, short_erasures);
+    if (n_corrected >= 0 && n_corrected <= DOWNLINK_SHORT_ROOTS && (data[0] >> 3) == 0) {
         // Valid short frame
-        corrected.resize(DOWNLINK_SHORT_DATA_BYTES);
-        return R{true, std::move(corrected), n_corrected};
+        return R{true, DOWNLINK_SHORT_DATA_BYTES, n_corrected};
     }
 
     // Failed.
-    return R{false, {}, 0};
+    return R{false, 0, 0};
 }
 
 std::tuple<bool, Bytes, unsigned> FEC::CorrectUplink(const Bytes &raw, const std::vector<std::size_t> &erasures) {
@@ -99,50 +110,201 @@ std::tuple<bool, Bytes, unsigned> FEC::CorrectUplink(const Bytes &raw, const std
         return R{false, {}, 0};
     }
 
-    // uplink messages consist of 6 blocks, interleaved; each block consists of a
-    // data section then an ECC section; we need to deinterleave, check/correct
-    // the data, then join the blocks removing the ECC sections.
-    unsigned total_errors = 0;
-    Bytes corrected;
-    Bytes blockdata;
+    UplinkBuffer fixed_raw;
+    std::copy(raw.begin(), raw.end(), fixed_raw.begin());
 
-    corrected.reserve(UPLINK_DATA_BYTES);
-    blockdata.resize(UPLINK_BLOCK_BYTES);
+    UplinkErasures fixed_erasures;
+    for (auto e : erasures) {
+        fixed_erasures.push_back(e);
+    }
 
-    for (unsigned block = 0; block < UPLINK_BLOCKS_PER_FRAME; ++block) {
-        // deinterleave
-        for (unsigned i = 0; i < UPLINK_BLOCK_BYTES; ++i) {
-            blockdata[i] = raw[i * UPLINK_BLOCKS_PER_FRAME + block];
+    UplinkDataBuffer corrected;
+    bool success;
+    unsigned total_errors;
+    std::tie(success, total_errors) = CorrectUplink(fixed_raw, fixed_erasures, corrected);
+    if (!success) {
+        return R{false, {}, 0};
+    }
+
+    return R{true, Bytes(corrected.begin(), corrected.end()), total_errors};
+}
+
+namespace {
+    typedef std::array<std::array<std::uint8_t, UPLINK_BLOCK_BYTES>, UPLINK_BLOCKS_PER_FRAME> UplinkBlocks;
+
+    // The transposes below take 8 rows (48 bytes) of the frame at a time
+    // and produce 8 bytes of each block; these are the byte indexes (into
+    // the 48 bytes) that make up each pair of blocks
+    const unsigned TRANSPOSE_ROWS = 8;
+    const unsigned TRANSPOSE_BYTES = TRANSPOSE_ROWS * UPLINK_BLOCKS_PER_FRAME;
+    static_assert(TRANSPOSE_BYTES == 48 && UPLINK_BLOCKS_PER_FRAME % 2 == 0, "transpose assumes 6 blocks per frame");
+
+    struct TransposeIndex {
+        TransposeIndex() {
+            for (unsigned pair = 0; pair < UPLINK_BLOCKS_PER_FRAME / 2; ++pair) {
+                for (unsigned lane = 0; lane < 16; ++lane) {
+                    const unsigned row = lane % TRANSPOSE_ROWS;
+                    const unsigned block = pair * 2 + lane / TRANSPOSE_ROWS;
+                    index[pair][lane] = row * UPLINK_BLOCKS_PER_FRAME + block;
+                }
+            }
         }
 
-        // build erasures for this block
-        int block_erasures[UPLINK_BLOCK_ROOTS];
-        int num_erasures = 0;
-        for (auto index : erasures) {
-            if (index % UPLINK_BLOCKS_PER_FRAME == block) {
-                if (num_erasures < UPLINK_BLOCK_ROOTS)
-                    block_erasures[num_erasures] = index / UPLINK_BLOCKS_PER_FRAME + UPLINK_BLOCK_PAD;
-                num_erasures++;
+        std::uint8_t index[UPLINK_BLOCKS_PER_FRAME / 2][16];
+    };
+
+    const TransposeIndex transpose_index;
+
+    // Deinterleave rows [first, UPLINK_BLOCK_BYTES) one byte at a time
+    void DeinterleaveTail(const std::uint8_t *frame, unsigned first, UplinkBlocks &blocks) {
+        for (unsigned i = first; i < UPLINK_BLOCK_BYTES; ++i) {
+            const std::uint8_t *row = frame + i * UPLINK_BLOCKS_PER_FRAME;
+            for (unsigned block = 0; block < UPLINK_BLOCKS_PER_FRAME; ++block) {
+                blocks[block][i] = row[block];
+            }
+        }
+    }
+
+    void DeinterleaveGeneric(const std::uint8_t *frame, UplinkBlocks &blocks) { DeinterleaveTail(frame, 0, blocks); }
+
+#ifdef DUMP978_X86
+    // Each output pair of blocks is gathered from the three input vectors
+    // with one PSHUFB each; lanes that come from a different input vector
+    // get an index with the high bit set, which PSHUFB turns into zero.
+    struct TransposeMasksSSSE3 {
+        TransposeMasksSSSE3() {
+            for (unsigned pair = 0; pair < UPLINK_BLOCKS_PER_FRAME / 2; ++pair) {
+                for (unsigned source = 0; source < 3; ++source) {
+                    for (unsigned lane = 0; lane < 16; ++lane) {
+                        const unsigned index = transpose_index.index[pair][lane];
+                        mask[pair][source][lane] = (index / 16 == source ? index % 16 : 0x80);
+                    }
+                }
+            }
+        }
+
+        alignas(16) std::uint8_t mask[UPLINK_BLOCKS_PER_FRAME / 2][3][16];
+    };
+
+    __attribute__((target("ssse3"))) void DeinterleaveSSSE3(const std::uint8_t *frame, UplinkBlocks &blocks) {
+        static const TransposeMasksSSSE3 masks;
+
+        unsigned i = 0;
+        for (; i + TRANSPOSE_ROWS <= UPLINK_BLOCK_BYTES; i += TRANSPOSE_ROWS) {
+            const std::uint8_t *in = frame + i * UPLINK_BLOCKS_PER_FRAME;
+            const __m128i v[3] = {_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 16)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 32))};
+
+            for (unsigned pair = 0; pair < UPLINK_BLOCKS_PER_FRAME / 2; ++pair) {
+                __m128i out = _mm_setzero_si128();
+                for (unsigned source = 0; source < 3; ++source) {
+                    out = _mm_or_si128(out, _mm_shuffle_epi8(v[source], _mm_load_si128(reinterpret_cast<const __m128i *>(masks.mask[pair][source]))));
+                }
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(blocks[pair * 2].data() + i), out);
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(blocks[pair * 2 + 1].data() + i), _mm_unpackhi_epi64(out, out));
             }
         }
 
-        // too many erasures in this block?
-        if (num_erasures > UPLINK_BLOCK_ROOTS) {
-            return R{false, {}, 0};
+        DeinterleaveTail(frame, i, blocks);
+    }
+#endif
+
+#ifdef DUMP978_NEON_TBL
+    // TBL can index all 48 input bytes directly
+    void DeinterleaveNeon(const std::uint8_t *frame, UplinkBlocks &blocks) {
+        unsigned i = 0;
+        for (; i + TRANSPOSE_ROWS <= UPLINK_BLOCK_BYTES; i += TRANSPOSE_ROWS) {
+            const std::uint8_t *in = frame + i * UPLINK_BLOCKS_PER_FRAME;
+            const uint8x16x3_t v = {{vld1q_u8(in), vld1q_u8(in + 16), vld1q_u8(in + 32)}};
+            for (unsigned pair = 0; pair < UPLINK_BLOCKS_PER_FRAME / 2; ++pair) {
+                const uint8x16_t out = vqtbl3q_u8(v, vld1q_u8(transpose_index.index[pair]));
+                vst1_u8(blocks[pair * 2].data() + i, vget_low_u8(out));
+                vst1_u8(blocks[pair * 2 + 1].data() + i, vget_high_u8(out));
+            }
         }
 
-        // error-correct
-        int n_corrected = ::decode_rs_char(rs_uplink_, blockdata.data(), block_erasures, num_erasures);
-        if (n_corrected < 0 || n_corrected > UPLINK_BLOCK_ROOTS) {
-            // Failed
-            return R{false, {}, 0};
+        DeinterleaveTail(frame, i, blocks);
+    }
+#endif
+
+    // Split an interleaved uplink frame into its six blocks
+    void Deinterleave(const std::uint8_t *frame, UplinkBlocks &blocks) {
+#ifdef DUMP978_X86
+        static const bool use_ssse3 = CpuHasSSSE3();
+        if (use_ssse3) {
+            DeinterleaveSSSE3(frame, blocks);
+            return;
         }
+#endif
+#ifdef DUMP978_NEON_TBL
+        DeinterleaveNeon(frame, blocks);
+        return;
+#endif
+        DeinterleaveGeneric(frame, blocks);
+    }
+}; // namespace
 
-        total_errors += n_corrected;
+std::tuple<bool, unsigned> FEC::CorrectUplink(const UplinkBuffer &raw, const UplinkErasures &erasures, UplinkDataBuffer &corrected) {
+    using R = std::tuple<bool, unsigned>;
 
-        // copy the data into the right place
-        std::copy(blockdata.begin(), blockdata.begin() + UPLINK_BLOCK_DATA_BYTES, std::back_inserter(corrected));
+    if (erasures.overflow()) {
+        // at least one block must have too many erasures
+        return R{false, 0};
+    }
+
+    // uplink messages consist of 6 blocks, interleaved; each block consists of a
+    // data section then an ECC section; we need to deinterleave, check/correct
+    // the data, then join the blocks removing the ECC sections.
+    //
+    // Everything that can reject the frame cheaply is done before any
+    // correction work: the erasures are sorted into their blocks in one
+    // pass, and a block with too many of them fails the whole frame.
+    int block_erasures[UPLINK_BLOCKS_PER_FRAME][UPLINK_BLOCK_ROOTS];
+    int num_erasures[UPLINK_BLOCKS_PER_FRAME] = {};
+    for (std::size_t i = 0; i < erasures.count; ++i) {
+        const std::size_t index = erasures.index[i];
+        const unsigned block = index % UPLINK_BLOCKS_PER_FRAME;
+        if (num_erasures[block] == UPLINK_BLOCK_ROOTS) {
+            return R{false, 0};
+        }
+        block_erasures[block][num_erasures[block]++] = index / UPLINK_BLOCKS_PER_FRAME;
+    }
+
+    // The syndromes of all six blocks are computed together, directly from
+    // the interleaved data (one block per SIMD lane); blocks with all-zero
+    // syndromes need no further work beyond copying out their data section.
+    std::array<UplinkCode::Syndromes, UPLINK_BLOCKS_PER_FRAME> syndromes;
+    const bool any_errors = rs_uplink_.ComputeInterleavedSyndromes(raw.data(), UPLINK_BLOCKS_PER_FRAME, syndromes.data());
+
+    UplinkBlocks blocks;
+    Deinterleave(raw.data(), blocks);
+
+    // correct the dirty blocks first, so that a frame that is going to fail
+    // does so before any data is copied out
+    unsigned total_errors = 0;
+    if (any_errors) {
+        for (unsigned block = 0; block < UPLINK_BLOCKS_PER_FRAME; ++block) {
+            std::uint8_t syn_error = 0;
+            for (auto syndrome : syndromes[block]) {
+                syn_error |= syndrome;
+            }
+            if (!syn_error) {
+                continue;
+            }
+
+            int n_corrected = rs_uplink_.Correct(blocks[block].data(), syndromes[block], block_erasures[block], num_erasures[block]);
+            if (n_corrected < 0 || n_corrected > UPLINK_BLOCK_ROOTS) {
+                // Failed
+                return R{false, 0};
+            }
+
+            total_errors += n_corrected;
+        }
+    }
+
+    // copy the data sections into the right place
+    for (unsigned block = 0; block < UPLINK_BLOCKS_PER_FRAME; ++block) {
+        std::memcpy(corrected.data() + block * UPLINK_BLOCK_DATA_BYTES, blocks[block].data(), UPLINK_BLOCK_DATA_BYTES);
     }
 
-    return R{true, std::move(corrected), total_errors};
+    return R{true, total_errors};
 }
@@ -7,19 +7,44 @@
 #ifndef UAT_FEC_H
 #define UAT_FEC_H
 
+#include <array>
 #include <tuple>
 
 #include "common.h"
+#include "reed_solomon.h"
+#include "uat_protocol.h"
 
 namespace airnav::uat {
+    // Fixed-size buffers for the allocation-free FEC API
+    typedef std::array<std::uint8_t, DOWNLINK_LONG_BYTES> DownlinkBuffer;
+    typedef std::array<std::uint8_t, UPLINK_BYTES> UplinkBuffer;
+    typedef std::array<std::uint8_t, UPLINK_DATA_BYTES> UplinkDataBuffer;
+
+    // A fixed-capacity list of byte indexes that should be treated as
+    // erasures. `count` keeps counting past the capacity, so a list that
+    // overflowed (which always means there are too many erasures to
+    // correct) can be detected.
+    template <std::size_t N> struct ErasureList {
+        std::array<std::uint16_t, N> index;
+        std::size_t count = 0;
+
+        void clear() { count = 0; }
+        void push_back(std::size_t i) {
+            if (count < N)
+                index[count] = i;
+            ++count;
+        }
+        bool overflow() const { return count > N; }
+    };
+
+    typedef ErasureList<fec::DOWNLINK_LONG_ROOTS> DownlinkErasures;
+    typedef ErasureList<fec::UPLINK_BLOCK_ROOTS * UPLINK_BLOCKS_PER_FRAME> UplinkErasures;
+
     // Deinterleaving and error-correction of UAT messages.
-    // This delegates to the "fec" library (in fec/) for the actual Reed-Solomon
-    // error-correction work.
+    // This delegates to ReedSolomon (reed_solomon.h) for the actual
+    // Reed-Solomon error-correction work.
     class FEC {
       public:
-        FEC();
-        ~FEC();
-
         // Given DOWNLINK_LONG_BYTES of demodulated data, returns a tuple of:
         //    bool     - true if the message is good, false if it was uncorrectable.
         //    Bytes    - a buffer containing the corrected data with FEC bits removed;
@@ -43,10 +68,30 @@ namespace airnav::uat {
         // handled as erasures
         std::tuple<bool, Bytes, unsigned> CorrectUplink(const Bytes &raw, const std::vector<std::size_t> &erasures = {});
 
+        // Allocation-free version of CorrectDownlink. `data` is corrected in
+        // place. Returns a tuple of:
+        //    bool        - true if the message is good, false if it was uncorrectable.
+        //    std::size_t - the number of corrected data bytes at the start of
+        //                  `data`; either DOWNLINK_SHORT_DATA_BYTES or
+        //                  DOWNLINK_LONG_DATA_BYTES. 0 if uncorrectable.
+        //    unsigned    - the number of errors corrected.
+        std::tuple<bool, std::size_t, unsigned> CorrectDownlink(DownlinkBuffer &data, const DownlinkErasures &erasures);
+
+        // Allocation-free version of CorrectUplink. The deinterleaved,
+        // corrected data is written to `corrected`. Returns a tuple of:
+        //    bool     - true if the message is good, false if it was uncorrectable.
+        //    unsigned - the number of errors corrected.
+        std::tuple<bool, unsigned> CorrectUplink(const UplinkBuffer &raw, const UplinkErasures &erasures, UplinkDataBuffer &corrected);
+
       private:
-        void *rs_uplink_;
-        void *rs_downlink_short_;
-        void *rs_downlink_long_;
+        typedef ReedSolomon<fec::DOWNLINK_SHORT_ROOTS, fec::DOWNLINK_SHORT_PAD> DownlinkShortCode;
+        typedef ReedSolomon<fec::DOWNLINK_LONG_ROOTS, fec::DOWNLINK_LONG_PAD> DownlinkLongCode;
+        typedef ReedSolomon<fec::UPLINK_BLOCK_ROOTS, fec::UPLINK_BLOCK_PAD> UplinkCode;
+
+        // shared, immutable tables
+        const UplinkCode &rs_uplink_ = UplinkCode::Get();
+        const DownlinkShortCode &rs_downlink_short_ = DownlinkShortCode::Get();
+        const DownlinkLongCode &rs_downlink_long_ = DownlinkLongCode::Get();
     };
 }; // namespace airnav::uat
 
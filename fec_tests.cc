@@ -1,7 +1,11 @@
+#include "fec.h"
+#include "reed_solomon.h"
 #include "uat_protocol.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <iomanip>
 #include <iostream>
 #include <vector>
 
@@ -9,6 +13,8 @@ extern "C" {
 #include "fec/rs.h"
 }
 
+static unsigned failures = 0;
+
 void test_rs_decode(unsigned seed, int trials, int symsize, int gfpoly, int fcr, int prim, int nroots, int pad) {
     srand(seed);
 
@@ -61,15 +67,18 @@ void test_rs_decode(unsigned seed, int trials, int symsize, int gfpoly, int fcr,
                 if (n_corrected >= 0) {
                     std::cerr << "RS(" << blocklen << "," << datalen << ") (seed: " << seed << " trial: " << trial << " errors: " << n_errors << ")"
                               << " returned success, but should have failed" << std::endl;
+                    ++failures;
                 }
             } else {
                 if (n_corrected != n_errors) {
                     std::cerr << "RS(" << blocklen << "," << datalen << ") (seed: " << seed << " trial: " << trial << " errors: " << n_errors << ")"
                               << " claimed to correct " << n_corrected << " errors" << std::endl;
+                    ++failures;
                 }
                 if (working_block != test_block) {
                     std::cerr << "RS(" << blocklen << "," << datalen << ") (seed: " << seed << " trial: " << trial << " errors: " << n_errors << ")"
                               << " data wasn't corrected correctly" << std::endl;
+                    ++failures;
                 }
 
                 for (int i = 0; i < n_corrected; ++i) {
@@ -77,6 +86,7 @@ void test_rs_decode(unsigned seed, int trials, int symsize, int gfpoly, int fcr,
                     if (found == error_pos.end()) {
                         std::cerr << "RS(" << blocklen << "," << datalen << ") (seed: " << seed << " trial: " << trial << " errors: " << n_errors << ")"
                                   << " corrected symbol at position " << corrected_pos[i] << " which was not in error" << std::endl;
+                        ++failures;
                     } else {
                         error_pos.erase(found);
                     }
@@ -88,6 +98,7 @@ void test_rs_decode(unsigned seed, int trials, int symsize, int gfpoly, int fcr,
                     for (int pos : error_pos)
                         std::cerr << pos;
                     std::cerr << "]" << std::endl;
+                    ++failures;
                 }
             }
         }
@@ -96,6 +107,220 @@ void test_rs_decode(unsigned seed, int trials, int symsize, int gfpoly, int fcr,
     ::free_rs_char(rs);
 }
 
+// Check that ReedSolomon gives exactly the same results as libs/fec for
+// random combinations of errors and erasures, including uncorrectable ones
+template <class Code> void test_fast_decode(unsigned seed, int trials, int nroots, int pad) {
+    srand(seed);
+
+    void *rs = ::init_rs_char(8, airnav::uat::fec::UPLINK_BLOCK_POLY, 120, 1, nroots, pad);
+    Code code;
+
+    int blocklen = 255 - pad;
+    int datalen = blocklen - nroots;
+
+    std::vector<unsigned char> test_block(blocklen, 0);
+
+    for (int trial = 0; trial < trials; ++trial) {
+        for (int i = 0; i < datalen; ++i)
+            test_block[i] = std::rand() & 255;
+        ::encode_rs_char(rs, test_block.data(), test_block.data() + datalen);
+
+        for (int n_errors = 0; n_errors <= nroots; ++n_errors) {
+            std::vector<unsigned char> reference_block = test_block;
+            for (int i = 0; i < n_errors; ++i)
+                reference_block[std::rand() % blocklen] ^= (std::rand() % 255) + 1;
+
+            // some of the time, mark some erasures (not necessarily at the errors)
+            int n_erasures = (std::rand() % 3 == 0 ? std::rand() % (nroots + 1) : 0);
+            std::vector<int> reference_erasures(nroots, 0);
+            for (int i = 0; i < n_erasures; ++i) {
+                int pos;
+                do {
+                    pos = std::rand() % blocklen;
+                } while (std::find(reference_erasures.begin(), reference_erasures.begin() + i, pos) != reference_erasures.begin() + i);
+                reference_erasures[i] = pos;
+            }
+
+            std::vector<unsigned char> fast_block = reference_block;
+            std::vector<int> fast_erasures = reference_erasures;
+
+            int reference_result = ::decode_rs_char(rs, reference_block.data(), reference_erasures.data(), n_erasures);
+            int fast_result = code.Decode(fast_block.data(), fast_erasures.data(), n_erasures);
+
+            bool same = (reference_result == fast_result && reference_block == fast_block);
+            for (int i = 0; same && i < reference_result; ++i)
+                same = (reference_erasures[i] == fast_erasures[i]);
+
+            if (!same) {
+                std::cerr << "fast RS(" << blocklen << "," << datalen << ") (seed: " << seed << " trial: " << trial << " errors: " << n_errors << " erasures: " << n_erasures << ")"
+                          << " returned " << fast_result << ", libfec returned " << reference_result << (reference_block == fast_block ? "" : " (data differs)") << std::endl;
+                ++failures;
+            }
+        }
+    }
+
+    ::free_rs_char(rs);
+}
+
+// Check interleaved syndrome computation against the one-block version
+void test_interleaved_syndromes(unsigned seed, int trials) {
+    using namespace airnav::uat;
+    typedef ReedSolomon<fec::UPLINK_BLOCK_ROOTS, fec::UPLINK_BLOCK_PAD> Code;
+
+    srand(seed);
+    Code code;
+
+    Bytes frame(UPLINK_BYTES);
+    Bytes block(UPLINK_BLOCK_BYTES);
+    std::array<Code::Syndromes, UPLINK_BLOCKS_PER_FRAME> interleaved;
+
+    for (int trial = 0; trial < trials; ++trial) {
+        for (auto &b : frame)
+            b = std::rand() & 255;
+
+        code.ComputeInterleavedSyndromes(frame.data(), UPLINK_BLOCKS_PER_FRAME, interleaved.data());
+
+        for (unsigned b = 0; b < UPLINK_BLOCKS_PER_FRAME; ++b) {
+            for (unsigned i = 0; i < UPLINK_BLOCK_BYTES; ++i)
+                block[i] = frame[i * UPLINK_BLOCKS_PER_FRAME + b];
+
+            Code::Syndromes single;
+            code.ComputeSyndromes(block.data(), single);
+            if (single != interleaved[b]) {
+                std::cerr << "interleaved syndromes (seed: " << seed << " trial: " << trial << " block: " << b << ") differ from single-block syndromes" << std::endl;
+                ++failures;
+            }
+        }
+    }
+}
+
+// Check FEC::CorrectUplink against deinterleaving by hand and running
+// decode_rs_char on each block, for frames with random errors and erasures
+void test_correct_uplink(unsigned seed, int trials) {
+    using namespace airnav::uat;
+
+    srand(seed);
+    void *rs = ::init_rs_char(8, fec::UPLINK_BLOCK_POLY, 120, 1, fec::UPLINK_BLOCK_ROOTS, fec::UPLINK_BLOCK_PAD);
+    FEC engine;
+
+    Bytes block(UPLINK_BLOCK_BYTES);
+    for (int trial = 0; trial < trials; ++trial) {
+        UplinkBuffer frame;
+        for (unsigned b = 0; b < UPLINK_BLOCKS_PER_FRAME; ++b) {
+            for (unsigned i = 0; i < UPLINK_BLOCK_DATA_BYTES; ++i)
+                block[i] = std::rand() & 255;
+            ::encode_rs_char(rs, block.data(), block.data() + UPLINK_BLOCK_DATA_BYTES);
+            for (unsigned i = 0; i < UPLINK_BLOCK_BYTES; ++i)
+                frame[i * UPLINK_BLOCKS_PER_FRAME + b] = block[i];
+        }
+
+        // anywhere from a clean frame to one that is mostly uncorrectable
+        const unsigned errors = std::rand() % (8 * UPLINK_BLOCKS_PER_FRAME);
+        for (unsigned e = 0; e < errors; ++e)
+            frame[std::rand() % UPLINK_BYTES] ^= (std::rand() % 255) + 1;
+
+        UplinkErasures erasures;
+        std::vector<int> block_erasures[UPLINK_BLOCKS_PER_FRAME];
+        const unsigned num_erasures = std::rand() % (4 * UPLINK_BLOCKS_PER_FRAME);
+        for (unsigned e = 0; e < num_erasures; ++e) {
+            const unsigned index = std::rand() % UPLINK_BYTES;
+            if (std::find(erasures.index.begin(), erasures.index.begin() + erasures.count, index) != erasures.index.begin() + erasures.count)
+                continue;
+            erasures.push_back(index);
+            block_erasures[index % UPLINK_BLOCKS_PER_FRAME].push_back(index / UPLINK_BLOCKS_PER_FRAME);
+        }
+
+        bool expected_success = true;
+        unsigned expected_errors = 0;
+        UplinkDataBuffer expected;
+        for (unsigned b = 0; b < UPLINK_BLOCKS_PER_FRAME && expected_success; ++b) {
+            for (unsigned i = 0; i < UPLINK_BLOCK_BYTES; ++i)
+                block[i] = frame[i * UPLINK_BLOCKS_PER_FRAME + b];
+            auto &eras = block_erasures[b];
+            if (eras.size() > static_cast<std::size_t>(fec::UPLINK_BLOCK_ROOTS)) {
+                expected_success = false;
+                break;
+            }
+            const int no_eras = eras.size();
+            eras.resize(fec::UPLINK_BLOCK_ROOTS);
+            int n = ::decode_rs_char(rs, block.data(), eras.data(), no_eras);
+            if (n < 0 || n > fec::UPLINK_BLOCK_ROOTS) {
+                expected_success = false;
+                break;
+            }
+            expected_errors += n;
+            std::copy(block.begin(), block.begin() + UPLINK_BLOCK_DATA_BYTES, expected.begin() + b * UPLINK_BLOCK_DATA_BYTES);
+        }
+
+        UplinkDataBuffer corrected;
+        bool success;
+        unsigned n_corrected;
+        std::tie(success, n_corrected) = engine.CorrectUplink(frame, erasures, corrected);
+
+        if (success != expected_success || (success && (n_corrected != expected_errors || corrected != expected))) {
+            std::cerr << "CorrectUplink (seed: " << seed << " trial: " << trial << ") returned " << success << "/" << n_corrected << ", expected " << expected_success << "/" << expected_errors << std::endl;
+            ++failures;
+        }
+    }
+
+    ::free_rs_char(rs);
+}
+
+// Time `iterations` calls of `fn` and return calls per second
+template <class F> double calls_per_second(unsigned iterations, F fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i)
+        fn();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return iterations / elapsed.count();
+}
+
+// Compare uplink frame decoding throughput between the libs/fec path (deinterleave,
+// then decode_rs_char on each block) and FEC::CorrectUplink
+void benchmark_uplink(unsigned iterations) {
+    using namespace airnav::uat;
+
+    srand(1);
+    void *rs = ::init_rs_char(8, fec::UPLINK_BLOCK_POLY, 120, 1, fec::UPLINK_BLOCK_ROOTS, fec::UPLINK_BLOCK_PAD);
+    FEC engine;
+
+    // build a valid interleaved frame
+    UplinkBuffer clean;
+    Bytes block(UPLINK_BLOCK_BYTES);
+    for (unsigned b = 0; b < UPLINK_BLOCKS_PER_FRAME; ++b) {
+        for (unsigned i = 0; i < UPLINK_BLOCK_DATA_BYTES; ++i)
+            block[i] = std::rand() & 255;
+        ::encode_rs_char(rs, block.data(), block.data() + UPLINK_BLOCK_DATA_BYTES);
+        for (unsigned i = 0; i < UPLINK_BLOCK_BYTES; ++i)
+            clean[i * UPLINK_BLOCKS_PER_FRAME + b] = block[i];
+    }
+
+    // and one with a few errors in every block
+    UplinkBuffer noisy = clean;
+    for (unsigned e = 0; e < 4 * UPLINK_BLOCKS_PER_FRAME; ++e)
+        noisy[std::rand() % UPLINK_BYTES] ^= (std::rand() % 255) + 1;
+
+    UplinkErasures no_erasures;
+    UplinkDataBuffer corrected;
+
+    for (auto frame : {&clean, &noisy}) {
+        double reference = calls_per_second(iterations, [&]() {
+            for (unsigned b = 0; b < UPLINK_BLOCKS_PER_FRAME; ++b) {
+                for (unsigned i = 0; i < UPLINK_BLOCK_BYTES; ++i)
+                    block[i] = (*frame)[i * UPLINK_BLOCKS_PER_FRAME + b];
+                int erasures[fec::UPLINK_BLOCK_ROOTS];
+                ::decode_rs_char(rs, block.data(), erasures, 0);
+            }
+        });
+
+        double fast = calls_per_second(iterations, [&]() { engine.CorrectUplink(*frame, no_erasures, corrected); });
+
+        std::cerr << "uplink frames, " << (frame == &clean ? "clean" : "with errors") << ": libfec " << std::fixed << std::setprecision(0) << reference << "/s, FEC " << fast << "/s (" << std::setprecision(1) << (fast / reference) << "x)" << std::endl;
+    }
+
+    ::free_rs_char(rs);
+}
+
 int main(int argc, char **argv) {
 
     test_rs_decode(/* seed */ 1,
@@ -124,4 +349,20 @@ int main(int argc, char **argv) {
                    /* prim */ 1,
                    /* nroots */ airnav::uat::fec::UPLINK_BLOCK_ROOTS,
                    /* pad */ airnav::uat::fec::UPLINK_BLOCK_PAD);
+
+    using namespace airnav::uat;
+    test_fast_decode<ReedSolomon<fec::DOWNLINK_SHORT_ROOTS, fec::DOWNLINK_SHORT_PAD>>(/* seed */ 2, /* trials */ 2000, fec::DOWNLINK_SHORT_ROOTS, fec::DOWNLINK_SHORT_PAD);
+    test_fast_decode<ReedSolomon<fec::DOWNLINK_LONG_ROOTS, fec::DOWNLINK_LONG_PAD>>(/* seed */ 2, /* trials */ 2000, fec::DOWNLINK_LONG_ROOTS, fec::DOWNLINK_LONG_PAD);
+    test_fast_decode<ReedSolomon<fec::UPLINK_BLOCK_ROOTS, fec::UPLINK_BLOCK_PAD>>(/* seed */ 2, /* trials */ 2000, fec::UPLINK_BLOCK_ROOTS, fec::UPLINK_BLOCK_PAD);
+    test_interleaved_syndromes(/* seed */ 3, /* trials */ 1000);
+    test_correct_uplink(/* seed */ 4, /* trials */ 2000);
+
+    benchmark_uplink(/* iterations */ 2000);
+
+    if (failures) {
+        std::cerr << failures << " test failures" << std::endl;
+        return 1;
+    }
+
+    return 0;
 }
@@ -0,0 +1,52 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "io_pool.h"
+
+#include <iostream>
+
+#include "thread_placement.h"
+
+using namespace airnav::uat;
+
+IoServicePool::IoServicePool(unsigned threads) {
+    for (unsigned i = 0; i < std::max(1U, threads); ++i) {
+        services_.emplace_back(new boost::asio::io_service(1));
+    }
+}
+
+IoServicePool::~IoServicePool() { Stop(); }
+
+void IoServicePool::Start() {
+    if (!threads_.empty()) {
+        return; // already running
+    }
+
+    for (auto &service : services_) {
+        work_.emplace_back(new boost::asio::io_service::work(*service));
+        auto *s = service.get();
+        threads_.emplace_back([s]() {
+            ApplyThreadPlacement(ThreadRole::IO, "978-io");
+            try {
+                s->run();
+            } catch (const std::exception &e) {
+                std::cerr << "io thread: uncaught exception: " << e.what() << std::endl;
+                throw;
+            }
+        });
+    }
+}
+
+void IoServicePool::Stop() {
+    work_.clear();
+    for (auto &service : services_) {
+        service->stop();
+    }
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+}
+
+boost::asio::io_service &IoServicePool::Next() { return *services_[next_++ % services_.size()]; }
@@ -0,0 +1,56 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_IO_POOL_H
+#define DUMP978_IO_POOL_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+
+namespace airnav::uat {
+    // A set of io_services, each run by its own thread, that network
+    // connections are sharded across. Each connection does all its work
+    // (its strand, reads and writes) on the one thread that owns its
+    // io_service, so connections on different threads never contend.
+    class IoServicePool {
+      public:
+        typedef std::shared_ptr<IoServicePool> Pointer;
+
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(unsigned threads) { return Pointer(new IoServicePool(threads)); }
+
+        ~IoServicePool();
+
+        IoServicePool(const IoServicePool &) = delete;
+        IoServicePool &operator=(const IoServicePool &) = delete;
+
+        void Start();
+
+        // Stop all the io_services, abandoning their outstanding work, and
+        // wait for the threads to finish
+        void Stop();
+
+        // The io_service for the next connection, round-robin; may be
+        // called from any thread
+        boost::asio::io_service &Next();
+
+        std::size_t Size() const { return services_.size(); }
+
+      private:
+        explicit IoServicePool(unsigned threads);
+
+        std::vector<std::unique_ptr<boost::asio::io_service>> services_;
+        std::vector<std::unique_ptr<boost::asio::io_service::work>> work_; // keep idle services running
+        std::vector<std::thread> threads_;
+        std::atomic<unsigned> next_{0};
+    };
+}; // namespace airnav::uat
+
+#endif
@@ -0,0 +1,73 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <boost/system/system_error.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace airnav::uat;
+
+static boost::system::system_error SystemError(int err, const std::string &what) { return boost::system::system_error(boost::system::error_code(err, boost::system::system_category()), what); }
+
+MappedFile::MappedFile(const std::string &path) {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        throw SystemError(errno, path);
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) < 0) {
+        auto err = errno;
+        ::close(fd_);
+        throw SystemError(err, path);
+    }
+
+    size_ = st.st_size;
+    if (size_ == 0) {
+        // an empty mapping is not allowed; leave data_ null
+        return;
+    }
+
+    void *base = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (base == MAP_FAILED) {
+        auto err = errno;
+        ::close(fd_);
+        throw SystemError(err, path + ": failed to map file");
+    }
+
+    // a hint only; readers work through the file from start to end
+    ::madvise(base, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const std::uint8_t *>(base);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        ::munmap(const_cast<std::uint8_t *>(data_), size_);
+    }
+    ::close(fd_);
+}
+
+void MappedFile::Release(std::size_t offset, std::size_t length) const {
+    static const std::size_t page_size = ::sysconf(_SC_PAGESIZE);
+
+    // only whole pages inside the range can go
+    std::size_t begin = (offset + page_size - 1) / page_size * page_size;
+    std::size_t end = std::min(offset + length, size_) / page_size * page_size;
+    if (!data_ || begin >= end) {
+        return;
+    }
+
+    // The mapping is private and read-only, so dropping its pages never
+    // loses data; this only fails for bad arguments, so errors are ignored
+    ::madvise(const_cast<std::uint8_t *>(data_) + begin, end - begin, MADV_DONTNEED);
+    ::posix_fadvise(fd_, begin, end - begin, POSIX_FADV_DONTNEED);
+}
@@ -0,0 +1,47 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_MAPPED_FILE_H
+#define DUMP978_MAPPED_FILE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace airnav::uat {
+    // A read-only memory mapping of a whole file.
+    class MappedFile {
+      public:
+        typedef std::shared_ptr<const MappedFile> Pointer;
+
+        // Map `path`; throws boost::system::system_error if it cannot be
+        // opened or mapped
+        static Pointer Open(const std::string &path) { return Pointer(new MappedFile(path)); }
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const std::uint8_t *Data() const { return data_; }
+        std::size_t Size() const { return size_; }
+
+        // Tell the kernel that `length` bytes at `offset` are no longer
+        // needed, so that their pages (whole pages only) can be dropped from
+        // the mapping and the page cache. The data stays readable: pages that
+        // are touched again are reread from the file.
+        void Release(std::size_t offset, std::size_t length) const;
+
+      private:
+        MappedFile(const std::string &path);
+
+        int fd_ = -1;
+        const std::uint8_t *data_ = nullptr;
+        std::size_t size_ = 0;
+    };
+}; // namespace airnav::uat
+
+#endif
@@ -4,77 +4,185 @@
 
 #include "message_dispatch.h"
 
-#include <boost/thread/locks.hpp>
-#include <mutex>
+#include <algorithm>
+#include <iostream>
+
+#include "stats.h"
+#include "thread_placement.h"
+#include "trace.h"
 
 using namespace airnav::uat;
 
-MessageDispatch::MessageDispatch() : next_handle_(0), busy_(0) {}
+MessageDispatch::MessageDispatch() : next_handle_(0), clients_(std::make_shared<ClientList>()), drop_when_full_(false), dropped_(0), reported_dropped_(0) {}
+
+MessageDispatch::~MessageDispatch() { StopAsync(); }
+
+MessageDispatch::Handle MessageDispatch::AddClient(MessageHandler handler, const MessageFilter &filter) {
+    std::unique_lock<std::mutex> lock(update_mutex_);
 
-MessageDispatch::Handle MessageDispatch::AddClient(MessageHandler handler) {
-    std::unique_lock<std::recursive_mutex> lock(mutex_);
+    auto client = std::make_shared<Client>();
+    client->handle = next_handle_++;
+    client->handler = std::move(handler);
+    client->removed = false;
 
-    Handle h = next_handle_++;
-    clients_[h] = {handler, false};
-    return h;
+    auto updated = std::make_shared<ClientList>(*std::atomic_load(&clients_));
+    updated->entries.push_back({client, filter, 0});
+    Publish(std::move(updated));
+
+    return client->handle;
 }
 
 void MessageDispatch::RemoveClient(Handle h) {
-    std::unique_lock<std::recursive_mutex> lock(mutex_);
+    std::unique_lock<std::mutex> lock(update_mutex_);
+
+    auto current = std::atomic_load(&clients_);
+    auto updated = std::make_shared<ClientList>();
+    updated->entries.reserve(current->entries.size());
+    for (const auto &entry : current->entries) {
+        if (entry.client->handle == h) {
+            // stop any Dispatch that is already working from the old snapshot
+            entry.client->removed = true;
+        } else {
+            updated->entries.push_back(entry);
+        }
+    }
 
-    auto i = clients_.find(h);
-    if (i == clients_.end())
-        return;
+    if (updated->entries.size() != current->entries.size()) {
+        Publish(std::move(updated));
+    }
+}
+
+void MessageDispatch::SetClientFilter(Handle h, const MessageFilter &filter) {
+    std::unique_lock<std::mutex> lock(update_mutex_);
 
-    i->second.deleted = true;
-    PurgeDeadClients();
+    auto updated = std::make_shared<ClientList>(*std::atomic_load(&clients_));
+    for (auto &entry : updated->entries) {
+        if (entry.client->handle == h) {
+            entry.filter = filter;
+        }
+    }
+    Publish(std::move(updated));
+}
+
+void MessageDispatch::Publish(std::shared_ptr<ClientList> updated) {
+    updated->groups.clear();
+    for (auto &entry : updated->entries) {
+        auto group = std::find(updated->groups.begin(), updated->groups.end(), entry.filter);
+        entry.group = group - updated->groups.begin();
+        if (group == updated->groups.end()) {
+            updated->groups.push_back(entry.filter);
+        }
+    }
+
+    std::atomic_store(&clients_, std::shared_ptr<const ClientList>(std::move(updated)));
 }
 
-template <typename T> class BusyCounter {
-  public:
-    BusyCounter(T &var) : var_(var), owned_(true) { ++var_; }
+void MessageDispatch::Dispatch(SharedMessageVector messages) {
+    if (!queue_) {
+        Deliver(messages);
+        return;
+    }
 
-    BusyCounter(const T &) = delete;
-    BusyCounter &operator=(const T &) = delete;
+    if (!drop_when_full_) {
+        queue_->Push(std::move(messages));
+    } else if (!queue_->TryPush(std::move(messages))) {
+        ++dropped_;
+        ReportDropped();
+    }
+}
 
-    ~BusyCounter() { release(); }
+void MessageDispatch::Deliver(const SharedMessageVector &messages) {
+    stats::StageTimer timer(stats::Stage::DISPATCH);
 
-    void release() {
-        if (owned_) {
-            --var_;
-            owned_ = false;
+    auto &timing = messages->timing;
+    timing.dispatched = std::chrono::steady_clock::now();
+    std::uint64_t age_ns = 0;
+    if (timing.received != std::chrono::steady_clock::time_point()) {
+        stats::Record(stats::Latency::DISPATCHED, timing.dispatched - timing.received);
+        age_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timing.dispatched - timing.received).count();
+    }
+    DUMP978_TRACE(DISPATCH, messages->size(), age_ns, 0);
+
+    // the snapshot keeps every client (and its handler) alive until we're done,
+    // even if it is removed while we are dispatching
+    auto snapshot = std::atomic_load(&clients_);
+    if (snapshot->groups.size() == 1 && snapshot->groups[0].PassesEverything()) {
+        // the common case: no filtering
+        for (const auto &entry : snapshot->entries) {
+            if (!entry.client->removed)
+                entry.client->handler(messages);
         }
+        return;
     }
 
-  private:
-    T &var_;
-    bool owned_;
-};
+    // each group's subset, built when the first of its clients needs it
+    std::vector<SharedMessageVector> subsets(snapshot->groups.size());
+    for (const auto &entry : snapshot->entries) {
+        if (entry.client->removed)
+            continue;
 
-void MessageDispatch::Dispatch(SharedMessageVector messages) {
-    std::unique_lock<std::recursive_mutex> lock(mutex_);
+        const auto &filter = snapshot->groups[entry.group];
+        if (filter.PassesEverything()) {
+            entry.client->handler(messages);
+            continue;
+        }
+
+        auto &subset = subsets[entry.group];
+        if (!subset) {
+            stats::Add(stats::Counter::FILTERED_SUBSETS);
+            subset = MessageVector::Create();
+            subset->timing = messages->timing;
+            subset->source = messages->source;
+            filter.Select(*messages, *subset);
+        }
+        if (!subset->empty())
+            entry.client->handler(subset);
+    }
+}
 
-    BusyCounter<unsigned> counter(busy_);
-    for (auto i = clients_.begin(); i != clients_.end(); ++i) {
-        Client &c = i->second;
-        if (!c.deleted)
-            c.handler(messages);
+void MessageDispatch::StartAsync(std::size_t queue_depth, bool drop_when_full) {
+    if (queue_) {
+        return; // already running
     }
-    counter.release();
 
-    PurgeDeadClients();
+    drop_when_full_ = drop_when_full;
+    last_drop_report_ = std::chrono::steady_clock::now();
+    queue_.reset(new BoundedQueue<SharedMessageVector>(queue_depth));
+    dispatch_thread_ = std::thread(&MessageDispatch::DispatchThread, this);
 }
 
-void MessageDispatch::PurgeDeadClients() {
-    // caller must lock!
-    if (busy_)
+void MessageDispatch::StopAsync() {
+    if (!queue_) {
         return;
+    }
+
+    // an empty pointer tells the dispatch thread to stop once it has
+    // delivered everything queued before it
+    queue_->Push(SharedMessageVector());
+    dispatch_thread_.join();
+    queue_.reset();
+}
+
+void MessageDispatch::DispatchThread() {
+    ApplyThreadPlacement(ThreadRole::IO, "978-dispatch");
+
+    SharedMessageVector messages;
+    while (queue_->Pop(messages) && messages) {
+        Deliver(messages);
+    }
+}
+
+void MessageDispatch::ReportDropped() {
+    const auto report_interval = std::chrono::milliseconds(15000);
 
-    for (auto i = clients_.begin(); i != clients_.end();) {
-        Client &c = i->second;
-        if (c.deleted)
-            clients_.erase(i++);
-        else
-            ++i;
+    std::unique_lock<std::mutex> lock(report_mutex_);
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_drop_report_ < report_interval) {
+        return;
     }
+
+    const std::uint64_t dropped = dropped_;
+    std::cerr << "Message dispatch: " << (dropped - reported_dropped_) << " message groups dropped (clients are not keeping up)" << std::endl;
+    last_drop_report_ = now;
+    reported_dropped_ = dropped;
 }
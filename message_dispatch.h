@@ -8,41 +8,107 @@
 #define MESSAGE_DISPATCH_H
 
 #include <atomic>
+#include <chrono>
 #include <functional>
-#include <map>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 
+#include "bounded_queue.h"
+#include "message_filter.h"
 #include "uat_message.h"
 
 namespace airnav::uat {
+    // Fans out message vectors to a set of clients.
+    //
+    // The client list is an immutable snapshot that is replaced (under a
+    // mutex that only AddClient / RemoveClient take) whenever a client is
+    // added or removed; Dispatch just loads the current snapshot atomically
+    // and calls each handler without holding any lock. Handlers may add or
+    // remove clients, including themselves.
+    //
+    // Each client has a MessageFilter. Clients with identical filters form a
+    // group, and each group's subset of a message vector is built once per
+    // Dispatch and shared by the group's clients, so (for example) an
+    // EncodingCache encodes it once for all of them. Clients that pass
+    // everything get the original vector.
+    //
+    // By default handlers are called on the thread that calls Dispatch.
+    // After StartAsync, Dispatch only queues the messages, and a separate
+    // dispatch thread calls the handlers.
     class MessageDispatch {
       public:
         typedef unsigned Handle;
         typedef std::function<void(SharedMessageVector)> MessageHandler;
 
         MessageDispatch();
+        ~MessageDispatch();
         MessageDispatch(const MessageDispatch &) = delete;
         MessageDispatch &operator=(const MessageDispatch &) = delete;
 
-        Handle AddClient(MessageHandler handler);
+        Handle AddClient(MessageHandler handler, const MessageFilter &filter = MessageFilter());
+
+        // Change the messages that a client receives, from the next Dispatch on
+        void SetClientFilter(Handle client, const MessageFilter &filter);
+
+        // Remove a client. Its handler will not be called by any later
+        // Dispatch, but may still be running (or about to run) on another
+        // thread for messages that were dispatched before this call.
         void RemoveClient(Handle client);
 
         void Dispatch(SharedMessageVector messages);
 
-      protected:
-        void PurgeDeadClients();
+        // Switch to asynchronous dispatch, with up to `queue_depth` message
+        // vectors waiting for the dispatch thread. If `drop_when_full` is
+        // set, Dispatch discards messages when the queue is full rather
+        // than waiting for space. Call this before messages start flowing.
+        void StartAsync(std::size_t queue_depth, bool drop_when_full);
 
-      private:
-        std::recursive_mutex mutex_;
-        Handle next_handle_;
-        unsigned busy_;
+        // Deliver any queued messages, stop the dispatch thread and return
+        // to synchronous dispatch. Must not be called from a handler.
+        void StopAsync();
 
+        // Number of message vectors discarded because the asynchronous
+        // dispatch queue was full
+        std::uint64_t DroppedMessages() const { return dropped_; }
+
+      private:
         struct Client {
+            Handle handle;
             MessageHandler handler;
-            bool deleted;
+            std::atomic<bool> removed;
+        };
+
+        struct Entry {
+            std::shared_ptr<Client> client;
+            MessageFilter filter;
+            std::size_t group; // index into ClientList::groups
+        };
+
+        struct ClientList {
+            std::vector<Entry> entries;
+            std::vector<MessageFilter> groups; // the distinct filters of the entries
         };
 
-        std::map<Handle, Client> clients_;
+        // Replace the client list with `updated`, after grouping its entries by filter
+        void Publish(std::shared_ptr<ClientList> updated);
+        void Deliver(const SharedMessageVector &messages);
+        void DispatchThread();
+        void ReportDropped();
+
+        std::mutex update_mutex_; // serializes changes to the client list
+        Handle next_handle_;
+        std::shared_ptr<const ClientList> clients_; // only accessed via std::atomic_load / std::atomic_store
+
+        std::unique_ptr<BoundedQueue<SharedMessageVector>> queue_;
+        std::thread dispatch_thread_;
+        bool drop_when_full_;
+        std::atomic<std::uint64_t> dropped_;
+
+        std::mutex report_mutex_;
+        std::chrono::steady_clock::time_point last_drop_report_;
+        std::uint64_t reported_dropped_;
     };
 }; // namespace airnav::uat
 
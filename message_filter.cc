@@ -0,0 +1,204 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "message_filter.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace airnav::uat;
+
+static std::vector<std::string> Split(const std::string &s, char separator) {
+    std::vector<std::string> parts;
+    std::string::size_type start = 0;
+    while (true) {
+        auto end = s.find(separator, start);
+        parts.push_back(s.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos)
+            return parts;
+        start = end + 1;
+    }
+}
+
+// Parse all of `s` as an unsigned number in `base`, or throw
+static unsigned long ParseUnsigned(const std::string &term, const std::string &s, int base) {
+    char *end = nullptr;
+    const auto value = std::strtoul(s.c_str(), &end, base);
+    if (s.empty() || *end != '\0' || s[0] == '-' || s[0] == '+') {
+        throw std::invalid_argument("bad value '" + s + "' in filter term '" + term + "'");
+    }
+    return value;
+}
+
+MessageFilter MessageFilter::Parse(const std::string &spec) {
+    MessageFilter filter;
+
+    // ignore surrounding whitespace, e.g. the \r of a client's CRLF
+    const auto first = spec.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        return filter;
+    }
+    const auto trimmed = spec.substr(first, spec.find_last_not_of(" \t\r\n") + 1 - first);
+
+    for (const auto &term : Split(trimmed, ',')) {
+        const auto equals = term.find('=');
+        if (equals == std::string::npos || equals == 0 || equals + 1 == term.size()) {
+            throw std::invalid_argument("filter term '" + term + "' is not key=value");
+        }
+
+        const auto key = term.substr(0, equals);
+        const auto value = term.substr(equals + 1);
+
+        if (key == "type") {
+            filter.types_ = 0;
+            for (const auto &type : Split(value, '+')) {
+                if (type == "downlink")
+                    filter.types_ |= DOWNLINK_SHORT_BIT | DOWNLINK_LONG_BIT;
+                else if (type == "downlink-short")
+                    filter.types_ |= DOWNLINK_SHORT_BIT;
+                else if (type == "downlink-long")
+                    filter.types_ |= DOWNLINK_LONG_BIT;
+                else if (type == "uplink")
+                    filter.types_ |= UPLINK_BIT;
+                else
+                    throw std::invalid_argument("unknown message type '" + type + "' in filter term '" + term + "'");
+            }
+        } else if (key == "aq") {
+            for (const auto &aq : Split(value, '+')) {
+                const auto n = ParseUnsigned(term, aq, 10);
+                if (n > 7) {
+                    throw std::invalid_argument("address qualifier '" + aq + "' out of range (0-7) in filter term '" + term + "'");
+                }
+                filter.qualifiers_.insert(n);
+            }
+        } else if (key == "address") {
+            for (const auto &address : Split(value, '+')) {
+                const auto n = ParseUnsigned(term, address, 16);
+                if (address.size() > 6 || n > 0xFFFFFF) {
+                    throw std::invalid_argument("address '" + address + "' is not 6 hex digits in filter term '" + term + "'");
+                }
+                filter.addresses_.insert(n);
+            }
+        } else if (key == "min-rssi") {
+            char *end = nullptr;
+            filter.min_rssi_ = std::strtof(value.c_str(), &end);
+            if (*end != '\0') {
+                throw std::invalid_argument("bad value '" + value + "' in filter term '" + term + "'");
+            }
+            filter.have_min_rssi_ = true;
+        } else if (key == "max-errors") {
+            filter.max_errors_ = ParseUnsigned(term, value, 10);
+            filter.have_max_errors_ = true;
+        } else {
+            throw std::invalid_argument("unknown filter term '" + term + "'");
+        }
+    }
+
+    return filter;
+}
+
+std::string MessageFilter::ToString() const {
+    std::ostringstream os;
+    const char *separator = "";
+    auto next_term = [&os, &separator](const char *key) {
+        os << separator << key << '=';
+        separator = ",";
+    };
+
+    if (types_ != ALL_TYPES) {
+        next_term("type");
+        const char *plus = "";
+        if ((types_ & (DOWNLINK_SHORT_BIT | DOWNLINK_LONG_BIT)) == (DOWNLINK_SHORT_BIT | DOWNLINK_LONG_BIT)) {
+            os << "downlink";
+            plus = "+";
+        } else if (types_ & DOWNLINK_SHORT_BIT) {
+            os << "downlink-short";
+            plus = "+";
+        } else if (types_ & DOWNLINK_LONG_BIT) {
+            os << "downlink-long";
+            plus = "+";
+        }
+        if (types_ & UPLINK_BIT) {
+            os << plus << "uplink";
+        }
+    }
+
+    if (!qualifiers_.empty()) {
+        next_term("aq");
+        const char *plus = "";
+        for (auto aq : qualifiers_) {
+            os << plus << aq;
+            plus = "+";
+        }
+    }
+
+    if (!addresses_.empty()) {
+        next_term("address");
+        const char *plus = "";
+        for (auto address : addresses_) {
+            os << plus << std::hex << std::setfill('0') << std::setw(6) << address << std::dec;
+            plus = "+";
+        }
+    }
+
+    if (have_min_rssi_) {
+        next_term("min-rssi");
+        os << min_rssi_;
+    }
+
+    if (have_max_errors_) {
+        next_term("max-errors");
+        os << max_errors_;
+    }
+
+    return os.str();
+}
+
+bool MessageFilter::Matches(const RawMessage &message) const {
+    unsigned type_bit;
+    switch (message.Type()) {
+    case MessageType::METADATA:
+        return true;
+    case MessageType::DOWNLINK_SHORT:
+        type_bit = DOWNLINK_SHORT_BIT;
+        break;
+    case MessageType::DOWNLINK_LONG:
+        type_bit = DOWNLINK_LONG_BIT;
+        break;
+    case MessageType::UPLINK:
+        type_bit = UPLINK_BIT;
+        break;
+    default:
+        return false;
+    }
+
+    if (!(types_ & type_bit))
+        return false;
+    if (have_max_errors_ && message.Errors() > max_errors_)
+        return false;
+    if (have_min_rssi_ && message.Rssi() < min_rssi_)
+        return false;
+
+    if (!qualifiers_.empty() || !addresses_.empty()) {
+        // header fields, present in every downlink (2.2.4.5.1.1 - 2.2.4.5.1.3)
+        if (type_bit == UPLINK_BIT)
+            return false;
+        if (!qualifiers_.empty() && !qualifiers_.count(message.Field<1, 6, 1, 8>()))
+            return false;
+        if (!addresses_.empty() && !addresses_.count(message.Field<2, 1, 4, 8>()))
+            return false;
+    }
+
+    return true;
+}
+
+void MessageFilter::Select(const MessageVector &in, MessageVector &out) const {
+    for (const auto &message : in) {
+        if (Matches(message))
+            out.push_back(message);
+    }
+}
@@ -0,0 +1,73 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_MESSAGE_FILTER_H
+#define DUMP978_MESSAGE_FILTER_H
+
+#include <cstdint>
+#include <set>
+#include <string>
+
+#include "uat_message.h"
+
+namespace airnav::uat {
+    // Selects the messages an output client wants. A default-constructed
+    // filter passes everything. Metadata messages always pass, so clients
+    // still see the connection header.
+    //
+    // The text form (Parse / ToString) is a comma-separated list of terms,
+    // all of which must match:
+    //
+    //   type=T[+T..]      downlink, downlink-short, downlink-long, uplink
+    //   aq=N[+N..]        downlink address qualifiers, 0-7
+    //   address=A[+A..]   downlink addresses, 6 hex digits
+    //   min-rssi=R        RSSI at least R dB
+    //   max-errors=N      at most N Reed-Solomon errors corrected
+    //
+    // e.g. "type=downlink,max-errors=2". aq= and address= only match
+    // downlinks; the empty string is the pass-everything filter.
+    class MessageFilter {
+      public:
+        MessageFilter() {}
+
+        // Throws std::invalid_argument, with a description of the problem,
+        // if `spec` is malformed
+        static MessageFilter Parse(const std::string &spec);
+
+        // The canonical text form: equal filters give equal strings
+        std::string ToString() const;
+
+        bool PassesEverything() const { return types_ == ALL_TYPES && qualifiers_.empty() && addresses_.empty() && !have_min_rssi_ && !have_max_errors_; }
+
+        bool Matches(const RawMessage &message) const;
+
+        // The downlink addresses that the filter is limited to; empty if any
+        const std::set<std::uint32_t> &Addresses() const { return addresses_; }
+
+        // Append the messages of `in` that match to `out`
+        void Select(const MessageVector &in, MessageVector &out) const;
+
+        bool operator==(const MessageFilter &o) const { return types_ == o.types_ && qualifiers_ == o.qualifiers_ && addresses_ == o.addresses_ && have_min_rssi_ == o.have_min_rssi_ && (!have_min_rssi_ || min_rssi_ == o.min_rssi_) && have_max_errors_ == o.have_max_errors_ && (!have_max_errors_ || max_errors_ == o.max_errors_); }
+        bool operator!=(const MessageFilter &o) const { return !(*this == o); }
+
+      private:
+        // bit masks of message types
+        static const unsigned DOWNLINK_SHORT_BIT = 1;
+        static const unsigned DOWNLINK_LONG_BIT = 2;
+        static const unsigned UPLINK_BIT = 4;
+        static const unsigned ALL_TYPES = DOWNLINK_SHORT_BIT | DOWNLINK_LONG_BIT | UPLINK_BIT;
+
+        unsigned types_ = ALL_TYPES;
+        std::set<unsigned> qualifiers_;     // empty: any
+        std::set<std::uint32_t> addresses_; // empty: any
+        bool have_min_rssi_ = false;
+        float min_rssi_ = 0;
+        bool have_max_errors_ = false;
+        unsigned max_errors_ = 0;
+    };
+}; // namespace airnav::uat
+
+#endif
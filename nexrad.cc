@@ -0,0 +1,260 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "nexrad.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace airnav::uat;
+
+// Block geometry, in arcminutes: see the comments in legacy/extract_nexrad.c.
+// Blocks are numbered east from 0E then north from the equator, 450 to a
+// ring of latitude; above 60 degrees blocks are twice as wide, but the
+// numbering keeps the narrow spacing and uses only even numbers.
+static const unsigned BLOCK_WIDTH = 48;
+static const unsigned WIDE_BLOCK_WIDTH = 96;
+static const unsigned BLOCK_HEIGHT = 4;
+static const unsigned BLOCKS_PER_RING = 450;
+static const unsigned WIDE_BLOCK_THRESHOLD = 405000;
+
+static const unsigned MINUTES_PER_DAY = 24 * 60;
+
+static unsigned ScaleMultiplier(unsigned scale) { return (scale == 1 ? 5 : scale == 2 ? 9 : 1); }
+
+int NexradBlock::North() const {
+    const int south_edge = BLOCK_HEIGHT * (number / BLOCKS_PER_RING);
+    return south ? -south_edge : south_edge + BLOCK_HEIGHT;
+}
+
+unsigned NexradBlock::West() const { return (number % BLOCKS_PER_RING) * BLOCK_WIDTH; }
+
+unsigned NexradBlock::Height() const { return BLOCK_HEIGHT * ScaleMultiplier(scale); }
+
+unsigned NexradBlock::Width() const { return (number >= WIDE_BLOCK_THRESHOLD ? WIDE_BLOCK_WIDTH : BLOCK_WIDTH) * ScaleMultiplier(scale); }
+
+void NexradBlock::Format(std::string &out) const {
+    char header[80];
+    int n = std::snprintf(header, sizeof(header), "NEXRAD %s %02u:%02u %u %d %u %u %u ", product_id == 63 ? "Regional" : "CONUS", minute_of_day / 60, minute_of_day % 60, scale, North(), West(), Height(), Width());
+    out.append(header, n);
+    for (auto bin : bins) {
+        out += (char)('0' + bin);
+    }
+    out += '\n';
+}
+
+void airnav::uat::DecodeNexrad(const FisbApdu &apdu, std::vector<NexradBlock> &blocks) {
+    // Header:
+    //
+    // byte/bit 7   6   5   4   3   2   1   0
+    //   0    |RLE|NS | Scale |  MSB Block #  |
+    //   1    |        Block #                |
+    //   2    |        Block #            LSB |
+
+    if (apdu.length < 4) {
+        return;
+    }
+
+    const std::uint8_t *data = apdu.data;
+    const bool rle = (data[0] & 0x80) != 0;
+    const unsigned block_number = ((data[0] & 0x0F) << 16) | (data[1] << 8) | data[2];
+
+    NexradBlock block;
+    block.product_id = apdu.product_id;
+    block.minute_of_day = apdu.hours * 60 + apdu.minutes;
+    block.south = (data[0] & 0x40) != 0;
+    block.scale = (data[0] & 0x30) >> 4;
+    if (block.scale > 2) {
+        return; // reserved
+    }
+
+    auto normalize = [](unsigned number) { return (number >= WIDE_BLOCK_THRESHOLD ? number & ~1U : number); };
+
+    if (rle) {
+        // One block of 128 bins. Each byte after the header is a run:
+        //   7   6   5   4   3   2   1   0
+        // |   runlength - 1   | intensity |
+        unsigned count = 0;
+        for (unsigned i = 3; i < apdu.length; ++i) {
+            const unsigned intensity = data[i] & 7;
+            const unsigned runlength = (data[i] >> 3) + 1;
+            if (count + runlength > block.bins.size()) {
+                return;
+            }
+            std::fill(block.bins.begin() + count, block.bins.begin() + count + runlength, intensity);
+            count += runlength;
+        }
+
+        if (count != block.bins.size()) {
+            return;
+        }
+
+        block.number = normalize(block_number);
+        blocks.push_back(block);
+        return;
+    }
+
+    // Empty block representation: a bitmap of empty blocks along the row
+    // of the header's block, starting with the header's block itself.
+    //
+    //       7    6    5    4    3    2    1    0
+    // 3   |b+4 |b+3 |b+2 |b+1 |    length (L)     |
+    // 4   |b+12|b+11|b+10|b+9 |b+8 |b+7 |b+6 |b+5 |
+    // ...
+    // 3+L |b+8L-3            ...            b+8L+4|
+    //
+    // Offsets wrap around within the row rather than continuing into the
+    // next row.
+    const unsigned length = data[3] & 15;
+    if (3 + length > apdu.length) {
+        return;
+    }
+
+    unsigned row_start, row_size;
+    if (block_number >= WIDE_BLOCK_THRESHOLD) {
+        row_start = block_number - ((block_number - WIDE_BLOCK_THRESHOLD) % (BLOCKS_PER_RING / 2));
+        row_size = BLOCKS_PER_RING / 2;
+    } else {
+        row_start = block_number - (block_number % BLOCKS_PER_RING);
+        row_size = BLOCKS_PER_RING;
+    }
+    const unsigned row_offset = block_number - row_start;
+
+    // as in extract_nexrad: CONUS empty blocks are intensity 1 (valid data,
+    // no precipitation), regional empty blocks are intensity 0 (< 5dBz)
+    block.bins.fill(apdu.product_id == 63 ? 0 : 1);
+
+    for (unsigned i = 0; i < length; ++i) {
+        // the first byte is synthesized in the same format as the others
+        const unsigned bitmap = (i == 0 ? (data[3] & 0xF0) | 0x08 : data[i + 3]);
+        for (unsigned j = 0; j < 8; ++j) {
+            if (bitmap & (1 << j)) {
+                const unsigned row_x = (row_offset + 8 * i + j - 3) % row_size;
+                block.number = normalize(row_start + row_x);
+                blocks.push_back(block);
+            }
+        }
+    }
+}
+
+NexradCache::NexradCache(unsigned max_age_minutes) : max_age_minutes_(max_age_minutes), products_({63, 64}, [this](const UplinkMessage &, const FisbApdu &apdu) { HandleApdu(apdu); }) {}
+
+NexradCache::SharedBuffer NexradCache::Update(const SharedMessageVector &messages) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const auto &entry : entries_) {
+        if (entry.messages == messages)
+            return entry.changes;
+    }
+
+    changes_.clear();
+    products_(*messages);
+    auto changes = std::make_shared<const std::string>(changes_);
+
+    // as in EncodingCache, holding the vector keeps its address from being reused
+    entries_[next_entry_] = {messages, changes};
+    next_entry_ = (next_entry_ + 1) % entries_.size();
+
+    num_blocks_ = images_[0].blocks.size() + images_[1].blocks.size();
+    return changes;
+}
+
+NexradCache::SharedBuffer NexradCache::Snapshot() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto snapshot = std::make_shared<std::string>();
+    for (const auto &image : images_) {
+        for (const auto &entry : image.blocks) {
+            entry.second.Format(*snapshot);
+        }
+    }
+    return snapshot;
+}
+
+// How many minutes before the image's newest time `minute_of_day` is; times
+// "after" the newest are treated as a day old
+unsigned NexradCache::Age(const Image &image, unsigned minute_of_day) const { return (image.latest_minute + MINUTES_PER_DAY - minute_of_day) % MINUTES_PER_DAY; }
+
+std::uint64_t NexradCache::HashApdu(const FisbApdu &apdu) {
+    // FNV-1a over the product, time and payload
+    std::uint64_t hash = UINT64_C(14695981039346656037);
+    auto mix = [&hash](std::uint8_t byte) {
+        hash ^= byte;
+        hash *= UINT64_C(1099511628211);
+    };
+
+    mix(apdu.product_id >> 8);
+    mix(apdu.product_id & 0xFF);
+    mix(apdu.hours);
+    mix(apdu.minutes);
+    for (unsigned i = 0; i < apdu.length; ++i) {
+        mix(apdu.data[i]);
+    }
+    return hash;
+}
+
+void NexradCache::HandleApdu(const FisbApdu &apdu) {
+    ++total_apdus_;
+
+    if (apdu.hours >= 24 || apdu.minutes >= 60) {
+        return;
+    }
+
+    auto &image = images_[apdu.product_id == 63 ? 0 : 1];
+    const unsigned minute_of_day = apdu.hours * 60 + apdu.minutes;
+
+    if (!image.started) {
+        image.started = true;
+        image.latest_minute = minute_of_day;
+    } else {
+        const unsigned ahead = (minute_of_day + MINUTES_PER_DAY - image.latest_minute) % MINUTES_PER_DAY;
+        if (ahead > 0 && ahead < MINUTES_PER_DAY / 2) {
+            image.latest_minute = minute_of_day;
+            Expire(image);
+        }
+    }
+
+    if (Age(image, minute_of_day) > max_age_minutes_) {
+        return; // from an image we have already forgotten
+    }
+
+    if (!image.seen_apdus.emplace(HashApdu(apdu), minute_of_day).second) {
+        ++repeated_apdus_;
+        return;
+    }
+
+    decoded_.clear();
+    DecodeNexrad(apdu, decoded_);
+    for (const auto &block : decoded_) {
+        auto inserted = image.blocks.emplace(BlockKey(block), block);
+        if (!inserted.second) {
+            auto &existing = inserted.first->second;
+            if (Age(image, existing.minute_of_day) < Age(image, block.minute_of_day)) {
+                continue; // we already have this block from a newer image
+            }
+            if (existing.minute_of_day == block.minute_of_day && existing.bins == block.bins) {
+                continue; // unchanged
+            }
+            existing = block;
+        }
+
+        block.Format(changes_);
+    }
+}
+
+void NexradCache::Expire(Image &image) {
+    for (auto i = image.blocks.begin(); i != image.blocks.end();) {
+        if (Age(image, i->second.minute_of_day) > max_age_minutes_) {
+            i = image.blocks.erase(i);
+        } else {
+            ++i;
+        }
+    }
+
+    for (auto i = image.seen_apdus.begin(); i != image.seen_apdus.end();) {
+        if (Age(image, i->second) > max_age_minutes_) {
+            i = image.seen_apdus.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
@@ -0,0 +1,118 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_NEXRAD_H
+#define DUMP978_NEXRAD_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "uat_message.h"
+
+namespace airnav::uat {
+    // One block of a NEXRAD "global block representation" image (FIS-B
+    // products 63, regional, and 64, CONUS): 32 x 4 bins of intensity 0-7,
+    // west to east then north to south.
+    struct NexradBlock {
+        unsigned product_id;
+        unsigned minute_of_day; // image time from the APDU header
+        bool south;             // ns flag: numbered from the equator southwards
+        unsigned scale;         // 0, 1 or 2: bins are 1x, 5x or 9x the base block size
+        unsigned number;        // block number, even-only above 60 degrees
+
+        std::array<std::uint8_t, 128> bins;
+
+        // Location and size in arcminutes; longitude is 0-21600 east of Greenwich
+        int North() const;
+        unsigned West() const;
+        unsigned Height() const;
+        unsigned Width() const;
+
+        // Append the block as one line in the format of legacy/extract_nexrad:
+        //   NEXRAD <Regional|CONUS> <hh>:<mm> <scale> <north> <west> <height> <width> <128 bins>
+        void Format(std::string &out) const;
+    };
+
+    // Decode the blocks described by one NEXRAD APDU: either a single
+    // run-length encoded block, or a set of empty blocks along one row.
+    // Malformed APDUs produce no blocks.
+    void DecodeNexrad(const FisbApdu &apdu, std::vector<NexradBlock> &blocks);
+
+    // Assembles the regional and CONUS NEXRAD images from the uplinks of
+    // successive message vectors.
+    //
+    // The same APDUs are rebroadcast many times. Each APDU is hashed, and
+    // one that has been seen before (for a recent image time) is dropped
+    // without being decoded. The images are kept as a map of blocks by
+    // location that are replaced one at a time as newer or different data
+    // arrives; each Update reports just the blocks it changed. Blocks from
+    // images much older than the newest one are forgotten.
+    class NexradCache {
+      public:
+        typedef std::shared_ptr<NexradCache> Pointer;
+        typedef std::shared_ptr<const std::string> SharedBuffer;
+
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(unsigned max_age_minutes = 30) { return Pointer(new NexradCache(max_age_minutes)); }
+
+        // Process `messages` and return the blocks that changed, formatted
+        // by NexradBlock::Format (an empty buffer if none did). A vector is
+        // processed only once however many callers pass it in; later
+        // callers get the same result. May be called from any thread.
+        SharedBuffer Update(const SharedMessageVector &messages);
+
+        // Every block currently held, formatted as by Update
+        SharedBuffer Snapshot();
+
+        std::size_t NumBlocks() const { return num_blocks_; }
+        std::uint64_t TotalApdus() const { return total_apdus_; }
+        std::uint64_t RepeatedApdus() const { return repeated_apdus_; }
+
+      private:
+        explicit NexradCache(unsigned max_age_minutes);
+
+        struct Image {
+            bool started = false;
+            unsigned latest_minute = 0;                             // newest image time seen
+            std::unordered_map<std::uint64_t, unsigned> seen_apdus; // APDU hash -> image time
+            std::unordered_map<std::uint32_t, NexradBlock> blocks;  // by BlockKey()
+        };
+
+        struct Entry {
+            SharedMessageVector messages;
+            SharedBuffer changes;
+        };
+
+        void HandleApdu(const FisbApdu &apdu);
+        void Expire(Image &image);
+        unsigned Age(const Image &image, unsigned minute_of_day) const;
+
+        static std::uint32_t BlockKey(const NexradBlock &block) { return (block.south ? 0x80000000U : 0) | (block.scale << 28) | block.number; }
+        static std::uint64_t HashApdu(const FisbApdu &apdu);
+
+        unsigned max_age_minutes_;
+
+        std::mutex mutex_;
+        std::array<Image, 2> images_; // regional, CONUS
+        FisbProducts products_;
+        std::string changes_; // blocks changed by the vector being processed
+        std::vector<NexradBlock> decoded_;
+        std::array<Entry, 4> entries_;
+        std::size_t next_entry_ = 0;
+
+        std::atomic<std::size_t> num_blocks_{0};
+        std::atomic<std::uint64_t> total_apdus_{0};
+        std::atomic<std::uint64_t> repeated_apdus_{0};
+    };
+}; // namespace airnav::uat
+
+#endif
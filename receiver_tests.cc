@@ -0,0 +1,509 @@
+#include "demodulator.h"
+#include "test_signals.h"
+#include "uat_protocol.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+#include <boost/asio/error.hpp>
+
+using namespace airnav::uat;
+
+static unsigned failures = 0;
+
+// Counts callbacks (or other events), which the tests wait for
+class EventCounter {
+  public:
+    void Notify() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++count_;
+        cond_.notify_all();
+    }
+
+    // Wait until there have been `count` events in total
+    bool WaitFor(unsigned count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cond_.wait_for(lock, std::chrono::seconds(10), [this, count]() { return count_ >= count; });
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    unsigned count_ = 0;
+};
+
+// Notifies an EventCounter when destroyed; a consumer callback that holds
+// one shows when the receiver that owns the callback is destroyed
+struct DestroyedToken {
+    explicit DestroyedToken(EventCounter &counter) : counter_(counter) {}
+    ~DestroyedToken() { counter_.Notify(); }
+    EventCounter &counter_;
+};
+
+// A CU8 capture of `count` long downlinks with random payloads
+static std::vector<std::uint8_t> downlink_capture(unsigned count) {
+    std::mt19937 rng(1);
+    FrameEncoder encoder;
+    std::vector<EncodedFrame> frames;
+    for (unsigned i = 0; i < count; ++i) {
+        std::uint8_t payload[DOWNLINK_LONG_DATA_BYTES];
+        for (auto &b : payload) {
+            b = rng() & 0xFF;
+        }
+        frames.push_back(encoder.Encode(RawMessage(payload, sizeof(payload), 0, 0, 0)));
+    }
+    return Modulate(frames, SampleFormat::CU8);
+}
+
+// Feed `capture` to `receiver` in blocks of `block_bytes`, each carrying as
+// much history as the receiver wants
+static void feed_blocks(Receiver &receiver, const std::shared_ptr<std::vector<std::uint8_t>> &capture, std::size_t block_bytes) {
+    const std::size_t history_bytes = receiver.NumTrailingSamples() * 2;
+    for (std::size_t offset = 0; offset < capture->size(); offset += block_bytes) {
+        SampleBlock block;
+        block.data = capture->data() + offset;
+        block.size = std::min(block_bytes, capture->size() - offset);
+        block.history = std::min(offset, history_bytes);
+        block.hold = capture;
+        receiver.HandleSamples(block);
+    }
+}
+
+// The number of messages a SingleThreadReceiver decodes from `capture` fed
+// in blocks of `block_bytes`; messages that straddle some block boundaries
+// are not found, so this is what the threaded receivers should match
+static unsigned reference_count(const std::shared_ptr<std::vector<std::uint8_t>> &capture, std::size_t block_bytes) {
+    unsigned received = 0;
+    auto receiver = SingleThreadReceiver::Create(SampleFormat::CU8);
+    receiver->SetConsumer([&received](SharedMessageVector messages) { received += messages->size(); });
+    receiver->Start();
+    feed_blocks(*receiver, capture, block_bytes);
+    receiver->Stop();
+    return received;
+}
+
+// Stopping a PipelinedReceiver from its own error handler must leave it
+// restartable and destroyable from another thread
+void test_pipelined_stop_from_callback() {
+    unsigned mismatches = 0;
+    EventCounter errors;
+
+    auto receiver = std::make_shared<PipelinedReceiver>(SampleFormat::CU8, false);
+    PipelinedReceiver *raw = receiver.get();
+    receiver->SetErrorHandler([raw, &errors](const boost::system::error_code &) {
+        raw->Stop();
+        errors.Notify();
+    });
+
+    for (unsigned run = 1; run <= 3; ++run) {
+        receiver->Start();
+        receiver->HandleError(boost::asio::error::eof);
+        if (!errors.WaitFor(run)) {
+            std::cerr << "pipelined: run " << run << ": no error callback" << std::endl;
+            ++mismatches;
+            break;
+        }
+    }
+
+    receiver.reset();
+
+    std::cerr << "pipelined receiver, stopped from its error handler: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// As above, for a ParallelFileReceiver stopped at EOF from its merge thread
+void test_parallel_file_stop_from_callback() {
+    unsigned mismatches = 0;
+    EventCounter errors;
+
+    char path[] = "/tmp/receiver_tests.XXXXXX";
+    int fd = ::mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "parallel file: can't create a temporary file" << std::endl;
+        ++failures;
+        return;
+    }
+    ::close(fd);
+    {
+        std::ofstream out(path, std::ios::binary);
+        const std::string quiet(65536, (char)127); // CU8 samples near zero
+        for (int i = 0; i < 8; ++i) {
+            out << quiet;
+        }
+    }
+
+    auto receiver = ParallelFileReceiver::Create(SampleFormat::CU8, MappedFile::Open(path), 2, 65536);
+    ::unlink(path);
+
+    ParallelFileReceiver *raw = receiver.get();
+    receiver->SetErrorHandler([raw, &errors](const boost::system::error_code &) {
+        raw->Stop();
+        errors.Notify();
+    });
+
+    for (unsigned run = 1; run <= 3; ++run) {
+        receiver->Start();
+        if (!errors.WaitFor(run)) {
+            std::cerr << "parallel file: run " << run << ": no EOF callback" << std::endl;
+            ++mismatches;
+            break;
+        }
+    }
+
+    receiver.reset();
+
+    std::cerr << "parallel file receiver, stopped from its error handler: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// Dropping the last outside reference to a PipelinedReceiver from its own
+// consumer callback, mid-stream, must not destroy it under its threads:
+// it carries on until stopped, and is destroyed as its threads exit
+void test_pipelined_destroy_from_callback() {
+    unsigned mismatches = 0;
+    const unsigned count = 100;
+    auto capture = std::make_shared<std::vector<std::uint8_t>>(downlink_capture(count));
+
+    EventCounter destroyed;
+    std::atomic<unsigned> received(0);
+    std::atomic<unsigned> vectors(0);
+
+    // the conversion queue holds the whole capture, so it can all be queued
+    // before the receiver starts
+    const std::size_t blocks = 32;
+    const std::size_t block_bytes = (capture->size() / blocks + 1) & ~std::size_t(1);
+    const unsigned expected = reference_count(capture, block_bytes);
+
+    auto holder = std::make_shared<PipelinedReceiver>(SampleFormat::CU8, false, blocks + 1);
+    PipelinedReceiver *raw = holder.get();
+    {
+        auto token = std::make_shared<DestroyedToken>(destroyed);
+        holder->SetConsumer([&holder, &received, &vectors, token](SharedMessageVector messages) {
+            received += messages->size();
+            if (vectors++ == 0) {
+                holder.reset(); // the last outside reference
+            }
+        });
+    }
+    holder->SetErrorHandler([raw](const boost::system::error_code &) { raw->Stop(); });
+
+    feed_blocks(*raw, capture, block_bytes);
+    raw->HandleError(boost::asio::error::eof);
+
+    // from here on only the receiver's threads (and the callback) touch it
+    raw->Start();
+
+    if (!destroyed.WaitFor(1)) {
+        std::cerr << "pipelined: receiver was not destroyed" << std::endl;
+        ++mismatches;
+    } else if (vectors < 2 || received != expected) {
+        std::cerr << "pipelined: expected " << expected << " messages in several vectors, got " << received << " in " << vectors << std::endl;
+        ++mismatches;
+    }
+
+    std::cerr << "pipelined receiver, destroyed from its consumer: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// As above, for a ParallelFileReceiver, which is destroyed as its threads
+// finish at the end of the file
+void test_parallel_file_destroy_from_callback() {
+    unsigned mismatches = 0;
+    const unsigned count = 100;
+
+    char path[] = "/tmp/receiver_tests.XXXXXX";
+    int fd = ::mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "parallel file: can't create a temporary file" << std::endl;
+        ++failures;
+        return;
+    }
+    ::close(fd);
+    auto capture = std::make_shared<std::vector<std::uint8_t>>(downlink_capture(count));
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(capture->data()), capture->size());
+    }
+    // the workers' chunks overlap, so nothing is lost at their boundaries
+    const unsigned expected = reference_count(capture, capture->size());
+
+    EventCounter destroyed;
+    std::atomic<unsigned> received(0);
+    std::atomic<unsigned> vectors(0);
+
+    auto holder = ParallelFileReceiver::Create(SampleFormat::CU8, MappedFile::Open(path), 4, 16384);
+    ::unlink(path);
+
+    ParallelFileReceiver *raw = holder.get();
+    {
+        auto token = std::make_shared<DestroyedToken>(destroyed);
+        holder->SetConsumer([&holder, &received, &vectors, token](SharedMessageVector messages) {
+            received += messages->size();
+            if (vectors++ == 0) {
+                holder.reset(); // the last outside reference
+            }
+        });
+    }
+
+    // from here on only the receiver's threads (and the callback) touch it
+    raw->Start();
+
+    if (!destroyed.WaitFor(1)) {
+        std::cerr << "parallel file: receiver was not destroyed" << std::endl;
+        ++mismatches;
+    } else if (vectors < 2 || received != expected) {
+        std::cerr << "parallel file: expected " << expected << " messages in several vectors, got " << received << " in " << vectors << std::endl;
+        ++mismatches;
+    }
+
+    std::cerr << "parallel file receiver, destroyed from its consumer: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// Count the bit errors between `pattern` and the sync word starting at
+// offset `s` of `phase`, sliced one phase difference at a time, as the
+// sample-by-sample search did before SyncSearch
+static unsigned sync_errors(const PhaseBuffer &phase, std::size_t s, std::uint64_t pattern) {
+    std::uint64_t word = 0;
+    for (unsigned i = 0; i < SYNC_BITS; ++i) {
+        word = (word << 1) | (static_cast<std::int16_t>(phase[s + 2 * i + 1] - phase[s + 2 * i]) > 0 ? 1 : 0);
+    }
+    return __builtin_popcountll(word ^ pattern);
+}
+
+// Check a prepared SyncSearch over `phase` against the sample-by-sample
+// search: the same matches at every offset, and the same candidate pairs
+// visited from every starting parity
+static unsigned check_sync_search(const std::string &desc, const SyncSearch &search, const PhaseBuffer &phase) {
+    unsigned mismatches = 0;
+    const std::size_t pairs = (phase.size() - 1) / 2;
+    const std::size_t offsets = (pairs >= SYNC_BITS ? pairs - SYNC_BITS + 1 : 0) * 2;
+
+    std::vector<bool> candidate(offsets + 1, false);
+    for (std::size_t s = 0; s < offsets; ++s) {
+        const bool downlink = sync_errors(phase, s, DOWNLINK_SYNC_WORD) <= SyncSearch::MAX_SYNC_ERRORS;
+        const bool uplink = sync_errors(phase, s, UPLINK_SYNC_WORD) <= SyncSearch::MAX_SYNC_ERRORS;
+        if (search.Match(s, DOWNLINK_SYNC_WORD) != downlink || search.Match(s, UPLINK_SYNC_WORD) != uplink) {
+            if (++mismatches <= 5) {
+                std::cerr << desc << ": offset " << s << ": expected downlink=" << downlink << " uplink=" << uplink << std::endl;
+            }
+        }
+        candidate[s] = downlink || uplink;
+    }
+
+    for (std::size_t limit : {offsets, offsets / 2 + 1}) {
+        for (std::size_t parity = 0; parity < 2; ++parity) {
+            std::vector<std::size_t> expected, found;
+            for (std::size_t s = parity; s < limit; s += 2) {
+                if (candidate[s] || candidate[s + 1]) {
+                    expected.push_back(s);
+                }
+            }
+            for (std::size_t s = parity; (s = search.NextCandidatePair(s, limit)) < limit; s += 2) {
+                found.push_back(s);
+            }
+            if (found != expected) {
+                std::cerr << desc << ": limit " << limit << ", parity " << parity << ": expected " << expected.size() << " candidate pairs, found " << found.size() << std::endl;
+                ++mismatches;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+// Phase data from a CU8 capture, starting `skip` samples in
+static PhaseBuffer capture_phase(const std::vector<std::uint8_t> &capture, std::size_t skip) {
+    CU8Converter converter;
+    PhaseBuffer phase(capture.size() / 2 - skip);
+    converter.ConvertPhase(capture.data() + skip * 2, capture.data() + capture.size(), phase.begin());
+    return phase;
+}
+
+// Frames synthesized from the first `count` messages of sample-data.txt.gz;
+// empty if it can't be read
+static std::vector<EncodedFrame> sample_frames(std::size_t count) {
+    FrameEncoder encoder;
+    std::vector<EncodedFrame> frames;
+    for (const auto &message : LoadSampleData("sample-data.txt.gz", count)) {
+        frames.push_back(encoder.Encode(message));
+    }
+    return frames;
+}
+
+// The vectorized sync search, whole-buffer and a tile at a time, and the
+// plain C++ one must all find exactly the sync words that a
+// sample-by-sample search finds: in synthesized captures, in random noise,
+// and in noise with sync words (with 0 to MAX_SYNC_ERRORS + 1 bit errors)
+// planted at every alignment to the vector blocks and tiles
+void test_sync_search_candidates() {
+    unsigned mismatches = 0;
+
+    std::vector<std::pair<std::string, PhaseBuffer>> signals;
+
+    const auto frames = sample_frames(200);
+    if (frames.empty()) {
+        std::cerr << "sync search: can't read sample-data.txt.gz, skipping synthesized captures" << std::endl;
+    }
+    for (double snr : {20.0, 8.0}) {
+        if (frames.empty()) {
+            break;
+        }
+        const auto capture = Modulate(frames, SampleFormat::CU8, NoiseSigma(snr));
+        for (std::size_t skip : {0, 1}) {
+            signals.emplace_back("sample data at " + std::to_string((int)snr) + "dB, skip " + std::to_string(skip), capture_phase(capture, skip));
+        }
+    }
+
+    std::mt19937 rng(1);
+    PhaseBuffer noise(50001);
+    for (auto &p : noise) {
+        p = rng() & 0xFFFF;
+    }
+    signals.emplace_back("random noise", noise);
+
+    // 149 is odd and coprime to every block and tile size, so the planted
+    // words start at every alignment
+    PhaseBuffer planted = noise;
+    for (std::size_t i = 0, s = 3; s + SYNC_BITS * 2 + 1 < planted.size(); ++i, s += 149) {
+        std::uint64_t word = (i & 1) ? UPLINK_SYNC_WORD : DOWNLINK_SYNC_WORD;
+        for (unsigned e = 0; e < i % (SyncSearch::MAX_SYNC_ERRORS + 2); ++e) {
+            word ^= 1ULL << ((i * 7 + e * 11) % SYNC_BITS);
+        }
+        for (unsigned b = 0; b < SYNC_BITS; ++b) {
+            const bool one = (word >> (SYNC_BITS - 1 - b)) & 1;
+            const std::size_t k = s + b * 2;
+            planted[k + 1] = planted[k] + (one ? 3000 : -3000);
+            planted[k + 2] = planted[k + 1] + (one ? 3000 : -3000);
+        }
+    }
+    signals.emplace_back("planted sync words", planted);
+    planted.erase(planted.begin(), planted.begin() + 5);
+    signals.emplace_back("planted sync words, skip 5", planted);
+
+    const std::string simd = SyncSearch::Implementation();
+    for (const auto &signal : signals) {
+        const PhaseBuffer &phase = signal.second;
+
+        SyncSearch vectorized;
+        vectorized.Prepare(phase.data(), phase.size());
+        mismatches += check_sync_search(signal.first + ", " + simd, vectorized, phase);
+
+        SyncSearch generic(true);
+        generic.Prepare(phase.data(), phase.size());
+        mismatches += check_sync_search(signal.first + ", generic", generic, phase);
+
+        for (std::size_t tile_pairs : {SyncSearch::TILE_ALIGNMENT, std::size_t(40), std::size_t(64), TwoMegDemodulator::TILE_SAMPLES / 2}) {
+            SyncSearch tiled;
+            tiled.Begin(phase.size());
+            for (std::size_t first = 0; first < tiled.Pairs(); first += tile_pairs) {
+                tiled.SliceTile(phase.data() + first * 2, first, std::min(tile_pairs, tiled.Pairs() - first));
+            }
+            tiled.Finish();
+            mismatches += check_sync_search(signal.first + ", " + simd + " in tiles of " + std::to_string(tile_pairs) + " pairs", tiled, phase);
+        }
+    }
+
+    std::cerr << "sync search (" << simd << " and generic vs sample-by-sample): " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+// Compare two lists of demodulated messages, whose begin/end iterators
+// point into different buffers starting at `a_base` and `b_base`
+static bool same_messages(const std::vector<Demodulator::Message> &a, PhaseBuffer::const_iterator a_base, const std::vector<Demodulator::Message> &b, PhaseBuffer::const_iterator b_base) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (a[i].payload.size() != b[i].payload.size() || !std::equal(a[i].payload.begin(), a[i].payload.end(), b[i].payload.begin()))
+            return false;
+        if (a[i].corrected_errors != b[i].corrected_errors)
+            return false;
+        if (a[i].begin - a_base != b[i].begin - b_base || a[i].end - a_base != b[i].end - b_base)
+            return false;
+    }
+    return true;
+}
+
+// Demodulating with the vectorized sync search, over a whole buffer and a
+// tile at a time from the raw samples, must decode exactly the messages
+// that the plain C++ search does, with the frames at many alignments to the
+// vector blocks and tiles
+void test_sync_search_messages() {
+    unsigned mismatches = 0;
+
+    std::vector<std::pair<std::string, std::vector<std::uint8_t>>> captures;
+    const auto frames = sample_frames(200);
+    for (double snr : {20.0, 8.0}) {
+        if (frames.empty()) {
+            break;
+        }
+        captures.emplace_back("sample data at " + std::to_string((int)snr) + "dB", Modulate(frames, SampleFormat::CU8, NoiseSigma(snr)));
+    }
+    captures.emplace_back("100 long downlinks", downlink_capture(100));
+
+    std::mt19937 rng(2);
+    std::vector<std::uint8_t> noise(200000);
+    for (auto &b : noise) {
+        b = rng() & 0xFF;
+    }
+    captures.emplace_back("random noise", noise);
+
+    for (const auto &capture : captures) {
+        for (std::size_t skip : {0, 1, 2, 3, 7, 31, 63, 4097}) {
+            const std::string desc = capture.first + ", skip " + std::to_string(skip);
+            const PhaseBuffer phase = capture_phase(capture.second, skip);
+
+            TwoMegDemodulator generic(true);
+            const auto expected = generic.Demodulate(phase.cbegin(), phase.cend());
+            if (expected.empty() && capture.first != "random noise") {
+                std::cerr << desc << ": nothing demodulated" << std::endl;
+                ++mismatches;
+            }
+
+            TwoMegDemodulator vectorized;
+            const auto whole = vectorized.Demodulate(phase.cbegin(), phase.cend());
+            if (!same_messages(expected, phase.cbegin(), whole, phase.cbegin())) {
+                std::cerr << desc << ": whole buffer: expected " << expected.size() << " messages, got " << whole.size() << std::endl;
+                ++mismatches;
+            }
+
+            CU8Converter converter;
+            PhaseBuffer tile_phase(phase.size());
+            TwoMegDemodulator tiled;
+            const auto tiles = tiled.DemodulateSamples(converter, capture.second.data() + skip * 2, phase.size(), tile_phase.begin());
+            if (!same_messages(expected, phase.cbegin(), tiles, tile_phase.cbegin())) {
+                std::cerr << desc << ": in tiles: expected " << expected.size() << " messages, got " << tiles.size() << std::endl;
+                ++mismatches;
+            }
+        }
+    }
+
+    std::cerr << "sync search (" << SyncSearch::Implementation() << " vs generic), demodulated messages: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+int main(int argc, char **argv) {
+    test_pipelined_stop_from_callback();
+    test_parallel_file_stop_from_callback();
+    test_pipelined_destroy_from_callback();
+    test_parallel_file_destroy_from_callback();
+    test_sync_search_candidates();
+    test_sync_search_messages();
+
+    if (failures) {
+        std::cerr << failures << " failures" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,438 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+// The correction stage is a port of decode_rs.h from Phil Karn's libfec
+// (see libs/fec), specialized for the UAT code parameters.
+
+#include "reed_solomon.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "cpu_features.h"
+#include "uat_protocol.h"
+
+#ifdef DUMP978_X86
+#include <immintrin.h>
+#endif
+
+#if defined(DUMP978_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define DUMP978_NEON_TBL 1
+#endif
+
+using namespace airnav::uat;
+
+static const int FCR = 120;
+static const int PRIM = 1;
+static const int IPRIM = 1; // prim-th root of 1
+
+// error returns, as in libs/fec/rs-common.h
+static const int RS_ERROR_DEG_LAMBDA_ZERO = -1;
+static const int RS_ERROR_IMPOSSIBLE_ERR_POS = -2;
+static const int RS_ERROR_DEG_LAMBDA_NEQ_COUNT = -3;
+static const int RS_ERROR_NOT_A_CODEWORD = -4;
+static const int RS_ERROR_BAD_ERASURE = -5;
+
+static_assert(fec::DOWNLINK_SHORT_POLY == fec::UPLINK_BLOCK_POLY && fec::DOWNLINK_LONG_POLY == fec::UPLINK_BLOCK_POLY, "all UAT codes are expected to use the same field");
+
+GaloisField::GaloisField() {
+    index_of[0] = A0; // log(zero) = -inf
+    alpha_to[A0] = 0; // alpha**-inf = 0
+
+    unsigned sr = 1;
+    for (unsigned i = 0; i < NN; ++i) {
+        index_of[sr] = i;
+        alpha_to[i] = sr;
+        sr <<= 1;
+        if (sr & 0x100)
+            sr ^= fec::UPLINK_BLOCK_POLY; // all three codes use the same field
+        sr &= NN;
+    }
+}
+
+const GaloisField &GaloisField::Get() {
+    static const GaloisField field;
+    return field;
+}
+
+template <int NROOTS, int PAD> ReedSolomon<NROOTS, PAD>::ReedSolomon() {
+    const auto &gf = GaloisField::Get();
+
+    for (int i = 0; i < NROOTS; ++i) {
+        const int root = GaloisField::Modnn((FCR + i) * PRIM);
+        for (unsigned x = 0; x < 256; ++x) {
+            root_mul_[i][x] = (x == 0 ? 0 : gf.alpha_to[GaloisField::Modnn(gf.index_of[x] + root)]);
+        }
+        for (unsigned x = 0; x < 16; ++x) {
+            root_mul_lo_[i][x] = root_mul_[i][x];
+            root_mul_hi_[i][x] = root_mul_[i][x << 4];
+        }
+    }
+}
+
+template <int NROOTS, int PAD> const ReedSolomon<NROOTS, PAD> &ReedSolomon<NROOTS, PAD>::Get() {
+    static const ReedSolomon code;
+    return code;
+}
+
+template <int NROOTS, int PAD> bool ReedSolomon<NROOTS, PAD>::ComputeSyndromes(const std::uint8_t *data, Syndromes &s) const {
+    // evaluate data(x) at the roots of g(x), by Horner's rule
+    s.fill(data[0]);
+    for (unsigned j = 1; j < BLOCK_BYTES; ++j) {
+        const auto d = data[j];
+        for (int i = 0; i < NROOTS; ++i) {
+            s[i] = root_mul_[i][s[i]] ^ d;
+        }
+    }
+
+    std::uint8_t syn_error = 0;
+    for (int i = 0; i < NROOTS; ++i) {
+        syn_error |= s[i];
+    }
+    return (syn_error != 0);
+}
+
+template <int NROOTS> static bool InterleavedSyndromesGeneric(const std::uint8_t *frame, unsigned bytes, unsigned interleave, const std::array<std::array<std::uint8_t, 256>, NROOTS> &root_mul, std::array<std::uint8_t, NROOTS> *s) {
+    for (unsigned b = 0; b < interleave; ++b) {
+        s[b].fill(frame[b]);
+    }
+
+    for (unsigned j = 1; j < bytes; ++j) {
+        const std::uint8_t *row = frame + j * interleave;
+        for (unsigned b = 0; b < interleave; ++b) {
+            const auto d = row[b];
+            auto &sb = s[b];
+            for (int i = 0; i < NROOTS; ++i) {
+                sb[i] = root_mul[i][sb[i]] ^ d;
+            }
+        }
+    }
+
+    std::uint8_t syn_error = 0;
+    for (unsigned b = 0; b < interleave; ++b) {
+        for (int i = 0; i < NROOTS; ++i) {
+            syn_error |= s[b][i];
+        }
+    }
+    return (syn_error != 0);
+}
+
+// Load one row of an interleaved frame into a 16-byte buffer, zero-filled
+static inline void LoadRow(const std::uint8_t *row, unsigned interleave, std::uint8_t *out) {
+    std::memset(out, 0, 16);
+    std::memcpy(out, row, interleave);
+}
+
+#ifdef DUMP978_X86
+// The blocks of the frame go in separate byte lanes, so every lane is
+// multiplied by the same constant for a given root: that's a pair of 16-entry
+// nibble lookups, i.e. two PSHUFBs.
+template <int NROOTS> __attribute__((target("ssse3"))) static bool InterleavedSyndromesSSSE3(const std::uint8_t *frame, unsigned bytes, unsigned interleave, const std::array<std::array<std::uint8_t, 16>, NROOTS> &lo, const std::array<std::array<std::uint8_t, 16>, NROOTS> &hi, std::array<std::uint8_t, NROOTS> *s) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    alignas(16) std::uint8_t row[16];
+
+    __m128i sv[NROOTS];
+    LoadRow(frame, interleave, row);
+    for (int i = 0; i < NROOTS; ++i) {
+        sv[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(row));
+    }
+
+    for (unsigned j = 1; j < bytes; ++j) {
+        __m128i d;
+        if (j * interleave + 16 <= bytes * interleave) {
+            d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(frame + j * interleave));
+        } else {
+            // too close to the end of the frame for a full load
+            LoadRow(frame + j * interleave, interleave, row);
+            d = _mm_load_si128(reinterpret_cast<const __m128i *>(row));
+        }
+
+        for (int i = 0; i < NROOTS; ++i) {
+            __m128i lo_table = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo[i].data()));
+            __m128i hi_table = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi[i].data()));
+            __m128i product = _mm_xor_si128(_mm_shuffle_epi8(lo_table, _mm_and_si128(sv[i], nibble)), _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(sv[i], 4), nibble)));
+            sv[i] = _mm_xor_si128(product, d);
+        }
+    }
+
+    // lanes beyond `interleave` may hold garbage from the loads above; ignore them
+    std::uint8_t syn_error = 0;
+    for (int i = 0; i < NROOTS; ++i) {
+        _mm_store_si128(reinterpret_cast<__m128i *>(row), sv[i]);
+        for (unsigned b = 0; b < interleave; ++b) {
+            s[b][i] = row[b];
+            syn_error |= row[b];
+        }
+    }
+    return (syn_error != 0);
+}
+#endif
+
+#ifdef DUMP978_NEON_TBL
+template <int NROOTS> static bool InterleavedSyndromesNeon(const std::uint8_t *frame, unsigned bytes, unsigned interleave, const std::array<std::array<std::uint8_t, 16>, NROOTS> &lo, const std::array<std::array<std::uint8_t, 16>, NROOTS> &hi, std::array<std::uint8_t, NROOTS> *s) {
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+    std::uint8_t row[16];
+
+    uint8x16_t sv[NROOTS];
+    LoadRow(frame, interleave, row);
+    for (int i = 0; i < NROOTS; ++i) {
+        sv[i] = vld1q_u8(row);
+    }
+
+    for (unsigned j = 1; j < bytes; ++j) {
+        uint8x16_t d;
+        if (j * interleave + 16 <= bytes * interleave) {
+            d = vld1q_u8(frame + j * interleave);
+        } else {
+            LoadRow(frame + j * interleave, interleave, row);
+            d = vld1q_u8(row);
+        }
+
+        for (int i = 0; i < NROOTS; ++i) {
+            uint8x16_t product = veorq_u8(vqtbl1q_u8(vld1q_u8(lo[i].data()), vandq_u8(sv[i], nibble)), vqtbl1q_u8(vld1q_u8(hi[i].data()), vshrq_n_u8(sv[i], 4)));
+            sv[i] = veorq_u8(product, d);
+        }
+    }
+
+    std::uint8_t syn_error = 0;
+    for (int i = 0; i < NROOTS; ++i) {
+        vst1q_u8(row, sv[i]);
+        for (unsigned b = 0; b < interleave; ++b) {
+            s[b][i] = row[b];
+            syn_error |= row[b];
+        }
+    }
+    return (syn_error != 0);
+}
+#endif
+
+template <int NROOTS, int PAD> bool ReedSolomon<NROOTS, PAD>::ComputeInterleavedSyndromes(const std::uint8_t *frame, unsigned interleave, Syndromes *s) const {
+    if (interleave <= 16) {
+#ifdef DUMP978_X86
+        static const bool use_ssse3 = CpuHasSSSE3();
+        if (use_ssse3)
+            return InterleavedSyndromesSSSE3<NROOTS>(frame, BLOCK_BYTES, interleave, root_mul_lo_, root_mul_hi_, s);
+#endif
+#ifdef DUMP978_NEON_TBL
+        return InterleavedSyndromesNeon<NROOTS>(frame, BLOCK_BYTES, interleave, root_mul_lo_, root_mul_hi_, s);
+#endif
+    }
+
+    return InterleavedSyndromesGeneric<NROOTS>(frame, BLOCK_BYTES, interleave, root_mul_, s);
+}
+
+template <int NROOTS, int PAD> int ReedSolomon<NROOTS, PAD>::Correct(std::uint8_t *data, const Syndromes &s, int *eras_pos, int no_eras) const {
+    typedef std::uint8_t data_t;
+
+    const auto &alpha_to = GaloisField::Get().alpha_to;
+    const auto &index_of = GaloisField::Get().index_of;
+    const int NN = GaloisField::NN;
+    const data_t A0 = GaloisField::A0;
+    auto modnn = GaloisField::Modnn;
+
+    int deg_lambda, el, deg_omega;
+    int i, j, r, k;
+    data_t u, q, tmp, num1, num2, den, discr_r;
+    data_t lambda[NROOTS + 1]; // Err+Eras Locator poly
+    data_t si[NROOTS];         // Syndrome in index form
+    data_t b[NROOTS + 1], t[NROOTS + 1], omega[NROOTS + 1];
+    data_t root[NROOTS], reg[NROOTS + 1], loc[NROOTS];
+    int count;
+
+    if (no_eras < 0 || no_eras > NROOTS) {
+        return RS_ERROR_BAD_ERASURE;
+    }
+    for (i = 0; i < no_eras; ++i) {
+        if (eras_pos[i] < 0 || eras_pos[i] >= static_cast<int>(BLOCK_BYTES))
+            return RS_ERROR_BAD_ERASURE;
+    }
+
+    // Convert syndromes to index form
+    for (i = 0; i < NROOTS; i++) {
+        si[i] = index_of[s[i]];
+    }
+
+    std::memset(&lambda[1], 0, NROOTS * sizeof(lambda[0]));
+    lambda[0] = 1;
+
+    if (no_eras > 0) {
+        // Init lambda to be the erasure locator polynomial
+        lambda[1] = alpha_to[modnn(PRIM * (NN - 1 - (eras_pos[0] + PAD)))];
+        for (i = 1; i < no_eras; i++) {
+            u = modnn(PRIM * (NN - 1 - (eras_pos[i] + PAD)));
+            for (j = i + 1; j > 0; j--) {
+                tmp = index_of[lambda[j - 1]];
+                if (tmp != A0)
+                    lambda[j] ^= alpha_to[modnn(u + tmp)];
+            }
+        }
+    }
+
+    for (i = 0; i < NROOTS + 1; i++)
+        b[i] = index_of[lambda[i]];
+
+    // Begin Berlekamp-Massey algorithm to determine error+erasure locator polynomial
+    r = no_eras;
+    el = no_eras;
+    while (++r <= NROOTS) { // r is the step number
+        // Compute discrepancy at the r-th step in poly-form
+        discr_r = 0;
+        for (i = 0; i < r; i++) {
+            if ((lambda[i] != 0) && (si[r - i - 1] != A0)) {
+                discr_r ^= alpha_to[modnn(index_of[lambda[i]] + si[r - i - 1])];
+            }
+        }
+        discr_r = index_of[discr_r]; // Index form
+        if (discr_r == A0) {
+            // B(x) <-- x*B(x)
+            std::memmove(&b[1], b, NROOTS * sizeof(b[0]));
+            b[0] = A0;
+        } else {
+            // T(x) <-- lambda(x) - discr_r*x*b(x)
+            t[0] = lambda[0];
+            for (i = 0; i < NROOTS; i++) {
+                if (b[i] != A0)
+                    t[i + 1] = lambda[i + 1] ^ alpha_to[modnn(discr_r + b[i])];
+                else
+                    t[i + 1] = lambda[i + 1];
+            }
+            if (2 * el <= r + no_eras - 1) {
+                el = r + no_eras - el;
+                // B(x) <-- inv(discr_r) * lambda(x)
+                for (i = 0; i <= NROOTS; i++)
+                    b[i] = (lambda[i] == 0) ? A0 : modnn(index_of[lambda[i]] - discr_r + NN);
+            } else {
+                // B(x) <-- x*B(x)
+                std::memmove(&b[1], b, NROOTS * sizeof(b[0]));
+                b[0] = A0;
+            }
+            std::memcpy(lambda, t, (NROOTS + 1) * sizeof(t[0]));
+        }
+    }
+
+    // Convert lambda to index form and compute deg(lambda(x))
+    deg_lambda = 0;
+    for (i = 0; i < NROOTS + 1; i++) {
+        lambda[i] = index_of[lambda[i]];
+        if (lambda[i] != A0)
+            deg_lambda = i;
+    }
+
+    if (deg_lambda == 0) {
+        // deg(lambda) is zero even though the syndrome is non-zero
+        // => uncorrectable error detected
+        return RS_ERROR_DEG_LAMBDA_ZERO;
+    }
+
+    // Find roots of the error+erasure locator polynomial by Chien search
+    std::memcpy(&reg[1], &lambda[1], NROOTS * sizeof(reg[0]));
+    count = 0; // Number of roots of lambda(x)
+    for (i = 1, k = IPRIM - 1; i <= NN; i++, k = modnn(k + IPRIM)) {
+        q = 1; // lambda[0] is always 0
+        for (j = deg_lambda; j > 0; j--) {
+            if (reg[j] != A0) {
+                reg[j] = modnn(reg[j] + j);
+                q ^= alpha_to[reg[j]];
+            }
+        }
+        if (q != 0)
+            continue; // Not a root
+
+        // store root (index-form) and error location number
+        if (k < PAD) {
+            // Impossible error location. Uncorrectable error.
+            return RS_ERROR_IMPOSSIBLE_ERR_POS;
+        }
+        root[count] = i;
+        loc[count] = k;
+        // If we've already found max possible roots, abort the search to save time
+        if (++count == deg_lambda)
+            break;
+    }
+    if (deg_lambda != count) {
+        // deg(lambda) unequal to number of roots => uncorrectable error detected
+        return RS_ERROR_DEG_LAMBDA_NEQ_COUNT;
+    }
+
+    // Compute err+eras evaluator poly omega(x) = s(x)*lambda(x) (modulo
+    // x**NROOTS). in index form. Also find deg(omega).
+    deg_omega = deg_lambda - 1;
+    for (i = 0; i <= deg_omega; i++) {
+        tmp = 0;
+        for (j = i; j >= 0; j--) {
+            if ((si[i - j] != A0) && (lambda[j] != A0))
+                tmp ^= alpha_to[modnn(si[i - j] + lambda[j])];
+        }
+        omega[i] = index_of[tmp];
+    }
+
+    // We reuse the buffer for b with a more appropriate name
+    data_t *cor = b;
+    int num_corrected = 0;
+
+    // Compute error values in poly-form. num1 = omega(inv(X(l))), num2 =
+    // inv(X(l))**(FCR-1) and den = lambda_pr(inv(X(l))) all in poly-form
+    for (j = count - 1; j >= 0; j--) {
+        num1 = 0;
+        for (i = deg_omega; i >= 0; i--) {
+            if (omega[i] != A0)
+                num1 ^= alpha_to[modnn(omega[i] + i * root[j])];
+        }
+
+        if (num1 == 0) {
+            cor[j] = 0;
+            continue;
+        }
+
+        num2 = alpha_to[modnn(root[j] * (FCR - 1) + NN)];
+        den = 0;
+
+        // lambda[i+1] for i even is the formal derivative lambda_pr of lambda[i]
+        for (i = std::min(deg_lambda, NROOTS - 1) & ~1; i >= 0; i -= 2) {
+            if (lambda[i + 1] != A0)
+                den ^= alpha_to[modnn(lambda[i + 1] + i * root[j])];
+        }
+
+        cor[j] = alpha_to[modnn(index_of[num1] + index_of[num2] + NN - index_of[den])];
+        num_corrected++;
+    }
+
+    // We compute the syndrome of the 'error' to and check that it matches the
+    // syndrome of the received word
+    for (i = 0; i < NROOTS; i++) {
+        tmp = 0;
+        for (j = 0; j < count; j++) {
+            if (cor[j]) {
+                k = (FCR + i) * PRIM * (NN - loc[j] - 1);
+                tmp ^= alpha_to[modnn(index_of[cor[j]] + k)];
+            }
+        }
+
+        if (tmp != s[i])
+            return RS_ERROR_NOT_A_CODEWORD;
+    }
+
+    // Apply error to data
+    for (i = 0; i < count; i++) {
+        if (cor[i])
+            data[loc[i] - PAD] ^= cor[i];
+    }
+
+    if (eras_pos != nullptr) {
+        j = 0;
+        for (i = 0; i < count; i++) {
+            if (cor[i])
+                eras_pos[j++] = loc[i] - PAD;
+        }
+    }
+
+    return num_corrected;
+}
+
+namespace airnav::uat {
+    template class ReedSolomon<fec::DOWNLINK_SHORT_ROOTS, fec::DOWNLINK_SHORT_PAD>;
+    template class ReedSolomon<fec::DOWNLINK_LONG_ROOTS, fec::DOWNLINK_LONG_PAD>;
+    template class ReedSolomon<fec::UPLINK_BLOCK_ROOTS, fec::UPLINK_BLOCK_PAD>;
+}; // namespace airnav::uat
@@ -0,0 +1,91 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_REED_SOLOMON_H
+#define DUMP978_REED_SOLOMON_H
+
+#include <array>
+#include <cstdint>
+
+namespace airnav::uat {
+    // Arithmetic tables for GF(2^8) with the UAT field polynomial (0x187)
+    struct GaloisField {
+        static const unsigned NN = 255;
+        static const std::uint8_t A0 = 255; // index form of zero
+
+        std::array<std::uint8_t, 256> alpha_to; // index form -> polynomial form; alpha_to[A0] = 0
+        std::array<std::uint8_t, 256> index_of; // polynomial form -> index form; index_of[0] = A0
+
+        // Reduce x modulo NN (x >= 0)
+        static int Modnn(int x) {
+            while (x >= 255) {
+                x -= 255;
+                x = (x >> 8) + (x & 255);
+            }
+            return x;
+        }
+
+        static const GaloisField &Get();
+
+      private:
+        GaloisField();
+    };
+
+    // Reed-Solomon decoder for the fixed-parameter UAT codes: 8-bit
+    // symbols, fcr 120, prim 1, with NROOTS parity symbols and PAD symbols
+    // of padding. It produces the same results as libs/fec's
+    // decode_rs_char, but is split into two stages: a table-driven syndrome
+    // computation, which is all that is needed when a block is clean (the
+    // common case), and Berlekamp-Massey / Chien / Forney correction, which
+    // only runs if some syndrome is nonzero.
+    template <int NROOTS, int PAD> class ReedSolomon {
+      public:
+        static const unsigned BLOCK_BYTES = GaloisField::NN - PAD;
+
+        typedef std::array<std::uint8_t, NROOTS> Syndromes;
+
+        ReedSolomon();
+
+        // The tables depend only on the code parameters, so one instance
+        // per code, built on first use, is shared by every FEC instance
+        static const ReedSolomon &Get();
+
+        // Decode a block of BLOCK_BYTES in place, as decode_rs_char does.
+        // `eras_pos` holds `no_eras` erasure positions (0 .. BLOCK_BYTES-1),
+        // and on success is overwritten with the positions of the corrected
+        // symbols. Returns the number of corrected symbols, or a negative
+        // value if the block is uncorrectable (leaving `data` unchanged).
+        int Decode(std::uint8_t *data, int *eras_pos, int no_eras) const {
+            Syndromes s;
+            if (!ComputeSyndromes(data, s))
+                return 0;
+            return Correct(data, s, eras_pos, no_eras);
+        }
+
+        // Compute the syndromes of a block. Returns false if they are all
+        // zero, i.e. the block is a valid codeword.
+        bool ComputeSyndromes(const std::uint8_t *data, Syndromes &s) const;
+
+        // Compute the syndromes for `interleave` blocks that are stored
+        // interleaved, byte by byte, in `frame` (BLOCK_BYTES * interleave
+        // bytes). `s` receives one set of syndromes per block. Returns false
+        // if all the blocks are valid codewords.
+        bool ComputeInterleavedSyndromes(const std::uint8_t *frame, unsigned interleave, Syndromes *s) const;
+
+        // Correct a block given its syndromes, which must not all be zero.
+        // Arguments and return value are as for Decode.
+        int Correct(std::uint8_t *data, const Syndromes &s, int *eras_pos, int no_eras) const;
+
+      private:
+        // multiply-by-alpha^(FCR+i) tables for each root i: the full table,
+        // and the low and high nibble halves for 16-entry shuffle lookups
+        std::array<std::array<std::uint8_t, 256>, NROOTS> root_mul_;
+        std::array<std::array<std::uint8_t, 16>, NROOTS> root_mul_lo_;
+        std::array<std::array<std::uint8_t, 16>, NROOTS> root_mul_hi_;
+    };
+}; // namespace airnav::uat
+
+#endif
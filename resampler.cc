@@ -0,0 +1,232 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "cpu_features.h"
+
+#ifdef DUMP978_X86
+#include <immintrin.h>
+#endif
+
+#ifdef DUMP978_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace airnav::uat;
+
+// Each kernel multiplies `n` (a multiple of 8) interleaved I/Q floats by
+// the same number of coefficients and returns the sums of the I and Q lanes
+
+static void DotGeneric(const float *x, const float *c, std::size_t n, float *i, float *q) {
+    float si = 0, sq = 0;
+    for (std::size_t k = 0; k < n; k += 2) {
+        si += x[k] * c[k];
+        sq += x[k + 1] * c[k + 1];
+    }
+    *i = si;
+    *q = sq;
+}
+
+#ifdef DUMP978_X86
+__attribute__((target("sse2"))) static void DotSSE2(const float *x, const float *c, std::size_t n, float *i, float *q) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (std::size_t k = 0; k < n; k += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(c + k)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(c + k + 4)));
+    }
+
+    // lanes are (I, Q, I, Q)
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    *i = lanes[0] + lanes[2];
+    *q = lanes[1] + lanes[3];
+}
+
+__attribute__((target("avx2,fma"))) static void DotAVX2(const float *x, const float *c, std::size_t n, float *i, float *q) {
+    __m256 acc = _mm256_setzero_ps();
+    for (std::size_t k = 0; k < n; k += 8) {
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(c + k), acc);
+    }
+
+    const __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    *i = lanes[0] + lanes[2];
+    *q = lanes[1] + lanes[3];
+}
+#endif
+
+#ifdef DUMP978_NEON
+static void DotNeon(const float *x, const float *c, std::size_t n, float *i, float *q) {
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    for (std::size_t k = 0; k < n; k += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(x + k), vld1q_f32(c + k));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(x + k + 4), vld1q_f32(c + k + 4));
+    }
+
+    const float32x4_t sum = vaddq_f32(acc0, acc1);
+    *i = vgetq_lane_f32(sum, 0) + vgetq_lane_f32(sum, 2);
+    *q = vgetq_lane_f32(sum, 1) + vgetq_lane_f32(sum, 3);
+}
+#endif
+
+namespace {
+    struct Kernel {
+        const char *name;
+        void (*dot)(const float *x, const float *c, std::size_t n, float *i, float *q);
+    };
+}; // namespace
+
+static Kernel ChooseKernel() {
+#ifdef DUMP978_X86
+    if (CpuHasAVX2() && __builtin_cpu_supports("fma"))
+        return {"avx2", DotAVX2};
+    if (__builtin_cpu_supports("sse2"))
+        return {"sse2", DotSSE2};
+#endif
+#ifdef DUMP978_NEON
+    if (CpuHasNeon())
+        return {"neon", DotNeon};
+#endif
+    return {"generic", DotGeneric};
+}
+
+static const Kernel &SelectedKernel() {
+    static const Kernel kernel = ChooseKernel();
+    return kernel;
+}
+
+const char *RationalResampler::Implementation() { return SelectedKernel().name; }
+
+static unsigned Gcd(unsigned a, unsigned b) {
+    while (b) {
+        const unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+RationalResampler::RationalResampler(unsigned interpolation, unsigned decimation, unsigned taps_per_phase) {
+    if (interpolation == 0 || decimation == 0 || taps_per_phase == 0) {
+        throw std::invalid_argument("bad resampling ratio");
+    }
+
+    const unsigned gcd = Gcd(interpolation, decimation);
+    interpolation_ = interpolation / gcd;
+    decimation_ = decimation / gcd;
+
+    // When decimating, the filter must span the same time at the input
+    // rate to keep the same transition band relative to the output rate
+    const unsigned wanted = std::max(taps_per_phase, taps_per_phase * decimation_ / std::max(interpolation_, 1U) / 2);
+    taps_per_phase_ = (wanted + 3) & ~3U;
+
+    // Blackman-windowed sinc at the rate of the (notional) interpolated
+    // stream, cut off at the lower of the input and output Nyquist rates
+    const unsigned L = interpolation_;
+    const unsigned T = taps_per_phase_;
+    const unsigned total = L * T;
+    const double cutoff = 0.5 / std::max(interpolation_, decimation_);
+    const double center = (total - 1) / 2.0;
+    const double span = (total > 1 ? total - 1 : 1);
+
+    std::vector<double> prototype(total);
+    double sum = 0;
+    for (unsigned m = 0; m < total; ++m) {
+        const double x = m - center;
+        const double sinc = (x == 0 ? 1.0 : std::sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x));
+        const double window = 0.42 - 0.5 * std::cos(2 * M_PI * m / span) + 0.08 * std::cos(4 * M_PI * m / span);
+        prototype[m] = sinc * window;
+        sum += prototype[m];
+    }
+
+    // Unity gain per output sample; phase p uses taps p, p + L, p + 2L, ..
+    // against the newest, next newest, .. input samples, stored here in
+    // oldest-first order
+    coeffs_.resize(L * T * 2);
+    for (unsigned p = 0; p < L; ++p) {
+        for (unsigned j = 0; j < T; ++j) {
+            const float c = static_cast<float>(prototype[p + j * L] * L / sum);
+            coeffs_[(p * T + (T - 1 - j)) * 2] = c;
+            coeffs_[(p * T + (T - 1 - j)) * 2 + 1] = c;
+        }
+    }
+
+    buffer_.assign((T - 1) * 2, 0.0f);
+}
+
+void RationalResampler::AppendInput(SampleFormat format, const std::uint8_t *in, std::size_t samples) {
+    const std::size_t start = buffer_.size();
+    buffer_.resize(start + samples * 2);
+    float *out = &buffer_[start];
+
+    // scale everything to a CS16H-like range
+    switch (format) {
+    case SampleFormat::CU8:
+        for (std::size_t k = 0; k < samples * 2; ++k) {
+            out[k] = (in[k] - 127.5f) * 256.0f;
+        }
+        break;
+    case SampleFormat::CS8_:
+        for (std::size_t k = 0; k < samples * 2; ++k) {
+            out[k] = static_cast<std::int8_t>(in[k]) * 256.0f;
+        }
+        break;
+    case SampleFormat::CS16H: {
+        const std::int16_t *s = reinterpret_cast<const std::int16_t *>(in);
+        for (std::size_t k = 0; k < samples * 2; ++k) {
+            out[k] = s[k];
+        }
+        break;
+    }
+    case SampleFormat::CF32H: {
+        const float *f = reinterpret_cast<const float *>(in);
+        for (std::size_t k = 0; k < samples * 2; ++k) {
+            out[k] = f[k] * 32767.0f;
+        }
+        break;
+    }
+    default:
+        throw std::invalid_argument("unsupported sample format");
+    }
+}
+
+std::size_t RationalResampler::Process(SampleFormat format, const std::uint8_t *in, std::size_t samples, std::int16_t *out) {
+    const auto &kernel = SelectedKernel();
+    const std::size_t history = taps_per_phase_ - 1;
+    const std::size_t n = taps_per_phase_ * 2;
+
+    AppendInput(format, in, samples);
+
+    auto clamp = [](float v) -> std::int16_t { return static_cast<std::int16_t>(std::max(-32768.0f, std::min(32767.0f, std::round(v)))); };
+
+    std::size_t produced = 0;
+    while (next_ < samples) {
+        // the filter window ends at the newest input sample of this
+        // output, history + next_, so it starts at next_
+        float i, q;
+        kernel.dot(&buffer_[next_ * 2], &coeffs_[phase_ * n], n, &i, &q);
+        out[produced * 2] = clamp(i);
+        out[produced * 2 + 1] = clamp(q);
+        ++produced;
+
+        phase_ += decimation_;
+        next_ += phase_ / interpolation_;
+        phase_ %= interpolation_;
+    }
+
+    // keep the newest samples as history for the next call
+    std::memmove(buffer_.data(), buffer_.data() + samples * 2, history * 2 * sizeof(float));
+    buffer_.resize(history * 2);
+    next_ -= samples;
+    return produced;
+}
@@ -0,0 +1,63 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_RESAMPLER_H
+#define DUMP978_RESAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "convert.h"
+
+namespace airnav::uat {
+    // Polyphase rational resampler for complex samples: produces
+    // `interpolation` output samples for every `decimation` input samples,
+    // low-pass filtering to the narrower of the two bandwidths. Integer
+    // decimation is the special case interpolation = 1; only the output
+    // samples that are kept are ever computed. Input may be in any
+    // SampleFormat; output is CS16H, scaled so that full scale input is
+    // full scale output. The filter state is carried across calls, so a
+    // stream may be processed in blocks of any size.
+    class RationalResampler {
+      public:
+        // `interpolation` / `decimation` need not be in lowest terms. Each
+        // output sample is the sum of at least `taps_per_phase` input samples.
+        RationalResampler(unsigned interpolation, unsigned decimation, unsigned taps_per_phase = 16);
+
+        unsigned Interpolation() const { return interpolation_; }
+        unsigned Decimation() const { return decimation_; }
+
+        // The most output samples that Process() can produce from `samples` input samples
+        std::size_t MaxOutput(std::size_t samples) const { return (samples * interpolation_) / decimation_ + 1; }
+
+        // Resample `samples` complex samples in `format` from `in` into
+        // `out`, which has room for at least MaxOutput(samples) samples.
+        // Returns the number of samples written.
+        std::size_t Process(SampleFormat format, const std::uint8_t *in, std::size_t samples, std::int16_t *out);
+        std::size_t Process(const std::int16_t *in, std::size_t samples, std::int16_t *out) { return Process(SampleFormat::CS16H, reinterpret_cast<const std::uint8_t *>(in), samples, out); }
+
+        // Name of the filter kernel in use (e.g. "avx2"), for diagnostics
+        static const char *Implementation();
+
+      private:
+        void AppendInput(SampleFormat format, const std::uint8_t *in, std::size_t samples);
+
+        unsigned interpolation_;
+        unsigned decimation_;
+        unsigned taps_per_phase_; // padded to a multiple of 4
+
+        // [phase][tap][I/Q]: taps in time order (oldest first), each
+        // duplicated for I and Q, so a filter is an elementwise product
+        // with the interleaved input
+        std::vector<float> coeffs_;
+        std::vector<float> buffer_; // interleaved I/Q: taps_per_phase_ - 1 samples of history, then new input
+        unsigned phase_ = 0;        // polyphase branch of the next output
+        std::size_t next_ = 0;      // offset (in samples after the history) of the newest input sample of the next output
+    };
+}; // namespace airnav::uat
+
+#endif
@@ -0,0 +1,200 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "rtlsdr_source.h"
+#include "exception.h"
+#include "stats.h"
+#include "thread_placement.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace airnav::uat;
+
+// size of each USB transfer: 64k samples, about 31ms
+static const std::uint32_t TRANSFER_BYTES = 131072;
+static const std::uint32_t TRANSFER_COUNT = 16;
+
+class RtlSdrCategory : public boost::system::error_category {
+  public:
+    const char *name() const noexcept override { return "rtlsdr"; }
+    std::string message(int ev) const override { return "librtlsdr error " + std::to_string(ev); }
+};
+
+static RtlSdrCategory rtlsdr_category;
+
+RtlSdrSampleSource::RtlSdrSampleSource(boost::asio::io_service &service, const std::string &device, const boost::program_options::variables_map &options) : timer_(service), device_name_(device), options_(options) {}
+
+RtlSdrSampleSource::~RtlSdrSampleSource() {
+    Stop();
+    if (device_) {
+        rtlsdr_close(device_);
+        device_ = nullptr;
+    }
+}
+
+void RtlSdrSampleSource::Init() {
+    if (options_.count("format") && options_["format"].as<SampleFormat>() != SampleFormat::CU8) {
+        throw config_error("RTL-SDR devices only provide CU8 samples");
+    }
+
+    const auto count = rtlsdr_get_device_count();
+    if (count == 0) {
+        throw config_error("No RTL-SDR devices found");
+    }
+
+    // a device index, or else a serial number
+    int index = -1;
+    if (device_name_.empty()) {
+        index = 0;
+    } else if (std::all_of(device_name_.begin(), device_name_.end(), ::isdigit) && std::stoul(device_name_) < count) {
+        index = std::stoi(device_name_);
+    } else {
+        index = rtlsdr_get_index_by_serial(device_name_.c_str());
+    }
+    if (index < 0) {
+        throw config_error("No RTL-SDR device matching " + device_name_ + " found");
+    }
+
+    char manufacturer[256] = {}, product[256] = {}, serial[256] = {};
+    rtlsdr_get_device_usb_strings(index, manufacturer, product, serial);
+    std::cerr << "rtlsdr: using device #" << index << ": " << manufacturer << " " << product << ", SN " << serial << std::endl;
+
+    if (rtlsdr_open(&device_, index) < 0) {
+        device_ = nullptr;
+        throw config_error("Failed to open RTL-SDR device #" + std::to_string(index));
+    }
+
+    const double rate = (options_.count("sample-rate") ? options_["sample-rate"].as<double>() : DEMOD_SAMPLE_RATE);
+    rtlsdr_set_sample_rate(device_, std::lround(rate));
+    clock_ = SampleClock(rate);
+    rtlsdr_set_center_freq(device_, 978000000);
+
+    if (options_.count("sdr-ppm")) {
+        auto ppm = std::lround(options_["sdr-ppm"].as<double>());
+        if (ppm != 0) {
+            std::cerr << "rtlsdr: using frequency correction " << ppm << " ppm" << std::endl;
+            rtlsdr_set_freq_correction(device_, ppm);
+        }
+    }
+
+    if (options_.count("sdr-auto-gain")) {
+        std::cerr << "rtlsdr: using automatic gain" << std::endl;
+        rtlsdr_set_tuner_gain_mode(device_, 0);
+    } else {
+        // gains are in tenths of a dB; pick the supported gain nearest the requested one
+        const int num_gains = rtlsdr_get_tuner_gains(device_, nullptr);
+        if (num_gains <= 0) {
+            throw config_error("Failed to read RTL-SDR tuner gains");
+        }
+
+        std::vector<int> gains(num_gains);
+        rtlsdr_get_tuner_gains(device_, gains.data());
+
+        int gain = *std::max_element(gains.begin(), gains.end());
+        if (options_.count("sdr-gain")) {
+            const int wanted = std::lround(options_["sdr-gain"].as<double>() * 10);
+            gain = *std::min_element(gains.begin(), gains.end(), [wanted](int a, int b) { return std::abs(a - wanted) < std::abs(b - wanted); });
+            std::cerr << "rtlsdr: using manual gain " << std::fixed << std::setprecision(1) << gain / 10.0 << " dB" << std::endl;
+        } else {
+            std::cerr << "rtlsdr: using maximum manual gain " << std::fixed << std::setprecision(1) << gain / 10.0 << " dB" << std::endl;
+        }
+
+        rtlsdr_set_tuner_gain_mode(device_, 1);
+        rtlsdr_set_tuner_gain(device_, gain);
+    }
+
+    if (options_.count("sdr-antenna") || options_.count("sdr-stream-settings") || options_.count("sdr-device-settings")) {
+        std::cerr << "rtlsdr: --sdr-antenna / --sdr-stream-settings / --sdr-device-settings only apply to SoapySDR devices, ignored" << std::endl;
+    }
+}
+
+void RtlSdrSampleSource::Start() {
+    if (!device_) {
+        Init();
+    }
+
+    rtlsdr_reset_buffer(device_);
+
+    halt_ = false;
+    rx_thread_.reset(new std::thread(&RtlSdrSampleSource::Run, this));
+
+    Keepalive();
+}
+
+void RtlSdrSampleSource::Keepalive() {
+    if (rx_thread_ && rx_thread_->joinable()) {
+        // Keep the io_service alive while the rx_thread is active
+        auto self(shared_from_this());
+        timer_.expires_from_now(std::chrono::milliseconds(1000));
+        timer_.async_wait([self, this](const boost::system::error_code &ec) {
+            if (!ec) {
+                Keepalive();
+            }
+        });
+    }
+}
+
+void RtlSdrSampleSource::Stop() {
+    if (rx_thread_) {
+        halt_ = true;
+        rtlsdr_cancel_async(device_);
+        rx_thread_->join();
+        rx_thread_.reset();
+    }
+    timer_.cancel();
+}
+
+void RtlSdrSampleSource::Run() {
+    // placed before the ring is allocated, so that it lands on our NUMA node
+    ApplyThreadPlacement(ThreadRole::RX, "978-rtlsdr");
+
+    ring_ = SampleRing::Create(TRANSFER_BYTES * TRANSFER_COUNT + HistorySamples() * 2, HistorySamples() * 2);
+    ring_->Prefault();
+    last_drop_report_ = std::chrono::steady_clock::now();
+
+    // runs the USB event loop on this thread, calling back for each transfer until cancelled
+    const int rc = rtlsdr_read_async(device_, &RtlSdrSampleSource::TransferCallback, this, TRANSFER_COUNT, TRANSFER_BYTES);
+    if (!halt_) {
+        std::cerr << "rtlsdr: async read stopped unexpectedly" << std::endl;
+        DispatchError(boost::system::error_code{rc < 0 ? rc : -1, rtlsdr_category});
+    }
+}
+
+void RtlSdrSampleSource::TransferCallback(unsigned char *buf, std::uint32_t len, void *ctx) { static_cast<RtlSdrSampleSource *>(ctx)->HandleTransfer(buf, len); }
+
+void RtlSdrSampleSource::HandleTransfer(unsigned char *buf, std::uint32_t len) {
+    if (halt_) {
+        return;
+    }
+
+    len &= ~1U; // whole samples only
+    const auto sample_index = clock_.Deliver(len / 2, std::chrono::system_clock::now());
+
+    // if the receiver is so far behind that the ring is full, drop this
+    // transfer rather than stalling the USB stream
+    if (ring_->WriteSpace() < len) {
+        ++dropped_count_;
+        stats::Add(stats::Counter::SDR_DROPPED_BLOCKS);
+        DUMP978_TRACE(SDR_DROPPED_BLOCK, 0, len / 2, 0);
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_drop_report_ > std::chrono::seconds(15)) {
+            std::cerr << "rtlsdr: " << dropped_count_ << " recent sample blocks dropped (receiver backlog)" << std::endl;
+            last_drop_report_ = now;
+            dropped_count_ = 0;
+        }
+        return;
+    }
+
+    std::memcpy(ring_->WritePointer(), buf, len);
+    DispatchBlock(ring_->Commit(len, clock_.Milliseconds(sample_index), sample_index));
+}
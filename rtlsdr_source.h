@@ -0,0 +1,61 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_RTLSDR_SOURCE_H
+#define DUMP978_RTLSDR_SOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include <rtl-sdr.h>
+
+#include "sample_clock.h"
+#include "sample_source.h"
+
+namespace airnav::uat {
+    // Reads CU8 samples from an RTL-SDR dongle through librtlsdr directly,
+    // without SoapySDR's extra buffering layer and rx thread. The rx thread
+    // runs rtlsdr_read_async itself, and each USB transfer is copied once,
+    // into the sample ring, and dispatched from the callback.
+    class RtlSdrSampleSource : public SampleSource {
+      public:
+        // `device` is a device index or serial number; empty selects the first device
+        static SampleSource::Pointer Create(boost::asio::io_service &service, const std::string &device, const boost::program_options::variables_map &options) { return Pointer(new RtlSdrSampleSource(service, device, options)); }
+
+        virtual ~RtlSdrSampleSource();
+
+        void Init() override;
+        void Start() override;
+        void Stop() override;
+        SampleFormat Format() override { return SampleFormat::CU8; }
+
+      private:
+        RtlSdrSampleSource(boost::asio::io_service &service, const std::string &device, const boost::program_options::variables_map &options);
+
+        void Run();
+        void Keepalive();
+        void HandleTransfer(unsigned char *buf, std::uint32_t len);
+        static void TransferCallback(unsigned char *buf, std::uint32_t len, void *ctx);
+
+        boost::asio::steady_timer timer_;
+        std::string device_name_;
+        boost::program_options::variables_map options_;
+
+        rtlsdr_dev_t *device_ = nullptr;
+        std::unique_ptr<std::thread> rx_thread_;
+        std::atomic<bool> halt_{false};
+
+        // rx thread only
+        SampleRing::Pointer ring_;
+        SampleClock clock_;
+        std::chrono::steady_clock::time_point last_drop_report_;
+        unsigned dropped_count_ = 0;
+    };
+}; // namespace airnav::uat
+
+#endif
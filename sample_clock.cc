@@ -0,0 +1,52 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "sample_clock.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace airnav::uat;
+
+constexpr double SampleClock::LATE_GAIN;
+constexpr double SampleClock::LATE_STEP_NS;
+constexpr double SampleClock::RESYNC_NS;
+
+std::uint64_t SampleClock::Deliver(std::size_t count, std::chrono::system_clock::time_point now, bool discontinuity) {
+    const std::int64_t system_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    if (!started_) {
+        base_ns_ = system_ns;
+    }
+
+    const double now_ns = system_ns - base_ns_;
+    const double block_ns = count * 1e9 / rate_;
+
+    if (!started_) {
+        origin_ns_ = now_ns - block_ns - next_index_ * 1e9 / rate_;
+        started_ = true;
+    } else if (discontinuity) {
+        // assume this block started when it would have if none of it had
+        // been delayed, and count the samples missing before it
+        const double expected_start_ns = origin_ns_ + next_index_ * 1e9 / rate_;
+        const double lost = std::round((now_ns - block_ns - expected_start_ns) * rate_ / 1e9);
+        if (lost > 0) {
+            next_index_ += static_cast<std::uint64_t>(lost);
+        }
+    }
+
+    const std::uint64_t first = next_index_;
+    next_index_ += count;
+
+    // how much later than predicted the end of this block arrived
+    const double error_ns = now_ns - (origin_ns_ + next_index_ * 1e9 / rate_);
+    if (std::fabs(error_ns) > RESYNC_NS) {
+        origin_ns_ = now_ns - next_index_ * 1e9 / rate_;
+    } else if (error_ns < 0) {
+        origin_ns_ += error_ns;
+    } else {
+        origin_ns_ += std::min(error_ns * LATE_GAIN, LATE_STEP_NS);
+    }
+
+    return first;
+}
@@ -0,0 +1,68 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_SAMPLE_CLOCK_H
+#define DUMP978_SAMPLE_CLOCK_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#include "common.h"
+
+namespace airnav::uat {
+    // Numbers the samples from a realtime source sequentially at the nominal
+    // sample rate, and maps sample indexes to wall-clock time.
+    //
+    // The mapping is a fixed rate plus an origin (the system time of sample
+    // 0) that is disciplined against the system clock as each block
+    // arrives. A block can only arrive after its last sample was taken, so
+    // a block that arrives earlier than the mapping predicts pulls the
+    // origin back at once, while one that arrives late (because the reading
+    // thread was descheduled, say) only nudges it forward. Timestamps
+    // therefore follow the earliest arrivals and do not jitter with
+    // scheduling delays, and slow drift between the SDR's clock and the
+    // system clock is still tracked.
+    class SampleClock {
+      public:
+        explicit SampleClock(double samples_per_second = DEMOD_SAMPLE_RATE) : rate_(samples_per_second) {}
+
+        // `count` samples have just been delivered at system time `now`.
+        // Returns the index of the first of them. If `discontinuity` is set,
+        // an unknown number of samples may have been lost since the
+        // previous block; the index skips forward to match the system clock.
+        std::uint64_t Deliver(std::size_t count, std::chrono::system_clock::time_point now, bool discontinuity = false);
+
+        // Skip `count` samples that are known to have been lost
+        void Skip(std::uint64_t count) { next_index_ += count; }
+
+        // The index that the next delivered sample will get
+        std::uint64_t NextIndex() const { return next_index_; }
+
+        // Wall-clock time of sample `index`, in nanoseconds / milliseconds
+        // since the Unix epoch
+        std::int64_t Nanoseconds(std::uint64_t index) const { return base_ns_ + static_cast<std::int64_t>(std::llround(origin_ns_ + index * 1e9 / rate_)); }
+        std::uint64_t Milliseconds(std::uint64_t index) const { return Nanoseconds(index) / 1000000; }
+
+      private:
+        // Fraction of a late arrival's error that moves the origin forward,
+        // and the most it may move per block (enough to follow several
+        // hundred ppm of drift, but not to be dragged by a long stall)
+        static constexpr double LATE_GAIN = 0.02;
+        static constexpr double LATE_STEP_NS = 20000;
+
+        // Errors larger than this reset the mapping (e.g. the system clock was stepped)
+        static constexpr double RESYNC_NS = 1e9;
+
+        double rate_;
+        bool started_ = false;
+        std::uint64_t next_index_ = 0;
+        std::int64_t base_ns_ = 0; // system time of the first delivery, ns since the epoch
+        double origin_ns_ = 0;     // estimated system time of sample 0, ns after base_ns_ (relative, so a double keeps it precise)
+    };
+}; // namespace airnav::uat
+
+#endif
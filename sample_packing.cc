@@ -0,0 +1,132 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "sample_packing.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace airnav::uat;
+
+static inline std::uint32_t ZigZag(std::int32_t v) { return (static_cast<std::uint32_t>(v) << 1) ^ static_cast<std::uint32_t>(v >> 31); }
+static inline std::int32_t UnZigZag(std::uint32_t v) { return static_cast<std::int32_t>(v >> 1) ^ -static_cast<std::int32_t>(v & 1); }
+
+static inline std::size_t GroupBytes(std::size_t count, unsigned width) { return (count * width + 7) / 8; }
+
+void airnav::uat::PackChunk(const std::int16_t *values, std::size_t count, Bytes &out) {
+    out.push_back(count & 0xFF);
+    out.push_back((count >> 8) & 0xFF);
+    out.push_back((count >> 16) & 0xFF);
+    out.push_back((count >> 24) & 0xFF);
+
+    for (std::size_t group = 0; group < count; group += PACKED_GROUP_VALUES) {
+        const std::int16_t *in = values + group;
+        const std::size_t n = std::min(PACKED_GROUP_VALUES, count - group);
+
+        std::uint16_t any_bits = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            any_bits |= static_cast<std::uint16_t>(in[i]);
+        }
+        const unsigned shift = (any_bits == 0 ? 0 : __builtin_ctz(any_bits));
+
+        std::uint32_t any_zigzag = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            any_zigzag |= ZigZag(in[i] >> shift);
+        }
+        const unsigned width = (any_zigzag == 0 ? 0 : 32 - __builtin_clz(any_zigzag));
+
+        out.push_back(shift);
+        out.push_back(width);
+
+        std::uint64_t bits = 0;
+        unsigned used = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            bits |= static_cast<std::uint64_t>(ZigZag(in[i] >> shift)) << used;
+            used += width;
+            while (used >= 8) {
+                out.push_back(bits & 0xFF);
+                bits >>= 8;
+                used -= 8;
+            }
+        }
+        if (used > 0) {
+            out.push_back(bits & 0xFF);
+        }
+    }
+}
+
+bool PackedSampleReader::Read(std::uint8_t *out, std::size_t max_bytes, std::size_t &produced) {
+    produced = 0;
+    while (produced + 2 <= max_bytes) {
+        if (used_ == chunk_.size()) {
+            if (!ReadChunk()) {
+                return false;
+            }
+            if (chunk_.empty()) {
+                return true; // end of file
+            }
+        }
+
+        const std::size_t n = std::min(chunk_.size() - used_, (max_bytes - produced) / 2);
+        std::memcpy(out + produced, chunk_.data() + used_, n * 2);
+        used_ += n;
+        produced += n * 2;
+    }
+
+    return true;
+}
+
+bool PackedSampleReader::ReadChunk() {
+    chunk_.clear();
+    used_ = 0;
+
+    std::uint8_t header[4];
+    stream_.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (stream_.gcount() == 0 && stream_.eof()) {
+        return true; // clean end of file
+    }
+    if (stream_.gcount() != sizeof(header)) {
+        return false;
+    }
+
+    const std::size_t count = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<std::size_t>(header[3]) << 24);
+    if (count == 0 || count > PACKED_CHUNK_VALUES) {
+        return false;
+    }
+
+    chunk_.resize(count);
+    for (std::size_t group = 0; group < count; group += PACKED_GROUP_VALUES) {
+        const std::size_t n = std::min(PACKED_GROUP_VALUES, count - group);
+
+        std::uint8_t params[2];
+        stream_.read(reinterpret_cast<char *>(params), sizeof(params));
+        const unsigned shift = params[0];
+        const unsigned width = params[1];
+        if (stream_.gcount() != sizeof(params) || shift > 15 || width > 16) {
+            return false;
+        }
+
+        packed_.resize(GroupBytes(n, width));
+        stream_.read(reinterpret_cast<char *>(packed_.data()), packed_.size());
+        if (static_cast<std::size_t>(stream_.gcount()) != packed_.size()) {
+            return false;
+        }
+
+        const std::uint32_t mask = (1U << width) - 1;
+        std::uint64_t bits = 0;
+        unsigned available = 0;
+        auto next = packed_.cbegin();
+        for (std::size_t i = 0; i < n; ++i) {
+            while (available < width) {
+                bits |= static_cast<std::uint64_t>(*next++) << available;
+                available += 8;
+            }
+            chunk_[group + i] = static_cast<std::int16_t>(static_cast<std::uint32_t>(UnZigZag(bits & mask)) << shift);
+            bits >>= width;
+            available -= width;
+        }
+    }
+
+    return true;
+}
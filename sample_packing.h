@@ -0,0 +1,61 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_SAMPLE_PACKING_H
+#define DUMP978_SAMPLE_PACKING_H
+
+#include <cstdint>
+#include <istream>
+#include <vector>
+
+#include "common.h"
+
+namespace airnav::uat {
+    // A lossless, cheap compressed file format for CS16H sample data.
+    //
+    // The file starts with the 8-byte PACKED_MAGIC, followed by chunks of
+    // up to PACKED_CHUNK_VALUES 16-bit values (I and Q counted separately):
+    //
+    //   uint32 LE  value count N
+    //   ceil(N / PACKED_GROUP_VALUES) groups, each:
+    //     uint8    shift: the number of low zero bits common to all values
+    //     uint8    width: bits per value after the shift (0..16)
+    //     the zigzag-encoded, shifted values, `width` bits each, LSB first,
+    //     padded to a whole byte
+    //
+    // Radios with 12-bit ADCs deliver either small values (right-justified)
+    // or values with 4 low zero bits (left-justified); either way they pack
+    // into at most 12 bits per value, and quieter signals pack further.
+    const char PACKED_MAGIC[8] = {'D', '9', '7', '8', 'I', 'Q', 'P', '1'};
+    const std::size_t PACKED_GROUP_VALUES = 256;
+    const std::size_t PACKED_CHUNK_VALUES = 65536;
+
+    // Append `count` values (at most PACKED_CHUNK_VALUES) as one chunk to `out`
+    void PackChunk(const std::int16_t *values, std::size_t count, Bytes &out);
+
+    // Reads packed sample data back as CS16H bytes
+    class PackedSampleReader {
+      public:
+        // `stream` should be positioned just after the magic
+        explicit PackedSampleReader(std::istream &stream) : stream_(stream) {}
+
+        // Decode up to `max_bytes` (a multiple of 2) of sample data into
+        // `out`, and set `produced` to the number of bytes written; this is
+        // 0 only at the end of the file. Returns false if the data is
+        // corrupt or could not be read.
+        bool Read(std::uint8_t *out, std::size_t max_bytes, std::size_t &produced);
+
+      private:
+        bool ReadChunk();
+
+        std::istream &stream_;
+        std::vector<std::int16_t> chunk_; // decoded values of the current chunk
+        std::size_t used_ = 0;            // values of chunk_ already returned
+        Bytes packed_;
+    };
+}; // namespace airnav::uat
+
+#endif
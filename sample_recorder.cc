@@ -0,0 +1,193 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "sample_recorder.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include "sample_packing.h"
+
+using namespace airnav::uat;
+
+static const char *FileExtension(SampleFormat format) {
+    switch (format) {
+    case SampleFormat::CU8:
+        return "cu8";
+    case SampleFormat::CS8_:
+        return "cs8";
+    case SampleFormat::CS16H:
+        return "cs16h";
+    case SampleFormat::CF32H:
+        return "cf32h";
+    default:
+        return "raw";
+    }
+}
+
+SampleRecorder::SampleRecorder(SampleFormat format, const Options &options) : format_(format), options_(options), bytes_per_second_(options.samples_per_second * BytesPerSample(format)), queue_(options.queue_blocks), free_(options.queue_blocks), triggered_(false), dropped_blocks_(0) {
+    if (options_.pack && format_ != SampleFormat::CS16H) {
+        throw std::runtime_error("packed recording is only supported for CS16H sample data");
+    }
+}
+
+SampleRecorder::~SampleRecorder() { Stop(); }
+
+void SampleRecorder::Start() {
+    if (thread_.joinable()) {
+        return; // already running
+    }
+
+    queue_.Reopen();
+    free_.Reopen();
+    thread_ = std::thread(&SampleRecorder::RecorderThread, this);
+}
+
+void SampleRecorder::Stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+
+    // let the recorder thread write out what is already queued
+    Chunk sentinel;
+    sentinel.stop = true;
+    queue_.Push(std::move(sentinel));
+    thread_.join();
+
+    queue_.Close();
+    free_.Close();
+
+    if (dropped_blocks_ > 0) {
+        std::cerr << "Recording: " << dropped_blocks_ << " sample blocks were not recorded because the disk could not keep up" << std::endl;
+    }
+}
+
+void SampleRecorder::HandleSamples(const SampleBlock &block) {
+    Chunk chunk;
+    free_.TryPop(chunk); // reuse an old buffer if we can
+    chunk.timestamp = block.timestamp;
+    chunk.data.assign(block.begin(), block.end());
+
+    if (!queue_.TryPush(std::move(chunk))) {
+        ++dropped_blocks_;
+    }
+}
+
+void SampleRecorder::RecorderThread() {
+    const std::size_t trigger_bytes = options_.trigger.count() * bytes_per_second_;
+
+    Chunk chunk;
+    while (queue_.Pop(chunk) && !chunk.stop) {
+        if (!trigger_bytes) {
+            Write(chunk);
+        } else {
+            if (triggered_.exchange(false)) {
+                // write out what led up to the trigger
+                for (auto &old : pre_trigger_) {
+                    Write(old);
+                    free_.TryPush(std::move(old));
+                }
+                pre_trigger_.clear();
+                pre_trigger_bytes_ = 0;
+                post_trigger_bytes_ = trigger_bytes;
+            }
+
+            if (post_trigger_bytes_ == 0) {
+                // not triggered; just remember the recent samples
+                pre_trigger_bytes_ += chunk.data.size();
+                pre_trigger_.push_back(std::move(chunk));
+                while (pre_trigger_bytes_ - pre_trigger_.front().data.size() >= trigger_bytes) {
+                    pre_trigger_bytes_ -= pre_trigger_.front().data.size();
+                    free_.TryPush(std::move(pre_trigger_.front()));
+                    pre_trigger_.pop_front();
+                }
+                chunk = Chunk();
+                continue;
+            }
+
+            Write(chunk);
+            post_trigger_bytes_ -= std::min(post_trigger_bytes_, chunk.data.size());
+            if (post_trigger_bytes_ == 0) {
+                CloseFile();
+            }
+        }
+
+        free_.TryPush(std::move(chunk));
+        chunk = Chunk();
+    }
+
+    CloseFile();
+}
+
+void SampleRecorder::Write(const Chunk &chunk) {
+    if (failed_) {
+        return;
+    }
+
+    if (file_.is_open() && options_.rotate.count() > 0 && file_bytes_ >= options_.rotate.count() * bytes_per_second_) {
+        CloseFile();
+    }
+
+    if (!file_.is_open() && !OpenFile(chunk.timestamp)) {
+        return;
+    }
+
+    if (options_.pack) {
+        const auto values = reinterpret_cast<const std::int16_t *>(chunk.data.data());
+        const std::size_t count = chunk.data.size() / 2;
+
+        packed_.clear();
+        for (std::size_t i = 0; i < count; i += PACKED_CHUNK_VALUES) {
+            PackChunk(values + i, std::min(PACKED_CHUNK_VALUES, count - i), packed_);
+        }
+        file_.write(reinterpret_cast<const char *>(packed_.data()), packed_.size());
+    } else {
+        file_.write(reinterpret_cast<const char *>(chunk.data.data()), chunk.data.size());
+    }
+
+    if (!file_.good()) {
+        std::cerr << "Recording: error writing " << filename_ << ": " << std::strerror(errno) << "; recording stopped" << std::endl;
+        CloseFile();
+        failed_ = true;
+        return;
+    }
+
+    file_bytes_ += chunk.data.size();
+}
+
+bool SampleRecorder::OpenFile(std::uint64_t timestamp) {
+    std::time_t seconds = timestamp / 1000;
+    std::tm tm;
+    ::gmtime_r(&seconds, &tm);
+    char when[32];
+    std::strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &tm);
+
+    filename_ = options_.prefix + "-" + when + "-" + std::to_string(sequence_++) + "." + FileExtension(format_) + (options_.pack ? ".iqp" : "");
+    file_.open(filename_, std::ios::binary | std::ios::trunc);
+    if (options_.pack) {
+        file_.write(PACKED_MAGIC, sizeof(PACKED_MAGIC));
+    }
+
+    if (!file_.good()) {
+        std::cerr << "Recording: could not create " << filename_ << ": " << std::strerror(errno) << "; recording stopped" << std::endl;
+        file_.close();
+        failed_ = true;
+        return false;
+    }
+
+    std::cerr << "Recording: writing samples to " << filename_ << std::endl;
+    file_bytes_ = 0;
+    return true;
+}
+
+void SampleRecorder::CloseFile() {
+    if (!file_.is_open()) {
+        return;
+    }
+
+    file_.close();
+    std::cerr << "Recording: finished " << filename_ << " (" << (file_bytes_ / BytesPerSample(format_)) << " samples)" << std::endl;
+}
@@ -0,0 +1,102 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_SAMPLE_RECORDER_H
+#define DUMP978_SAMPLE_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "common.h"
+#include "convert.h"
+#include "sample_ring.h"
+
+namespace airnav::uat {
+    // Records the raw sample stream to disk on its own thread, as a tap
+    // alongside the receiver. HandleSamples copies each block into a
+    // queue and never waits, so a slow disk cannot hold up the thread that
+    // delivers samples: if the queue is full, the block is not recorded.
+    //
+    // Recordings are written as PREFIX-YYYYMMDD-HHMMSS-N.<format>, in the
+    // source's format (readable by --file as-is) or, for CS16H, in the
+    // packed format from sample_packing.h (".iqp" is appended; --file
+    // recognizes these too).
+    class SampleRecorder {
+      public:
+        typedef std::shared_ptr<SampleRecorder> Pointer;
+
+        struct Options {
+            std::string prefix;              // path prefix of the recording files
+            bool pack = false;               // write packed CS16H
+            std::chrono::seconds rotate{0};  // start a new file after this much sample data; 0 never rotates
+            std::chrono::seconds trigger{0}; // if nonzero, only record this long before and after each Trigger()
+            std::size_t queue_blocks = 64;   // blocks to queue before dropping
+            std::size_t samples_per_second = DEMOD_SAMPLE_RATE;
+        };
+
+        static Pointer Create(SampleFormat format, const Options &options) { return Pointer(new SampleRecorder(format, options)); }
+
+        ~SampleRecorder();
+
+        void Start();
+        void Stop();
+
+        // Queue a copy of a block for recording
+        void HandleSamples(const SampleBlock &block);
+
+        // In trigger mode, write out the buffered samples from before now
+        // and keep recording for the trigger period after it. Safe to call
+        // from any thread (including signal handlers run by asio).
+        void Trigger() { triggered_ = true; }
+
+        // Number of blocks that were not recorded because the queue was full
+        std::uint64_t DroppedBlocks() const { return dropped_blocks_; }
+
+      private:
+        struct Chunk {
+            std::uint64_t timestamp = 0;
+            Bytes data;
+            bool stop = false; // sentinel pushed by Stop()
+        };
+
+        SampleRecorder(SampleFormat format, const Options &options);
+
+        void RecorderThread();
+        void Write(const Chunk &chunk);
+        bool OpenFile(std::uint64_t timestamp);
+        void CloseFile();
+
+        SampleFormat format_;
+        Options options_;
+        std::size_t bytes_per_second_;
+
+        BoundedQueue<Chunk> queue_;
+        BoundedQueue<Chunk> free_; // recycled buffers
+
+        std::thread thread_;
+        std::atomic<bool> triggered_;
+        std::atomic<std::uint64_t> dropped_blocks_;
+
+        // recorder thread state
+        std::ofstream file_;
+        std::string filename_;
+        unsigned sequence_ = 0;
+        bool failed_ = false;                // a file could not be written; recording has stopped
+        std::size_t file_bytes_ = 0;         // sample bytes written to the current file
+        std::size_t post_trigger_bytes_ = 0; // trigger mode: sample bytes still to record
+        std::deque<Chunk> pre_trigger_;      // trigger mode: recent samples
+        std::size_t pre_trigger_bytes_ = 0;
+        Bytes packed_;
+    };
+}; // namespace airnav::uat
+
+#endif
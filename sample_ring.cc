@@ -0,0 +1,151 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "sample_ring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace airnav::uat;
+
+// Return an fd for an anonymous shared memory file of `size` bytes
+static int AnonymousFile(std::size_t size) {
+    int fd = -1;
+
+#ifdef SYS_memfd_create
+    fd = ::syscall(SYS_memfd_create, "dump978-samples", 0);
+#endif
+
+    if (fd < 0) {
+        // older kernels: use an unlinked temporary file, preferably on tmpfs
+        for (const char *dir : {"/dev/shm", "/tmp"}) {
+            std::string path = std::string(dir) + "/dump978-samples-XXXXXX";
+            fd = ::mkstemp(&path[0]);
+            if (fd >= 0) {
+                ::unlink(path.c_str());
+                break;
+            }
+        }
+    }
+
+    if (fd < 0) {
+        throw std::runtime_error(std::string("failed to create sample ring buffer: ") + std::strerror(errno));
+    }
+
+    if (::ftruncate(fd, size) < 0) {
+        auto err = errno;
+        ::close(fd);
+        throw std::runtime_error(std::string("failed to size sample ring buffer: ") + std::strerror(err));
+    }
+
+    return fd;
+}
+
+SampleRing::SampleRing(std::size_t capacity, std::size_t history) : history_(history) {
+    const std::size_t page = ::sysconf(_SC_PAGESIZE);
+    capacity_ = (std::max(capacity, history + 1) + page - 1) / page * page;
+
+    int fd = AnonymousFile(capacity_);
+
+    // reserve address space for two copies, then map the file into both halves
+    void *base = ::mmap(nullptr, capacity_ * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        auto err = errno;
+        ::close(fd);
+        throw std::runtime_error(std::string("failed to map sample ring buffer: ") + std::strerror(err));
+    }
+
+    auto lower = ::mmap(base, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    auto upper = ::mmap(static_cast<std::uint8_t *>(base) + capacity_, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    auto err = errno;
+    ::close(fd);
+
+    if (lower == MAP_FAILED || upper == MAP_FAILED) {
+        ::munmap(base, capacity_ * 2);
+        throw std::runtime_error(std::string("failed to map sample ring buffer: ") + std::strerror(err));
+    }
+
+    base_ = static_cast<std::uint8_t *>(base);
+}
+
+void SampleRing::Prefault() {
+    const std::size_t page = ::sysconf(_SC_PAGESIZE);
+    for (std::size_t offset = 0; offset < capacity_; offset += page) {
+        static_cast<volatile std::uint8_t *>(base_)[offset] = 0;
+    }
+}
+
+SampleRing::~SampleRing() {
+    if (base_) {
+        ::munmap(base_, capacity_ * 2);
+    }
+}
+
+std::size_t SampleRing::UnlockedWriteSpace() const {
+    // we must preserve the oldest region still in use, and the history that
+    // will be attached to the next block
+    std::uint64_t keep_from = write_pos_ - std::min<std::uint64_t>(write_pos_, history_);
+    if (!regions_.empty()) {
+        keep_from = std::min(keep_from, regions_.front().start);
+    }
+
+    return capacity_ - (write_pos_ - keep_from);
+}
+
+std::size_t SampleRing::WriteSpace() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return UnlockedWriteSpace();
+}
+
+void SampleRing::WaitForSpace(std::size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_.wait(lock, [this, bytes] { return UnlockedWriteSpace() >= bytes; });
+}
+
+SampleBlock SampleRing::Commit(std::size_t bytes, std::uint64_t timestamp, std::uint64_t sample_index) {
+    SampleBlock block;
+    block.timestamp = timestamp;
+    block.sample_index = sample_index;
+    block.data = WritePointer();
+    block.size = bytes;
+    block.history = std::min<std::uint64_t>(write_pos_, history_);
+
+    const auto region_start = write_pos_ - block.history;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        regions_.push_back({region_start, false});
+        write_pos_ += bytes;
+    }
+
+    auto self(shared_from_this());
+    block.hold = std::shared_ptr<const void>(block.data, [self, region_start](const void *) { self->Release(region_start); });
+    return block;
+}
+
+void SampleRing::Release(std::uint64_t region_start) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (auto &region : regions_) {
+        if (region.start == region_start && !region.released) {
+            region.released = true;
+            break;
+        }
+    }
+
+    // blocks are normally released in order, but handle the general case
+    while (!regions_.empty() && regions_.front().released) {
+        regions_.pop_front();
+    }
+
+    lock.unlock();
+    released_.notify_all();
+}
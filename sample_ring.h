@@ -0,0 +1,110 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_SAMPLE_RING_H
+#define DUMP978_SAMPLE_RING_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace airnav::uat {
+    // A block of sample data delivered by a SampleSource.
+    //
+    // `data` .. `data + size` is newly delivered sample data. The `history`
+    // bytes immediately before `data` repeat the end of the previously
+    // delivered data and are also valid to read, so consumers that need
+    // some overlap between blocks do not need to keep their own copy.
+    //
+    // The memory stays valid for as long as any copy of the block exists.
+    struct SampleBlock {
+        std::uint64_t timestamp = 0;    // ms since the epoch (or a synthetic clock) of the first sample of data
+        std::uint64_t sample_index = 0; // number of samples the source produced before the first sample of data
+        const std::uint8_t *data = nullptr;
+        std::size_t size = 0;
+        std::size_t history = 0;
+        std::shared_ptr<const void> hold;
+        std::chrono::steady_clock::time_point received; // when the source delivered the block
+
+        const std::uint8_t *begin() const { return data; }
+        const std::uint8_t *end() const { return data + size; }
+    };
+
+    // A circular buffer of sample data that sources write into directly.
+    //
+    // The buffer is mapped twice, back to back, so any region of up to
+    // Capacity() bytes is contiguous in memory even if it wraps around the
+    // end of the buffer. Committed blocks are reference-counted; the writer
+    // never overwrites a region that is still held by a SampleBlock, nor the
+    // retained history before the write position.
+    //
+    // There must be only one writer. Blocks may be released from any thread.
+    class SampleRing : public std::enable_shared_from_this<SampleRing> {
+      public:
+        typedef std::shared_ptr<SampleRing> Pointer;
+
+        // Create a ring holding at least `capacity` bytes (rounded up to a
+        // whole number of pages), retaining `history` bytes of older data
+        // before each committed block.
+        static Pointer Create(std::size_t capacity, std::size_t history) { return Pointer(new SampleRing(capacity, history)); }
+
+        ~SampleRing();
+
+        SampleRing(const SampleRing &) = delete;
+        SampleRing &operator=(const SampleRing &) = delete;
+
+        std::size_t Capacity() const { return capacity_; }
+        std::size_t History() const { return history_; }
+
+        // Start of the writable region. This is placed so that the history
+        // before it is contiguous with it, in either copy of the mapping.
+        std::uint8_t *WritePointer() {
+            const std::uint64_t keep = std::min<std::uint64_t>(write_pos_, history_);
+            return base_ + ((write_pos_ - keep) % capacity_) + keep;
+        }
+
+        // Number of contiguous bytes that may be written at WritePointer()
+        std::size_t WriteSpace();
+
+        // Wait until at least `bytes` can be written at WritePointer()
+        void WaitForSpace(std::size_t bytes);
+
+        // Touch every page of the ring, so that it is allocated now (on the
+        // calling thread's NUMA node) rather than on first use
+        void Prefault();
+
+        // Publish `bytes` of data that were written at WritePointer() as a new block
+        SampleBlock Commit(std::size_t bytes, std::uint64_t timestamp, std::uint64_t sample_index);
+
+      private:
+        SampleRing(std::size_t capacity, std::size_t history);
+
+        void Release(std::uint64_t region_start);
+        std::size_t UnlockedWriteSpace() const;
+
+        struct Region {
+            std::uint64_t start; // includes history
+            bool released;
+        };
+
+        std::size_t capacity_;
+        std::size_t history_;
+        std::uint8_t *base_ = nullptr;
+
+        // positions are byte offsets into the unwrapped stream of all data written
+        std::uint64_t write_pos_ = 0;
+
+        std::mutex mutex_;
+        std::condition_variable released_;
+        std::deque<Region> regions_; // oldest first
+    };
+}; // namespace airnav::uat
+
+#endif
@@ -4,22 +4,47 @@
 
 #include "sample_source.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 
 using namespace airnav::uat;
 
 void FileSampleSource::Start() {
-    stream_.open(path_.native());
-    if (!stream_.good()) {
-        auto ec = boost::system::error_code(errno, boost::system::system_category());
-        stream_.close();
-        DispatchError(ec);
-        return;
+    boost::system::error_code ec;
+    if (boost::filesystem::is_regular_file(path_, ec) && IsPackedFile()) {
+        if (format_ != SampleFormat::CS16H) {
+            std::cerr << path_.native() << ": packed sample files hold CS16H data, use --format CS16H" << std::endl;
+            DispatchError(boost::system::errc::make_error_code(boost::system::errc::invalid_argument));
+            return;
+        }
+
+        stream_.open(path_.native(), std::ios::binary);
+        stream_.seekg(sizeof(PACKED_MAGIC));
+        packed_.reset(new PackedSampleReader(stream_));
+        ring_ = SampleRing::Create(block_size_ * 4 + HistorySamples() * alignment_, HistorySamples() * alignment_);
+    } else if (boost::filesystem::is_regular_file(path_, ec)) {
+        try {
+            mapping_ = MappedFile::Open(path_.native());
+        } catch (const boost::system::system_error &err) {
+            DispatchError(err.code());
+            return;
+        }
+        offset_ = 0;
+    } else {
+        stream_.open(path_.native());
+        if (!stream_.good()) {
+            auto ec = boost::system::error_code(errno, boost::system::system_category());
+            stream_.close();
+            DispatchError(ec);
+            return;
+        }
+        ring_ = SampleRing::Create(block_size_ * 4 + HistorySamples() * alignment_, HistorySamples() * alignment_);
     }
 
+    open_ = true;
     next_block_ = std::chrono::steady_clock::now();
-    timestamp_ = 1; // always use synthetic timestamps for file sources
+    samples_read_ = 0;
 
     auto self = std::static_pointer_cast<FileSampleSource>(shared_from_this());
     service_.post(std::bind(&FileSampleSource::ReadBlock, self, boost::system::error_code()));
@@ -27,9 +52,25 @@ void FileSampleSource::Start() {
 
 void FileSampleSource::Stop() {
     timer_.cancel();
+    if (open_) {
+        Close();
+        DispatchError(boost::asio::error::eof);
+    }
+}
+
+bool FileSampleSource::IsPackedFile() {
+    std::ifstream stream(path_.native(), std::ios::binary);
+    char magic[sizeof(PACKED_MAGIC)];
+    stream.read(magic, sizeof(magic));
+    return (stream.gcount() == sizeof(magic) && std::equal(magic, magic + sizeof(magic), PACKED_MAGIC));
+}
+
+void FileSampleSource::Close() {
+    open_ = false;
+    mapping_.reset(); // blocks still held by the consumer keep the mapping alive
+    packed_.reset();
     if (stream_.is_open()) {
         stream_.close();
-        DispatchError(boost::asio::error::eof);
     }
 }
 
@@ -39,40 +80,30 @@ void FileSampleSource::ReadBlock(const boost::system::error_code &ec) {
             return;
         }
 
-        stream_.close();
+        Close();
         DispatchError(ec);
         return;
     }
 
-    if (!stream_.is_open()) {
-        return;
-    }
-
-    block_.resize(block_.capacity());
-    stream_.read(reinterpret_cast<char *>(block_.data()), block_.size());
-
-    if (stream_.bad()) {
-        auto ec = boost::system::error_code(errno, boost::system::system_category());
-        stream_.close();
-        DispatchError(ec);
+    if (!open_) {
         return;
     }
 
-    block_.resize(stream_.gcount() - (stream_.gcount() % alignment_));
-    if (!block_.empty()) {
-        DispatchBuffer(timestamp_, block_);
-        timestamp_ += (block_.size() * 1000ULL / bytes_per_second_);
+    std::size_t block_bytes = 0;
+    const bool more = (mapping_ ? ReadMappedBlock(block_bytes) : ReadStreamBlock(block_bytes));
+    if (!open_) {
+        return; // read error, already reported
     }
 
-    if (stream_.eof()) {
-        stream_.close();
+    if (!more) {
+        Close();
         DispatchError(boost::asio::error::eof);
         return;
     }
 
     auto self = std::static_pointer_cast<FileSampleSource>(shared_from_this());
     if (throttle_) {
-        auto delay = std::chrono::nanoseconds(1000000000ULL * block_.size() / bytes_per_second_);
+        auto delay = std::chrono::nanoseconds(1000000000ULL * block_bytes / bytes_per_second_);
         next_block_ += delay;
         timer_.expires_at(next_block_);
         timer_.async_wait(std::bind(&FileSampleSource::ReadBlock, self, std::placeholders::_1));
@@ -81,11 +112,87 @@ void FileSampleSource::ReadBlock(const boost::system::error_code &ec) {
     }
 }
 
+// Deliver the next block as a view into the mapping, with the preceding
+// history read in place. Returns false at the end of the file.
+bool FileSampleSource::ReadMappedBlock(std::size_t &block_bytes) {
+    const std::size_t usable = mapping_->Size() - (mapping_->Size() % alignment_);
+    const std::size_t history_bytes = HistorySamples() * alignment_;
+
+    block_bytes = std::min(block_size_, usable - offset_);
+    if (block_bytes > 0) {
+        // always use synthetic timestamps for file sources
+        SampleBlock block;
+        block.sample_index = offset_ / alignment_;
+        block.timestamp = Timestamp(block.sample_index);
+        block.data = mapping_->Data() + offset_;
+        block.size = block_bytes;
+        block.history = std::min(offset_, history_bytes);
+
+        // Each block owns the pages from the start of its history up to the
+        // start of the next block's history; they are dropped when the
+        // consumer releases the block.
+        const std::size_t end = offset_ + block_bytes;
+        const std::size_t release_begin = offset_ - block.history;
+        const std::size_t release_end = (end == usable ? mapping_->Size() : end - std::min(end, history_bytes));
+        auto mapping = mapping_;
+        block.hold = std::shared_ptr<const void>(block.data, [mapping, release_begin, release_end](const void *) {
+            if (release_end > release_begin) {
+                mapping->Release(release_begin, release_end - release_begin);
+            }
+        });
+
+        offset_ = end;
+        DispatchBlock(block);
+    }
+
+    return offset_ < usable;
+}
+
+// Read the next block from a (non-mappable or packed) stream into the ring.
+// Returns false at the end of the file or on error.
+bool FileSampleSource::ReadStreamBlock(std::size_t &block_bytes) {
+    // read directly into the ring; this waits for the receiver to finish
+    // with older blocks if it has fallen behind
+    ring_->WaitForSpace(block_size_);
+
+    std::size_t bytes_read;
+    bool more;
+    if (packed_) {
+        if (!packed_->Read(ring_->WritePointer(), block_size_, bytes_read)) {
+            std::cerr << path_.native() << ": packed sample data is truncated or corrupt" << std::endl;
+            Close();
+            DispatchError(boost::system::errc::make_error_code(boost::system::errc::illegal_byte_sequence));
+            return false;
+        }
+        more = (bytes_read > 0);
+    } else {
+        stream_.read(reinterpret_cast<char *>(ring_->WritePointer()), block_size_);
+        if (stream_.bad()) {
+            auto ec = boost::system::error_code(errno, boost::system::system_category());
+            Close();
+            DispatchError(ec);
+            return false;
+        }
+        bytes_read = stream_.gcount();
+        more = !stream_.eof();
+    }
+
+    block_bytes = bytes_read - (bytes_read % alignment_);
+    if (block_bytes > 0) {
+        DispatchBlock(ring_->Commit(block_bytes, Timestamp(samples_read_), samples_read_));
+        samples_read_ += block_bytes / alignment_;
+    }
+
+    return more;
+}
+
 //
 //
 //
 
 void StdinSampleSource::Start() {
+    ring_ = SampleRing::Create(block_size_ * 4 + HistorySamples() * alignment_, HistorySamples() * alignment_);
+    partial_ = 0;
     stream_.assign(::dup(STDIN_FILENO));
     ScheduleRead();
 }
@@ -102,10 +209,10 @@ void StdinSampleSource::ScheduleRead() {
         return;
     }
 
-    block_.resize(block_.capacity());
+    ring_->WaitForSpace(block_size_);
 
     auto self = shared_from_this();
-    stream_.async_read_some(boost::asio::buffer(block_.data() + used_, block_.size() - used_), [this, self](const boost::system::error_code &ec, std::size_t bytes_transferred) {
+    stream_.async_read_some(boost::asio::buffer(ring_->WritePointer() + partial_, block_size_ - partial_), [this, self](const boost::system::error_code &ec, std::size_t bytes_transferred) {
         if (ec) {
             if (ec == boost::asio::error::operation_aborted) {
                 return;
@@ -116,24 +223,70 @@ void StdinSampleSource::ScheduleRead() {
             return;
         }
 
-        used_ += bytes_transferred;
-
-        // work out a starting timestamp
-        static auto unix_epoch = std::chrono::system_clock::from_time_t(0);
-        auto end_of_block = std::chrono::system_clock::now();
-        auto start_of_block = end_of_block - (std::chrono::milliseconds(1000) * bytes_transferred / samples_per_second_ / alignment_);
-        std::uint64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(start_of_block - unix_epoch).count();
+        // Publish only whole samples; any trailing partial sample stays
+        // where it is, which becomes the start of the next write.
+        auto available = partial_ + bytes_transferred;
+        partial_ = available % alignment_;
+        if (available > partial_) {
+            const auto sample_index = clock_.Deliver((available - partial_) / alignment_, std::chrono::system_clock::now());
+            DispatchBlock(ring_->Commit(available - partial_, clock_.Milliseconds(sample_index), sample_index));
+        }
+        ScheduleRead();
+    });
+}
 
-        // fixme, don't copy!
-        auto trailing_bytes = used_ % alignment_;
-        auto leading_bytes = used_ - trailing_bytes;
+// at most this many input samples are resampled into each output block
+static const std::size_t RESAMPLE_CHUNK_SAMPLES = 65536;
 
-        Bytes buffer;
-        buffer.resize(leading_bytes);
-        std::copy(block_.begin(), block_.begin() + leading_bytes, buffer.begin());
-        std::copy(block_.begin() + leading_bytes, block_.end(), block_.begin());
-        used_ = trailing_bytes;
-        DispatchBuffer(timestamp, buffer);
-        ScheduleRead();
+void ResampledSampleSource::Start() {
+    std::weak_ptr<SampleSource> weak(shared_from_this());
+    upstream_->SetHistory(0); // the resampler carries its own filter history
+    upstream_->SetConsumer([weak, this](const SampleBlock &block) {
+        if (auto self = weak.lock()) {
+            HandleBlock(block);
+        }
     });
+    upstream_->SetErrorHandler([weak, this](const boost::system::error_code &ec) {
+        if (auto self = weak.lock()) {
+            DispatchError(ec);
+        }
+    });
+
+    input_format_ = upstream_->Format();
+    upstream_->Start();
+}
+
+void ResampledSampleSource::HandleBlock(const SampleBlock &block) {
+    const auto input_bytes_per_sample = BytesPerSample(input_format_);
+    const auto output_bytes_per_sample = BytesPerSample(SampleFormat::CS16H);
+    const std::size_t max_output = resampler_.MaxOutput(RESAMPLE_CHUNK_SAMPLES);
+
+    if (!ring_) {
+        // created here, on the thread that delivers samples
+        ring_ = SampleRing::Create(max_output * output_bytes_per_sample * 16 + HistorySamples() * output_bytes_per_sample, HistorySamples() * output_bytes_per_sample);
+        next_input_index_ = block.sample_index;
+    }
+
+    if (block.sample_index > next_input_index_) {
+        // upstream dropped samples; skip the same time in the output
+        output_index_ += (block.sample_index - next_input_index_) * resampler_.Interpolation() / resampler_.Decimation();
+    }
+
+    const std::size_t samples = block.size / input_bytes_per_sample;
+    next_input_index_ = block.sample_index + samples;
+
+    for (std::size_t consumed = 0; consumed < samples;) {
+        const std::size_t count = std::min(samples - consumed, RESAMPLE_CHUNK_SAMPLES);
+
+        ring_->WaitForSpace(max_output * output_bytes_per_sample);
+        auto *out = reinterpret_cast<std::int16_t *>(ring_->WritePointer());
+        const auto produced = resampler_.Process(input_format_, block.data + consumed * input_bytes_per_sample, count, out);
+
+        if (produced > 0) {
+            const std::uint64_t timestamp = block.timestamp + static_cast<std::uint64_t>(consumed * 1000 / input_rate_);
+            DispatchBlock(ring_->Commit(produced * output_bytes_per_sample, timestamp, output_index_));
+            output_index_ += produced;
+        }
+        consumed += count;
+    }
 }
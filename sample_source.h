@@ -20,12 +20,17 @@
 
 #include "common.h"
 #include "convert.h"
+#include "mapped_file.h"
+#include "resampler.h"
+#include "sample_clock.h"
+#include "sample_packing.h"
+#include "sample_ring.h"
 
 namespace airnav::uat {
     class SampleSource : public std::enable_shared_from_this<SampleSource> {
       public:
         typedef std::shared_ptr<SampleSource> Pointer;
-        typedef std::function<void(std::uint64_t, const Bytes &)> Consumer;
+        typedef std::function<void(const SampleBlock &)> Consumer;
         typedef std::function<void(const boost::system::error_code &ec)> ErrorHandler;
 
         virtual ~SampleSource() {}
@@ -38,12 +43,21 @@ namespace airnav::uat {
         void SetConsumer(Consumer consumer) { consumer_ = consumer; }
         void SetErrorHandler(ErrorHandler handler) { error_handler_ = handler; }
 
+        // Set the number of samples from the end of each block that should
+        // also be available as history before the start of the next block.
+        // Must be called before Start().
+        void SetHistory(std::size_t samples) { history_samples_ = samples; }
+
       protected:
         SampleSource() {}
 
-        void DispatchBuffer(std::uint64_t timestamp, const Bytes &buffer) {
+        std::size_t HistorySamples() const { return history_samples_; }
+
+        // Deliver a block to the consumer, stamped with the time of delivery
+        void DispatchBlock(SampleBlock block) {
             if (consumer_) {
-                consumer_(timestamp, buffer);
+                block.received = std::chrono::steady_clock::now();
+                consumer_(block);
             }
         }
 
@@ -56,11 +70,17 @@ namespace airnav::uat {
       private:
         Consumer consumer_;
         ErrorHandler error_handler_;
+        std::size_t history_samples_ = 0;
     };
 
+    // Reads sample data from a file. Regular files are memory-mapped and
+    // blocks are views into the mapping, with pages dropped once the
+    // consumer has released each block; other files (e.g. pipes), and
+    // regular files in the packed CS16H format written by SampleRecorder,
+    // are read through a SampleRing.
     class FileSampleSource : public SampleSource {
       public:
-        static SampleSource::Pointer Create(boost::asio::io_service &service, const boost::filesystem::path &path, const boost::program_options::variables_map &options = boost::program_options::variables_map(), std::size_t samples_per_second = 2083333, std::size_t samples_per_block = 524288) { return Pointer(new FileSampleSource(service, path, options, samples_per_second, samples_per_block)); }
+        static SampleSource::Pointer Create(boost::asio::io_service &service, const boost::filesystem::path &path, const boost::program_options::variables_map &options = boost::program_options::variables_map(), std::size_t samples_per_second = DEMOD_SAMPLE_RATE, std::size_t samples_per_block = 524288) { return Pointer(new FileSampleSource(service, path, options, samples_per_second, samples_per_block)); }
 
         void Init() override {}
         void Start() override;
@@ -77,29 +97,43 @@ namespace airnav::uat {
 
             format_ = options["format"].as<SampleFormat>();
             alignment_ = BytesPerSample(format_);
+            samples_per_second_ = samples_per_second;
             bytes_per_second_ = samples_per_second * alignment_;
-            block_.reserve(samples_per_block * alignment_);
+            block_size_ = samples_per_block * alignment_;
         }
 
+        // Synthetic timestamp of the sample at `sample_index`
+        std::uint64_t Timestamp(std::uint64_t sample_index) const { return 1 + sample_index * 1000 / samples_per_second_; }
+
         void ReadBlock(const boost::system::error_code &ec);
+        bool ReadMappedBlock(std::size_t &block_bytes);
+        bool ReadStreamBlock(std::size_t &block_bytes);
+        bool IsPackedFile();
+        void Close();
 
         boost::asio::io_service &service_;
         boost::filesystem::path path_;
         SampleFormat format_;
         unsigned alignment_;
         bool throttle_;
+        std::size_t samples_per_second_;
         std::size_t bytes_per_second_;
 
+        bool open_ = false;
+        MappedFile::Pointer mapping_;
+        std::size_t offset_ = 0; // next byte of mapping_ to deliver
         std::ifstream stream_;
+        std::unique_ptr<PackedSampleReader> packed_; // set if stream_ holds packed data
         boost::asio::steady_timer timer_;
         std::chrono::steady_clock::time_point next_block_;
-        Bytes block_;
-        std::uint64_t timestamp_;
+        std::size_t block_size_;
+        SampleRing::Pointer ring_;
+        std::uint64_t samples_read_ = 0; // samples delivered from stream_
     };
 
     class StdinSampleSource : public SampleSource {
       public:
-        static SampleSource::Pointer Create(boost::asio::io_service &service, const boost::program_options::variables_map &options, std::size_t samples_per_second = 2083333, std::size_t samples_per_block = 524288) { return Pointer(new StdinSampleSource(service, options, samples_per_second, samples_per_block)); }
+        static SampleSource::Pointer Create(boost::asio::io_service &service, const boost::program_options::variables_map &options, std::size_t samples_per_second = DEMOD_SAMPLE_RATE, std::size_t samples_per_block = 524288) { return Pointer(new StdinSampleSource(service, options, samples_per_second, samples_per_block)); }
 
         void Init() override {}
         void Start() override;
@@ -107,14 +141,14 @@ namespace airnav::uat {
         SampleFormat Format() override { return format_; }
 
       private:
-        StdinSampleSource(boost::asio::io_service &service, const boost::program_options::variables_map &options, std::size_t samples_per_second, std::size_t samples_per_block) : service_(service), samples_per_second_(samples_per_second), stream_(service), used_(0) {
+        StdinSampleSource(boost::asio::io_service &service, const boost::program_options::variables_map &options, std::size_t samples_per_second, std::size_t samples_per_block) : service_(service), clock_(samples_per_second), stream_(service), partial_(0) {
             if (!options.count("format")) {
                 throw std::runtime_error("--format must be specified when using a file input");
             }
 
             format_ = options["format"].as<SampleFormat>();
             alignment_ = BytesPerSample(format_);
-            block_.reserve(samples_per_block * alignment_);
+            block_size_ = samples_per_block * alignment_;
         }
 
         void ScheduleRead();
@@ -122,10 +156,41 @@ namespace airnav::uat {
         boost::asio::io_service &service_;
         SampleFormat format_;
         unsigned alignment_;
-        std::size_t samples_per_second_;
+        SampleClock clock_;
         boost::asio::posix::stream_descriptor stream_;
-        Bytes block_;
-        std::size_t used_;
+        std::size_t block_size_;
+        SampleRing::Pointer ring_;
+        std::size_t partial_; // bytes of an incomplete sample waiting at the ring's write pointer
+    };
+
+    // Wraps another source whose samples are not at the demodulator's rate,
+    // resampling each of its blocks by interpolation / decimation into CS16H
+    // in a SampleRing of its own. Sample indexes and timestamps are those of
+    // the output samples; a gap in the upstream sample indexes (dropped
+    // samples) becomes the equivalent gap in the output.
+    class ResampledSampleSource : public SampleSource {
+      public:
+        static SampleSource::Pointer Create(SampleSource::Pointer upstream, double input_rate, unsigned interpolation, unsigned decimation) { return Pointer(new ResampledSampleSource(upstream, input_rate, interpolation, decimation)); }
+
+        void Init() override { upstream_->Init(); }
+        void Start() override;
+        void Stop() override { upstream_->Stop(); }
+        SampleFormat Format() override { return SampleFormat::CS16H; }
+
+        SampleSource::Pointer Upstream() const { return upstream_; }
+
+      private:
+        ResampledSampleSource(SampleSource::Pointer upstream, double input_rate, unsigned interpolation, unsigned decimation) : upstream_(upstream), input_rate_(input_rate), resampler_(interpolation, decimation) {}
+
+        void HandleBlock(const SampleBlock &block);
+
+        SampleSource::Pointer upstream_;
+        double input_rate_;
+        RationalResampler resampler_;
+        SampleFormat input_format_ = SampleFormat::UNKNOWN;
+        SampleRing::Pointer ring_;
+        std::uint64_t next_input_index_ = 0; // upstream sample index expected next
+        std::uint64_t output_index_ = 0;     // sample index of the next output sample
     };
 }; // namespace airnav::uat
 
@@ -0,0 +1,198 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "shm_output.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#include <boost/system/system_error.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace airnav::uat;
+
+struct ShmRingOutput::Header {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t slot_size;
+    std::uint32_t slot_count;
+    std::atomic<std::uint64_t> write_sequence;
+    std::atomic<std::uint32_t> wakeup;
+    std::atomic<std::uint32_t> waiters;
+    std::atomic<std::uint32_t> closed;
+    std::uint32_t writer_pid;
+};
+
+struct ShmRingOutput::Slot {
+    std::atomic<std::uint64_t> sequence;
+    std::uint32_t frame_length;
+    std::uint32_t reserved;
+
+    std::uint8_t *Frame() { return reinterpret_cast<std::uint8_t *>(this) + SLOT_HEADER_BYTES; }
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "the shared ring needs lock-free atomics");
+
+static boost::system::system_error SystemError(int err, const std::string &what) { return boost::system::system_error(boost::system::error_code(err, boost::system::system_category()), what); }
+
+static void WakeAll(std::atomic<std::uint32_t> &word) {
+#ifdef __linux__
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+    // no futexes: readers poll
+    (void)word;
+#endif
+}
+
+// If `path` is a ring left by an earlier instance, tell its readers that
+// it is going away, so they reopen the replacement
+static void AbandonExisting(const std::string &path, std::size_t header_bytes) {
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && std::size_t(st.st_size) >= header_bytes) {
+        void *base = ::mmap(nullptr, header_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED) {
+            auto *header = static_cast<std::uint32_t *>(base);
+            if (header[0] == ShmRingOutput::MAGIC && header[1] == ShmRingOutput::LAYOUT_VERSION) {
+                // same offsets as Header::closed and Header::wakeup
+                reinterpret_cast<std::atomic<std::uint32_t> *>(header + 8)->store(1);
+                reinterpret_cast<std::atomic<std::uint32_t> *>(header + 6)->fetch_add(1);
+                WakeAll(*reinterpret_cast<std::atomic<std::uint32_t> *>(header + 6));
+            }
+            ::munmap(base, header_bytes);
+        }
+    }
+    ::close(fd);
+}
+
+ShmRingOutput::ShmRingOutput(const std::string &path, std::size_t slots) : path_(path) {
+    static_assert(sizeof(Header) <= HEADER_BYTES, "ring header too large");
+    static_assert(sizeof(Slot) == SLOT_HEADER_BYTES, "unexpected slot header layout");
+    static_assert(offsetof(Header, wakeup) == 6 * 4 && offsetof(Header, closed) == 8 * 4, "unexpected ring header layout");
+
+    // room for the largest frame (an uplink), rounded up to whole cache lines
+    const std::size_t max_frame = BINARY_LENGTH_BYTES + BINARY_MESSAGE_HEADER_BYTES + UPLINK_DATA_BYTES;
+    slot_size_ = (SLOT_HEADER_BYTES + max_frame + 63) / 64 * 64;
+    slot_count_ = 1;
+    while (slot_count_ < slots) {
+        slot_count_ <<= 1;
+    }
+    map_size_ = HEADER_BYTES + slot_size_ * slot_count_;
+
+    // Always start a new file, rather than rewriting one that readers may
+    // still have mapped
+    AbandonExisting(path_, HEADER_BYTES);
+    if (::unlink(path_.c_str()) < 0 && errno != ENOENT) {
+        throw SystemError(errno, path_);
+    }
+
+    const int fd = ::open(path_.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw SystemError(errno, path_);
+    }
+    if (::ftruncate(fd, map_size_) < 0) {
+        auto err = errno;
+        ::close(fd);
+        ::unlink(path_.c_str());
+        throw SystemError(err, path_ + ": failed to size ring");
+    }
+
+    void *base = ::mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto err = errno;
+    ::close(fd); // the mapping keeps the file
+    if (base == MAP_FAILED) {
+        ::unlink(path_.c_str());
+        throw SystemError(err, path_ + ": failed to map ring");
+    }
+
+    base_ = static_cast<std::uint8_t *>(base);
+
+    // The new file reads as zeros, which is a valid empty ring (every slot
+    // sequence 0, write_sequence 0); fill in the geometry last, so a reader
+    // that finds the magic sees the rest
+    header_ = new (base_) Header;
+    header_->slot_size = slot_size_;
+    header_->slot_count = slot_count_;
+    header_->writer_pid = ::getpid();
+    header_->version = LAYOUT_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = MAGIC;
+}
+
+ShmRingOutput::~ShmRingOutput() {
+    if (header_) {
+        header_->closed.store(1);
+        header_->wakeup.fetch_add(1);
+        WakeAll(header_->wakeup);
+    }
+    if (base_) {
+        ::munmap(base_, map_size_);
+        ::unlink(path_.c_str());
+    }
+}
+
+ShmRingOutput::Slot *ShmRingOutput::SlotFor(std::uint64_t sequence) const { return reinterpret_cast<Slot *>(base_ + HEADER_BYTES + (sequence & (slot_count_ - 1)) * slot_size_); }
+
+void ShmRingOutput::HandleMessages(SharedMessageVector messages) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // only this writer changes write_sequence
+    const std::uint64_t start = header_->write_sequence.load(std::memory_order_relaxed);
+    std::uint64_t sequence = start;
+
+    for (const auto &message : *messages) {
+        if (message.Type() == MessageType::METADATA || message.Type() == MessageType::INVALID) {
+            continue;
+        }
+
+        scratch_.clear();
+        EncodeBinary(message, scratch_);
+        if (scratch_.empty() || scratch_.size() > slot_size_ - SLOT_HEADER_BYTES) {
+            continue;
+        }
+
+        // seqlock-style: mark the slot as changing, rewrite it, then
+        // publish it under its new sequence number
+        Slot *slot = SlotFor(sequence);
+        slot->sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->frame_length = scratch_.size();
+        std::memcpy(slot->Frame(), scratch_.data(), scratch_.size());
+        slot->sequence.store(sequence + 1, std::memory_order_release);
+        ++sequence;
+    }
+
+    if (sequence == start) {
+        return;
+    }
+
+    // One store and (only when someone is asleep) one wakeup per batch.
+    // The sequentially consistent store / load pairs with a reader's
+    // increment of `waiters` and recheck of write_sequence, so either the
+    // reader sees the new messages or we see the reader.
+    header_->write_sequence.store(sequence);
+    header_->wakeup.fetch_add(1);
+    if (header_->waiters.load() > 0) {
+        WakeAll(header_->wakeup);
+        ++wakeups_;
+    }
+
+    messages_written_ += sequence - start;
+}
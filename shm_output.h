@@ -0,0 +1,112 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_SHM_OUTPUT_H
+#define DUMP978_SHM_OUTPUT_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "uat_message.h"
+
+namespace airnav::uat {
+    // Publishes messages into a ring in a shared memory file (normally in
+    // /dev/shm) for consumers on the same host. There is a single writer
+    // and any number of readers; readers never write to the ring and are
+    // not known to the writer, so each extra reader costs dump978-rb
+    // nothing. Readers that fall more than a ring's worth behind lose
+    // messages, and can tell that they have.
+    //
+    // Layout (all fields in host byte order, naturally aligned):
+    //
+    //   header, 128 bytes at offset 0:
+    //     u32 magic            0x38373955 ("U978")
+    //     u32 version          1
+    //     u32 slot_size        bytes per slot, a multiple of 64
+    //     u32 slot_count       a power of two
+    //     u64 write_sequence   sequence number of the next message to be
+    //                          written; all earlier messages are complete
+    //     u32 wakeup           futex word, incremented after each batch
+    //     u32 waiters          readers blocked in FUTEX_WAIT on `wakeup`
+    //     u32 closed           nonzero once this file is abandoned (writer
+    //                          exited, or a new instance replaced it)
+    //     u32 writer_pid
+    //     (the rest is reserved, zero)
+    //
+    //   slot_count slots of slot_size bytes from offset 128; message N
+    //   lives in slot N & (slot_count - 1):
+    //     u64 sequence         N + 1 when the slot holds message N, 0
+    //                          while it is being rewritten
+    //     u32 frame_length     bytes of frame that follow
+    //     u32 reserved
+    //     frame                the message as a binary frame, exactly as
+    //                          sent on --binary-port (see EncodeBinary)
+    //
+    // To read message N: load `sequence` (acquire); if it is not N + 1 the
+    // message has not been written yet (if it is less) or was overwritten
+    // (if it is more). Otherwise use the frame in place, then load
+    // `sequence` again after an acquire fence: if it has changed, the frame
+    // was overwritten while reading and must be discarded. A reader that
+    // catches up with write_sequence sleeps by incrementing `waiters`,
+    // rechecking write_sequence, and calling FUTEX_WAIT (shared, not
+    // FUTEX_PRIVATE) on `wakeup` with the value it saw before the recheck,
+    // then decrementing `waiters`. A reader that sees `closed` should
+    // reopen the path.
+    //
+    // Metadata messages are not written to the ring.
+    class ShmRingOutput {
+      public:
+        typedef std::shared_ptr<ShmRingOutput> Pointer;
+
+        // Create (or replace) the ring file at `path` with room for
+        // `slots` messages (rounded up to a power of two). Throws
+        // boost::system::system_error if the file cannot be created or
+        // mapped.
+        static Pointer Create(const std::string &path, std::size_t slots = 8192) { return Pointer(new ShmRingOutput(path, slots)); }
+
+        ~ShmRingOutput();
+
+        ShmRingOutput(const ShmRingOutput &) = delete;
+        ShmRingOutput &operator=(const ShmRingOutput &) = delete;
+
+        // A MessageDispatch handler
+        void HandleMessages(SharedMessageVector messages);
+
+        std::uint64_t MessagesWritten() const { return messages_written_; }
+        std::uint64_t Wakeups() const { return wakeups_; }
+
+        static const std::uint32_t MAGIC = 0x38373955;
+        static const std::uint32_t LAYOUT_VERSION = 1;
+        static const std::size_t HEADER_BYTES = 128;
+        static const std::size_t SLOT_HEADER_BYTES = 16;
+
+      private:
+        ShmRingOutput(const std::string &path, std::size_t slots);
+
+        struct Header;
+        struct Slot;
+
+        Slot *SlotFor(std::uint64_t sequence) const;
+
+        std::string path_;
+        std::size_t slot_size_;
+        std::size_t slot_count_;
+        std::size_t map_size_;
+        std::uint8_t *base_ = nullptr;
+        Header *header_ = nullptr;
+
+        std::mutex mutex_;    // serializes HandleMessages
+        std::string scratch_; // one encoded frame
+
+        std::atomic<std::uint64_t> messages_written_{0};
+        std::atomic<std::uint64_t> wakeups_{0};
+    };
+}; // namespace airnav::uat
+
+#endif
@@ -4,7 +4,12 @@
 
 #include "soapy_source.h"
 #include "exception.h"
+#include "sample_clock.h"
+#include "stats.h"
+#include "thread_placement.h"
+#include "trace.h"
 
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 
@@ -162,8 +167,12 @@ void SoapySampleSource::Init() {
         throw config_error("No matching SoapySDR device found");
     }
 
+    if (options_.count("sample-rate")) {
+        sample_rate_ = options_["sample-rate"].as<double>();
+    }
+
     // hacky mchackerson
-    device_->setSampleRate(SOAPY_SDR_RX, 0, 2083333.0);
+    device_->setSampleRate(SOAPY_SDR_RX, 0, sample_rate_);
     device_->setFrequency(SOAPY_SDR_RX, 0, 978000000);
     device_->setBandwidth(SOAPY_SDR_RX, 0, 3.0e6);
 
@@ -307,24 +316,71 @@ void SoapySampleSource::Stop() {
 }
 
 void SoapySampleSource::Run() {
-    const auto bytes_per_element = BytesPerSample(format_);
-    const auto elements = std::max<size_t>(65536, device_->getStreamMTU(stream_.get()));
+    // placed before the ring is allocated, so that it lands on our NUMA node
+    ApplyThreadPlacement(ThreadRole::RX, "978-rx");
 
-    Bytes block;
-    block.reserve(elements * bytes_per_element);
+    const auto bytes_per_element = BytesPerSample(format_);
+    const auto mtu = device_->getStreamMTU(stream_.get());
+
+    // The read size adapts between these limits: larger after overruns, or
+    // when reads keep finding the driver already holding a full read of
+    // data (we are behind, and fewer, larger reads cost less per sample);
+    // smaller again after a long quiet spell, for lower latency.
+    const auto initial_elements = std::max<size_t>(65536, mtu);
+    const auto min_elements = std::max<size_t>(8192, mtu);
+    const auto max_elements = initial_elements * 4;
+    auto elements = initial_elements;
+    read_elements_ = elements;
+
+    // Samples are read directly into the ring, so blocks are passed to the
+    // receiver (and on to other threads) without a copy. If the receiver
+    // falls behind we read less, into whatever space remains; once the ring
+    // is full, we read into a scratch buffer and discard the data rather
+    // than stalling the SDR stream.
+    auto ring = SampleRing::Create(max_elements * bytes_per_element * 4 + HistorySamples() * bytes_per_element, HistorySamples() * bytes_per_element);
+    ring->Prefault();
+    ring_capacity_ = ring->Capacity();
+    Bytes scratch;
+
+    const auto adapt_interval = std::chrono::seconds(5);
+    const unsigned quiet_intervals_before_shrink = 12;
+    auto last_adapt = std::chrono::steady_clock::now();
+    unsigned interval_reads = 0;
+    unsigned interval_backlogged = 0;
+    unsigned interval_overflows = 0;
+    unsigned quiet_intervals = 0;
 
     const auto overflow_report_interval = std::chrono::milliseconds(15000);
     auto last_overflow_report = std::chrono::steady_clock::now();
     unsigned overflow_count = 0;
+    unsigned dropped_count = 0;
+
+    // Blocks are timestamped from the sample count rather than from the
+    // system clock at each read. Gaps are measured with the hardware
+    // timestamps if the driver provides them, and otherwise estimated from
+    // the system clock after an overrun.
+    const double samples_per_second = sample_rate_;
+    SampleClock clock(samples_per_second);
+    bool overrun = false;
+    bool have_hardware_time = false;
+    long long expected_time_ns = 0; // hardware time of the next sample
 
     while (!halt_) {
-        void *buffs[1] = {block.data()};
+        const auto space = ring->WriteSpace() / bytes_per_element;
+        const bool have_space = (space >= min_elements);
+        const auto read_elements = (have_space ? std::min(elements, space) : elements);
+        if (!have_space && scratch.size() < read_elements * bytes_per_element) {
+            scratch.resize(max_elements * bytes_per_element);
+        }
+
+        void *buffs[1] = {have_space ? ring->WritePointer() : scratch.data()};
         int flags = 0;
         long long time_ns;
 
-        block.resize(elements * bytes_per_element);
-        auto elements_read = device_->readStream(stream_.get(), buffs, elements, flags, time_ns,
+        const auto read_start = std::chrono::steady_clock::now();
+        auto elements_read = device_->readStream(stream_.get(), buffs, read_elements, flags, time_ns,
                                                  /* timeout, microseconds */ 5000000);
+        const auto read_end = std::chrono::steady_clock::now();
         if (halt_) {
             break;
         }
@@ -332,33 +388,92 @@ void SoapySampleSource::Run() {
         if (elements_read < 0) {
             if (elements_read == SOAPY_SDR_OVERFLOW) {
                 ++overflow_count;
+                ++interval_overflows;
+                overrun = true;
+                stats::Add(stats::Counter::SDR_OVERRUNS);
+                DUMP978_TRACE(SDR_OVERRUN, 0, read_elements, 0);
             } else {
                 DispatchError(boost::system::error_code{elements_read, soapysdr_category});
                 break;
             }
         }
 
-        if (overflow_count > 0) {
+        if (elements_read > 0) {
+            // a full read that returned in well under the time the samples
+            // took to arrive was already buffered by the driver
+            ++interval_reads;
+            const auto sample_time = std::chrono::duration<double>(elements_read / samples_per_second);
+            if ((std::size_t)elements_read == read_elements && read_end - read_start < sample_time / 4) {
+                ++interval_backlogged;
+                ++backlogged_reads_;
+            }
+        }
+
+        if (read_end - last_adapt >= adapt_interval) {
+            auto new_elements = elements;
+            if (interval_overflows > 0 || interval_backlogged * 2 > interval_reads) {
+                new_elements = std::min(max_elements, elements * 2);
+                quiet_intervals = 0;
+            } else if (++quiet_intervals >= quiet_intervals_before_shrink) {
+                new_elements = std::max(min_elements, elements / 2);
+                quiet_intervals = 0;
+            }
+
+            if (new_elements != elements) {
+                elements = new_elements;
+                read_elements_ = elements;
+                ++read_size_changes_;
+            }
+
+            last_adapt = read_end;
+            interval_reads = interval_backlogged = interval_overflows = 0;
+        }
+
+        std::uint64_t sample_index = 0;
+        if (elements_read > 0) {
+            const auto now = std::chrono::system_clock::now();
+            const bool hardware_time = (flags & SOAPY_SDR_HAS_TIME) != 0;
+            if (hardware_time && have_hardware_time) {
+                const double missing = std::round((time_ns - expected_time_ns) * samples_per_second / 1e9);
+                if (missing > 0) {
+                    clock.Skip(static_cast<std::uint64_t>(missing));
+                }
+            }
+            if (hardware_time) {
+                expected_time_ns = time_ns + static_cast<long long>(elements_read * 1e9 / samples_per_second);
+            }
+            have_hardware_time = hardware_time;
+
+            sample_index = clock.Deliver(elements_read, now, overrun && !hardware_time);
+            overrun = false;
+        }
+
+        if (elements_read > 0 && !have_space) {
+            ++dropped_count;
+            stats::Add(stats::Counter::SDR_DROPPED_BLOCKS);
+            DUMP978_TRACE(SDR_DROPPED_BLOCK, 0, elements_read, 0);
+        }
+
+        if (overflow_count > 0 || dropped_count > 0) {
             auto now = std::chrono::steady_clock::now();
             if (now - last_overflow_report > overflow_report_interval) {
-                std::cerr << "SoapySDR: " << overflow_count << " recent input overruns (sample data dropped)" << std::endl;
+                if (overflow_count > 0) {
+                    std::cerr << "SoapySDR: " << overflow_count << " recent input overruns (sample data dropped); now reading " << elements << " samples at a time" << std::endl;
+                }
+                if (dropped_count > 0) {
+                    std::cerr << "SoapySDR: " << dropped_count << " recent sample blocks dropped (receiver backlog)" << std::endl;
+                }
                 last_overflow_report = now;
                 overflow_count = 0;
+                dropped_count = 0;
             }
         }
 
-        if (elements_read <= 0) {
+        if (elements_read <= 0 || !have_space) {
             continue;
         }
 
-        block.resize(elements_read * bytes_per_element);
-
-        // work out a starting timestamp
-        static auto unix_epoch = std::chrono::system_clock::from_time_t(0);
-        auto end_of_block = std::chrono::system_clock::now();
-        auto start_of_block = end_of_block - (std::chrono::milliseconds(1000) * elements / 2083333);
-        std::uint64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(start_of_block - unix_epoch).count();
-
-        DispatchBuffer(timestamp, block);
+        DispatchBlock(ring->Commit(elements_read * bytes_per_element, clock.Milliseconds(sample_index), sample_index));
+        ring_used_ = ring->Capacity() - ring->WriteSpace();
     }
 }
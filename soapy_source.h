@@ -27,6 +27,16 @@ namespace airnav::uat {
         void Stop() override;
         SampleFormat Format() override { return format_; }
 
+        // Read buffering, for stats: the number of samples asked for in
+        // each read (adjusted as the rx thread runs), how many reads found
+        // the driver already holding a full read of data (i.e. we are behind),
+        // and how much of the sample ring is held by blocks not yet released
+        std::size_t ReadSamples() const { return read_elements_; }
+        std::uint64_t ReadSizeChanges() const { return read_size_changes_; }
+        std::uint64_t BackloggedReads() const { return backlogged_reads_; }
+        std::size_t RingCapacity() const { return ring_capacity_; }
+        std::size_t RingUsed() const { return ring_used_; }
+
       private:
         SoapySampleSource(boost::asio::io_service &service, const std::string &device_name, const boost::program_options::variables_map &options);
 
@@ -37,12 +47,19 @@ namespace airnav::uat {
         SampleFormat format_ = SampleFormat::UNKNOWN;
         std::string device_name_;
         boost::program_options::variables_map options_;
+        double sample_rate_ = DEMOD_SAMPLE_RATE; // as requested by --sample-rate
 
         std::shared_ptr<SoapySDR::Device> device_;
         std::shared_ptr<SoapySDR::Stream> stream_;
         std::unique_ptr<std::thread> rx_thread_;
         bool halt_ = false;
 
+        std::atomic<std::size_t> read_elements_{0};
+        std::atomic<std::uint64_t> read_size_changes_{0};
+        std::atomic<std::uint64_t> backlogged_reads_{0};
+        std::atomic<std::size_t> ring_capacity_{0};
+        std::atomic<std::size_t> ring_used_{0};
+
         static std::atomic_bool log_handler_registered_;
     };
 }; // namespace airnav::uat
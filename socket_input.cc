@@ -4,14 +4,16 @@
 
 #include "socket_input.h"
 
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
 using namespace airnav::uat;
 using boost::asio::ip::tcp;
 
-#include <iostream>
-
-RawInput::RawInput(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval) : service_(service), host_(host), port_or_service_(port_or_service), reconnect_interval_(reconnect_interval), resolver_(service), socket_(service), reconnect_timer_(service), used_(0) { readbuf_.resize(8192); }
+SocketInput::SocketInput(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval) : service_(service), host_(host), port_or_service_(port_or_service), reconnect_interval_(reconnect_interval), resolver_(service), socket_(service), reconnect_timer_(service), start_(0), used_(0) { readbuf_.resize(65536); }
 
-void RawInput::Start() {
+void SocketInput::Start() {
     auto self(shared_from_this());
 
     std::cerr << "Connecting to " << host_ << ":" << port_or_service_ << std::endl;
@@ -29,12 +31,14 @@ void RawInput::Start() {
     });
 }
 
-void RawInput::Stop() {
+void SocketInput::Stop() {
+    reconnect_interval_ = std::chrono::milliseconds(0);
     reconnect_timer_.cancel();
+    resolver_.cancel();
     socket_.close();
 }
 
-void RawInput::TryNextEndpoint(const boost::system::error_code &last_error) {
+void SocketInput::TryNextEndpoint(const boost::system::error_code &last_error) {
     if (next_endpoint_ == tcp::resolver::iterator()) {
         // No more addresses to try
         HandleError(last_error);
@@ -46,6 +50,7 @@ void RawInput::TryNextEndpoint(const boost::system::error_code &last_error) {
     socket_.async_connect(endpoint, [this, self, endpoint](const boost::system::error_code &ec) {
         if (!ec) {
             std::cerr << "Connected to " << endpoint << std::endl;
+            start_ = used_ = 0;
             ScheduleRead();
         } else if (ec == boost::asio::error::operation_aborted) {
             return;
@@ -57,13 +62,14 @@ void RawInput::TryNextEndpoint(const boost::system::error_code &last_error) {
     });
 }
 
-void RawInput::ScheduleRead() {
+void SocketInput::ScheduleRead() {
     auto self(shared_from_this());
 
     if (!socket_.is_open())
         return;
 
     if (used_ >= readbuf_.size()) {
+        // ParseBuffer leaves space unless a single line fills the buffer
         HandleError(boost::asio::error::make_error_code(boost::asio::error::no_buffer_space));
         return;
     }
@@ -80,62 +86,91 @@ void RawInput::ScheduleRead() {
     });
 }
 
-void RawInput::HandleError(const boost::system::error_code &ec) {
+void SocketInput::HandleError(const boost::system::error_code &ec) {
     if (ec == boost::asio::error::operation_aborted) {
         return;
     }
     socket_.close();
+    start_ = used_ = 0;
 
     if (reconnect_interval_.count() > 0) {
-        // do this before calling the error handler, so the error handler has the option
-        // of calling Stop() and cancelling the reconnect timer
+        if (ec == boost::asio::error::eof) {
+            std::cerr << Name() << ": connection closed";
+        } else {
+            std::cerr << Name() << ": " << ec.message();
+        }
+        std::cerr << ", reconnecting in " << std::chrono::duration_cast<std::chrono::duration<double>>(reconnect_interval_).count() << " seconds" << std::endl;
 
         auto self(shared_from_this());
-
         reconnect_timer_.expires_from_now(reconnect_interval_);
         reconnect_timer_.async_wait([this, self](const boost::system::error_code &ec) {
             if (!ec)
                 Start();
         });
+        return;
     }
 
-    if (error_handler_) {
-        error_handler_(ec);
+    DispatchError(ec);
+}
+
+void SocketInput::Emit(RawMessage &&message) {
+    if (!parsed_) {
+        parsed_ = MessageVector::Create();
+        parsed_->timing.received = std::chrono::steady_clock::now();
     }
+    parsed_->emplace_back(std::move(message));
 }
 
-void RawInput::ParseBuffer() {
-    SharedMessageVector messages;
+void SocketInput::ParseBuffer() {
+    const char *buf = readbuf_.data();
+    const char *parsed_end = Parse(buf + start_, buf + used_);
+    if (!parsed_end) {
+        parsed_.reset();
+        HandleError(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
+        return;
+    }
 
-    auto sol = readbuf_.begin();
-    auto end = readbuf_.begin() + used_;
+    start_ = parsed_end - buf;
+    if (start_ == used_) {
+        start_ = used_ = 0;
+    } else if (readbuf_.size() - used_ < readbuf_.size() / 4) {
+        // running out of space for the next read; move the partial message down
+        std::memmove(readbuf_.data(), readbuf_.data() + start_, used_ - start_);
+        used_ -= start_;
+        start_ = 0;
+    }
+
+    if (parsed_) {
+        SharedMessageVector messages;
+        messages.swap(parsed_);
+        DispatchMessages(messages);
+    }
+}
+
+//////////////
+
+const char *RawInput::Parse(const char *begin, const char *end) {
+    const char *sol = begin;
     while (sol < end) {
-        auto eol = std::find(sol, end, '\n');
-        if (eol == end)
+        auto eol = static_cast<const char *>(std::memchr(sol, '\n', end - sol));
+        if (!eol)
             break;
 
-        std::string line(sol, eol);
-        auto result = ParseLine(line);
-        if (result) {
-            if (!messages) {
-                messages = std::make_shared<MessageVector>();
-            }
-            messages->emplace_back(std::move(*result));
-        } else {
-            std::cerr << "error: failed to parse input line: " << line << std::endl;
-            HandleError(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
-            return;
+        auto result = ParseLine(sol, eol);
+        if (!result) {
+            std::cerr << Name() << ": failed to parse input line: " << std::string(sol, eol) << std::endl;
+            return nullptr;
+        }
+
+        // a payload whose length matches no message type parses, but is
+        // dropped here as BinaryInput drops it
+        if (result->Type() != MessageType::INVALID) {
+            Emit(std::move(*result));
         }
         sol = eol + 1;
     }
 
-    if (sol != readbuf_.begin()) {
-        std::copy(sol, end, readbuf_.begin());
-        used_ = std::distance(sol, end);
-    }
-    if (messages) {
-        DispatchMessages(messages);
-    }
+    return sol;
 }
 
 static inline int hexvalue(char c) {
@@ -183,117 +218,159 @@ static inline int hexvalue(char c) {
     }
 }
 
-boost::optional<RawMessage> RawInput::ParseMetadataLine(const std::string &line) {
+boost::optional<RawMessage> RawInput::ParseMetadataLine(const char *begin, const char *end) {
     // Parse metadata line that starts with '!'
     RawMessage::MetadataMap metadata;
 
-    for (size_t i = 1; i < line.size();) {
-        auto equals = line.find('=', i);
-        auto semicolon = line.find(';', i);
-        if (equals == std::string::npos || semicolon == std::string::npos || semicolon < equals) {
+    for (const char *i = begin + 1; i < end;) {
+        auto equals = static_cast<const char *>(std::memchr(i, '=', end - i));
+        auto semicolon = static_cast<const char *>(std::memchr(i, ';', end - i));
+        if (!equals || !semicolon || semicolon < equals) {
             // no more valid data
             break;
         }
 
-        auto key = line.substr(i, equals - i);
-        auto value = line.substr(equals + 1, semicolon - equals - 1);
-        metadata[key] = value;
-
+        metadata[std::string(i, equals)] = std::string(equals + 1, semicolon);
         i = semicolon + 1;
     }
 
     return RawMessage(std::move(metadata));
 }
 
-boost::optional<RawMessage> RawInput::ParseLine(const std::string &line) {
-    if (line.size() < 2) {
+boost::optional<RawMessage> RawInput::ParseLine(const char *begin, const char *end) {
+    if (end - begin < 2) {
         // too short
         return boost::none;
     }
 
-    if (line[0] == '!') {
+    if (begin[0] == '!') {
         // metadata only
-        return ParseMetadataLine(line);
+        return ParseMetadataLine(begin, end);
     }
 
     // message with data payload
-    if (line[0] != '-' && line[0] != '+') {
+    if (begin[0] != '-' && begin[0] != '+') {
         // badly formatted
         return boost::none;
     }
 
-    auto eod = line.find(';', 1);
-    if (eod == std::string::npos) {
+    auto eod = static_cast<const char *>(std::memchr(begin + 1, ';', end - begin - 1));
+    if (!eod) {
         // missing semicolon
         return boost::none;
     }
 
-    auto hexlength = eod - 1;
+    auto hexlength = eod - begin - 1;
     if (hexlength % 2 != 0) {
         // wrong number of data characters
         return boost::none;
     }
 
-    // parse hex digits
-    Bytes payload;
-    payload.reserve(hexlength / 2);
+    // parse hex digits; no message is larger than an uplink, so anything
+    // longer can only be an INVALID message
+    const std::size_t payload_size = hexlength / 2;
+    if (payload_size > MessagePayload::CAPACITY) {
+        return RawMessage();
+    }
 
-    for (decltype(eod) i = 1; i < eod; i += 2) {
-        auto h1 = hexvalue(line[i]);
-        auto h2 = hexvalue(line[i + 1]);
+    std::uint8_t payload[MessagePayload::CAPACITY];
+    const char *hex = begin + 1;
+    for (std::size_t i = 0; i < payload_size; ++i) {
+        auto h1 = hexvalue(hex[0]);
+        auto h2 = hexvalue(hex[1]);
         if (h1 < 0 || h2 < 0) {
             // bad hex value
             return boost::none;
         }
-        payload.push_back((std::uint8_t)((h1 << 4) | h2));
+        payload[i] = (std::uint8_t)((h1 << 4) | h2);
+        hex += 2;
     }
 
-    // parse key-value pairs
+    // parse key-value pairs. Each value is followed by a semicolon, which
+    // stops the numeric conversions; unparseable values convert to 0.
 
     unsigned rs = 0;
     double rssi = 0;
     std::uint64_t t = 0;
     std::uint64_t rt = 0;
+    unsigned dup = 1;
 
-    for (auto i = eod + 1; i < line.size();) {
-        auto equals = line.find('=', i);
-        auto semicolon = line.find(';', i);
-        if (equals == std::string::npos || semicolon == std::string::npos || semicolon < equals) {
+    for (const char *i = eod + 1; i < end;) {
+        auto equals = static_cast<const char *>(std::memchr(i, '=', end - i));
+        auto semicolon = static_cast<const char *>(std::memchr(i, ';', end - i));
+        if (!equals || !semicolon || semicolon < equals) {
             // no more valid data
             break;
         }
 
-        auto key = line.substr(i, equals - i);
-        auto value = line.substr(equals + 1, semicolon - equals - 1);
-
-        if (key == "rs") {
-            try {
-                rs = std::stoi(value, nullptr, 10);
-            } catch (const std::exception &e) {
-                rs = 0;
-            }
-        } else if (key == "rssi") {
-            try {
-                rssi = std::stod(value);
-            } catch (const std::exception &e) {
-                rssi = 0;
-            }
-        } else if (key == "t") {
-            try {
-                t = (std::uint64_t)(std::stod(value) * 1000);
-            } catch (const std::exception &e) {
-                t = 0;
-            }
-        } else if (key == "rt") {
-            try {
-                rt = (std::uint64_t)std::stoll(value, nullptr, 10);
-            } catch (const std::exception &e) {
-                rt = 0;
-            }
+        const std::size_t key_length = equals - i;
+        auto key_is = [i, key_length](const char *key) { return key_length == std::strlen(key) && std::memcmp(i, key, key_length) == 0; };
+        const char *value = equals + 1;
+
+        if (key_is("rs")) {
+            rs = (unsigned)std::strtol(value, nullptr, 10);
+        } else if (key_is("rssi")) {
+            rssi = std::strtod(value, nullptr);
+        } else if (key_is("t")) {
+            t = (std::uint64_t)(std::strtod(value, nullptr) * 1000);
+        } else if (key_is("rt")) {
+            rt = (std::uint64_t)std::strtoll(value, nullptr, 10);
+        } else if (key_is("dup")) {
+            dup = (unsigned)std::strtol(value, nullptr, 10);
         }
 
         i = semicolon + 1;
     }
 
-    return RawMessage(std::move(payload), t, rs, rssi, rt);
+    RawMessage message(payload, payload_size, t, rs, rssi, rt);
+    if (dup > 1) {
+        message.SetCopies(dup);
+    }
+    return message;
+}
+
+//////////////
+
+const char *BinaryInput::Parse(const char *begin, const char *end) {
+    auto frame = reinterpret_cast<const std::uint8_t *>(begin);
+    auto data_end = reinterpret_cast<const std::uint8_t *>(end);
+    while (auto size = BinaryFrameSize(frame, data_end)) {
+        auto result = DecodeBinary(frame, size);
+        if (!result) {
+            std::cerr << Name() << ": failed to parse a binary frame of " << size << " bytes" << std::endl;
+            return nullptr;
+        }
+
+        if (result->Type() != MessageType::INVALID) {
+            Emit(std::move(*result));
+        }
+        frame += size;
+    }
+
+    return reinterpret_cast<const char *>(frame);
+}
+
+//////////////
+
+void MergedMessageSource::Start() {
+    std::weak_ptr<MergedMessageSource> weak(shared_from_this());
+    for (unsigned index = 0; index < sources_.size(); ++index) {
+        const auto &source = sources_[index];
+        source->SetConsumer([weak, index](SharedMessageVector messages) {
+            messages->source = index;
+            if (auto self = weak.lock())
+                self->DispatchMessages(messages);
+        });
+        source->SetErrorHandler([weak](const boost::system::error_code &ec) {
+            if (auto self = weak.lock())
+                self->DispatchError(ec);
+        });
+        source->Start();
+    }
+}
+
+void MergedMessageSource::Stop() {
+    for (const auto &source : sources_) {
+        source->Stop();
+    }
 }
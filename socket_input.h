@@ -9,6 +9,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
@@ -17,26 +18,35 @@
 #include "message_source.h"
 
 namespace airnav::uat {
-    class RawInput : public MessageSource, public std::enable_shared_from_this<RawInput> {
+    // Reads messages from a TCP connection to another receiver; subclasses
+    // provide the parsing for one wire format.
+    //
+    // If `reconnect_interval` is nonzero, lost or failed connections are
+    // retried after that interval and errors are only logged; otherwise
+    // the first error is reported to the error handler.
+    class SocketInput : public MessageSource, public std::enable_shared_from_this<SocketInput> {
       public:
-        typedef std::shared_ptr<RawInput> Pointer;
-        typedef std::function<void(const boost::system::error_code &)> ErrorHandler;
+        void Start() override;
+        void Stop() override;
 
-        static Pointer Create(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval = std::chrono::milliseconds(0)) { return Pointer(new RawInput(service, host, port_or_service, reconnect_interval)); }
+      protected:
+        SocketInput(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval);
 
-        void Start();
-        void Stop();
+        // Parse the complete messages at the start of [begin, end), passing
+        // each to Emit. Return the end of the last complete message parsed
+        // (begin if there are none yet), or nullptr if the data is not
+        // valid, which drops the connection.
+        virtual const char *Parse(const char *begin, const char *end) = 0;
 
-        void SetErrorHandler(ErrorHandler handler) { error_handler_ = handler; }
+        void Emit(RawMessage &&message);
 
-      private:
-        RawInput(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval);
+        // host:port, for log messages
+        std::string Name() const { return host_ + ":" + port_or_service_; }
 
+      private:
         void TryNextEndpoint(const boost::system::error_code &last_error);
         void ScheduleRead();
         void ParseBuffer();
-        boost::optional<RawMessage> ParseLine(const std::string &line);
-        boost::optional<RawMessage> ParseMetadataLine(const std::string &line);
         void HandleError(const boost::system::error_code &ec);
 
         boost::asio::io_service &service_;
@@ -49,10 +59,67 @@ namespace airnav::uat {
         boost::asio::ip::tcp::resolver::iterator next_endpoint_;
         boost::asio::steady_timer reconnect_timer_;
 
-        ErrorHandler error_handler_;
-
+        // Received data is readbuf_[start_, used_); complete messages are
+        // parsed where they lie, and the leftover partial message is only
+        // moved back to the start of the buffer when space runs short.
         std::vector<char> readbuf_;
+        std::size_t start_;
         std::size_t used_;
+
+        SharedMessageVector parsed_; // messages from the current read, created on demand
+    };
+
+    // Reads raw-format messages, as written by RawOutput
+    class RawInput : public SocketInput {
+      public:
+        typedef std::shared_ptr<RawInput> Pointer;
+
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval = std::chrono::milliseconds(0)) { return Pointer(new RawInput(service, host, port_or_service, reconnect_interval)); }
+
+        // Parse one line (without its newline) in place. Exposed for tests
+        // and benchmarks.
+        static boost::optional<RawMessage> ParseLine(const char *begin, const char *end);
+
+      protected:
+        const char *Parse(const char *begin, const char *end) override;
+
+      private:
+        RawInput(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval) : SocketInput(service, host, port_or_service, reconnect_interval) {}
+
+        static boost::optional<RawMessage> ParseMetadataLine(const char *begin, const char *end);
+    };
+
+    // Reads binary frames, as written by BinaryOutput (see EncodeBinary)
+    class BinaryInput : public SocketInput {
+      public:
+        typedef std::shared_ptr<BinaryInput> Pointer;
+
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval = std::chrono::milliseconds(0)) { return Pointer(new BinaryInput(service, host, port_or_service, reconnect_interval)); }
+
+      protected:
+        const char *Parse(const char *begin, const char *end) override;
+
+      private:
+        BinaryInput(boost::asio::io_service &service, const std::string &host, const std::string &port_or_service, std::chrono::milliseconds reconnect_interval) : SocketInput(service, host, port_or_service, reconnect_interval) {}
+    };
+
+    // Merges the messages of several sources into one stream, setting each
+    // vector's `source` to the index of the source it came from
+    class MergedMessageSource : public MessageSource, public std::enable_shared_from_this<MergedMessageSource> {
+      public:
+        typedef std::shared_ptr<MergedMessageSource> Pointer;
+
+        static Pointer Create(const std::vector<MessageSource::Pointer> &sources) { return Pointer(new MergedMessageSource(sources)); }
+
+        void Start() override;
+        void Stop() override;
+
+      private:
+        explicit MergedMessageSource(const std::vector<MessageSource::Pointer> &sources) : sources_(sources) {}
+
+        std::vector<MessageSource::Pointer> sources_;
     };
 }; // namespace airnav::uat
 
@@ -0,0 +1,84 @@
+#include "socket_input.h"
+#include "uat_protocol.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+
+using namespace airnav::uat;
+using boost::asio::ip::tcp;
+
+static unsigned failures = 0;
+
+// Serve `data` to one RawInput over a loopback connection, then close the
+// connection; return the messages the RawInput emitted
+static std::vector<RawMessage> feed_raw_input(const std::string &data) {
+    boost::asio::io_service service;
+    tcp::acceptor acceptor(service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    tcp::socket peer(service);
+
+    acceptor.async_accept(peer, [&](const boost::system::error_code &ec) {
+        if (ec)
+            return;
+        boost::asio::async_write(peer, boost::asio::buffer(data), [&](const boost::system::error_code &, std::size_t) { peer.close(); });
+    });
+
+    std::vector<RawMessage> emitted;
+    auto input = RawInput::Create(service, "127.0.0.1", std::to_string(acceptor.local_endpoint().port()));
+    input->SetConsumer([&](SharedMessageVector messages) { emitted.insert(emitted.end(), messages->begin(), messages->end()); });
+    // the connection closing (or failing) ends the test
+    input->SetErrorHandler([&](const boost::system::error_code &) { service.stop(); });
+
+    boost::asio::steady_timer timeout(service);
+    timeout.expires_from_now(std::chrono::seconds(10));
+    timeout.async_wait([&](const boost::system::error_code &ec) {
+        if (!ec) {
+            std::cerr << "raw input: timed out" << std::endl;
+            ++failures;
+            service.stop();
+        }
+    });
+
+    input->Start();
+    service.run();
+    input->Stop();
+    return emitted;
+}
+
+// Lines whose payload length matches no message type must not be emitted
+// (outputs cannot encode them), but must not drop the connection either
+void test_raw_invalid_length() {
+    const std::string downlink = "-" + std::string(DOWNLINK_SHORT_DATA_BYTES * 2, '0') + ";rs=1;\n";
+    const std::string oversized = "+" + std::string((UPLINK_DATA_BYTES + 1) * 2, '0') + ";\n";
+    auto emitted = feed_raw_input("-0011;\n" + oversized + downlink);
+
+    unsigned mismatches = 0;
+    for (const auto &message : emitted) {
+        if (message.Type() == MessageType::INVALID) {
+            std::cerr << "raw input: emitted an INVALID message" << std::endl;
+            ++mismatches;
+        }
+    }
+    if (emitted.size() != 1 || emitted[0].Type() != MessageType::DOWNLINK_SHORT) {
+        std::cerr << "raw input: expected only the valid downlink, got " << emitted.size() << " messages" << std::endl;
+        ++mismatches;
+    }
+
+    std::cerr << "raw input, invalid payload lengths: " << mismatches << " mismatches" << std::endl;
+    failures += mismatches;
+}
+
+int main(int argc, char **argv) {
+    test_raw_invalid_length();
+
+    if (failures) {
+        std::cerr << failures << " failures" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
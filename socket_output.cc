@@ -2,12 +2,18 @@
 // All rights reserved.
 // Licensed under the 2-clause BSD license; see the LICENSE file
 
+#include <algorithm>
+#include <cctype>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 
 #include <boost/asio.hpp>
 #include <boost/asio/ip/v6_only.hpp>
 
+#ifdef DUMP978_BEAST
+#include "es_conversion.h"
+#endif
 #include "message_dispatch.h"
 #include "socket_output.h"
 
@@ -16,52 +22,234 @@ using boost::asio::ip::tcp;
 
 using namespace airnav::uat;
 
-SocketOutput::SocketOutput(asio::io_service &service, tcp::socket &&socket) : service_(service), strand_(service), socket_(std::move(socket)), peer_(socket_.remote_endpoint()), flush_pending_(false) {}
+SocketOutput::SocketOutput(asio::io_service &service, tcp::socket &&socket, const OutputQueueLimits &limits) : service_(service), strand_(service), socket_(std::move(socket)), local_(socket_.local_endpoint()), peer_(socket_.remote_endpoint()), limits_(limits), pending_bytes_(0), flush_pending_(false), coalesce_timer_(service), dropped_chunks_(0), dropped_bytes_(0), bytes_written_(0), writes_(0) {}
 
-void SocketOutput::Start() { ReadAndDiscard(); }
+// Every started connection, for CollectStats
+static std::mutex all_outputs_mutex;
+static std::vector<std::weak_ptr<SocketOutput>> all_outputs;
 
-void SocketOutput::ReadAndDiscard() {
+void SocketOutput::Start() {
+    {
+        std::unique_lock<std::mutex> lock(all_outputs_mutex);
+        all_outputs.erase(std::remove_if(all_outputs.begin(), all_outputs.end(), [](const std::weak_ptr<SocketOutput> &output) { return output.expired(); }), all_outputs.end());
+        all_outputs.push_back(shared_from_this());
+    }
+
+    // Output is already batched into whole chunks (and, when coalescing,
+    // held for a bounded time), so Nagle's algorithm would only add delay
+    boost::system::error_code ignored;
+    socket_.set_option(tcp::no_delay(true), ignored);
+
+    // on the strand, as Write() may already be using the socket from
+    // another thread if the connection's io_service runs elsewhere
+    auto self(shared_from_this());
+    strand_.dispatch([this, self]() { ReadCommands(); });
+}
+
+static std::string EndpointString(const tcp::endpoint &endpoint) {
+    std::ostringstream os;
+    os << endpoint;
+    return os.str();
+}
+
+void SocketOutput::CollectStats(std::vector<stats::Metric> &metrics) {
+    std::unique_lock<std::mutex> lock(all_outputs_mutex);
+    for (const auto &weak : all_outputs) {
+        auto output = weak.lock();
+        if (!output)
+            continue; // closed and released
+
+        const std::map<std::string, std::string> labels = {{"local", EndpointString(output->local_)}, {"peer", EndpointString(output->peer_)}};
+        metrics.push_back({"client_bytes_written_total", labels, (double)output->BytesWritten(), true});
+        metrics.push_back({"client_writes_total", labels, (double)output->Writes(), true});
+        metrics.push_back({"client_dropped_chunks_total", labels, (double)output->DroppedChunks(), true});
+        metrics.push_back({"client_dropped_bytes_total", labels, (double)output->DroppedBytes(), true});
+    }
+}
+
+// Longest command line accepted; longer lines are discarded
+static const std::size_t MAX_COMMAND_LENGTH = 4096;
+
+void SocketOutput::ReadCommands() {
     auto self(shared_from_this());
     auto buf = std::make_shared<Bytes>(512);
     socket_.async_read_some(asio::buffer(*buf), strand_.wrap([this, self, buf](const boost::system::error_code &ec, std::size_t len) {
         if (ec) {
             HandleError(ec);
-        } else {
-            ReadAndDiscard();
+            return;
+        }
+
+        // anything other than a command is discarded, as before commands existed
+        for (std::size_t i = 0; i < len; ++i) {
+            const char c = (char)(*buf)[i];
+            if (c == '\n') {
+                HandleCommand(command_);
+                command_.clear();
+            } else if (command_.size() < MAX_COMMAND_LENGTH) {
+                command_ += c;
+            }
         }
+
+        ReadCommands();
     }));
 }
 
+void SocketOutput::HandleCommand(const std::string &line) {
+    static const std::string filter_command = "filter";
+    if (line.compare(0, filter_command.size(), filter_command) != 0 || (line.size() > filter_command.size() && !std::isspace((unsigned char)line[filter_command.size()]))) {
+        return;
+    }
+
+    try {
+        auto filter = MessageFilter::Parse(line.substr(filter_command.size()));
+        std::cerr << peer_ << ": filter set to \"" << filter.ToString() << "\"" << std::endl;
+        if (filter_notifier_) {
+            filter_notifier_(filter);
+        }
+    } catch (const std::invalid_argument &err) {
+        std::cerr << peer_ << ": ignoring bad filter command: " << err.what() << std::endl;
+    }
+}
+
+SharedBuffer EncodingCache::Encode(const SharedMessageVector &messages) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const auto &entry : entries_) {
+        if (entry.messages == messages)
+            return entry.encoded;
+    }
+    lock.unlock();
+
+    // encode without holding the lock; at worst two threads both encode the
+    // same vector, which is harmless
+    auto encoded = std::make_shared<std::string>();
+    encoder_(*messages, *encoded);
+
+    lock.lock();
+    // keeping the vector alive in the cache means its address can't be reused
+    // by a different vector while the entry exists
+    entries_[next_entry_] = {messages, encoded};
+    next_entry_ = (next_entry_ + 1) % entries_.size();
+    return encoded;
+}
+
 void SocketOutput::Write(SharedMessageVector messages) {
+    auto buffer = Encode(messages);
+    if (!buffer || buffer->empty())
+        return;
+
+    WriteBuffer(buffer, messages->timing.received);
+}
+
+void SocketOutput::WriteBuffer(SharedBuffer buffer, std::chrono::steady_clock::time_point received) {
     auto self(shared_from_this());
-    strand_.dispatch([this, self, messages]() {
+    strand_.dispatch([this, self, buffer, received]() {
         if (IsOpen()) {
-            InternalWrite(messages);
-            Flush();
+            Enqueue(buffer, received);
+            ScheduleFlush();
         }
     });
 }
 
-void SocketOutput::Flush() {
-    if (flush_pending_)
+void SocketOutput::ScheduleFlush() {
+    if (limits_.coalesce_time == std::chrono::steady_clock::duration::zero() || pending_bytes_ >= limits_.coalesce_bytes) {
+        Flush();
         return;
+    }
 
-    auto writebuf = std::make_shared<std::string>(outbuf_.str());
-    if (writebuf->empty())
+    // hold the output until the window closes; a write that is already in
+    // progress will pick it up on completion if that comes first
+    if (coalesce_timer_pending_ || flush_pending_ || pending_.empty()) {
+        return;
+    }
+
+    // the window runs from when the oldest waiting chunk was queued, so time
+    // spent waiting for an earlier write counts against it
+    coalesce_timer_pending_ = true;
+    auto self(shared_from_this());
+    coalesce_timer_.expires_at(pending_.front().queued + limits_.coalesce_time);
+    coalesce_timer_.async_wait(strand_.wrap([this, self](const boost::system::error_code &ec) {
+        coalesce_timer_pending_ = false;
+        if (!ec && IsOpen()) {
+            Flush();
+        }
+    }));
+}
+
+void SocketOutput::Enqueue(SharedBuffer buffer, std::chrono::steady_clock::time_point received) {
+    const auto now = std::chrono::steady_clock::now();
+    auto over_limit = [this, &buffer, now]() { return !pending_.empty() && (pending_bytes_ + buffer->size() > limits_.max_bytes || now - pending_.front().queued > limits_.max_age); };
+
+    if (over_limit()) {
+        switch (limits_.policy) {
+        case OutputQueueLimits::Policy::DISCONNECT:
+            std::cerr << peer_ << ": output queue over limit (" << pending_bytes_ << " bytes queued), disconnecting slow client" << std::endl;
+            Close();
+            return;
+
+        case OutputQueueLimits::Policy::DROP_NEWEST:
+            Drop(buffer);
+            return;
+
+        case OutputQueueLimits::Policy::DROP_OLDEST:
+            while (over_limit()) {
+                Drop(pending_.front().buffer);
+                pending_bytes_ -= pending_.front().buffer->size();
+                pending_.pop_front();
+            }
+            break;
+        }
+    }
+
+    pending_.push_back({std::move(buffer), now, received});
+    pending_bytes_ += pending_.back().buffer->size();
+}
+
+void SocketOutput::Drop(const SharedBuffer &buffer) {
+    if (dropped_chunks_ == 0) {
+        std::cerr << peer_ << ": output queue over limit, dropping data for slow client" << std::endl;
+    }
+
+    ++dropped_chunks_;
+    dropped_bytes_ += buffer->size();
+}
+
+void SocketOutput::Flush() {
+    if (flush_pending_ || pending_.empty())
         return;
 
     flush_pending_ = true;
-    outbuf_.str(std::string());
+    if (coalesce_timer_pending_) {
+        coalesce_timer_.cancel();
+    }
+
+    // send all the pending (shared) buffers with one scatter-gather write
+    auto writing = std::make_shared<std::vector<QueuedChunk>>(std::make_move_iterator(pending_.begin()), std::make_move_iterator(pending_.end()));
+    std::vector<asio::const_buffer> buffers;
+    buffers.reserve(writing->size());
+    for (const auto &chunk : *writing) {
+        buffers.push_back(asio::buffer(*chunk.buffer));
+    }
+    pending_.clear();
+    pending_bytes_ = 0;
 
     auto self(shared_from_this());
-    async_write(socket_, boost::asio::buffer(*writebuf), strand_.wrap([this, self, writebuf](const boost::system::error_code &ec, size_t len) {
+    async_write(socket_, buffers, strand_.wrap([this, self, writing](const boost::system::error_code &ec, size_t len) {
         flush_pending_ = false;
+        bytes_written_ += len;
+        ++writes_;
         if (ec) {
             HandleError(ec);
             return;
         }
 
-        Flush(); // maybe some more data arrived
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto &chunk : *writing) {
+            if (chunk.received != std::chrono::steady_clock::time_point()) {
+                stats::Record(stats::Latency::WRITTEN, now - chunk.received);
+            }
+        }
+
+        ScheduleFlush(); // maybe some more data arrived
     }));
 }
 
@@ -76,7 +264,12 @@ void SocketOutput::HandleError(const boost::system::error_code &ec) {
 }
 
 void SocketOutput::Close() {
+    if (socket_.is_open() && dropped_chunks_ > 0) {
+        std::cerr << peer_ << ": " << dropped_chunks_ << " output chunks (" << dropped_bytes_ << " bytes) were dropped on this connection" << std::endl;
+    }
+
     socket_.close();
+    coalesce_timer_.cancel();
     if (close_notifier_) {
         close_notifier_();
     }
@@ -90,25 +283,56 @@ void RawOutput::Start() {
         Write(header_);
 }
 
-void RawOutput::InternalWrite(SharedMessageVector messages) {
-    for (const auto &message : *messages) {
-        Buf() << message << '\n';
-    }
+static EncodingCache raw_cache([](const MessageVector &messages, std::string &out) { EncodeRawLines(messages, out); });
+static EncodingCache raw_latency_cache([](const MessageVector &messages, std::string &out) { EncodeRawLines(messages, out, true); });
+
+SharedBuffer RawOutput::Encode(const SharedMessageVector &messages) { return (latency_ ? raw_latency_cache : raw_cache).Encode(messages); }
+
+//////////////
+
+void BinaryOutput::Start() {
+    SocketOutput::Start();
+    if (header_)
+        Write(header_);
 }
 
+static EncodingCache binary_cache([](const MessageVector &messages, std::string &out) { EncodeBinaryFrames(messages, out); });
+
+SharedBuffer BinaryOutput::Encode(const SharedMessageVector &messages) { return binary_cache.Encode(messages); }
+
 //////////////
 
-void JsonOutput::InternalWrite(SharedMessageVector messages) {
-    for (const auto &message : *messages) {
-        if (message.Type() == MessageType::DOWNLINK_SHORT || message.Type() == MessageType::DOWNLINK_LONG) {
-            Buf() << AdsbMessage(message).ToJson() << '\n';
-        }
+static EncodingCache json_cache([](const MessageVector &messages, std::string &out) {
+    for (const auto &message : messages.DecodedDownlink()) {
+        message.EncodeJson(out);
+        out += '\n';
     }
+});
+
+SharedBuffer JsonOutput::Encode(const SharedMessageVector &messages) { return json_cache.Encode(messages); }
+
+//////////////
+
+#ifdef DUMP978_BEAST
+static EncodingCache beast_cache([](const MessageVector &messages, std::string &out) { EncodeBeastFrames(messages, out); });
+
+SharedBuffer BeastOutput::Encode(const SharedMessageVector &messages) { return beast_cache.Encode(messages); }
+#endif
+
+//////////////
+
+void NexradOutput::Start() {
+    SocketOutput::Start();
+    auto snapshot = cache_->Snapshot();
+    if (!snapshot->empty())
+        WriteBuffer(snapshot);
 }
 
+SharedBuffer NexradOutput::Encode(const SharedMessageVector &messages) { return cache_->Update(messages); }
+
 //////////////
 
-SocketListener::SocketListener(asio::io_service &service, const tcp::endpoint &endpoint, MessageDispatch &dispatch, ConnectionFactory factory) : service_(service), acceptor_(service), endpoint_(endpoint), socket_(service), dispatch_(dispatch), factory_(factory) {}
+SocketListener::SocketListener(asio::io_service &service, const tcp::endpoint &endpoint, MessageDispatch &dispatch, ConnectionFactory factory, IoServicePool::Pointer pool, const MessageFilter &filter) : service_(service), acceptor_(service), endpoint_(endpoint), dispatch_(dispatch), factory_(factory), pool_(pool), filter_(filter) {}
 
 void SocketListener::Start() {
     acceptor_.open(endpoint_.protocol());
@@ -126,19 +350,26 @@ void SocketListener::Start() {
 
 void SocketListener::Close() {
     acceptor_.cancel();
-    socket_.close();
+    if (socket_) {
+        socket_->close();
+    }
 }
 
 void SocketListener::Accept() {
     auto self(shared_from_this());
 
-    acceptor_.async_accept(socket_, peer_, [this, self](const boost::system::error_code &ec) {
+    // accept directly onto the io_service that will run the new connection
+    auto *connection_service = (pool_ ? &pool_->Next() : &service_);
+    socket_.reset(new tcp::socket(*connection_service));
+
+    acceptor_.async_accept(*socket_, peer_, [this, self, connection_service](const boost::system::error_code &ec) {
         if (!ec) {
             std::cerr << endpoint_ << ": accepted a connection from " << peer_ << std::endl;
-            auto new_output = factory_(service_, std::move(socket_));
+            auto new_output = factory_(*connection_service, std::move(*socket_));
             if (new_output) {
-                auto handle = dispatch_.AddClient(std::bind(&SocketOutput::Write, new_output, std::placeholders::_1));
+                auto handle = dispatch_.AddClient(std::bind(&SocketOutput::Write, new_output, std::placeholders::_1), filter_);
                 new_output->SetCloseNotifier([this, self, handle] { dispatch_.RemoveClient(handle); });
+                new_output->SetFilterNotifier([this, self, handle](const MessageFilter &filter) { dispatch_.SetClientFilter(handle, filter); });
                 new_output->Start();
             }
         } else {
@@ -7,17 +7,72 @@
 #ifndef SOCKET_OUTPUT_H
 #define SOCKET_OUTPUT_H
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <memory>
-#include <sstream>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/strand.hpp>
 
+#include "io_pool.h"
 #include "message_dispatch.h"
+#include "message_filter.h"
+#include "nexrad.h"
+#include "stats.h"
 #include "uat_message.h"
 
 namespace airnav::uat {
+    // An encoded, immutable chunk of output, shared between connections
+    typedef std::shared_ptr<const std::string> SharedBuffer;
+
+    // Remembers the encodings of the most recently seen message vectors, so
+    // that each vector is encoded once per output format no matter how many
+    // connections it is sent to.
+    class EncodingCache {
+      public:
+        typedef std::function<void(const MessageVector &, std::string &)> Encoder;
+
+        explicit EncodingCache(Encoder encoder) : encoder_(encoder) {}
+
+        SharedBuffer Encode(const SharedMessageVector &messages);
+
+      private:
+        struct Entry {
+            SharedMessageVector messages;
+            SharedBuffer encoded;
+        };
+
+        Encoder encoder_;
+        std::mutex mutex_;
+        std::array<Entry, 4> entries_;
+        std::size_t next_entry_ = 0;
+    };
+
+    // Limits on how much output may be queued for one connection that is not
+    // keeping up, and what to do when they are exceeded
+    struct OutputQueueLimits {
+        enum class Policy { DROP_OLDEST, DROP_NEWEST, DISCONNECT };
+
+        std::size_t max_bytes = 4 * 1024 * 1024;                                // queued bytes not yet handed to the socket
+        std::chrono::steady_clock::duration max_age = std::chrono::seconds(30); // age of the oldest queued chunk
+        Policy policy = Policy::DROP_OLDEST;
+
+        // Write coalescing: when `coalesce_time` is nonzero, output is held
+        // for up to that long, or until `coalesce_bytes` are queued, and
+        // then sent with a single gathered write. This trades a bounded
+        // delay for far fewer syscalls per client on a busy hub.
+        std::chrono::steady_clock::duration coalesce_time = std::chrono::steady_clock::duration::zero();
+        std::size_t coalesce_bytes = 16384;
+    };
+
     class SocketOutput : public std::enable_shared_from_this<SocketOutput> {
       public:
         typedef std::shared_ptr<SocketOutput> Pointer;
@@ -28,42 +83,105 @@ namespace airnav::uat {
 
         void SetCloseNotifier(std::function<void()> notifier) { close_notifier_ = notifier; }
 
+        // Called (on the connection's strand) when the client sends a
+        // "filter <spec>" line (see MessageFilter) to change what it receives
+        void SetFilterNotifier(std::function<void(const MessageFilter &)> notifier) { filter_notifier_ = notifier; }
+
         bool IsOpen() const { return socket_.is_open(); }
 
+        // Output discarded because the connection's queue was over its limits
+        std::uint64_t DroppedChunks() const { return dropped_chunks_; }
+        std::uint64_t DroppedBytes() const { return dropped_bytes_; }
+
+        // Output handed to the socket, and the number of writes it took
+        std::uint64_t BytesWritten() const { return bytes_written_; }
+        std::uint64_t Writes() const { return writes_; }
+
+        // A stats::Collector that reports bytes written and dropped for
+        // every open connection
+        static void CollectStats(std::vector<stats::Metric> &metrics);
+
       protected:
-        SocketOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_);
-        std::ostringstream &Buf() { return outbuf_; }
+        SocketOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_, const OutputQueueLimits &limits);
+
+        // Return the encoded form of `messages` for this output, or an
+        // empty pointer / empty buffer if there is nothing to send.
+        // Called on the dispatching thread.
+        virtual SharedBuffer Encode(const SharedMessageVector &messages) = 0;
 
-        virtual void InternalWrite(SharedMessageVector messages) = 0;
+        // Queue already-encoded output, outside the normal flow of messages
+        void WriteBuffer(SharedBuffer buffer, std::chrono::steady_clock::time_point received = {});
 
       private:
+        struct QueuedChunk {
+            SharedBuffer buffer;
+            std::chrono::steady_clock::time_point queued;
+            std::chrono::steady_clock::time_point received; // MessageTiming::received of the encoded messages
+        };
+
         void HandleError(const boost::system::error_code &ec);
+        void Enqueue(SharedBuffer buffer, std::chrono::steady_clock::time_point received);
+        void Drop(const SharedBuffer &buffer);
         void Flush();
-        void ReadAndDiscard();
+        void ScheduleFlush();
+        void ReadCommands();
+        void HandleCommand(const std::string &line);
 
         boost::asio::io_service &service_;
         boost::asio::io_service::strand strand_;
         boost::asio::ip::tcp::socket socket_;
+        boost::asio::ip::tcp::endpoint local_;
         boost::asio::ip::tcp::endpoint peer_;
 
-        std::ostringstream outbuf_;
+        OutputQueueLimits limits_;
+        std::deque<QueuedChunk> pending_; // chunks waiting for the current write to complete
+        std::size_t pending_bytes_;
         bool flush_pending_;
+        boost::asio::steady_timer coalesce_timer_;
+        bool coalesce_timer_pending_ = false;
+
+        std::atomic<std::uint64_t> dropped_chunks_;
+        std::atomic<std::uint64_t> dropped_bytes_;
+        std::atomic<std::uint64_t> bytes_written_;
+        std::atomic<std::uint64_t> writes_;
 
         std::function<void()> close_notifier_;
+        std::function<void(const MessageFilter &)> filter_notifier_;
+        std::string command_; // client input up to the next newline
     };
 
     class RawOutput : public SocketOutput {
       public:
         // factory method, this class must always be constructed via make_shared
-        static Pointer Create(boost::asio::io_service &service, boost::asio::ip::tcp::socket &&socket, SharedMessageVector header) { return Pointer(new RawOutput(service, std::move(socket), header)); }
+        // If `latency` is set, lines carry a lat= field (see EncodeRawLines)
+        static Pointer Create(boost::asio::io_service &service, boost::asio::ip::tcp::socket &&socket, const OutputQueueLimits &limits, SharedMessageVector header, bool latency = false) { return Pointer(new RawOutput(service, std::move(socket), limits, header, latency)); }
 
         void Start() override;
 
       protected:
-        void InternalWrite(SharedMessageVector messages) override;
+        SharedBuffer Encode(const SharedMessageVector &messages) override;
 
       private:
-        RawOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_, SharedMessageVector header) : SocketOutput(service_, std::move(socket_)) { header_ = header; }
+        RawOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_, const OutputQueueLimits &limits, SharedMessageVector header, bool latency) : SocketOutput(service_, std::move(socket_), limits), header_(header), latency_(latency) {}
+
+        SharedMessageVector header_;
+        bool latency_;
+    };
+
+    // Sends messages as binary frames (see EncodeBinary), starting with
+    // the metadata header if there is one
+    class BinaryOutput : public SocketOutput {
+      public:
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, boost::asio::ip::tcp::socket &&socket, const OutputQueueLimits &limits, SharedMessageVector header) { return Pointer(new BinaryOutput(service, std::move(socket), limits, header)); }
+
+        void Start() override;
+
+      protected:
+        SharedBuffer Encode(const SharedMessageVector &messages) override;
+
+      private:
+        BinaryOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_, const OutputQueueLimits &limits, SharedMessageVector header) : SocketOutput(service_, std::move(socket_), limits), header_(header) {}
 
         SharedMessageVector header_;
     };
@@ -71,13 +189,49 @@ namespace airnav::uat {
     class JsonOutput : public SocketOutput {
       public:
         // factory method, this class must always be constructed via make_shared
-        static Pointer Create(boost::asio::io_service &service, boost::asio::ip::tcp::socket &&socket) { return Pointer(new JsonOutput(service, std::move(socket))); }
+        static Pointer Create(boost::asio::io_service &service, boost::asio::ip::tcp::socket &&socket, const OutputQueueLimits &limits) { return Pointer(new JsonOutput(service, std::move(socket), limits)); }
+
+      protected:
+        SharedBuffer Encode(const SharedMessageVector &messages) override;
+
+      private:
+        JsonOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_, const OutputQueueLimits &limits) : SocketOutput(service_, std::move(socket_), limits) {}
+    };
+
+#ifdef DUMP978_BEAST
+    // Sends downlinks converted to 1090ES (DF 18) frames in Beast binary
+    // form (see ConvertToEs), for ADS-B 1090 decoders and aggregators.
+    // Only in builds made with `make BEAST=yes`.
+    class BeastOutput : public SocketOutput {
+      public:
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, boost::asio::ip::tcp::socket &&socket, const OutputQueueLimits &limits) { return Pointer(new BeastOutput(service, std::move(socket), limits)); }
 
       protected:
-        void InternalWrite(SharedMessageVector messages) override;
+        SharedBuffer Encode(const SharedMessageVector &messages) override;
 
       private:
-        JsonOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_) : SocketOutput(service_, std::move(socket_)) {}
+        BeastOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_, const OutputQueueLimits &limits) : SocketOutput(service_, std::move(socket_), limits) {}
+    };
+#endif
+
+    // Sends NEXRAD blocks from a NexradCache, one line per block as
+    // NexradBlock::Format writes them: every block the cache holds when the
+    // connection starts, then each block as it changes.
+    class NexradOutput : public SocketOutput {
+      public:
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, boost::asio::ip::tcp::socket &&socket, const OutputQueueLimits &limits, NexradCache::Pointer cache) { return Pointer(new NexradOutput(service, std::move(socket), limits, cache)); }
+
+        void Start() override;
+
+      protected:
+        SharedBuffer Encode(const SharedMessageVector &messages) override;
+
+      private:
+        NexradOutput(boost::asio::io_service &service_, boost::asio::ip::tcp::socket &&socket_, const OutputQueueLimits &limits, NexradCache::Pointer cache) : SocketOutput(service_, std::move(socket_), limits), cache_(cache) {}
+
+        NexradCache::Pointer cache_;
     };
 
     class SocketListener : public std::enable_shared_from_this<SocketListener> {
@@ -86,23 +240,28 @@ namespace airnav::uat {
         typedef std::function<SocketOutput::Pointer(boost::asio::io_service &, boost::asio::ip::tcp::socket &&)> ConnectionFactory;
 
         // factory method, this class must always be constructed via make_shared
-        static Pointer Create(boost::asio::io_service &service, const boost::asio::ip::tcp::endpoint &endpoint, MessageDispatch &dispatch, ConnectionFactory factory) { return Pointer(new SocketListener(service, endpoint, dispatch, factory)); }
+        // If `pool` is given, each accepted connection is run on the next of
+        // its io_services in turn, rather than on `service`. Connections
+        // start with `filter`, until they send a filter command of their own.
+        static Pointer Create(boost::asio::io_service &service, const boost::asio::ip::tcp::endpoint &endpoint, MessageDispatch &dispatch, ConnectionFactory factory, IoServicePool::Pointer pool = nullptr, const MessageFilter &filter = MessageFilter()) { return Pointer(new SocketListener(service, endpoint, dispatch, factory, pool, filter)); }
 
         void Start();
         void Close();
 
       private:
-        SocketListener(boost::asio::io_service &service, const boost::asio::ip::tcp::endpoint &endpoint, MessageDispatch &dispatch, ConnectionFactory factory);
+        SocketListener(boost::asio::io_service &service, const boost::asio::ip::tcp::endpoint &endpoint, MessageDispatch &dispatch, ConnectionFactory factory, IoServicePool::Pointer pool, const MessageFilter &filter);
 
         void Accept();
 
         boost::asio::io_service &service_;
         boost::asio::ip::tcp::acceptor acceptor_;
         boost::asio::ip::tcp::endpoint endpoint_;
-        boost::asio::ip::tcp::socket socket_;
+        std::unique_ptr<boost::asio::ip::tcp::socket> socket_; // the connection being accepted
         boost::asio::ip::tcp::endpoint peer_;
         MessageDispatch &dispatch_;
         ConnectionFactory factory_;
+        IoServicePool::Pointer pool_;
+        MessageFilter filter_;
     };
 }; // namespace airnav::uat
 
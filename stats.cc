@@ -0,0 +1,363 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+#include <json.hpp>
+
+using namespace airnav::uat::stats;
+
+namespace {
+    const unsigned NUM_COUNTERS = static_cast<unsigned>(Counter::COUNT);
+    const unsigned NUM_STAGES = static_cast<unsigned>(Stage::COUNT);
+    const unsigned NUM_LATENCIES = static_cast<unsigned>(Latency::COUNT);
+
+    // One thread's counters. Only the owning thread writes to them, so
+    // updates are a relaxed load and store rather than a locked add; the
+    // atomics just make concurrent reads by Collect() well-defined.
+    struct Histogram {
+        Histogram() {
+            count = 0;
+            nanoseconds = 0;
+            for (auto &b : buckets)
+                b = 0;
+        }
+
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> nanoseconds;
+        std::array<std::atomic<std::uint64_t>, HISTOGRAM_BUCKETS> buckets;
+    };
+
+    struct Shard {
+        Shard() {
+            for (auto &c : counters)
+                c = 0;
+        }
+
+        std::array<std::atomic<std::uint64_t>, NUM_COUNTERS> counters;
+        std::array<Histogram, NUM_STAGES> stages;
+        std::array<Histogram, NUM_LATENCIES> latencies;
+    };
+
+    inline void Bump(std::atomic<std::uint64_t> &value, std::uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+    void AddHistogram(Histogram &into, const Histogram &from) {
+        Bump(into.count, from.count.load(std::memory_order_relaxed));
+        Bump(into.nanoseconds, from.nanoseconds.load(std::memory_order_relaxed));
+        for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b)
+            Bump(into.buckets[b], from.buckets[b].load(std::memory_order_relaxed));
+    }
+
+    void RecordHistogram(Histogram &histogram, std::chrono::steady_clock::duration elapsed) {
+        const std::uint64_t ns = std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+        unsigned bucket = 0;
+        for (std::uint64_t bound = 1000; bucket + 1 < HISTOGRAM_BUCKETS && ns > bound; bound <<= 1) {
+            ++bucket;
+        }
+
+        Bump(histogram.count, 1);
+        Bump(histogram.nanoseconds, ns);
+        Bump(histogram.buckets[bucket], 1);
+    }
+
+    void SnapshotHistogram(HistogramSnapshot &into, const Histogram &from) {
+        into.count = from.count;
+        into.seconds = from.nanoseconds / 1e9;
+        for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b)
+            into.buckets[b] = from.buckets[b];
+    }
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Shard *> live; // shards of running threads
+        Shard retired;             // totals from threads that have exited
+
+        std::map<CollectorHandle, Collector> collectors;
+        CollectorHandle next_handle = 0;
+    };
+
+    // Never destroyed, so that threads that outlive main() can still update it
+    Registry &TheRegistry() {
+        static Registry *registry = new Registry();
+        return *registry;
+    }
+
+    void AddShard(Shard &into, const Shard &from) {
+        for (unsigned i = 0; i < NUM_COUNTERS; ++i)
+            Bump(into.counters[i], from.counters[i].load(std::memory_order_relaxed));
+        for (unsigned i = 0; i < NUM_STAGES; ++i)
+            AddHistogram(into.stages[i], from.stages[i]);
+        for (unsigned i = 0; i < NUM_LATENCIES; ++i)
+            AddHistogram(into.latencies[i], from.latencies[i]);
+    }
+
+    // Registers the calling thread's shard on first use, and folds it into
+    // the retired totals when the thread exits
+    class ThreadShard {
+      public:
+        ThreadShard() {
+            auto &registry = TheRegistry();
+            std::unique_lock<std::mutex> lock(registry.mutex);
+            registry.live.push_back(&shard_);
+        }
+
+        ~ThreadShard() {
+            auto &registry = TheRegistry();
+            std::unique_lock<std::mutex> lock(registry.mutex);
+            AddShard(registry.retired, shard_);
+            registry.live.erase(std::remove(registry.live.begin(), registry.live.end(), &shard_), registry.live.end());
+        }
+
+        Shard &Get() { return shard_; }
+
+      private:
+        Shard shard_;
+    };
+
+    Shard &LocalShard() {
+        thread_local ThreadShard shard;
+        return shard.Get();
+    }
+
+    struct CounterInfo {
+        const char *name;
+        const char *help;
+    };
+
+    // indexed by Counter
+    const CounterInfo counter_info[NUM_COUNTERS] = {
+        {"samples", "Samples handed to a receiver"},
+        {"samples_skipped", "Samples not demodulated because the energy gate did not pass them"},
+        {"sdr_overruns", "SDR reads that reported lost sample data"},
+        {"sdr_dropped_blocks", "SDR reads discarded because the receiver had fallen behind"},
+        {"sync_candidates", "Sync word matches that were demodulated"},
+        {"downlink_fec_attempts", "Downlink frames given to error correction"},
+        {"downlink_fec_successes", "Downlink frames successfully error-corrected"},
+        {"uplink_fec_attempts", "Uplink frames given to error correction"},
+        {"uplink_fec_successes", "Uplink frames successfully error-corrected"},
+        {"downlink_messages", "Downlink messages delivered by a receiver"},
+        {"uplink_messages", "Uplink messages delivered by a receiver"},
+        {"corrected_errors", "Errors corrected in delivered messages"},
+        {"soft_retries", "Soft-decision error correction retries (least confident bytes as erasures)"},
+        {"soft_successes", "Frames corrected by a soft-decision retry after hard decisions failed"},
+        {"soft_retries_skipped", "Failed frames not retried with soft decisions because the CPU budget was spent"},
+        {"filtered_subsets", "Message subsets built once per distinct client filter"},
+    };
+
+    // indexed by Stage
+    const char *stage_names[NUM_STAGES] = {"convert", "demod", "fec", "dispatch"};
+
+    // indexed by Latency
+    const char *latency_names[NUM_LATENCIES] = {"demodulated", "dispatched", "written"};
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+}; // namespace
+
+void airnav::uat::stats::Add(Counter counter, std::uint64_t n) { Bump(LocalShard().counters[static_cast<unsigned>(counter)], n); }
+
+void airnav::uat::stats::Record(Stage stage, std::chrono::steady_clock::duration elapsed) { RecordHistogram(LocalShard().stages[static_cast<unsigned>(stage)], elapsed); }
+
+void airnav::uat::stats::Record(Latency point, std::chrono::steady_clock::duration age) { RecordHistogram(LocalShard().latencies[static_cast<unsigned>(point)], age); }
+
+double HistogramSnapshot::Quantile(double q) const {
+    if (count == 0)
+        return 0;
+
+    const double target = q * count;
+    double cumulative = 0;
+    for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        const double lower = (b == 0 ? 0 : BucketBound(b - 1));
+        if (b + 1 == HISTOGRAM_BUCKETS)
+            return lower; // no upper bound to interpolate towards
+        if (buckets[b] > 0 && cumulative + buckets[b] >= target)
+            return lower + (BucketBound(b) - lower) * (target - cumulative) / buckets[b];
+        cumulative += buckets[b];
+    }
+
+    return 0; // not reached
+}
+
+CollectorHandle airnav::uat::stats::AddCollector(Collector collector) {
+    auto &registry = TheRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    auto handle = registry.next_handle++;
+    registry.collectors[handle] = std::move(collector);
+    return handle;
+}
+
+void airnav::uat::stats::RemoveCollector(CollectorHandle handle) {
+    auto &registry = TheRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    registry.collectors.erase(handle);
+}
+
+Snapshot airnav::uat::stats::Collect() {
+    auto &registry = TheRegistry();
+
+    Shard total;
+    std::vector<Collector> collectors;
+    {
+        std::unique_lock<std::mutex> lock(registry.mutex);
+        AddShard(total, registry.retired);
+        for (auto shard : registry.live)
+            AddShard(total, *shard);
+        for (const auto &i : registry.collectors)
+            collectors.push_back(i.second);
+    }
+
+    Snapshot snapshot;
+    for (unsigned i = 0; i < NUM_COUNTERS; ++i)
+        snapshot.counters[i] = total.counters[i];
+    for (unsigned i = 0; i < NUM_STAGES; ++i)
+        SnapshotHistogram(snapshot.stages[i], total.stages[i]);
+    for (unsigned i = 0; i < NUM_LATENCIES; ++i)
+        SnapshotHistogram(snapshot.latencies[i], total.latencies[i]);
+
+    // collectors may be slow or take their own locks, so call them without the registry lock
+    for (const auto &collector : collectors)
+        collector(snapshot.metrics);
+
+    std::stable_sort(snapshot.metrics.begin(), snapshot.metrics.end(), [](const Metric &a, const Metric &b) { return a.name < b.name; });
+    return snapshot;
+}
+
+const char *airnav::uat::stats::CounterName(Counter counter) { return counter_info[static_cast<unsigned>(counter)].name; }
+
+const char *airnav::uat::stats::StageName(Stage stage) { return stage_names[static_cast<unsigned>(stage)]; }
+
+const char *airnav::uat::stats::LatencyName(Latency point) { return latency_names[static_cast<unsigned>(point)]; }
+
+double airnav::uat::stats::BucketBound(unsigned bucket) { return 1e-6 * (1ULL << bucket); }
+
+static std::string EscapeLabel(const std::string &value) {
+    std::string escaped;
+    for (auto ch : value) {
+        if (ch == '\\' || ch == '"')
+            escaped += '\\';
+        if (ch == '\n')
+            escaped += "\\n";
+        else
+            escaped += ch;
+    }
+    return escaped;
+}
+
+static void FormatLabels(std::ostream &os, const std::map<std::string, std::string> &labels) {
+    if (labels.empty())
+        return;
+
+    os << '{';
+    bool first = true;
+    for (const auto &label : labels) {
+        os << (first ? "" : ",") << label.first << "=\"" << EscapeLabel(label.second) << '"';
+        first = false;
+    }
+    os << '}';
+}
+
+static void FormatHistogram(std::ostream &os, const char *name, const char *label, const char *value, const HistogramSnapshot &histogram) {
+    std::uint64_t cumulative = 0;
+    for (unsigned b = 0; b + 1 < HISTOGRAM_BUCKETS; ++b) {
+        cumulative += histogram.buckets[b];
+        os << name << "_bucket{" << label << "=\"" << value << "\",le=\"" << BucketBound(b) << "\"} " << cumulative << "\n";
+    }
+    os << name << "_bucket{" << label << "=\"" << value << "\",le=\"+Inf\"} " << histogram.count << "\n";
+    os << name << "_sum{" << label << "=\"" << value << "\"} " << histogram.seconds << "\n";
+    os << name << "_count{" << label << "=\"" << value << "\"} " << histogram.count << "\n";
+}
+
+std::string airnav::uat::stats::FormatPrometheus(const Snapshot &snapshot) {
+    std::ostringstream os;
+    os << std::setprecision(15);
+
+    for (unsigned i = 0; i < NUM_COUNTERS; ++i) {
+        const auto &info = counter_info[i];
+        os << "# HELP dump978_" << info.name << "_total " << info.help << "\n";
+        os << "# TYPE dump978_" << info.name << "_total counter\n";
+        os << "dump978_" << info.name << "_total " << snapshot.counters[i] << "\n";
+    }
+
+    os << "# HELP dump978_stage_seconds Time spent in each processing stage\n";
+    os << "# TYPE dump978_stage_seconds histogram\n";
+    for (unsigned i = 0; i < NUM_STAGES; ++i)
+        FormatHistogram(os, "dump978_stage_seconds", "stage", stage_names[i], snapshot.stages[i]);
+
+    os << "# HELP dump978_message_latency_seconds Time from sample delivery to each point in the message pipeline\n";
+    os << "# TYPE dump978_message_latency_seconds histogram\n";
+    for (unsigned i = 0; i < NUM_LATENCIES; ++i)
+        FormatHistogram(os, "dump978_message_latency_seconds", "point", latency_names[i], snapshot.latencies[i]);
+
+    os << "# HELP dump978_message_latency_quantile_seconds Estimated message latency quantiles since startup\n";
+    os << "# TYPE dump978_message_latency_quantile_seconds gauge\n";
+    for (unsigned i = 0; i < NUM_LATENCIES; ++i) {
+        for (auto q : quantiles)
+            os << "dump978_message_latency_quantile_seconds{point=\"" << latency_names[i] << "\",quantile=\"" << q << "\"} " << snapshot.latencies[i].Quantile(q) << "\n";
+    }
+
+    // metrics are sorted by name, so each name's TYPE line comes once before its samples
+    const std::string *previous = nullptr;
+    for (const auto &metric : snapshot.metrics) {
+        if (!previous || *previous != metric.name) {
+            os << "# TYPE dump978_" << metric.name << ' ' << (metric.counter ? "counter" : "gauge") << "\n";
+            previous = &metric.name;
+        }
+        os << "dump978_" << metric.name;
+        FormatLabels(os, metric.labels);
+        os << ' ' << metric.value << "\n";
+    }
+
+    return os.str();
+}
+
+static nlohmann::json HistogramJson(const HistogramSnapshot &histogram) {
+    nlohmann::json o;
+    o["count"] = histogram.count;
+    o["seconds"] = histogram.seconds;
+    o["buckets"] = histogram.buckets; // one more than bucket_bounds: the last is unbounded
+    return o;
+}
+
+std::string airnav::uat::stats::FormatJson(const Snapshot &snapshot) {
+    nlohmann::json o;
+
+    auto &counters = o["counters"] = nlohmann::json::object();
+    for (unsigned i = 0; i < NUM_COUNTERS; ++i)
+        counters[counter_info[i].name] = snapshot.counters[i];
+
+    auto &bounds = o["bucket_bounds"] = nlohmann::json::array();
+    for (unsigned b = 0; b + 1 < HISTOGRAM_BUCKETS; ++b)
+        bounds.push_back(BucketBound(b));
+
+    auto &stages = o["stages"] = nlohmann::json::object();
+    for (unsigned i = 0; i < NUM_STAGES; ++i)
+        stages[stage_names[i]] = HistogramJson(snapshot.stages[i]);
+
+    auto &latency = o["latency"] = nlohmann::json::object();
+    for (unsigned i = 0; i < NUM_LATENCIES; ++i) {
+        auto l = HistogramJson(snapshot.latencies[i]);
+        l["p50"] = snapshot.latencies[i].Quantile(0.5);
+        l["p90"] = snapshot.latencies[i].Quantile(0.9);
+        l["p99"] = snapshot.latencies[i].Quantile(0.99);
+        l["p999"] = snapshot.latencies[i].Quantile(0.999);
+        latency[latency_names[i]] = std::move(l);
+    }
+
+    auto &metrics = o["metrics"] = nlohmann::json::array();
+    for (const auto &metric : snapshot.metrics) {
+        nlohmann::json m;
+        m["name"] = metric.name;
+        m["value"] = metric.value;
+        if (!metric.labels.empty())
+            m["labels"] = metric.labels;
+        metrics.push_back(std::move(m));
+    }
+
+    return o.dump();
+}
@@ -0,0 +1,136 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_STATS_H
+#define DUMP978_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace airnav::uat::stats {
+    // Hot-path event counters
+    enum class Counter : unsigned {
+        SAMPLES,                // samples handed to a receiver
+        SAMPLES_SKIPPED,        // samples the energy gate did not pass on
+        SDR_OVERRUNS,           // SDR reads that reported lost samples
+        SDR_DROPPED_BLOCKS,     // SDR reads discarded because the receiver was behind
+        SYNC_CANDIDATES,        // sync word matches that were demodulated
+        DOWNLINK_FEC_ATTEMPTS,  // downlink frames given to error correction
+        DOWNLINK_FEC_SUCCESSES, // ... that were corrected
+        UPLINK_FEC_ATTEMPTS,    // uplink frames given to error correction
+        UPLINK_FEC_SUCCESSES,   // ... that were corrected
+        DOWNLINK_MESSAGES,      // downlink messages delivered by a receiver
+        UPLINK_MESSAGES,        // uplink messages delivered by a receiver
+        CORRECTED_ERRORS,       // errors corrected in delivered messages
+        SOFT_RETRIES,           // soft-decision FEC retries made
+        SOFT_SUCCESSES,         // ... that corrected a frame hard decisions could not
+        SOFT_RETRIES_SKIPPED,   // frames not retried because the CPU budget was spent
+        FILTERED_SUBSETS,       // per-filter message subsets built by MessageDispatch
+        COUNT
+    };
+
+    // Stages whose running time is measured
+    enum class Stage : unsigned {
+        CONVERT,  // energy gate and phase conversion, per block
+        DEMOD,    // demodulation including FEC, per block
+        FEC,      // one error correction attempt
+        DISPATCH, // delivery of one message vector to all clients
+        COUNT
+    };
+
+    // Points at which the age of a message vector (time since its samples
+    // were delivered by the sample source) is measured
+    enum class Latency : unsigned {
+        DEMODULATED, // the receiver has demodulated it
+        DISPATCHED,  // it is being handed to the output clients
+        WRITTEN,     // a socket write containing it has completed (once per client)
+        COUNT
+    };
+
+    // Histograms have power-of-two buckets from 1us up
+    const unsigned HISTOGRAM_BUCKETS = 24;
+
+    // Add to a counter. Each thread updates its own copy, so this is a
+    // plain (unlocked) add; copies are summed whenever stats are read.
+    void Add(Counter counter, std::uint64_t n = 1);
+
+    // Record one run of a stage that took `elapsed`
+    void Record(Stage stage, std::chrono::steady_clock::duration elapsed);
+
+    // Record the age of a message vector at `point`
+    void Record(Latency point, std::chrono::steady_clock::duration age);
+
+    // Records the time from construction to destruction as one run of a stage
+    class StageTimer {
+      public:
+        explicit StageTimer(Stage stage) : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+        ~StageTimer() { Record(stage_, std::chrono::steady_clock::now() - start_); }
+
+        StageTimer(const StageTimer &) = delete;
+        StageTimer &operator=(const StageTimer &) = delete;
+
+      private:
+        Stage stage_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // A value provided by a collector: a gauge, or a counter that the
+    // collector keeps itself (e.g. per-client bytes written)
+    struct Metric {
+        std::string name; // without the "dump978_" prefix
+        std::map<std::string, std::string> labels;
+        double value;
+        bool counter;
+    };
+
+    typedef std::function<void(std::vector<Metric> &)> Collector;
+    typedef unsigned CollectorHandle;
+
+    // Register something that appends its current metrics whenever stats
+    // are read. Collectors are called on the thread that reads the stats.
+    CollectorHandle AddCollector(Collector collector);
+    void RemoveCollector(CollectorHandle handle);
+
+    struct HistogramSnapshot {
+        std::uint64_t count = 0;
+        double seconds = 0;
+        std::array<std::uint64_t, HISTOGRAM_BUCKETS> buckets{}; // not cumulative
+
+        // Estimate the `q` quantile (0..1) in seconds, interpolating within buckets
+        double Quantile(double q) const;
+    };
+
+    // Everything, summed over all threads (including threads that have exited)
+    struct Snapshot {
+        std::array<std::uint64_t, static_cast<unsigned>(Counter::COUNT)> counters{};
+        std::array<HistogramSnapshot, static_cast<unsigned>(Stage::COUNT)> stages;
+        std::array<HistogramSnapshot, static_cast<unsigned>(Latency::COUNT)> latencies;
+        std::vector<Metric> metrics;
+    };
+
+    Snapshot Collect();
+
+    // Prometheus text exposition format
+    std::string FormatPrometheus(const Snapshot &snapshot);
+
+    // A JSON object
+    std::string FormatJson(const Snapshot &snapshot);
+
+    const char *CounterName(Counter counter);
+    const char *StageName(Stage stage);
+    const char *LatencyName(Latency point);
+
+    // Upper bound of histogram bucket `bucket` in seconds; the last bucket has no upper bound
+    double BucketBound(unsigned bucket);
+}; // namespace airnav::uat::stats
+
+#endif
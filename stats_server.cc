@@ -0,0 +1,157 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "stats_server.h"
+
+#include <iostream>
+#include <sstream>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ip/v6_only.hpp>
+
+#include "stats.h"
+
+namespace asio = boost::asio;
+using boost::asio::ip::tcp;
+
+using namespace airnav::uat;
+
+namespace airnav::uat {
+    // One HTTP request / response on an accepted connection
+    class StatsConnection : public std::enable_shared_from_this<StatsConnection> {
+      public:
+        StatsConnection(asio::io_service &service, tcp::socket &&socket, std::shared_ptr<const StatsServer> server) : socket_(std::move(socket)), timer_(service), request_(MAX_REQUEST_BYTES), server_(server) {}
+
+        void Start() {
+            auto self(shared_from_this());
+
+            // don't let an idle client hold the connection open forever
+            timer_.expires_from_now(std::chrono::seconds(10));
+            timer_.async_wait([this, self](const boost::system::error_code &ec) {
+                if (!ec) {
+                    socket_.close();
+                }
+            });
+
+            asio::async_read_until(socket_, request_, "\r\n\r\n", [this, self](const boost::system::error_code &ec, std::size_t) {
+                if (ec == asio::error::not_found) {
+                    // the buffer filled up before the end of the headers
+                    Reply("431 Request Header Fields Too Large", "text/plain", "request too large\n", true);
+                    return;
+                }
+                if (ec) {
+                    timer_.cancel();
+                    return;
+                }
+                Respond();
+            });
+        }
+
+      private:
+        // Requests are a request line and a few headers; don't buffer more
+        // than this from any client
+        static const std::size_t MAX_REQUEST_BYTES = 8192;
+
+        void Respond() {
+            std::istream is(&request_);
+            std::string method, target;
+            is >> method >> target;
+            target = target.substr(0, target.find('?'));
+
+            std::string status = "200 OK";
+            std::string content_type;
+            std::string body;
+            const StatsServer::Route *route = nullptr;
+            if (method != "GET" && method != "HEAD") {
+                status = "405 Method Not Allowed";
+                content_type = "text/plain";
+                body = "only GET is supported\n";
+            } else if ((route = server_->FindRoute(target))) {
+                content_type = route->content_type;
+                body = route->handler();
+            } else {
+                status = "404 Not Found";
+                content_type = "text/plain";
+                body = "try /metrics or /stats.json\n";
+            }
+
+            Reply(status, content_type, body, method != "HEAD");
+        }
+
+        void Reply(const std::string &status, const std::string &content_type, const std::string &body, bool send_body) {
+            std::ostringstream os;
+            os << "HTTP/1.0 " << status << "\r\n"
+               << "Content-Type: " << content_type << "\r\n"
+               << "Content-Length: " << body.size() << "\r\n"
+               << "Connection: close\r\n"
+               << "\r\n";
+            if (send_body) {
+                os << body;
+            }
+            response_ = os.str();
+
+            auto self(shared_from_this());
+            asio::async_write(socket_, asio::buffer(response_), [this, self](const boost::system::error_code &, std::size_t) {
+                timer_.cancel();
+                boost::system::error_code ignored;
+                socket_.shutdown(tcp::socket::shutdown_both, ignored);
+                socket_.close(ignored);
+            });
+        }
+
+        tcp::socket socket_;
+        asio::steady_timer timer_;
+        asio::streambuf request_;
+        std::string response_;
+        std::shared_ptr<const StatsServer> server_;
+    };
+}; // namespace airnav::uat
+
+StatsServer::StatsServer(asio::io_service &service, const tcp::endpoint &endpoint) : service_(service), acceptor_(service), endpoint_(endpoint), socket_(service) {
+    AddRoute("/metrics", "text/plain; version=0.0.4", [] { return stats::FormatPrometheus(stats::Collect()); });
+    Handler json = [] { return stats::FormatJson(stats::Collect()) + "\n"; };
+    AddRoute("/", "application/json", json);
+    AddRoute("/stats.json", "application/json", json);
+}
+
+void StatsServer::AddRoute(const std::string &path, const std::string &content_type, Handler handler) { routes_[path] = Route{content_type, handler}; }
+
+const StatsServer::Route *StatsServer::FindRoute(const std::string &path) const {
+    auto i = routes_.find(path);
+    return (i == routes_.end() ? nullptr : &i->second);
+}
+
+void StatsServer::Start() {
+    acceptor_.open(endpoint_.protocol());
+    acceptor_.set_option(tcp::acceptor::reuse_address(true));
+
+    // We are v6 aware and bind separately to v4 and v6 addresses
+    if (endpoint_.protocol() == tcp::v6())
+        acceptor_.set_option(asio::ip::v6_only(true));
+
+    acceptor_.bind(endpoint_);
+    acceptor_.listen();
+    Accept();
+}
+
+void StatsServer::Close() {
+    acceptor_.cancel();
+    socket_.close();
+}
+
+void StatsServer::Accept() {
+    auto self(shared_from_this());
+
+    acceptor_.async_accept(socket_, peer_, [this, self](const boost::system::error_code &ec) {
+        if (!ec) {
+            std::make_shared<StatsConnection>(service_, std::move(socket_), self)->Start();
+        } else {
+            if (ec == boost::system::errc::operation_canceled)
+                return;
+            std::cerr << endpoint_ << ": accept error: " << ec.message() << std::endl;
+        }
+
+        Accept();
+    });
+}
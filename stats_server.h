@@ -0,0 +1,64 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_STATS_SERVER_H
+#define DUMP978_STATS_SERVER_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+namespace airnav::uat {
+    // A minimal HTTP server for the stats in stats.h: GET /metrics returns
+    // the Prometheus text format, GET / or /stats.json returns JSON. Other
+    // documents can be added with AddRoute. Each connection handles one
+    // request and is then closed.
+    class StatsServer : public std::enable_shared_from_this<StatsServer> {
+      public:
+        typedef std::shared_ptr<StatsServer> Pointer;
+
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, const boost::asio::ip::tcp::endpoint &endpoint) { return Pointer(new StatsServer(service, endpoint)); }
+
+        // Produces the body of a document; called on the io_service thread
+        typedef std::function<std::string()> Handler;
+
+        // Serve the output of `handler` at `path`. Call this before Start.
+        void AddRoute(const std::string &path, const std::string &content_type, Handler handler);
+
+        void Start();
+        void Close();
+
+      private:
+        friend class StatsConnection;
+
+        struct Route {
+            std::string content_type;
+            Handler handler;
+        };
+
+        StatsServer(boost::asio::io_service &service, const boost::asio::ip::tcp::endpoint &endpoint);
+
+        void Accept();
+
+        // The route for `path`, or nullptr
+        const Route *FindRoute(const std::string &path) const;
+
+        std::map<std::string, Route> routes_;
+
+        boost::asio::io_service &service_;
+        boost::asio::ip::tcp::acceptor acceptor_;
+        boost::asio::ip::tcp::endpoint endpoint_;
+        boost::asio::ip::tcp::socket socket_;
+        boost::asio::ip::tcp::endpoint peer_;
+    };
+}; // namespace airnav::uat
+
+#endif
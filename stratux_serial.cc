@@ -8,8 +8,12 @@
 
 #include "stratux_serial.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
+#include <boost/asio/read.hpp>
+
 using namespace airnav::uat;
 
 //
@@ -26,14 +30,12 @@ using namespace airnav::uat;
 // tt tt tt tt   - timestamp, 32 bits, big-endian
 // pp pp pp ...  - payload, size as above, includes FEC data
 
-enum class StratuxSerial::ParserState {
-    PREAMBLE, // scanning for preamble sequence
-    LENGTH_1, // reading first length byte
-    LENGTH_2, // reading second length byte
-    MESSAGE   // reading rssi / timestamp / payload
-};
+static const std::array<std::uint8_t, 4> preamble = {0x0A, 0xB0, 0xCD, 0xE0};
+
+// preamble, length, rssi, timestamp
+static const std::size_t header_size = 11;
 
-StratuxSerial::StratuxSerial(boost::asio::io_service &io_service, const std::string &path) : io_service_(io_service), path_(path), port_(io_service), read_timer_(io_service), parser_state_(ParserState::PREAMBLE), preamble_index_(0) {}
+StratuxSerial::StratuxSerial(boost::asio::io_service &io_service, const std::string &path) : io_service_(io_service), path_(path), port_(io_service), buffer_(read_buffer_size), needed_(header_size) {}
 
 void StratuxSerial::Start() {
     try {
@@ -60,7 +62,6 @@ void StratuxSerial::Start() {
 }
 
 void StratuxSerial::Stop() {
-    read_timer_.cancel();
     if (port_.is_open()) {
         boost::system::error_code ignored;
         port_.close(ignored);
@@ -69,119 +70,91 @@ void StratuxSerial::Stop() {
 
 void StratuxSerial::StartReading() {
     auto self(shared_from_this());
-    std::shared_ptr<Bytes> buf;
 
-    buf.swap(readbuf_);
-    if (buf) {
-        buf->resize(read_buffer_size);
-    } else {
-        buf = std::make_shared<Bytes>(read_buffer_size);
-    }
+    // Complete only once there is enough to make progress: the rest of a
+    // partly-received frame, or else a frame header. A frame that arrives
+    // in several pieces is parsed once, as soon as its last byte arrives,
+    // rather than after a fixed delay.
+    const std::size_t space = buffer_.size() - buffered_;
+    const std::size_t wanted = std::max<std::size_t>(1, std::min(needed_, space));
 
-    port_.async_read_some(boost::asio::buffer(*buf), [this, self, buf](const boost::system::error_code &ec, std::size_t len) {
+    boost::asio::async_read(port_, boost::asio::buffer(buffer_.data() + buffered_, space), boost::asio::transfer_at_least(wanted), [this, self](const boost::system::error_code &ec, std::size_t len) {
         if (ec) {
-            readbuf_ = buf;
             HandleError(ec);
         } else {
-            buf->resize(len);
-            ParseInput(*buf);
-            readbuf_ = buf;
-
-            // If we didn't get a full-ish buffer, then wait a bit before the next read so we don't
-            // spin reading only a few bytes each time.
-
-            // (unfortunately, boost::asio's edge-triggered epoll still gets woken repeatedly each time a
-            // little more data arrives, but at least we don't have to do a bunch of work on every one of
-            // those)
-            if (len < read_buffer_size * 3 / 4) {
-                read_timer_.expires_from_now(read_interval);
-                read_timer_.async_wait([this, self](const boost::system::error_code &ec) {
-                    if (!ec) {
-                        StartReading();
-                    }
-                });
-            } else {
-                StartReading();
-            }
+            buffered_ += len;
+            ParseInput();
+            StartReading();
         }
     });
 }
 
-void StratuxSerial::ParseInput(const Bytes &buf) {
+void StratuxSerial::ParseInput() {
     SharedMessageVector messages;
-    static const std::array<std::uint8_t, 4> preamble = {0x0A, 0xB0, 0xCD, 0xE0};
 
     // 2000000Mbps, 8N1 = 200,000 bytes/s = 200 bytes/ms
     static auto unix_epoch = std::chrono::system_clock::from_time_t(0);
-    auto start_of_read = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - unix_epoch).count() - buf.size() / 200;
+    auto start_of_buffer = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - unix_epoch).count() - buffered_ / 200;
     std::uint64_t previous_sys_timestamp = 0;
     std::uint32_t previous_raw_timestamp = 0;
 
-    for (auto i = buf.begin(); i != buf.end();) {
-        switch (parser_state_) {
-        case ParserState::PREAMBLE:
-            if (*i == preamble[preamble_index_]) {
-                // remember the (system) time of the preamble start
-                if (preamble_index_ == 0) {
-                    message_start_timestamp_ = start_of_read + (std::distance(buf.begin(), i) / 200);
-                }
-                ++i;
-                if (++preamble_index_ >= preamble.size()) {
-                    parser_state_ = ParserState::LENGTH_1;
-                }
-            } else {
-                if (preamble_index_ > 0) {
-                    preamble_index_ = 0;
-                } else {
-                    ++i;
-                }
-            }
-            break;
+    const std::uint8_t *begin = buffer_.data();
+    const std::uint8_t *end = begin + buffered_;
+    const std::uint8_t *p = begin;
+    needed_ = header_size;
 
-        case ParserState::LENGTH_1:
-            message_length_ = *i++ + 5;
-            parser_state_ = ParserState::LENGTH_2;
+    while (p < end) {
+        // find the next preamble
+        p = static_cast<const std::uint8_t *>(std::memchr(p, preamble[0], end - p));
+        if (!p) {
+            p = end;
             break;
-
-        case ParserState::LENGTH_2:
-            message_length_ += (*i++ << 8);
-            message_.clear();
-            parser_state_ = ParserState::MESSAGE;
+        }
+        if (std::size_t(end - p) < header_size) {
+            needed_ = header_size - (end - p);
             break;
+        }
+        if (!std::equal(preamble.begin(), preamble.end(), p)) {
+            ++p;
+            continue;
+        }
 
-        case ParserState::MESSAGE: {
-            auto bytes_to_copy = std::min<std::size_t>(message_length_ - message_.size(), std::distance(i, buf.end()));
-            std::copy(i, i + bytes_to_copy, std::back_inserter(message_));
-            i += bytes_to_copy;
-
-            if (message_.size() == message_length_) {
-                // work out a suitable timestamp
-                std::uint32_t raw_timestamp = message_[1] | (message_[2] << 8) | (message_[3] << 16) | (message_[4] << 24);
-                std::uint64_t sys_timestamp;
-                if (previous_sys_timestamp != 0 && raw_timestamp > previous_raw_timestamp) {
-                    sys_timestamp = previous_sys_timestamp + (raw_timestamp - previous_raw_timestamp) / 4000;
-                } else {
-                    sys_timestamp = previous_sys_timestamp = message_start_timestamp_;
-                    previous_raw_timestamp = raw_timestamp;
-                }
-
-                auto parsed = ParseMessage(message_, sys_timestamp);
-                if (parsed) {
-                    if (!messages) {
-                        messages = std::make_shared<MessageVector>();
-                    }
-                    messages->push_back(std::move(*parsed));
-                }
-                message_.clear();
-                parser_state_ = ParserState::PREAMBLE;
-                preamble_index_ = 0;
-            }
+        const std::size_t payload_size = p[4] | (p[5] << 8);
+        if (payload_size != UPLINK_BYTES && payload_size != DOWNLINK_LONG_BYTES) {
+            // unexpected length, maybe a false preamble; resynchronize
+            ++p;
+            continue;
+        }
+        if (std::size_t(end - p) < header_size + payload_size) {
+            needed_ = header_size + payload_size - (end - p);
             break;
         }
 
-        default:
-            assert("impossible state" && false);
+        // work out a suitable timestamp
+        const std::uint64_t message_start_timestamp = start_of_buffer + (p - begin) / 200;
+        std::uint32_t raw_timestamp = p[7] | (p[8] << 8) | (p[9] << 16) | (p[10] << 24);
+        std::uint64_t sys_timestamp;
+        if (previous_sys_timestamp != 0 && raw_timestamp > previous_raw_timestamp) {
+            sys_timestamp = previous_sys_timestamp + (raw_timestamp - previous_raw_timestamp) / 4000;
+        } else {
+            sys_timestamp = previous_sys_timestamp = message_start_timestamp;
+            previous_raw_timestamp = raw_timestamp;
+        }
+
+        auto parsed = ParseMessage(p + 6, payload_size, sys_timestamp);
+        if (parsed) {
+            if (!messages) {
+                messages = MessageVector::Create();
+            }
+            messages->push_back(std::move(*parsed));
         }
+        p += header_size + payload_size;
+    }
+
+    // keep any partial frame for the next read
+    buffered_ = end - p;
+    if (buffered_ > 0 && p != begin) {
+        std::memmove(buffer_.data(), p, buffered_);
     }
 
     if (messages) {
@@ -189,31 +162,36 @@ void StratuxSerial::ParseInput(const Bytes &buf) {
     }
 }
 
-boost::optional<RawMessage> StratuxSerial::ParseMessage(const Bytes &message, std::uint64_t sys_timestamp) {
-    assert(message.size() >= 5);
-
+boost::optional<RawMessage> StratuxSerial::ParseMessage(const std::uint8_t *message, std::size_t payload_size, std::uint64_t sys_timestamp) {
     // not entirely clear what the RSSI format is; here we assume it's
     // the format returned by the CC1310 (signed dBm)
     std::int8_t raw_rssi = message[0];
     float rssi = 1.0 * raw_rssi;
 
     std::uint32_t raw_timestamp = message[1] | (message[2] << 8) | (message[3] << 16) | (message[4] << 24);
-
-    Bytes payload;
-    std::copy(message.begin() + 5, message.end(), std::back_inserter(payload));
+    const std::uint8_t *payload = message + 5;
 
     bool success;
-    Bytes corrected;
     unsigned errors;
+    const std::uint8_t *corrected = nullptr;
+    std::size_t corrected_size = 0;
 
-    switch (payload.size()) {
+    switch (payload_size) {
     case UPLINK_BYTES:
-        std::tie(success, corrected, errors) = fec_.CorrectUplink(payload);
+        std::copy(payload, payload + UPLINK_BYTES, uplink_.begin());
+        std::tie(success, errors) = fec_.CorrectUplink(uplink_, UplinkErasures(), uplink_data_);
+        corrected = uplink_data_.data();
+        corrected_size = uplink_data_.size();
         break;
 
-    case DOWNLINK_LONG_BYTES:
-        std::tie(success, corrected, errors) = fec_.CorrectDownlink(payload);
+    case DOWNLINK_LONG_BYTES: {
+        std::size_t data_bytes;
+        std::copy(payload, payload + DOWNLINK_LONG_BYTES, downlink_.begin());
+        std::tie(success, data_bytes, errors) = fec_.CorrectDownlink(downlink_, DownlinkErasures());
+        corrected = downlink_.data();
+        corrected_size = data_bytes;
         break;
+    }
 
     default:
         // unexpected length
@@ -225,7 +203,7 @@ boost::optional<RawMessage> StratuxSerial::ParseMessage(const Bytes &message, st
         return boost::none;
     }
 
-    return RawMessage{std::move(corrected), sys_timestamp, errors, rssi, raw_timestamp};
+    return RawMessage{corrected, corrected_size, sys_timestamp, errors, rssi, raw_timestamp};
 }
 
 void StratuxSerial::HandleError(const boost::system::error_code &ec) { DispatchError(ec); }
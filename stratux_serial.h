@@ -15,7 +15,6 @@
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/posix/stream_descriptor.hpp>
 #include <boost/asio/serial_port.hpp>
-#include <boost/asio/steady_timer.hpp>
 #include <boost/optional.hpp>
 
 #include "common.h"
@@ -39,28 +38,29 @@ namespace airnav::uat {
 
       private:
         void StartReading();
-        void ParseInput(const Bytes &buf);
-        boost::optional<RawMessage> ParseMessage(const Bytes &message, std::uint64_t sys_timestamp);
+        void ParseInput();
+        boost::optional<RawMessage> ParseMessage(const std::uint8_t *message, std::size_t payload_size, std::uint64_t sys_timestamp);
         void HandleError(const boost::system::error_code &ec);
 
         // the size of the read buffer
         const std::size_t read_buffer_size = 1024 * 16;
-        // how long to wait between scheduling reads (to reduce the spinning on short messages)
-        const std::chrono::milliseconds read_interval = std::chrono::milliseconds(50);
 
         boost::asio::io_service &io_service_;
         std::string path_;
         boost::asio::serial_port port_;
-        boost::asio::steady_timer read_timer_;
-        std::shared_ptr<Bytes> readbuf_;
         FEC fec_;
 
-        enum class ParserState;
-        ParserState parser_state_;
-        unsigned preamble_index_;
-        std::uint32_t message_length_;
-        Bytes message_;
-        std::uint64_t message_start_timestamp_;
+        // Input is read into buffer_ and frames are decoded from it in
+        // place; only an incomplete frame at the end of a read is kept,
+        // moved to the start of the buffer.
+        Bytes buffer_;
+        std::size_t buffered_ = 0; // bytes of buffer_ holding unparsed input
+        std::size_t needed_ = 0;   // bytes to wait for before the next parse
+
+        // FEC working space
+        DownlinkBuffer downlink_;
+        UplinkBuffer uplink_;
+        UplinkDataBuffer uplink_data_;
     };
 }; // namespace airnav::uat
 
@@ -0,0 +1,287 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "sync_search.h"
+
+#include <cstring>
+
+#include "cpu_features.h"
+#include "uat_protocol.h"
+
+#ifdef DUMP978_X86
+#include <immintrin.h>
+#endif
+
+#ifdef DUMP978_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace airnav::uat;
+
+static const std::uint64_t SYNC_MASK = (1ULL << SYNC_BITS) - 1;
+
+// The two sync words are complements of each other, so one popcount
+// tells us the distance to both
+static_assert(UPLINK_SYNC_WORD == (~DOWNLINK_SYNC_WORD & SYNC_MASK), "sync words should be complementary");
+
+// Reverse the bit order of a sync word to match the LSB-first packing of
+// the sliced bit streams
+static std::uint64_t ReverseSyncWord(std::uint64_t word) {
+    std::uint64_t reversed = 0;
+    for (unsigned i = 0; i < SYNC_BITS; ++i) {
+        if (word & (1ULL << i))
+            reversed |= 1ULL << (SYNC_BITS - 1 - i);
+    }
+    return reversed;
+}
+
+static const std::uint64_t DOWNLINK_PATTERN = ReverseSyncWord(DOWNLINK_SYNC_WORD);
+
+// Return the bits of a packed bit stream starting at bit `k`; at least the
+// low 57 bits of the result are valid
+static inline std::uint64_t LoadBits(const std::uint8_t *bits, std::size_t k) {
+    std::uint64_t word;
+    std::memcpy(&word, bits + (k >> 3), sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word >> (k & 7);
+}
+
+// Slice pairs `from` .. `pairs`-1 one at a time; `from` must be a multiple of 8.
+// The output bytes must already be zeroed.
+static void SliceGeneric(const std::uint16_t *phase, std::size_t from, std::size_t pairs, std::uint8_t *even, std::uint8_t *odd) {
+    for (std::size_t k = from; k < pairs; ++k) {
+        // same as PhaseDifference(from, to) > 0
+        if (static_cast<std::int16_t>(phase[2 * k + 1] - phase[2 * k]) > 0)
+            even[k >> 3] |= 1 << (k & 7);
+        if (static_cast<std::int16_t>(phase[2 * k + 2] - phase[2 * k + 1]) > 0)
+            odd[k >> 3] |= 1 << (k & 7);
+    }
+}
+
+// Mark candidate offsets 0 .. windows-1 in one bit stream
+static inline __attribute__((always_inline)) void MarkCandidatesInline(const std::uint8_t *bits, std::size_t windows, std::uint64_t *candidates) {
+    for (std::size_t k = 0; k < windows; ++k) {
+        unsigned errors = __builtin_popcountll((LoadBits(bits, k) ^ DOWNLINK_PATTERN) & SYNC_MASK);
+        if (errors <= SyncSearch::MAX_SYNC_ERRORS || errors >= SYNC_BITS - SyncSearch::MAX_SYNC_ERRORS)
+            candidates[k >> 6] |= 1ULL << (k & 63);
+    }
+}
+
+static std::size_t SliceNone(const std::uint16_t *, std::size_t, std::uint8_t *, std::uint8_t *) { return 0; }
+
+static void MarkGeneric(const std::uint8_t *bits, std::size_t windows, std::uint64_t *candidates) { MarkCandidatesInline(bits, windows, candidates); }
+
+#ifdef DUMP978_X86
+// Split 16-bit phase differences into those in the low half of each 32-bit
+// lane (even sample offsets) and the high half (odd offsets), sign-extended
+// so that a saturating pack keeps their sign
+__attribute__((target("sse4.2"))) static inline __m128i EvenLanes(__m128i v) { return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16); }
+__attribute__((target("sse4.2"))) static inline __m128i OddLanes(__m128i v) { return _mm_srai_epi32(v, 16); }
+
+// Slice 16 pairs at a time; returns the number of pairs sliced
+__attribute__((target("sse4.2"))) static std::size_t SliceSSE42(const std::uint16_t *phase, std::size_t pairs, std::uint8_t *even, std::uint8_t *odd) {
+    const __m128i zero = _mm_setzero_si128();
+
+    std::size_t k = 0;
+    for (; k + 16 <= pairs; k += 16) {
+        const std::uint16_t *p = phase + 2 * k;
+
+        __m128i d0 = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+        __m128i d1 = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 9)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 8)));
+        __m128i d2 = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 17)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16)));
+        __m128i d3 = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 25)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 24)));
+
+        __m128i e = _mm_packs_epi16(_mm_packs_epi32(EvenLanes(d0), EvenLanes(d1)), _mm_packs_epi32(EvenLanes(d2), EvenLanes(d3)));
+        __m128i o = _mm_packs_epi16(_mm_packs_epi32(OddLanes(d0), OddLanes(d1)), _mm_packs_epi32(OddLanes(d2), OddLanes(d3)));
+
+        unsigned e_bits = _mm_movemask_epi8(_mm_cmpgt_epi8(e, zero));
+        unsigned o_bits = _mm_movemask_epi8(_mm_cmpgt_epi8(o, zero));
+
+        even[k >> 3] = e_bits & 0xFF;
+        even[(k >> 3) + 1] = e_bits >> 8;
+        odd[k >> 3] = o_bits & 0xFF;
+        odd[(k >> 3) + 1] = o_bits >> 8;
+    }
+
+    return k;
+}
+
+__attribute__((target("avx2"))) static inline __m256i EvenLanes256(__m256i v) { return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16); }
+__attribute__((target("avx2"))) static inline __m256i OddLanes256(__m256i v) { return _mm256_srai_epi32(v, 16); }
+
+// Slice 32 pairs at a time; returns the number of pairs sliced
+__attribute__((target("avx2"))) static std::size_t SliceAVX2(const std::uint16_t *phase, std::size_t pairs, std::uint8_t *even, std::uint8_t *odd) {
+    const __m256i zero = _mm256_setzero_si256();
+    // the packs operate within 128-bit lanes; this puts the 4-byte groups back in order
+    const __m256i unshuffle = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    std::size_t k = 0;
+    for (; k + 32 <= pairs; k += 32) {
+        const std::uint16_t *p = phase + 2 * k;
+
+        __m256i d0 = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+        __m256i d1 = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 17)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 16)));
+        __m256i d2 = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 33)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32)));
+        __m256i d3 = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 49)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 48)));
+
+        __m256i e = _mm256_packs_epi16(_mm256_packs_epi32(EvenLanes256(d0), EvenLanes256(d1)), _mm256_packs_epi32(EvenLanes256(d2), EvenLanes256(d3)));
+        __m256i o = _mm256_packs_epi16(_mm256_packs_epi32(OddLanes256(d0), OddLanes256(d1)), _mm256_packs_epi32(OddLanes256(d2), OddLanes256(d3)));
+
+        std::uint32_t e_bits = _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_permutevar8x32_epi32(e, unshuffle), zero));
+        std::uint32_t o_bits = _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_permutevar8x32_epi32(o, unshuffle), zero));
+
+        for (unsigned i = 0; i < 4; ++i) {
+            even[(k >> 3) + i] = (e_bits >> (i * 8)) & 0xFF;
+            odd[(k >> 3) + i] = (o_bits >> (i * 8)) & 0xFF;
+        }
+    }
+
+    return k;
+}
+
+__attribute__((target("popcnt"))) static void MarkPopcnt(const std::uint8_t *bits, std::size_t windows, std::uint64_t *candidates) { MarkCandidatesInline(bits, windows, candidates); }
+#endif
+
+#ifdef DUMP978_NEON
+static inline std::uint8_t NeonMaskToBits(uint8x8_t mask) {
+    uint8x8_t weighted = vand_u8(mask, vcreate_u8(0x8040201008040201ULL));
+    weighted = vpadd_u8(weighted, weighted);
+    weighted = vpadd_u8(weighted, weighted);
+    weighted = vpadd_u8(weighted, weighted);
+    return vget_lane_u8(weighted, 0);
+}
+
+// Slice 8 pairs at a time; returns the number of pairs sliced
+static std::size_t SliceNeon(const std::uint16_t *phase, std::size_t pairs, std::uint8_t *even, std::uint8_t *odd) {
+    const int16x8_t zero = vdupq_n_s16(0);
+
+    std::size_t k = 0;
+    for (; k + 8 <= pairs; k += 8) {
+        const std::uint16_t *p = phase + 2 * k;
+
+        // deinterleaving loads: a = (p0, p2, ..), (p1, p3, ..); b = (p1, p3, ..), (p2, p4, ..)
+        uint16x8x2_t a = vld2q_u16(p);
+        uint16x8x2_t b = vld2q_u16(p + 1);
+
+        int16x8_t d_even = vreinterpretq_s16_u16(vsubq_u16(a.val[1], a.val[0]));
+        int16x8_t d_odd = vreinterpretq_s16_u16(vsubq_u16(b.val[1], b.val[0]));
+
+        even[k >> 3] = NeonMaskToBits(vmovn_u16(vcgtq_s16(d_even, zero)));
+        odd[k >> 3] = NeonMaskToBits(vmovn_u16(vcgtq_s16(d_odd, zero)));
+    }
+
+    return k;
+}
+#endif
+
+struct SyncSearch::Kernels {
+    const char *name;
+    // vectorized slicer: slices a prefix of the pairs (a multiple of 8) and returns its length
+    std::size_t (*slice)(const std::uint16_t *phase, std::size_t pairs, std::uint8_t *even, std::uint8_t *odd);
+    void (*mark)(const std::uint8_t *bits, std::size_t windows, std::uint64_t *candidates);
+};
+
+static SyncSearch::Kernels ChooseKernels() {
+#ifdef DUMP978_X86
+    if (CpuHasAVX2())
+        return {"avx2", SliceAVX2, MarkPopcnt};
+    if (CpuHasSSE42())
+        return {"sse4.2", SliceSSE42, MarkPopcnt};
+#endif
+#ifdef DUMP978_NEON
+    if (CpuHasNeon())
+        return {"neon", SliceNeon, MarkGeneric};
+#endif
+    return {"generic", SliceNone, MarkGeneric};
+}
+
+static const SyncSearch::Kernels &SelectedKernels() {
+    static const SyncSearch::Kernels kernels = ChooseKernels();
+    return kernels;
+}
+
+static const SyncSearch::Kernels GENERIC_KERNELS = {"generic", SliceNone, MarkGeneric};
+
+SyncSearch::SyncSearch(bool generic) : kernels_(generic ? &GENERIC_KERNELS : &SelectedKernels()) {}
+
+const char *SyncSearch::Implementation() { return SelectedKernels().name; }
+
+void SyncSearch::Prepare(const std::uint16_t *phase, std::size_t count) {
+    Begin(count);
+    SliceTile(phase, 0, pairs_);
+    Finish();
+}
+
+void SyncSearch::Begin(std::size_t count) {
+    // the odd stream needs one sample beyond the end of each pair
+    pairs_ = (count > 0 ? (count - 1) / 2 : 0);
+    windows_ = (pairs_ >= SYNC_BITS ? pairs_ - SYNC_BITS + 1 : 0);
+
+    // padded so that LoadBits and NextCandidatePair can always read a whole word
+    even_.assign((pairs_ + 7) / 8 + sizeof(std::uint64_t), 0);
+    odd_.assign((pairs_ + 7) / 8 + sizeof(std::uint64_t), 0);
+    even_candidates_.assign(windows_ / 64 + 2, 0);
+    odd_candidates_.assign(windows_ / 64 + 2, 0);
+}
+
+void SyncSearch::SliceTile(const std::uint16_t *phase, std::size_t first, std::size_t pairs) {
+    std::uint8_t *even = even_.data() + first / 8;
+    std::uint8_t *odd = odd_.data() + first / 8;
+
+    auto done = kernels_->slice(phase, pairs, even, odd);
+    SliceGeneric(phase, done, pairs, even, odd);
+}
+
+void SyncSearch::Finish() {
+    kernels_->mark(even_.data(), windows_, even_candidates_.data());
+    kernels_->mark(odd_.data(), windows_, odd_candidates_.data());
+}
+
+std::size_t SyncSearch::NextCandidatePair(std::size_t from, std::size_t limit) const {
+    if (from >= limit) {
+        return limit;
+    }
+
+    // for an even `from`, the pairs are (2j, 2j+1), i.e. bit j of both
+    // bitmaps; for an odd `from`, the pairs are (2j+1, 2j+2), i.e. bit j of
+    // the odd bitmap and bit j+1 of the even bitmap
+    const std::size_t parity = from & 1;
+    auto combined = [this, parity](std::size_t w) -> std::uint64_t {
+        if (parity)
+            return odd_candidates_[w] | (even_candidates_[w] >> 1) | (even_candidates_[w + 1] << 63);
+        else
+            return odd_candidates_[w] | even_candidates_[w];
+    };
+
+    const std::size_t j = from >> 1;
+    std::size_t w = j >> 6;
+    std::uint64_t word = combined(w) & (~0ULL << (j & 63));
+
+    while (true) {
+        if (word) {
+            std::size_t s = ((w * 64 + __builtin_ctzll(word)) << 1) | parity;
+            return (s < limit ? s : limit);
+        }
+
+        ++w;
+        if (w + 1 >= even_candidates_.size() || w * 128 >= limit) {
+            return limit;
+        }
+
+        word = combined(w);
+    }
+}
+
+bool SyncSearch::Match(std::size_t s, std::uint64_t pattern) const {
+    const std::size_t k = s >> 1;
+    if (k >= windows_) {
+        return false;
+    }
+
+    const auto &bits = (s & 1) ? odd_ : even_;
+    unsigned errors = __builtin_popcountll((LoadBits(bits.data(), k) ^ ReverseSyncWord(pattern)) & SYNC_MASK);
+    return errors <= MAX_SYNC_ERRORS;
+}
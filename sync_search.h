@@ -0,0 +1,86 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_SYNC_SEARCH_H
+#define DUMP978_SYNC_SEARCH_H
+
+#include <cstdint>
+#include <vector>
+
+namespace airnav::uat {
+    // Block-at-a-time search for UAT sync words in a 2Msps phase buffer.
+    //
+    // Prepare() slices the phase difference between every pair of adjacent
+    // samples into two bit streams (pairs starting at even and at odd sample
+    // offsets), then marks every offset where a sync word with at most
+    // MAX_SYNC_ERRORS bit errors (either downlink or uplink) starts. The
+    // demodulator only needs to look more closely at the marked offsets.
+    //
+    // Offsets are sample offsets from the start of the prepared buffer; the
+    // sync word starting at offset `s` is made up of the phase differences
+    // (s, s+1), (s+2, s+3), ... (s+70, s+71).
+    //
+    // Vectorized implementations are chosen at runtime (AVX2 or SSE4.2 on
+    // x86, NEON on ARM builds that enable it), falling back to plain C++.
+    class SyncSearch {
+      public:
+        static const unsigned MAX_SYNC_ERRORS = 4;
+        // tiles start on a byte of the sliced bit streams
+        static const std::size_t TILE_ALIGNMENT = 8;
+
+        // If `generic` is set, use the plain C++ implementation rather than
+        // the one chosen for this CPU (to test one against the other)
+        explicit SyncSearch(bool generic = false);
+
+        // Slice phase[0 .. count) and mark candidate sync words
+        void Prepare(const std::uint16_t *phase, std::size_t count);
+
+        // The same as Prepare(), a tile at a time, so that phase data never
+        // needs to exist for the whole buffer at once: call Begin(count),
+        // then SliceTile() for each run of pairs, in any order, until all
+        // Pairs() pairs have been sliced, then Finish().
+        void Begin(std::size_t count);
+        // Slice pairs `first` .. `first + pairs - 1`. `phase` holds the
+        // (2 * pairs + 1) phase values from sample offset 2 * first;
+        // `first` must be a multiple of TILE_ALIGNMENT.
+        void SliceTile(const std::uint16_t *phase, std::size_t first, std::size_t pairs);
+        void Finish();
+        std::size_t Pairs() const { return pairs_; }
+
+        // Return the first offset `s` >= `from`, with the same parity as
+        // `from` and less than `limit`, where a candidate sync word starts
+        // at either `s` or `s + 1`; or return `limit` if there is none.
+        std::size_t NextCandidatePair(std::size_t from, std::size_t limit) const;
+
+        // Return true if the sync word starting at offset `s` matches
+        // `pattern` with at most MAX_SYNC_ERRORS bit errors.
+        bool Match(std::size_t s, std::uint64_t pattern) const;
+
+        // Name of the implementation in use on this CPU
+        static const char *Implementation();
+
+        // The slicing and marking functions of one implementation
+        struct Kernels;
+
+      private:
+        const Kernels *kernels_;
+
+        std::size_t pairs_ = 0;   // number of sliced pairs in each of the even/odd streams
+        std::size_t windows_ = 0; // number of candidate offsets in each of the even/odd streams
+
+        // sliced bits, packed LSB-first; bit k of even_ is the phase
+        // difference (2k, 2k+1), bit k of odd_ is (2k+1, 2k+2)
+        std::vector<std::uint8_t> even_;
+        std::vector<std::uint8_t> odd_;
+
+        // candidate bitmaps; bit k is set if a sync word starts at 2k (even)
+        // or 2k+1 (odd)
+        std::vector<std::uint64_t> even_candidates_;
+        std::vector<std::uint64_t> odd_candidates_;
+    };
+}; // namespace airnav::uat
+
+#endif
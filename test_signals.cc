@@ -0,0 +1,193 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "test_signals.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "fec.h"
+#include "uat_protocol.h"
+
+extern "C" {
+#include "fec/rs.h"
+}
+
+using namespace airnav::uat;
+
+// the amplitude of a synthesized signal
+static const double SIGNAL_AMPLITUDE = 0.7;
+
+std::vector<RawMessage> airnav::uat::LoadSampleData(const std::string &path, std::size_t limit) {
+    std::vector<RawMessage> messages;
+
+    const std::string command = "gzip -dc '" + path + "'";
+    FILE *f = popen(command.c_str(), "r");
+    if (!f) {
+        return messages;
+    }
+
+    char line[4096];
+    while (messages.size() < limit && std::fgets(line, sizeof(line), f)) {
+        if (line[0] != '-' && line[0] != '+')
+            continue;
+
+        Bytes payload;
+        for (const char *p = line + 1; std::isxdigit(p[0]) && std::isxdigit(p[1]); p += 2) {
+            char hex[3] = {p[0], p[1], 0};
+            payload.push_back((std::uint8_t)std::strtoul(hex, nullptr, 16));
+        }
+
+        RawMessage message(std::move(payload), 0, 0, -10.0f);
+        if (message)
+            messages.push_back(std::move(message));
+    }
+
+    pclose(f);
+    return messages;
+}
+
+FrameEncoder::FrameEncoder() {
+    downlink_short_ = ::init_rs_char(8, fec::DOWNLINK_SHORT_POLY, 120, 1, fec::DOWNLINK_SHORT_ROOTS, fec::DOWNLINK_SHORT_PAD);
+    downlink_long_ = ::init_rs_char(8, fec::DOWNLINK_LONG_POLY, 120, 1, fec::DOWNLINK_LONG_ROOTS, fec::DOWNLINK_LONG_PAD);
+    uplink_ = ::init_rs_char(8, fec::UPLINK_BLOCK_POLY, 120, 1, fec::UPLINK_BLOCK_ROOTS, fec::UPLINK_BLOCK_PAD);
+}
+
+FrameEncoder::~FrameEncoder() {
+    ::free_rs_char(downlink_short_);
+    ::free_rs_char(downlink_long_);
+    ::free_rs_char(uplink_);
+}
+
+EncodedFrame FrameEncoder::Encode(const RawMessage &message) const {
+    EncodedFrame frame;
+    frame.type = message.Type();
+
+    const auto &payload = message.Payload();
+    switch (message.Type()) {
+    case MessageType::DOWNLINK_SHORT:
+        frame.data.assign(DOWNLINK_LONG_BYTES, 0);
+        std::copy(payload.begin(), payload.end(), frame.data.begin());
+        ::encode_rs_char(downlink_short_, frame.data.data(), frame.data.data() + DOWNLINK_SHORT_DATA_BYTES);
+        break;
+
+    case MessageType::DOWNLINK_LONG:
+        frame.data.assign(DOWNLINK_LONG_BYTES, 0);
+        std::copy(payload.begin(), payload.end(), frame.data.begin());
+        ::encode_rs_char(downlink_long_, frame.data.data(), frame.data.data() + DOWNLINK_LONG_DATA_BYTES);
+        break;
+
+    case MessageType::UPLINK:
+        frame.data.assign(UPLINK_BYTES, 0);
+        for (unsigned block = 0; block < UPLINK_BLOCKS_PER_FRAME; ++block) {
+            std::uint8_t buf[UPLINK_BLOCK_BYTES];
+            std::copy(payload.begin() + block * UPLINK_BLOCK_DATA_BYTES, payload.begin() + (block + 1) * UPLINK_BLOCK_DATA_BYTES, buf);
+            ::encode_rs_char(uplink_, buf, buf + UPLINK_BLOCK_DATA_BYTES);
+            for (unsigned i = 0; i < UPLINK_BLOCK_BYTES; ++i) {
+                frame.data[i * UPLINK_BLOCKS_PER_FRAME + block] = buf[i];
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return frame;
+}
+
+std::vector<std::uint8_t> airnav::uat::Modulate(const std::vector<EncodedFrame> &frames, SampleFormat format, double sigma) {
+    std::vector<std::uint8_t> out;
+    std::mt19937 rng(1);
+    std::normal_distribution<double> noise(0, sigma);
+    double phase = 0;
+
+    auto emit = [&](double amplitude, double dphi) {
+        phase += dphi;
+        const double i = amplitude * std::cos(phase) + noise(rng);
+        const double q = amplitude * std::sin(phase) + noise(rng);
+
+        switch (format) {
+        case SampleFormat::CU8:
+            out.push_back((std::uint8_t)std::max(0.0, std::min(255.0, i * 127 + 127.5)));
+            out.push_back((std::uint8_t)std::max(0.0, std::min(255.0, q * 127 + 127.5)));
+            break;
+        case SampleFormat::CS8_:
+            out.push_back((std::uint8_t)(std::int8_t)std::max(-128.0, std::min(127.0, i * 127)));
+            out.push_back((std::uint8_t)(std::int8_t)std::max(-128.0, std::min(127.0, q * 127)));
+            break;
+        case SampleFormat::CS16H: {
+            const std::int16_t s[2] = {(std::int16_t)std::max(-32768.0, std::min(32767.0, i * 32000)), (std::int16_t)std::max(-32768.0, std::min(32767.0, q * 32000))};
+            out.insert(out.end(), (const std::uint8_t *)s, (const std::uint8_t *)(s + 2));
+            break;
+        }
+        case SampleFormat::CF32H: {
+            const float s[2] = {(float)i, (float)q};
+            out.insert(out.end(), (const std::uint8_t *)s, (const std::uint8_t *)(s + 2));
+            break;
+        }
+        default:
+            break;
+        }
+    };
+
+    // each bit is two samples, with a phase change of +/- 0.3*pi per sample
+    auto emit_bits = [&](std::uint64_t sync, const Bytes &data) {
+        for (int k = SYNC_BITS - 1; k >= 0; --k) {
+            const double d = ((sync >> k) & 1) ? 0.3 * M_PI : -0.3 * M_PI;
+            emit(SIGNAL_AMPLITUDE, d);
+            emit(SIGNAL_AMPLITUDE, d);
+        }
+        for (auto b : data) {
+            for (int k = 7; k >= 0; --k) {
+                const double d = ((b >> k) & 1) ? 0.3 * M_PI : -0.3 * M_PI;
+                emit(SIGNAL_AMPLITUDE, d);
+                emit(SIGNAL_AMPLITUDE, d);
+            }
+        }
+    };
+
+    for (const auto &frame : frames) {
+        const int gap = 2000 + (int)(rng() % 3000);
+        for (int k = 0; k < gap; ++k)
+            emit(0, 0);
+
+        if (frame.type == MessageType::UPLINK) {
+            emit_bits(UPLINK_SYNC_WORD, frame.data);
+        } else if (frame.type == MessageType::DOWNLINK_SHORT) {
+            emit_bits(DOWNLINK_SYNC_WORD, Bytes(frame.data.begin(), frame.data.begin() + DOWNLINK_SHORT_BYTES));
+        } else {
+            emit_bits(DOWNLINK_SYNC_WORD, frame.data);
+        }
+    }
+
+    for (int k = 0; k < 20000; ++k)
+        emit(0, 0);
+
+    return out;
+}
+
+double airnav::uat::NoiseSigma(double snr_db) {
+    // signal power is amplitude^2; the noise is independent on I and Q
+    return std::sqrt(SIGNAL_AMPLITUDE * SIGNAL_AMPLITUDE / (2 * std::pow(10.0, snr_db / 10)));
+}
+
+const char *airnav::uat::FormatName(SampleFormat format) {
+    switch (format) {
+    case SampleFormat::CU8:
+        return "CU8";
+    case SampleFormat::CS8_:
+        return "CS8";
+    case SampleFormat::CS16H:
+        return "CS16H";
+    case SampleFormat::CF32H:
+        return "CF32H";
+    default:
+        return "?";
+    }
+}
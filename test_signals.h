@@ -0,0 +1,62 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_TEST_SIGNALS_H
+#define DUMP978_TEST_SIGNALS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "convert.h"
+#include "uat_message.h"
+
+// Synthetic IQ captures built from known messages, shared by the
+// benchmark and the comparison harness
+
+namespace airnav::uat {
+    // Read up to `limit` messages from a gzipped file of raw messages (in
+    // the format of sample-data.txt.gz); the result is empty if the file
+    // could not be read
+    std::vector<RawMessage> LoadSampleData(const std::string &path, std::size_t limit);
+
+    // A message with FEC parity added, as it is transmitted (before any errors)
+    struct EncodedFrame {
+        MessageType type;
+        Bytes data;
+    };
+
+    // Adds FEC parity to messages
+    class FrameEncoder {
+      public:
+        FrameEncoder();
+        ~FrameEncoder();
+
+        FrameEncoder(const FrameEncoder &) = delete;
+        FrameEncoder &operator=(const FrameEncoder &) = delete;
+
+        EncodedFrame Encode(const RawMessage &message) const;
+
+      private:
+        void *downlink_short_;
+        void *downlink_long_;
+        void *uplink_;
+    };
+
+    // Synthesize a 2.083333Msps capture containing `frames`, separated by
+    // gaps of noise (with standard deviation `sigma`, relative to a signal
+    // amplitude of 0.7), in the given sample format. The noise is the same
+    // on every call, only scaled by `sigma`.
+    std::vector<std::uint8_t> Modulate(const std::vector<EncodedFrame> &frames, SampleFormat format, double sigma = 0.05);
+
+    // The noise level to pass to Modulate for a given signal-to-noise
+    // ratio, in dB
+    double NoiseSigma(double snr_db);
+
+    const char *FormatName(SampleFormat format);
+}; // namespace airnav::uat
+
+#endif
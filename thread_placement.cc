@@ -0,0 +1,128 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "thread_placement.h"
+
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+using namespace airnav::uat;
+
+namespace {
+    struct RoleState {
+        airnav::uat::ThreadPlacement placement;
+        unsigned next_cpu = 0;
+    };
+
+    std::mutex placement_mutex;
+    std::array<RoleState, 3> roles;
+} // namespace
+
+std::vector<unsigned> airnav::uat::ParseCpuList(const std::string &list) {
+    std::vector<unsigned> cpus;
+
+    auto parse_number = [&list](const char *&p) -> unsigned {
+        char *end;
+        errno = 0;
+        const unsigned long value = std::strtoul(p, &end, 10);
+        if (end == p || errno != 0 || value >= CPU_SETSIZE) {
+            throw std::invalid_argument("bad CPU list: " + list);
+        }
+        p = end;
+        return (unsigned)value;
+    };
+
+    const char *p = list.c_str();
+    while (*p) {
+        const unsigned first = parse_number(p);
+        unsigned last = first;
+        if (*p == '-') {
+            ++p;
+            last = parse_number(p);
+            if (last < first) {
+                throw std::invalid_argument("bad CPU list: " + list);
+            }
+        }
+        for (unsigned cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+
+        if (*p == ',') {
+            ++p;
+        } else if (*p) {
+            throw std::invalid_argument("bad CPU list: " + list);
+        }
+    }
+
+    if (cpus.empty()) {
+        throw std::invalid_argument("empty CPU list");
+    }
+    return cpus;
+}
+
+void airnav::uat::SetThreadPlacement(ThreadRole role, const ThreadPlacement &placement) {
+    std::unique_lock<std::mutex> lock(placement_mutex);
+    auto &state = roles[static_cast<unsigned>(role)];
+    state.placement = placement;
+    state.next_cpu = 0;
+}
+
+void airnav::uat::ApplyThreadPlacement(ThreadRole role, const char *name) {
+    if (name) {
+        // Linux limits thread names to 15 characters
+        char short_name[16];
+        std::strncpy(short_name, name, sizeof(short_name) - 1);
+        short_name[sizeof(short_name) - 1] = 0;
+        pthread_setname_np(pthread_self(), short_name);
+    } else {
+        name = "main thread";
+    }
+
+    ThreadPlacement placement;
+    int cpu = -1;
+    {
+        std::unique_lock<std::mutex> lock(placement_mutex);
+        auto &state = roles[static_cast<unsigned>(role)];
+        placement = state.placement;
+        if (!placement.cpus.empty()) {
+            cpu = placement.cpus[state.next_cpu++ % placement.cpus.size()];
+        }
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0) {
+            std::cerr << name << ": could not pin thread to CPU " << cpu << ": " << std::strerror(rc) << std::endl;
+        }
+    }
+
+    if (placement.fifo_priority > 0) {
+        sched_param param = {};
+        param.sched_priority = placement.fifo_priority;
+        int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (rc != 0) {
+            std::cerr << name << ": could not set SCHED_FIFO priority " << placement.fifo_priority << ": " << std::strerror(rc) << std::endl;
+        }
+    }
+}
+
+bool airnav::uat::LockMemory() {
+    if (::mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        std::cerr << "could not lock memory: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_THREAD_PLACEMENT_H
+#define DUMP978_THREAD_PLACEMENT_H
+
+#include <string>
+#include <vector>
+
+namespace airnav::uat {
+    // The kinds of thread that can be placed separately
+    enum class ThreadRole {
+        RX,    // SDR sample reading (SoapySampleSource)
+        DEMOD, // sample conversion and demodulation workers
+        IO,    // the io_service thread and the asynchronous dispatch thread
+    };
+
+    // Where and how to run the threads of one role. Each thread that
+    // starts is pinned to the next CPU from `cpus` in turn (wrapping
+    // around), so giving one CPU per thread keeps each on its own core.
+    // An empty list leaves the threads wherever the scheduler puts them.
+    struct ThreadPlacement {
+        std::vector<unsigned> cpus;
+        int fifo_priority = 0; // if nonzero, run with SCHED_FIFO at this priority
+    };
+
+    // Parse a CPU list such as "0,2-3"; throws std::invalid_argument
+    std::vector<unsigned> ParseCpuList(const std::string &list);
+
+    // Configure a role; call before the threads of that role start
+    void SetThreadPlacement(ThreadRole role, const ThreadPlacement &placement);
+
+    // Apply the configuration for `role` to the calling thread and name it
+    // `name` (for top / ps), unless `name` is null. Called by each thread as
+    // it starts. Failures (e.g. no permission for SCHED_FIFO) are logged,
+    // not fatal.
+    //
+    // Memory that a thread touches first is allocated on its NUMA node, so
+    // threads should call this before allocating and faulting in their
+    // buffers.
+    void ApplyThreadPlacement(ThreadRole role, const char *name);
+
+    // Lock all current and future memory of the process, so that the rx
+    // path never waits for a page fault. Returns false (after logging) on
+    // failure.
+    bool LockMemory();
+}; // namespace airnav::uat
+
+#endif
@@ -0,0 +1,256 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <pthread.h>
+
+using namespace airnav::uat::trace;
+
+namespace {
+    const unsigned NUM_EVENTS = static_cast<unsigned>(Event::COUNT);
+
+    // One event. Only the owning thread writes to a slot; the atomics
+    // (relaxed, so plain stores) just make concurrent reads by Format()
+    // well-defined.
+    struct Slot {
+        std::atomic<std::uint64_t> time; // steady_clock nanoseconds
+        std::atomic<std::uint32_t> event;
+        std::atomic<std::uint32_t> a;
+        std::atomic<std::uint64_t> b;
+        std::atomic<std::uint64_t> c;
+    };
+
+    struct Ring {
+        explicit Ring(std::size_t size) : slots(new Slot[size]), mask(size - 1) {}
+
+        std::unique_ptr<Slot[]> slots;
+        const std::size_t mask;
+        std::atomic<std::uint64_t> head{0}; // events ever written; the next goes in slot head & mask
+        std::atomic<bool> in_use{true};     // false once the owning thread has exited
+        char thread_name[16] = {0};         // guarded by the registry mutex
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Ring>> rings; // never shrinks, so rings stay valid
+        std::atomic<std::size_t> ring_size{32768};
+    };
+
+    // Never destroyed, so that threads that outlive main() can still record
+    Registry &TheRegistry() {
+        static Registry *registry = new Registry();
+        return *registry;
+    }
+
+    // Gives the calling thread a ring on first use (reusing one left by a
+    // thread that has exited, if there is one of the right size), and
+    // hands it back when the thread exits
+    class ThreadRing {
+      public:
+        ThreadRing() {
+            auto &registry = TheRegistry();
+            const std::size_t size = registry.ring_size;
+
+            char name[16] = {0};
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+
+            std::unique_lock<std::mutex> lock(registry.mutex);
+            for (auto &ring : registry.rings) {
+                if (!ring->in_use && ring->mask + 1 == size) {
+                    ring->in_use = true;
+                    ring_ = ring.get();
+                    break;
+                }
+            }
+            if (!ring_) {
+                registry.rings.emplace_back(new Ring(size));
+                ring_ = registry.rings.back().get();
+            }
+            std::memcpy(ring_->thread_name, name, sizeof(name));
+        }
+
+        ~ThreadRing() { ring_->in_use = false; }
+
+        Ring *Get() { return ring_; }
+
+      private:
+        Ring *ring_ = nullptr;
+    };
+
+    // The fast path only touches this trivially-destructible pointer; the
+    // ThreadRing behind it is set up on first use
+    thread_local Ring *local_ring = nullptr;
+
+    Ring *AttachRing() {
+        thread_local ThreadRing ring;
+        return ring.Get();
+    }
+
+    std::uint64_t SteadyNanos(std::chrono::steady_clock::time_point t) { return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count(); }
+
+    struct EventInfo {
+        const char *name;
+        const char *a;
+        const char *b;
+        const char *c;
+    };
+
+    // indexed by Event; names of the arguments that are shown (nullptr: unused)
+    const EventInfo event_info[NUM_EVENTS] = {
+        {"sample_block", "samples", "timestamp", "sample_index"},
+        {"sync_candidate", "downlink", nullptr, nullptr},
+        {"downlink_fec", "ok", "errors", "ns"},
+        {"uplink_fec", "ok", "errors", "ns"},
+        {"dispatch", "messages", "age_ns", nullptr},
+        {"sdr_overrun", nullptr, "samples", nullptr},
+        {"sdr_dropped_block", nullptr, "samples", nullptr},
+    };
+
+    struct Copy {
+        std::uint64_t time;
+        std::uint32_t event;
+        std::uint32_t a;
+        std::uint64_t b;
+        std::uint64_t c;
+        unsigned ring; // index into the thread names copied by Format()
+    };
+}; // namespace
+
+void airnav::uat::trace::Record(Event event, std::uint32_t a, std::uint64_t b, std::uint64_t c) {
+    Ring *ring = local_ring;
+    if (!ring) {
+        if (!TheRegistry().ring_size.load(std::memory_order_relaxed)) {
+            return;
+        }
+        ring = local_ring = AttachRing();
+    }
+
+    const std::uint64_t index = ring->head.load(std::memory_order_relaxed);
+    Slot &slot = ring->slots[index & ring->mask];
+    slot.time.store(SteadyNanos(std::chrono::steady_clock::now()), std::memory_order_relaxed);
+    slot.event.store(static_cast<std::uint32_t>(event), std::memory_order_relaxed);
+    slot.a.store(a, std::memory_order_relaxed);
+    slot.b.store(b, std::memory_order_relaxed);
+    slot.c.store(c, std::memory_order_relaxed);
+    ring->head.store(index + 1, std::memory_order_release);
+}
+
+void airnav::uat::trace::SetRingSize(std::size_t events) {
+    std::size_t size = 0;
+    if (events > 0) {
+        size = 1;
+        while (size < events) {
+            size <<= 1;
+        }
+    }
+    TheRegistry().ring_size = size;
+}
+
+const char *airnav::uat::trace::EventName(Event event) {
+    const unsigned i = static_cast<unsigned>(event);
+    return (i < NUM_EVENTS ? event_info[i].name : "unknown");
+}
+
+std::string airnav::uat::trace::Format(std::chrono::milliseconds window) {
+    const auto steady_now = std::chrono::steady_clock::now();
+    const auto system_now = std::chrono::system_clock::now();
+    const std::uint64_t now_ns = SteadyNanos(steady_now);
+    const std::uint64_t window_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(window).count();
+    const std::uint64_t since = (now_ns > window_ns ? now_ns - window_ns : 0);
+
+    auto &registry = TheRegistry();
+    std::vector<Copy> events;
+    std::vector<std::string> thread_names;
+    {
+        std::unique_lock<std::mutex> lock(registry.mutex);
+        for (const auto &ring : registry.rings) {
+            thread_names.push_back(ring->thread_name[0] ? ring->thread_name : "?");
+            const std::uint64_t size = ring->mask + 1;
+            const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+            const std::size_t first = events.size();
+            for (std::uint64_t index = (head > size ? head - size : 0); index < head; ++index) {
+                const Slot &slot = ring->slots[index & ring->mask];
+                events.push_back({slot.time.load(std::memory_order_relaxed), slot.event.load(std::memory_order_relaxed), slot.a.load(std::memory_order_relaxed), slot.b.load(std::memory_order_relaxed), slot.c.load(std::memory_order_relaxed), static_cast<unsigned>(thread_names.size() - 1)});
+            }
+
+            // Drop whatever the owner may have overwritten while we copied:
+            // everything before the slot it is (or was last) writing
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const std::uint64_t head_after = ring->head.load(std::memory_order_relaxed);
+            if (head_after + 1 > size) {
+                const std::uint64_t valid_from = head_after + 1 - size;
+                const std::uint64_t copied_from = (head > size ? head - size : 0);
+                if (valid_from > copied_from) {
+                    const std::size_t stale = std::min<std::uint64_t>(valid_from - copied_from, events.size() - first);
+                    events.erase(events.begin() + first, events.begin() + first + stale);
+                }
+            }
+        }
+    }
+
+    events.erase(std::remove_if(events.begin(), events.end(), [since](const Copy &e) { return e.time < since || e.event >= NUM_EVENTS; }), events.end());
+    std::stable_sort(events.begin(), events.end(), [](const Copy &l, const Copy &r) { return l.time < r.time; });
+
+    const std::int64_t system_now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(system_now.time_since_epoch()).count();
+
+    std::string out;
+    char line[256];
+    for (const auto &e : events) {
+        const std::int64_t wall_ns = system_now_ns - static_cast<std::int64_t>(now_ns - e.time);
+        std::time_t seconds = wall_ns / 1000000000;
+        std::tm tm;
+        ::gmtime_r(&seconds, &tm);
+        char when[32];
+        std::strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+
+        const auto &info = event_info[e.event];
+        int n = std::snprintf(line, sizeof(line), "%s.%06uZ %-15s %s", when, static_cast<unsigned>((wall_ns % 1000000000) / 1000), thread_names[e.ring].c_str(), info.name);
+        if (info.a) {
+            n += std::snprintf(line + n, sizeof(line) - n, " %s=%u", info.a, e.a);
+        }
+        if (info.b) {
+            n += std::snprintf(line + n, sizeof(line) - n, " %s=%llu", info.b, static_cast<unsigned long long>(e.b));
+        }
+        if (info.c) {
+            n += std::snprintf(line + n, sizeof(line) - n, " %s=%llu", info.c, static_cast<unsigned long long>(e.c));
+        }
+        out.append(line, n);
+        out += '\n';
+    }
+
+    return out;
+}
+
+std::string airnav::uat::trace::Dump(const std::string &prefix, std::chrono::milliseconds window) {
+    const std::string text = Format(window);
+
+    std::time_t seconds = std::time(nullptr);
+    std::tm tm;
+    ::gmtime_r(&seconds, &tm);
+    char when[32];
+    std::strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &tm);
+
+    const std::string filename = prefix + "-" + when + ".trace";
+    std::ofstream file(filename, std::ios::trunc);
+    file << text;
+    file.close();
+    if (!file) {
+        std::cerr << "Trace: could not write " << filename << ": " << std::strerror(errno) << std::endl;
+        return std::string();
+    }
+    return filename;
+}
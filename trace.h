@@ -0,0 +1,72 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_TRACE_H
+#define DUMP978_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#ifdef DUMP978_USDT
+#include <sys/sdt.h>
+#endif
+
+// A flight recorder: every thread that records an event gets a ring of
+// the most recent events (a fixed number of slots, reused in turn), which
+// stays available after the thread exits until another thread takes it
+// over. Recording is a plain store into the caller's own ring, so it is
+// always on; Format() merges the rings of all threads on demand.
+//
+// Record events through DUMP978_TRACE(EVENT, a, b, c), which also fires a
+// USDT probe dump978:EVENT with the same arguments in builds made with
+// `make USDT=yes` (which needs <sys/sdt.h>, e.g. from systemtap-sdt-dev).
+// The arguments may be evaluated more than once.
+
+#ifdef DUMP978_USDT
+#define DUMP978_TRACE(event, a, b, c)                                                    \
+    do {                                                                                 \
+        DTRACE_PROBE3(dump978, event, (a), (b), (c));                                    \
+        ::airnav::uat::trace::Record(::airnav::uat::trace::Event::event, (a), (b), (c)); \
+    } while (0)
+#else
+#define DUMP978_TRACE(event, a, b, c) ::airnav::uat::trace::Record(::airnav::uat::trace::Event::event, (a), (b), (c))
+#endif
+
+namespace airnav::uat::trace {
+    // What each event's arguments mean
+    enum class Event : std::uint32_t {
+        SAMPLE_BLOCK,      // a receiver got a block: a = samples, b = block timestamp (ms since the epoch), c = index of its first sample
+        SYNC_CANDIDATE,    // a sync word match is being demodulated: a = 1 for downlink, 0 for uplink
+        DOWNLINK_FEC,      // one downlink error correction attempt: a = 1 if it succeeded, b = errors corrected, c = nanoseconds taken
+        UPLINK_FEC,        // one uplink error correction attempt: as DOWNLINK_FEC
+        DISPATCH,          // a message vector is being handed to the output clients: a = messages, b = nanoseconds since its samples were delivered (0 if unknown)
+        SDR_OVERRUN,       // an SDR read reported lost samples: b = samples requested
+        SDR_DROPPED_BLOCK, // an SDR read was discarded because the receiver was behind: b = samples dropped
+        COUNT
+    };
+
+    // Append an event to the calling thread's ring
+    void Record(Event event, std::uint32_t a = 0, std::uint64_t b = 0, std::uint64_t c = 0);
+
+    // Set the number of events each thread's ring holds (rounded up to a
+    // power of two); 0 turns recording off. Only rings created afterwards
+    // are affected, so call this before starting any threads.
+    void SetRingSize(std::size_t events);
+
+    // The events of all threads from the last `window`, oldest first, one
+    // per line: UTC time, thread name, event name, arguments
+    std::string Format(std::chrono::milliseconds window);
+
+    // Write Format(window) to a new file named `prefix`-YYYYMMDD-HHMMSS.trace;
+    // returns the file's name, or the empty string (having logged why) if
+    // it could not be written
+    std::string Dump(const std::string &prefix, std::chrono::milliseconds window);
+
+    const char *EventName(Event event);
+}; // namespace airnav::uat::trace
+
+#endif
@@ -4,22 +4,28 @@
 
 #include "track.h"
 
-#include <iomanip>
-#include <iostream>
+#include <algorithm>
 
 using namespace airnav::uat;
 
-void AircraftState::UpdateFromMessage(const AdsbMessage &message) {
+void AircraftState::UpdateFromMessage(const CompactAdsbMessage &message) {
     if (message.received_at < last_message_time) {
         // Out of order message
         return;
     }
 
-#define UPDATE(x)                                           \
-    do {                                                    \
-        if (message.x) {                                    \
-            x.MaybeUpdate(message.received_at, *message.x); \
-        }                                                   \
+#define UPDATE(x)                                       \
+    do {                                                \
+        if (auto value = message.x()) {                 \
+            x.MaybeUpdate(message.received_at, *value); \
+        }                                               \
+    } while (0)
+
+#define UPDATE_DETAIL(x)                                                 \
+    do {                                                                 \
+        if (auto value = message.x()) {                                  \
+            MutableDetails().x.MaybeUpdate(message.received_at, *value); \
+        }                                                                \
     } while (0)
 
     UPDATE(position); // latitude, longitude
@@ -35,38 +41,38 @@ void AircraftState::UpdateFromMessage(const AdsbMessage &message) {
     UPDATE(magnetic_heading);
     UPDATE(true_heading);
     UPDATE(true_track);
-    UPDATE(aircraft_size); // length, width
-    UPDATE(gps_lateral_offset);
-    UPDATE(gps_longitudinal_offset);
-    UPDATE(gps_position_offset_applied);
-    UPDATE(utc_coupled);
-
-    UPDATE(emitter_category);
-    UPDATE(callsign);
-    UPDATE(flightplan_id); // aka Mode 3/A squawk
-    UPDATE(emergency);
-    UPDATE(mops_version);
-    UPDATE(sil);
-    UPDATE(transmit_mso);
-    UPDATE(sda);
-    UPDATE(nac_p);
-    UPDATE(nac_v);
-    UPDATE(nic_baro);
-    UPDATE(capability_codes);
-    UPDATE(operational_modes);
-    UPDATE(sil_supplement);
-    UPDATE(gva);
-    UPDATE(single_antenna);
-    UPDATE(nic_supplement);
-
-    UPDATE(selected_altitude_mcp);
-    UPDATE(selected_altitude_fms);
-    UPDATE(barometric_pressure_setting);
-    UPDATE(selected_heading);
-    UPDATE(mode_indicators);
+    UPDATE_DETAIL(aircraft_size); // length, width
+    UPDATE_DETAIL(gps_lateral_offset);
+    UPDATE_DETAIL(gps_longitudinal_offset);
+    UPDATE_DETAIL(gps_position_offset_applied);
+    UPDATE_DETAIL(utc_coupled);
+
+    UPDATE_DETAIL(emitter_category);
+    UPDATE_DETAIL(callsign);
+    UPDATE_DETAIL(flightplan_id); // aka Mode 3/A squawk
+    UPDATE_DETAIL(emergency);
+    UPDATE_DETAIL(mops_version);
+    UPDATE_DETAIL(sil);
+    UPDATE_DETAIL(transmit_mso);
+    UPDATE_DETAIL(sda);
+    UPDATE_DETAIL(nac_p);
+    UPDATE_DETAIL(nac_v);
+    UPDATE_DETAIL(nic_baro);
+    UPDATE_DETAIL(capability_codes);
+    UPDATE_DETAIL(operational_modes);
+    UPDATE_DETAIL(sil_supplement);
+    UPDATE_DETAIL(gva);
+    UPDATE_DETAIL(single_antenna);
+    UPDATE_DETAIL(nic_supplement);
+
+    UPDATE_DETAIL(selected_altitude_mcp);
+    UPDATE_DETAIL(selected_altitude_fms);
+    UPDATE_DETAIL(barometric_pressure_setting);
+    UPDATE_DETAIL(selected_heading);
+    UPDATE_DETAIL(mode_indicators);
 
     // derive horizontal containment radius
-    if (message.nic) {
+    if (auto nic_value = message.nic()) {
         static std::map<unsigned, double> rc_lookup = {
             /* 0 - unknown */
             {1, 37040},
@@ -84,14 +90,15 @@ void AircraftState::UpdateFromMessage(const AdsbMessage &message) {
         };
 
         double rc = 0;
-        if (*message.nic == 6) {
+        if (*nic_value == 6) {
+            const auto &nic_supplement = Details().nic_supplement;
             if (nic_supplement.Valid() && nic_supplement.Value()) {
                 rc = 555.6;
             } else {
                 rc = 1111.2;
             }
         } else {
-            auto i = rc_lookup.find(*message.nic);
+            auto i = rc_lookup.find(*nic_value);
             if (i != rc_lookup.end())
                 rc = i->second;
         }
@@ -104,22 +111,137 @@ void AircraftState::UpdateFromMessage(const AdsbMessage &message) {
     ++messages;
 
 #undef UPDATE
+#undef UPDATE_DETAIL
+}
+
+AircraftDetails &AircraftState::MutableDetails() {
+    if (!details_) {
+        details_.reset(new AircraftDetails());
+    }
+    return *details_;
+}
+
+const AircraftDetails &AircraftState::NoDetails() {
+    static const AircraftDetails none;
+    return none;
+}
+
+const AircraftTable::Key AircraftTable::EMPTY;
+const unsigned AircraftTable::MIN_SLOT_BITS;
+
+std::size_t AircraftTable::FindSlot(Key key) const {
+    const std::size_t mask = slots_.size() - 1;
+    std::size_t i = Home(key);
+    while (slots_[i].key != key && slots_[i].key != EMPTY) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+AircraftState &AircraftTable::FindOrInsert(AddressQualifier aq, AdsbAddress address) {
+    const Key key = MakeKey(aq, address);
+    std::size_t slot = FindSlot(key);
+    if (slots_[slot].key == key) {
+        return states_[slots_[slot].index];
+    }
+
+    if ((states_.size() + 1) * 2 > slots_.size()) {
+        Grow();
+        slot = FindSlot(key);
+    }
+
+    slots_[slot] = {key, static_cast<std::uint32_t>(states_.size())};
+    states_.emplace_back(aq, address);
+    return states_.back();
+}
+
+const AircraftState *AircraftTable::Find(Key key) const {
+    const Slot &slot = slots_[FindSlot(key)];
+    if (slot.key == EMPTY) {
+        return nullptr;
+    }
+    return &states_[slot.index];
+}
+
+void AircraftTable::EraseAt(std::size_t index) {
+    const std::size_t mask = slots_.size() - 1;
+
+    // remove the slot, then shift later members of its probe run back so
+    // that no lookup runs into the hole (backward-shift deletion)
+    std::size_t hole = FindSlot(StateKey(states_[index]));
+    for (std::size_t i = (hole + 1) & mask; slots_[i].key != EMPTY; i = (i + 1) & mask) {
+        // move slot i into the hole unless its home lies cyclically in (hole, i]
+        const std::size_t home = Home(slots_[i].key);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            slots_[hole] = slots_[i];
+            hole = i;
+        }
+    }
+    slots_[hole].key = EMPTY;
+
+    // fill the gap in the states with the last state
+    const std::size_t last = states_.size() - 1;
+    if (index != last) {
+        states_[index] = std::move(states_[last]);
+        slots_[FindSlot(StateKey(states_[index]))].index = index;
+    }
+    states_.pop_back();
 }
 
+void AircraftTable::Grow() {
+    ++slot_bits_;
+    std::vector<Slot> old_slots(std::size_t(1) << slot_bits_, Slot{EMPTY, 0});
+    old_slots.swap(slots_);
+
+    for (const auto &slot : old_slots) {
+        if (slot.key != EMPTY) {
+            slots_[FindSlot(slot.key)] = slot;
+        }
+    }
+}
+
+const std::size_t Tracker::WHEEL_SLOTS;
+
+Tracker::Tracker(boost::asio::io_service &service, std::chrono::milliseconds timeout, bool realtime) : service_(service), strand_(service), timer_(service), timeout_(timeout), realtime_(realtime) { bucket_ms_ = std::max<std::uint64_t>(1, timeout_.count() / 16); }
+
 void Tracker::Start() { PurgeOld(); }
 
 void Tracker::Stop() { timer_.cancel(); }
 
 void Tracker::PurgeOld() {
-    std::uint64_t expires_timestamp = now_millis() - timeout_.count();
+    const std::uint64_t now = (realtime_ ? now_millis() : latest_message_time_);
+    if (now > static_cast<std::uint64_t>(timeout_.count())) {
+        const std::uint64_t expires_timestamp = now - timeout_.count();
 
-    for (auto i = aircraft_.begin(); i != aircraft_.end();) {
-        if (i->second.last_message_time < expires_timestamp) {
-            i = aircraft_.erase(i);
-        } else {
-            ++i;
+        // every bucket before this one is wholly older than expires_timestamp;
+        // after a jump in time, each slot only needs visiting once
+        const std::uint64_t expired_buckets = expires_timestamp / bucket_ms_;
+        const std::uint64_t visit = std::min<std::uint64_t>(expired_buckets > next_expiry_bucket_ ? expired_buckets - next_expiry_bucket_ : 0, WHEEL_SLOTS);
+        for (std::uint64_t bucket = next_expiry_bucket_; bucket < next_expiry_bucket_ + visit; ++bucket) {
+            const std::size_t slot = bucket % WHEEL_SLOTS;
+            auto &keys = wheel_[slot];
+            std::size_t kept = 0;
+            for (auto key : keys) {
+                auto state = aircraft_.FindMutable(key);
+                if (!state) {
+                    continue; // already expired via another entry
+                }
+                if (state->last_message_time < expires_timestamp) {
+                    if (track_changes_) {
+                        removed_.push_back(key);
+                    }
+                    aircraft_.Erase(key);
+                } else if (state->expiry_bucket % WHEEL_SLOTS == slot) {
+                    keys[kept++] = key; // a later bucket that shares the slot
+                }
+                // otherwise the aircraft has been filed in a later slot
+            }
+            keys.resize(kept);
         }
+        next_expiry_bucket_ = std::max(next_expiry_bucket_, expired_buckets);
+        num_aircraft_ = aircraft_.size();
     }
+
     auto self(shared_from_this());
     timer_.expires_from_now(timeout_ / 4);
     timer_.async_wait(strand_.wrap([this, self](const boost::system::error_code &ec) {
@@ -130,39 +252,59 @@ void Tracker::PurgeOld() {
 }
 
 void Tracker::HandleMessages(SharedMessageVector messages) {
-    static auto unix_epoch = std::chrono::system_clock::from_time_t(0);
-    const std::uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - unix_epoch).count();
+    const std::uint64_t now = now_millis();
 
     auto self(shared_from_this());
     strand_.dispatch([this, self, now, messages]() {
         const std::uint64_t PAST_FUZZ = 15000;
         const std::uint64_t FUTURE_FUZZ = 1000;
 
-        for (const auto &message : *messages) {
-            // Handle only downlink messages
-            if (message.Type() != MessageType::DOWNLINK_SHORT && message.Type() != MessageType::DOWNLINK_LONG) {
-                continue;
-            }
-
+        for (const auto &message : messages->DecodedDownlink()) {
             // validate message time vs system clock so we are only processing
             // contemporaneous messages
-            if (message.ReceivedAt() == 0 || message.ReceivedAt() < (now - PAST_FUZZ) || message.ReceivedAt() > (now + FUTURE_FUZZ)) {
-                std::cerr << "DISCARD " << message.ReceivedAt() << std::endl;
+            if (realtime_ && (message.received_at == 0 || message.received_at < (now - PAST_FUZZ) || message.received_at > (now + FUTURE_FUZZ))) {
+                ++discarded_messages_;
                 continue;
             }
 
-            HandleMessage(AdsbMessage(message));
+            HandleMessage(message);
         }
+
+        num_aircraft_ = aircraft_.size();
     });
 }
 
-void Tracker::HandleMessage(const AdsbMessage &message) {
-    AddressKey key{message.address_qualifier, message.address};
-    auto i = aircraft_.find(key);
-    if (i == aircraft_.end()) {
-        aircraft_[key] = {message.address_qualifier, message.address};
+void Tracker::TakeChanges(std::vector<AircraftTable::Key> &updated, std::vector<AircraftTable::Key> &removed) {
+    for (auto key : updated_) {
+        if (auto state = aircraft_.FindMutable(key)) {
+            state->dirty = false;
+        }
     }
 
-    aircraft_[key].UpdateFromMessage(message);
+    updated.clear();
+    removed.clear();
+    updated.swap(updated_);
+    removed.swap(removed_);
+}
+
+void Tracker::HandleMessage(const CompactAdsbMessage &message) {
+    auto &state = aircraft_.FindOrInsert(message.address_qualifier, message.address);
+    state.UpdateFromMessage(message);
+    File(state);
+    if (track_changes_ && !state.dirty) {
+        state.dirty = true;
+        updated_.push_back(AircraftTable::StateKey(state));
+    }
+    latest_message_time_ = std::max(latest_message_time_, message.received_at);
     ++total_messages_;
 }
+
+void Tracker::File(AircraftState &state) {
+    // aircraft heard from in buckets that have already been purged go in
+    // the next bucket to be purged
+    const std::uint64_t bucket = std::max(state.last_message_time / bucket_ms_, next_expiry_bucket_);
+    if (bucket != state.expiry_bucket) {
+        state.expiry_bucket = bucket;
+        wheel_[bucket % WHEEL_SLOTS].push_back(AircraftTable::StateKey(state));
+    }
+}
@@ -7,9 +7,12 @@
 #ifndef FAUP978_TRACK_H
 #define FAUP978_TRACK_H
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <numeric>
+#include <vector>
 
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/steady_timer.hpp>
@@ -73,29 +76,10 @@ namespace airnav::uat {
         T v_;
     };
 
-    struct AircraftState {
-        AircraftState(AddressQualifier aq = AddressQualifier::INVALID, AdsbAddress ad = 0) : address_qualifier(aq), address(ad) { rssi.fill(0.0); }
-
-        AddressQualifier address_qualifier;
-        AdsbAddress address;
-
-        std::uint64_t last_message_time = 0;
-        std::uint32_t messages = 0;
-        std::array<double, 16> rssi;
-
-        AgedField<std::pair<double, double>> position; // latitude, longitude
-        AgedField<int> pressure_altitude;
-        AgedField<int> geometric_altitude;
-        AgedField<unsigned> nic;
-        AgedField<AirGroundState> airground_state;
-        AgedField<int> north_velocity;
-        AgedField<int> east_velocity;
-        AgedField<int> vertical_velocity_barometric;
-        AgedField<int> vertical_velocity_geometric;
-        AgedField<int> ground_speed;
-        AgedField<double> magnetic_heading;
-        AgedField<double> true_heading;
-        AgedField<double> true_track;
+    // The fields of an aircraft's state that change rarely (mostly those
+    // from Mode Status and Auxiliary State Vector elements). These are kept
+    // out of line so that the commonly-updated state stays compact.
+    struct AircraftDetails {
         AgedField<std::pair<double, double>> aircraft_size; // length, width
         AgedField<double> gps_lateral_offset;
         AgedField<double> gps_longitudinal_offset;
@@ -120,14 +104,49 @@ namespace airnav::uat {
         AgedField<bool> single_antenna;
         AgedField<bool> nic_supplement;
 
-        // derived from nic, nic_supplement
-        AgedField<double> horizontal_containment; // upper bound, meters
-
         AgedField<int> selected_altitude_mcp;
         AgedField<int> selected_altitude_fms;
         AgedField<double> barometric_pressure_setting;
         AgedField<double> selected_heading;
         AgedField<ModeIndicators> mode_indicators;
+    };
+
+    struct AircraftState {
+        AircraftState(AddressQualifier aq = AddressQualifier::INVALID, AdsbAddress ad = 0) : address_qualifier(aq), address(ad) { rssi.fill(0.0); }
+
+        AircraftState(AircraftState &&) = default;
+        AircraftState &operator=(AircraftState &&) = default;
+
+        AddressQualifier address_qualifier;
+        AdsbAddress address;
+
+        std::uint64_t last_message_time = 0;
+        std::uint32_t messages = 0;
+        bool dirty = false;                 // queued in the tracker's change list
+        std::uint64_t expiry_bucket = ~0ULL; // the tracker's expiry wheel bucket it was last filed under
+        std::array<float, 16> rssi;
+
+        AgedField<std::pair<double, double>> position; // latitude, longitude
+        AgedField<int> pressure_altitude;
+        AgedField<int> geometric_altitude;
+        AgedField<unsigned> nic;
+        AgedField<AirGroundState> airground_state;
+        AgedField<int> north_velocity;
+        AgedField<int> east_velocity;
+        AgedField<int> vertical_velocity_barometric;
+        AgedField<int> vertical_velocity_geometric;
+        AgedField<int> ground_speed;
+        AgedField<double> magnetic_heading;
+        AgedField<double> true_heading;
+        AgedField<double> true_track;
+
+        // derived from nic, nic_supplement
+        AgedField<double> horizontal_containment; // upper bound, meters
+
+        // The rarely-changing fields. These are allocated the first time one
+        // of them is received; until then, Details() returns a shared
+        // all-invalid instance.
+        const AircraftDetails &Details() const { return details_ ? *details_ : NoDetails(); }
 
         double AverageRssi() const {
             if (!messages)
@@ -136,37 +155,164 @@ namespace airnav::uat {
             return std::accumulate(rssi.begin(), rssi.end(), 0.0) / std::min<double>(messages, rssi.size());
         }
 
-        void UpdateFromMessage(const AdsbMessage &message);
+        void UpdateFromMessage(const CompactAdsbMessage &message);
+
+      private:
+        AircraftDetails &MutableDetails();
+        static const AircraftDetails &NoDetails();
+
+        std::unique_ptr<AircraftDetails> details_;
+    };
+
+    // The set of tracked aircraft, keyed on (address qualifier, address).
+    //
+    // States are stored contiguously, in no particular order, so that
+    // walking the whole table (for expiry, or to report it) is a linear
+    // scan. Lookups go through an open-addressing hash index (linear
+    // probing, kept at most half full) of small slots that map a packed
+    // key to a position in the state array. Erasing moves the last state
+    // into the hole, so erasing invalidates references and positions.
+    class AircraftTable {
+      public:
+        typedef std::vector<AircraftState>::const_iterator const_iterator;
+
+        // (address qualifier, address) packed into 32 bits: the qualifier
+        // (at most 8) goes above the 24-bit address
+        typedef std::uint32_t Key;
+        static Key MakeKey(AddressQualifier aq, AdsbAddress address) { return (static_cast<Key>(aq) << 24) | (address & 0xFFFFFF); }
+        static Key StateKey(const AircraftState &state) { return MakeKey(state.address_qualifier, state.address); }
+
+        AircraftTable() : slots_(std::size_t(1) << MIN_SLOT_BITS, Slot{EMPTY, 0}) {}
+
+        // Return the state for this aircraft, adding a new one if it is not
+        // already in the table
+        AircraftState &FindOrInsert(AddressQualifier aq, AdsbAddress address);
+
+        // Return the state for this aircraft, or nullptr if it is not in the table
+        const AircraftState *Find(AddressQualifier aq, AdsbAddress address) const { return Find(MakeKey(aq, address)); }
+        const AircraftState *Find(Key key) const;
+
+        // Remove the state for this key, if there is one
+        void Erase(Key key) {
+            const Slot &slot = slots_[FindSlot(key)];
+            if (slot.key != EMPTY) {
+                EraseAt(slot.index);
+            }
+        }
+
+        // Remove every state for which `pred(state)` is true
+        template <class F> void EraseIf(F pred) {
+            for (std::size_t i = 0; i < states_.size();) {
+                if (pred(const_cast<const AircraftState &>(states_[i]))) {
+                    EraseAt(i);
+                } else {
+                    ++i;
+                }
+            }
+        }
+
+        const_iterator begin() const { return states_.begin(); }
+        const_iterator end() const { return states_.end(); }
+        std::size_t size() const { return states_.size(); }
+        bool empty() const { return states_.empty(); }
+
+      private:
+        friend class Tracker;
+
+        AircraftState *FindMutable(Key key) { return const_cast<AircraftState *>(Find(key)); }
+
+        // no real key has a qualifier this large
+        static const Key EMPTY = 0xFFFFFFFF;
+        static const unsigned MIN_SLOT_BITS = 6;
+
+        struct Slot {
+            Key key;
+            std::uint32_t index; // into states_
+        };
+
+        // Fibonacci hashing: the top bits of the product depend on all the
+        // bits of the key, so clustered addresses still spread out
+        std::size_t Home(Key key) const { return static_cast<std::uint32_t>(key * 2654435769U) >> (32 - slot_bits_); }
+        std::size_t FindSlot(Key key) const; // slot holding key, or the empty slot where it would go
+
+        void EraseAt(std::size_t index);
+        void Grow();
+
+        unsigned slot_bits_ = MIN_SLOT_BITS;
+        std::vector<Slot> slots_; // 2^slot_bits_ of them
+        std::vector<AircraftState> states_;
     };
 
     class Tracker : public std::enable_shared_from_this<Tracker> {
       public:
-        typedef std::pair<AddressQualifier, AdsbAddress> AddressKey;
         typedef std::shared_ptr<Tracker> Pointer;
-        typedef std::map<AddressKey, AircraftState> MapType;
 
-        static Pointer Create(boost::asio::io_service &service, std::chrono::milliseconds timeout = std::chrono::seconds(300)) { return Pointer(new Tracker(service, timeout)); }
+        // If `realtime` is set, messages are expected to carry system-clock
+        // timestamps; messages that are not contemporaneous are discarded,
+        // and aircraft expire relative to the system clock. Otherwise (e.g.
+        // for messages from a file) aircraft expire relative to the most
+        // recent message.
+        static Pointer Create(boost::asio::io_service &service, std::chrono::milliseconds timeout = std::chrono::seconds(300), bool realtime = true) { return Pointer(new Tracker(service, timeout, realtime)); }
 
         void Start();
         void Stop();
         void HandleMessages(SharedMessageVector messages);
 
-        const MapType &Aircraft() const { return aircraft_; }
+        // Only safe to use from handlers run via Strand()
+        const AircraftTable &Aircraft() const { return aircraft_; }
+        boost::asio::io_service::strand &Strand() { return strand_; }
+
+        // These may be read from any thread
         std::uint32_t TotalMessages() const { return total_messages_; }
+        std::uint64_t DiscardedMessages() const { return discarded_messages_; }
+        std::size_t NumAircraft() const { return num_aircraft_; }
+
+        // Start recording which aircraft change, for TakeChanges
+        void TrackChanges() { track_changes_ = true; }
+
+        // Swap out the keys of the aircraft that have been added or updated,
+        // and of those that have expired, since the last call. An aircraft
+        // that expired and then reappeared can be in both lists, and an
+        // updated key may no longer be in the table if the aircraft has
+        // since expired. Only safe to use via Strand().
+        void TakeChanges(std::vector<AircraftTable::Key> &updated, std::vector<AircraftTable::Key> &removed);
 
         void PurgeOld();
 
       private:
-        Tracker(boost::asio::io_service &service, std::chrono::milliseconds timeout) : service_(service), strand_(service), timer_(service), timeout_(timeout) {}
+        Tracker(boost::asio::io_service &service, std::chrono::milliseconds timeout, bool realtime);
+
+        void HandleMessage(const CompactAdsbMessage &message);
+
+        // Expiry works from a timer wheel: a ring of WHEEL_SLOTS lists of
+        // keys, with slot (t / bucket_ms_) % WHEEL_SLOTS taking the aircraft
+        // last heard from at time t. Buckets are timeout_ / 16 wide, so the
+        // ring spans twice the timeout and a slot's live keys all belong
+        // to one bucket. An aircraft is filed again each time its last
+        // message moves it into a later bucket, and its old entry is left
+        // to be dropped when that slot is next purged; so expiry only
+        // visits the slots whose buckets have wholly passed, costing
+        // O(expired + moved) rather than a scan of every aircraft.
+        static const std::size_t WHEEL_SLOTS = 32;
 
-        void HandleMessage(const AdsbMessage &message);
+        void File(AircraftState &state);
 
         boost::asio::io_service &service_;
         boost::asio::io_service::strand strand_;
         boost::asio::steady_timer timer_;
         std::chrono::milliseconds timeout_;
-        MapType aircraft_;
-        std::uint32_t total_messages_ = 0;
+        bool realtime_;
+        AircraftTable aircraft_;
+        bool track_changes_ = false;
+        std::vector<AircraftTable::Key> updated_;
+        std::vector<AircraftTable::Key> removed_;
+        std::uint64_t latest_message_time_ = 0;
+        std::uint64_t bucket_ms_;
+        std::uint64_t next_expiry_bucket_ = 0; // earliest bucket that may still hold live aircraft
+        std::array<std::vector<AircraftTable::Key>, WHEEL_SLOTS> wheel_;
+        std::atomic<std::uint32_t> total_messages_{0};
+        std::atomic<std::uint64_t> discarded_messages_{0};
+        std::atomic<std::size_t> num_aircraft_{0};
     };
 }; // namespace airnav::uat
 
@@ -4,74 +4,417 @@
 
 #include "uat_message.h"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
-
-#include <boost/io/ios_state.hpp>
+#include <type_traits>
 
 using namespace airnav::uat;
 
 //
-// streaming raw messages
+// number and hex formatting for the encoders
 //
 
-std::ostream &airnav::uat::operator<<(std::ostream &os, const RawMessage &message) {
-    boost::io::ios_flags_saver ifs(os);
+static const char hex_digits[] = "0123456789abcdef";
+
+static void AppendUnsigned(std::string &out, std::uint64_t value) {
+    char buf[20];
+    char *p = buf + sizeof(buf);
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    out.append(p, buf + sizeof(buf));
+}
+
+static void AppendSigned(std::string &out, std::int64_t value) {
+    if (value < 0) {
+        out += '-';
+        AppendUnsigned(out, 0 - (std::uint64_t)value);
+    } else {
+        AppendUnsigned(out, (std::uint64_t)value);
+    }
+}
 
+// Same result as printing with std::fixed and std::setprecision(1)
+static void AppendFixed1(std::string &out, float value) {
+    // value * 10 is exact for any float, so rounding it to nearest-even gives
+    // the same result as printf's correctly rounded decimal conversion
+    const double scaled = (double)value * 10.0;
+    if (!std::isfinite(scaled) || std::fabs(scaled) >= 1e18) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.1f", (double)value);
+        out += buf;
+        return;
+    }
+
+    const double rounded = std::nearbyint(scaled);
+    if (std::signbit(rounded))
+        out += '-';
+    const std::uint64_t tenths = (std::uint64_t)std::fabs(rounded);
+    AppendUnsigned(out, tenths / 10);
+    out += '.';
+    out += (char)('0' + tenths % 10);
+}
+
+//
+// encoding raw messages
+//
+
+void airnav::uat::EncodeRaw(const RawMessage &message, std::string &out) {
     switch (message.Type()) {
     case MessageType::DOWNLINK_SHORT:
     case MessageType::DOWNLINK_LONG:
-        os << '-';
+        out += '-';
         break;
     case MessageType::UPLINK:
-        os << '+';
+        out += '+';
         break;
     case MessageType::METADATA:
-        os << '!';
+        out += '!';
         break;
     default:
         throw std::logic_error("unexpected message type");
     }
 
     if (message.Type() != MessageType::METADATA) {
-        os << std::setfill('0');
-        for (auto b : message.Payload()) {
-            os << std::hex << std::setw(2) << (int)b;
+        const auto &payload = message.Payload();
+        const auto start = out.size();
+        out.resize(start + payload.size() * 2 + 1);
+        char *p = &out[start];
+        for (auto b : payload) {
+            *p++ = hex_digits[b >> 4];
+            *p++ = hex_digits[b & 15];
         }
-
-        os << ";";
+        *p = ';';
     }
 
     if (message.Errors() > 0) {
-        os << "rs=" << std::dec << std::setw(0) << message.Errors() << ';';
+        out += "rs=";
+        AppendUnsigned(out, message.Errors());
+        out += ';';
     }
     if (message.Rssi() != 0) {
-        os << "rssi=" << std::dec << std::setprecision(1) << std::fixed << message.Rssi() << ';';
+        out += "rssi=";
+        AppendFixed1(out, message.Rssi());
+        out += ';';
     }
     if (message.ReceivedAt() != 0) {
-        os << "t=" << std::dec << std::setw(0) << (message.ReceivedAt() / 1000) << '.' << std::setfill('0') << std::setw(3) << (message.ReceivedAt() % 1000) << ';';
+        out += "t=";
+        AppendUnsigned(out, message.ReceivedAt() / 1000);
+        const unsigned ms = message.ReceivedAt() % 1000;
+        out += '.';
+        out += (char)('0' + ms / 100);
+        out += (char)('0' + ms / 10 % 10);
+        out += (char)('0' + ms % 10);
+        out += ';';
     }
     if (message.RawTimestamp() != 0) {
-        os << "rt=" << std::dec << std::setw(0) << message.RawTimestamp() << ';';
+        out += "rt=";
+        AppendUnsigned(out, message.RawTimestamp());
+        out += ';';
+    }
+    if (message.Copies() > 1) {
+        out += "dup=";
+        AppendUnsigned(out, message.Copies());
+        out += ';';
     }
     for (auto &i : message.Metadata()) {
-        os << i.first << '=' << i.second << ';';
+        out += i.first;
+        out += '=';
+        out += i.second;
+        out += ';';
+    }
+}
+
+const RawMessage::MetadataMap &RawMessage::NoMetadata() {
+    static const MetadataMap empty;
+    return empty;
+}
+
+// Recycled message vectors. Never destroyed, as vectors may be released
+// by other threads during exit.
+static std::mutex message_vector_pool_mutex;
+static std::vector<MessageVector *> &MessageVectorPool() {
+    static auto *pool = new std::vector<MessageVector *>();
+    return *pool;
+}
+
+// The most idle vectors kept for reuse; enough for every pipeline queue
+// and output client to hold a few
+static const std::size_t MESSAGE_VECTOR_POOL_SIZE = 256;
+
+SharedMessageVector MessageVector::Create() {
+    MessageVector *messages = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(message_vector_pool_mutex);
+        auto &pool = MessageVectorPool();
+        if (!pool.empty()) {
+            messages = pool.back();
+            pool.pop_back();
+        }
+    }
+
+    if (!messages) {
+        messages = new MessageVector();
+    }
+    return SharedMessageVector(messages, &MessageVector::Release);
+}
+
+void MessageVector::Release(MessageVector *messages) {
+    messages->Recycle();
+
+    {
+        std::lock_guard<std::mutex> lock(message_vector_pool_mutex);
+        auto &pool = MessageVectorPool();
+        if (pool.size() < MESSAGE_VECTOR_POOL_SIZE) {
+            pool.push_back(messages);
+            return;
+        }
+    }
+
+    delete messages;
+}
+
+void MessageVector::Recycle() {
+    clear();
+    timing = MessageTiming();
+    source = 0;
+    decoded_.clear();
+    decoded_ready_.store(false, std::memory_order_relaxed);
+    decoded_uplink_.clear();
+    decoded_uplink_ready_.store(false, std::memory_order_relaxed);
+}
+
+const std::vector<CompactAdsbMessage> &MessageVector::DecodedDownlink() const {
+    if (!decoded_ready_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        if (!decoded_ready_.load(std::memory_order_relaxed)) {
+            for (const auto &message : *this) {
+                if (message.Type() == MessageType::DOWNLINK_SHORT || message.Type() == MessageType::DOWNLINK_LONG) {
+                    decoded_.emplace_back(message);
+                }
+            }
+            decoded_ready_.store(true, std::memory_order_release);
+        }
+    }
+    return decoded_;
+}
+
+const std::vector<UplinkMessage> &MessageVector::DecodedUplink() const {
+    if (!decoded_uplink_ready_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        if (!decoded_uplink_ready_.load(std::memory_order_relaxed)) {
+            for (const auto &message : *this) {
+                if (message.Type() == MessageType::UPLINK) {
+                    decoded_uplink_.emplace_back(message);
+                }
+            }
+            decoded_uplink_ready_.store(true, std::memory_order_release);
+        }
+    }
+    return decoded_uplink_;
+}
+
+void airnav::uat::EncodeRawLines(const MessageVector &messages, std::string &out, bool latency) {
+    const auto received = messages.timing.received;
+    latency = latency && (received != std::chrono::steady_clock::time_point());
+    const std::uint64_t lat = (latency ? std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - received).count() : 0);
+
+    for (const auto &message : messages) {
+        if (message.Type() == MessageType::INVALID) {
+            continue;
+        }
+
+        EncodeRaw(message, out);
+        if (latency && message.Type() != MessageType::METADATA) {
+            out += "lat=";
+            AppendUnsigned(out, lat);
+            out += ';';
+        }
+        out += '\n';
+    }
+}
+
+//
+// binary framing
+//
+
+enum : std::uint8_t { BINARY_METADATA = 0, BINARY_DOWNLINK_SHORT = 1, BINARY_DOWNLINK_LONG = 2, BINARY_UPLINK = 3 };
+
+static void AppendBigEndian(std::string &out, std::uint64_t value, unsigned bytes) {
+    for (unsigned i = bytes; i > 0; --i) {
+        out += (char)((value >> (8 * (i - 1))) & 0xFF);
+    }
+}
+
+static std::uint64_t ReadBigEndian(const std::uint8_t *p, unsigned bytes) {
+    std::uint64_t value = 0;
+    for (unsigned i = 0; i < bytes; ++i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+void airnav::uat::EncodeBinary(const RawMessage &message, std::string &out) {
+    std::uint8_t type;
+    switch (message.Type()) {
+    case MessageType::DOWNLINK_SHORT:
+        type = BINARY_DOWNLINK_SHORT;
+        break;
+    case MessageType::DOWNLINK_LONG:
+        type = BINARY_DOWNLINK_LONG;
+        break;
+    case MessageType::UPLINK:
+        type = BINARY_UPLINK;
+        break;
+    case MessageType::METADATA:
+        type = BINARY_METADATA;
+        break;
+    default:
+        throw std::logic_error("unexpected message type");
+    }
+
+    // the length is filled in once the frame is complete
+    const auto start = out.size();
+    out.append(BINARY_LENGTH_BYTES, '\0');
+    out += (char)type;
+
+    if (message.Type() == MessageType::METADATA) {
+        for (const auto &i : message.Metadata()) {
+            out += i.first;
+            out += '=';
+            out += i.second;
+            out += ';';
+        }
+    } else {
+        const long centi_db = std::lround(std::max(-327.68f, std::min(327.67f, message.Rssi())) * 100.0f);
+        AppendBigEndian(out, std::min(message.Errors(), 255U), 1);
+        AppendBigEndian(out, (std::uint16_t)(std::int16_t)centi_db, 2);
+        AppendBigEndian(out, std::min(message.Copies(), 65535U), 2);
+        AppendBigEndian(out, message.ReceivedAt(), 8);
+        AppendBigEndian(out, message.RawTimestamp(), 8);
+        out.append(message.Payload().begin(), message.Payload().end());
     }
 
-    return os;
+    const std::size_t length = out.size() - start - BINARY_LENGTH_BYTES;
+    if (length > 65535) {
+        throw std::length_error("message too large for a binary frame");
+    }
+    out[start] = (char)(length >> 8);
+    out[start + 1] = (char)(length & 0xFF);
+}
+
+void airnav::uat::EncodeBinaryFrames(const MessageVector &messages, std::string &out) {
+    for (const auto &message : messages) {
+        if (message.Type() != MessageType::INVALID) {
+            EncodeBinary(message, out);
+        }
+    }
+}
+
+std::size_t airnav::uat::BinaryFrameSize(const std::uint8_t *begin, const std::uint8_t *end) {
+    if (end - begin < (std::ptrdiff_t)BINARY_LENGTH_BYTES) {
+        return 0;
+    }
+    const std::size_t size = BINARY_LENGTH_BYTES + ReadBigEndian(begin, BINARY_LENGTH_BYTES);
+    return ((std::size_t)(end - begin) < size ? 0 : size);
+}
+
+boost::optional<RawMessage> airnav::uat::DecodeBinary(const std::uint8_t *frame, std::size_t size) {
+    if (size < BINARY_LENGTH_BYTES + 1) {
+        return boost::none;
+    }
+
+    const std::uint8_t type = frame[BINARY_LENGTH_BYTES];
+    const std::uint8_t *body = frame + BINARY_LENGTH_BYTES + 1;
+    const std::uint8_t *end = frame + size;
+
+    if (type == BINARY_METADATA) {
+        RawMessage::MetadataMap metadata;
+        const char *i = reinterpret_cast<const char *>(body);
+        const char *text_end = reinterpret_cast<const char *>(end);
+        while (i < text_end) {
+            auto equals = static_cast<const char *>(std::memchr(i, '=', text_end - i));
+            auto semicolon = static_cast<const char *>(std::memchr(i, ';', text_end - i));
+            if (!equals || !semicolon || semicolon < equals) {
+                break;
+            }
+            metadata[std::string(i, equals)] = std::string(equals + 1, semicolon);
+            i = semicolon + 1;
+        }
+        return RawMessage(std::move(metadata));
+    }
+
+    MessageType expected;
+    switch (type) {
+    case BINARY_DOWNLINK_SHORT:
+        expected = MessageType::DOWNLINK_SHORT;
+        break;
+    case BINARY_DOWNLINK_LONG:
+        expected = MessageType::DOWNLINK_LONG;
+        break;
+    case BINARY_UPLINK:
+        expected = MessageType::UPLINK;
+        break;
+    default:
+        return RawMessage();
+    }
+
+    if (size < BINARY_LENGTH_BYTES + BINARY_MESSAGE_HEADER_BYTES) {
+        return boost::none;
+    }
+
+    const unsigned errors = body[0];
+    const float rssi = (std::int16_t)ReadBigEndian(body + 1, 2) / 100.0f;
+    const unsigned copies = (unsigned)ReadBigEndian(body + 3, 2);
+    const std::uint64_t received_at = ReadBigEndian(body + 5, 8);
+    const std::uint64_t raw_timestamp = ReadBigEndian(body + 13, 8);
+
+    RawMessage message(body + BINARY_MESSAGE_HEADER_BYTES - 1, end - (body + BINARY_MESSAGE_HEADER_BYTES - 1), received_at, errors, rssi, raw_timestamp);
+    if (message.Type() != expected) {
+        // payload length does not match the frame type
+        return boost::none;
+    }
+    if (copies > 1) {
+        message.SetCopies(copies);
+    }
+    return message;
+}
+
+std::ostream &airnav::uat::operator<<(std::ostream &os, const RawMessage &message) {
+    std::string encoded;
+    EncodeRaw(message, encoded);
+    return os << encoded;
 }
 
 //
 // decoding messages
 //
 
-AdsbMessage::AdsbMessage(const RawMessage &raw) {
+// Round `value` to `dp` decimal places as RoundN does, but return the result
+// scaled up by 10^dp as an integer: RoundN(value, dp) == ScaledRound(value, dp) / 10^dp
+static inline std::int32_t ScaledRound(double value, unsigned dp) { return static_cast<std::int32_t>(std::round(value * std::pow(10, dp))); }
+
+CompactAdsbMessage::CompactAdsbMessage(const RawMessage &raw) {
     if (raw.Type() != MessageType::DOWNLINK_SHORT && raw.Type() != MessageType::DOWNLINK_LONG) {
         throw std::logic_error("can't parse this sort of message as a downlink ADS-B message");
     }
 
+    // The decoders below read fields without bounds checks, so check the
+    // payload length once up front: at least a short message for the header
+    // and state vector, and a long message for payload types that carry
+    // anything else.
+    const auto &payload = raw.Payload();
+    if (payload.size() < DOWNLINK_SHORT_DATA_BYTES) {
+        throw std::out_of_range("payload too short for a downlink message");
+    }
+
     // Metadata
     received_at = raw.ReceivedAt();
     raw_timestamp = raw.RawTimestamp();
@@ -79,9 +422,13 @@ AdsbMessage::AdsbMessage(const RawMessage &raw) {
     rssi = raw.Rssi();
 
     // HDR
-    payload_type = raw.Bits(1, 1, 1, 5);
-    address_qualifier = static_cast<AddressQualifier>(raw.Bits(1, 6, 1, 8));
-    address = raw.Bits(2, 1, 4, 8);
+    payload_type = raw.Field<1, 1, 1, 5>();
+    address_qualifier = static_cast<AddressQualifier>(raw.Field<1, 6, 1, 8>());
+    address = raw.Field<2, 1, 4, 8>();
+
+    if (payload_type >= 1 && payload_type <= 6 && payload.size() < DOWNLINK_LONG_DATA_BYTES) {
+        throw std::out_of_range("payload too short for its payload type");
+    }
 
     // Optional parts of the message
     // DO-282B Table 2-10 "Composition of the ADS-B Payload"
@@ -101,11 +448,11 @@ AdsbMessage::AdsbMessage(const RawMessage &raw) {
     case 3:
         DecodeSV(raw);
         DecodeMS(raw);
-        DecodeTS(raw, 30);
+        DecodeTS<30>(raw);
         break;
     case 4:
         DecodeSV(raw);
-        DecodeTS(raw, 30);
+        DecodeTS<30>(raw);
         break;
     case 5:
         DecodeSV(raw);
@@ -113,7 +460,7 @@ AdsbMessage::AdsbMessage(const RawMessage &raw) {
         break;
     case 6:
         DecodeSV(raw);
-        DecodeTS(raw, 25);
+        DecodeTS<25>(raw);
         DecodeAUXSV(raw);
         break;
     case 7:
@@ -129,23 +476,26 @@ AdsbMessage::AdsbMessage(const RawMessage &raw) {
     }
 }
 
-void AdsbMessage::DecodeSV(const RawMessage &raw) {
-    auto raw_lat = raw.Bits(5, 1, 7, 7);
-    auto raw_lon = raw.Bits(7, 8, 10, 7);
+void CompactAdsbMessage::DecodeSV(const RawMessage &raw) {
+    auto raw_lat = raw.Field<5, 1, 7, 7>();
+    auto raw_lon = raw.Field<7, 8, 10, 7>();
 
-    auto raw_alt = raw.Bits(11, 1, 12, 4);
+    auto raw_alt = raw.Field<11, 1, 12, 4>();
     if (raw_alt != 0) {
-        auto altitude = (raw_alt - 41) * 25;
-        if (raw.Bit(10, 8)) { // 2.2.4.5.2.2 "ALTITUDE TYPE" field
-            geometric_altitude = altitude;
+        int altitude = (raw_alt - 41) * 25;
+        if (raw.Bit<10, 8>()) { // 2.2.4.5.2.2 "ALTITUDE TYPE" field
+            geometric_altitude_ = altitude;
+            Set(GEOMETRIC_ALTITUDE);
         } else {
-            pressure_altitude = altitude;
+            pressure_altitude_ = altitude;
+            Set(PRESSURE_ALTITUDE);
         }
     }
 
-    nic = raw.Bits(12, 5, 12, 8);
+    nic_ = raw.Field<12, 5, 12, 8>();
+    Set(NIC);
 
-    if (raw_lat != 0 || raw_lon != 0 || *nic != 0) {
+    if (raw_lat != 0 || raw_lon != 0 || nic_ != 0) {
         // NB: north and south pole encode identically. We return north pole in this
         // case
         auto lat = raw_lat * 360.0 / 16777216.0;
@@ -156,47 +506,59 @@ void AdsbMessage::DecodeSV(const RawMessage &raw) {
         if (lon > 180)
             lon -= 360;
 
-        position = std::make_pair<>(RoundN(lat, 5), RoundN(lon, 5));
+        latitude_e5_ = ScaledRound(lat, 5);
+        longitude_e5_ = ScaledRound(lon, 5);
+        Set(POSITION);
     }
 
-    airground_state = static_cast<AirGroundState>(raw.Bits(13, 1, 13, 2));
+    airground_state_ = static_cast<AirGroundState>(raw.Field<13, 1, 13, 2>());
+    Set(AIRGROUND_STATE);
 
     // bit 13,3 reserved
 
-    switch (*airground_state) {
+    switch (airground_state_) {
     case AirGroundState::AIRBORNE_SUBSONIC:
     case AirGroundState::AIRBORNE_SUPERSONIC: {
-        int supersonic = (*airground_state == AirGroundState::AIRBORNE_SUPERSONIC ? 4 : 1);
-        int ns_sign = raw.Bit(13, 4) ? -1 : 1;
-        auto raw_ns = raw.Bits(13, 5, 14, 6);
-        if (raw_ns != 0)
-            north_velocity = supersonic * ns_sign * (raw_ns - 1);
+        int supersonic = (airground_state_ == AirGroundState::AIRBORNE_SUPERSONIC ? 4 : 1);
+        int ns_sign = raw.Bit<13, 4>() ? -1 : 1;
+        auto raw_ns = raw.Field<13, 5, 14, 6>();
+        if (raw_ns != 0) {
+            north_velocity_ = supersonic * ns_sign * (int)(raw_ns - 1);
+            Set(NORTH_VELOCITY);
+        }
 
-        int ew_sign = raw.Bit(14, 7) ? -1 : 1;
-        auto raw_ew = raw.Bits(14, 8, 16, 1);
-        if (raw_ew != 0)
-            east_velocity = supersonic * ew_sign * (raw_ew - 1);
+        int ew_sign = raw.Bit<14, 7>() ? -1 : 1;
+        auto raw_ew = raw.Field<14, 8, 16, 1>();
+        if (raw_ew != 0) {
+            east_velocity_ = supersonic * ew_sign * (int)(raw_ew - 1);
+            Set(EAST_VELOCITY);
+        }
 
         // derive groundspeed, true track from north/east velocity for convenience
-        if (north_velocity && east_velocity) { // nb: testing for presence, not non-zero value
-            ground_speed = RoundN(std::sqrt(1.0 * (*north_velocity) * (*north_velocity) + 1.0 * (*east_velocity) * (*east_velocity)), 1);
-            auto angle = std::atan2(*east_velocity, *north_velocity) * 180.0 / M_PI;
+        if (Has(NORTH_VELOCITY) && Has(EAST_VELOCITY)) { // nb: testing for presence, not non-zero value
+            ground_speed_ = static_cast<int>(RoundN(std::sqrt(1.0 * north_velocity_ * north_velocity_ + 1.0 * east_velocity_ * east_velocity_), 1));
+            Set(GROUND_SPEED);
+            auto angle = std::atan2(east_velocity_, north_velocity_) * 180.0 / M_PI;
             if (angle < 0)
                 angle += 360.0;
-            true_track = RoundN(angle, 1);
+            true_track_e1_ = ScaledRound(angle, 1);
+            Set(TRUE_TRACK);
         }
 
-        vv_src = static_cast<VerticalVelocitySource>(raw.Bits(16, 2, 16, 2));
-        int vv_sign = raw.Bit(16, 3) ? -1 : 1;
-        auto raw_vv = raw.Bits(16, 4, 17, 4);
+        vv_src_ = static_cast<VerticalVelocitySource>(raw.Field<16, 2, 16, 2>());
+        Set(VV_SRC);
+        int vv_sign = raw.Bit<16, 3>() ? -1 : 1;
+        auto raw_vv = raw.Field<16, 4, 17, 4>();
         if (raw_vv != 0) {
-            auto vertical_velocity = vv_sign * (raw_vv - 1) * 64;
-            switch (vv_src.get()) {
+            int vertical_velocity = vv_sign * (int)(raw_vv - 1) * 64;
+            switch (vv_src_) {
             case VerticalVelocitySource::BAROMETRIC:
-                vertical_velocity_barometric = vertical_velocity;
+                vertical_velocity_barometric_ = vertical_velocity;
+                Set(VERTICAL_VELOCITY_BAROMETRIC);
                 break;
             case VerticalVelocitySource::GEOMETRIC:
-                vertical_velocity_geometric = vertical_velocity;
+                vertical_velocity_geometric_ = vertical_velocity;
+                Set(VERTICAL_VELOCITY_GEOMETRIC);
                 break;
             default:
                 break;
@@ -208,70 +570,60 @@ void AdsbMessage::DecodeSV(const RawMessage &raw) {
 
     case AirGroundState::ON_GROUND: {
         // 13,4 reserved
-        auto raw_gs = raw.Bits(13, 5, 14, 6);
-        if (raw_gs != 0)
-            ground_speed = (raw_gs - 1);
+        auto raw_gs = raw.Field<13, 5, 14, 6>();
+        if (raw_gs != 0) {
+            ground_speed_ = (raw_gs - 1);
+            Set(GROUND_SPEED);
+        }
 
-        auto tah_type = raw.Bits(14, 7, 14, 8);
-        auto angle = RoundN(raw.Bits(15, 1, 16, 1) * 360.0 / 512.0, 1);
+        auto tah_type = raw.Field<14, 7, 14, 8>();
+        auto angle = ScaledRound(raw.Field<15, 1, 16, 1>() * 360.0 / 512.0, 1);
         switch (tah_type) { // 2.2.4.5.2.6.4 / Table 2-28 "Track Angle/Heading Type"
         case 0:             // data unavailable
             break;
         case 1: // true track
-            true_track = angle;
+            true_track_e1_ = angle;
+            Set(TRUE_TRACK);
             break;
         case 2: // magnetic heading
-            magnetic_heading = angle;
+            magnetic_heading_e1_ = angle;
+            Set(MAGNETIC_HEADING);
             break;
         case 3: // true heading
-            true_heading = angle;
+            true_heading_e1_ = angle;
+            Set(TRUE_HEADING);
             break;
         }
 
-        auto raw_av_size = raw.Bits(16, 2, 16, 5);
+        auto raw_av_size = raw.Field<16, 2, 16, 5>();
         if (raw_av_size != 0) {
-            // DO-282B Table 2-35
-            static std::array<std::pair<double, double>, 16> aircraft_sizes = {{{0, 0}, // no data
-                                                                                {15, 23},
-                                                                                {25, 28.5},
-                                                                                {25, 34},
-                                                                                {35, 33},
-                                                                                {35, 38},
-                                                                                {45, 39.5},
-                                                                                {45, 45},
-                                                                                {55, 45},
-                                                                                {55, 52},
-                                                                                {65, 59.5},
-                                                                                {65, 67},
-                                                                                {75, 72.5},
-                                                                                {75, 80},
-                                                                                {85, 80},
-                                                                                {85, 90}}};
-
-            aircraft_size = aircraft_sizes[raw_av_size];
-        }
-
-        if (raw.Bit(16, 7)) {
+            raw_aircraft_size_ = raw_av_size;
+            Set(AIRCRAFT_SIZE);
+        }
+
+        if (raw.Bit<16, 7>()) {
             // Longitudinal GPS offset
-            auto raw_gps_long = raw.Bits(16, 8, 17, 4);
+            auto raw_gps_long = raw.Field<16, 8, 17, 4>();
             if (raw_gps_long != 0) {
                 if (raw_gps_long == 1) {
-                    gps_position_offset_applied = true;
+                    SetFlag(GPS_POSITION_OFFSET_APPLIED, FLAG_GPS_POSITION_OFFSET_APPLIED, true);
                 } else {
-                    gps_position_offset_applied = false;
-                    gps_longitudinal_offset = (raw_gps_long - 1) * 2;
+                    SetFlag(GPS_POSITION_OFFSET_APPLIED, FLAG_GPS_POSITION_OFFSET_APPLIED, false);
+                    gps_longitudinal_offset_ = (raw_gps_long - 1) * 2;
+                    Set(GPS_LONGITUDINAL_OFFSET);
                 }
             }
         } else {
             // Lateral GPS offset
             // We adopt the convention that left is negative
-            auto raw_gps_lat = raw.Bits(16, 8, 17, 2);
+            auto raw_gps_lat = raw.Field<16, 8, 17, 2>();
             if (raw_gps_lat != 0) {
                 if (raw_gps_lat <= 3) {
-                    gps_lateral_offset = raw_gps_lat * -2;
+                    gps_lateral_offset_ = (int)raw_gps_lat * -2;
                 } else {
-                    gps_lateral_offset = (raw_gps_lat - 4) * 2;
+                    gps_lateral_offset_ = (raw_gps_lat - 4) * 2;
                 }
+                Set(GPS_LATERAL_OFFSET);
             }
         }
 
@@ -288,14 +640,16 @@ void AdsbMessage::DecodeSV(const RawMessage &raw) {
     case AddressQualifier::ADSB_OTHER:
     case AddressQualifier::VEHICLE:
     case AddressQualifier::FIXED_BEACON:
-        utc_coupled = raw.Bit(17, 5);
-        uplink_feedback = raw.Bits(17, 6, 17, 8);
+        SetFlag(UTC_COUPLED, FLAG_UTC_COUPLED, raw.Bit<17, 5>());
+        uplink_feedback_ = raw.Field<17, 6, 17, 8>();
+        Set(UPLINK_FEEDBACK);
         break;
 
     case AddressQualifier::TISB_ICAO:
     case AddressQualifier::TISB_TRACKFILE:
     case AddressQualifier::ADSR_OTHER:
-        tisb_site_id = raw.Bits(17, 5, 17, 8);
+        tisb_site_id_ = raw.Field<17, 5, 17, 8>();
+        Set(TISB_SITE_ID);
         break;
 
     default:
@@ -304,43 +658,48 @@ void AdsbMessage::DecodeSV(const RawMessage &raw) {
     }
 }
 
-void AdsbMessage::DecodeTS(const RawMessage &raw, unsigned startbyte) {
+template <unsigned startbyte> void CompactAdsbMessage::DecodeTS(const RawMessage &raw) {
     // TS starts at byte 30 (§2.2.4.5.6) in payload type 3 or 4;
     // or at byte 25 (§2.2.4.5.7) in payload type 6;
-    // the starting offset to use is passed by the caller
+    // the starting offset to use is a template parameter, so field offsets are constant
 
-    auto raw_altitude = raw.Bits(startbyte + 0, 2, startbyte + 1, 4);
+    auto raw_altitude = raw.Field<startbyte + 0, 2, startbyte + 1, 4>();
     if (raw_altitude != 0) {
-        selected_altitude_type = static_cast<SelectedAltitudeType>(raw.Bits(startbyte + 0, 1, startbyte + 0, 1));
-        switch (*selected_altitude_type) {
+        selected_altitude_type_ = static_cast<SelectedAltitudeType>(raw.Field<startbyte + 0, 1, startbyte + 0, 1>());
+        Set(SELECTED_ALTITUDE_TYPE);
+        switch (selected_altitude_type_) {
         case SelectedAltitudeType::MCP_FCU:
-            selected_altitude_mcp = (raw_altitude - 1) * 32;
+            selected_altitude_mcp_ = (raw_altitude - 1) * 32;
+            Set(SELECTED_ALTITUDE_MCP);
             break;
         case SelectedAltitudeType::FMS:
-            selected_altitude_fms = (raw_altitude - 1) * 32;
+            selected_altitude_fms_ = (raw_altitude - 1) * 32;
+            Set(SELECTED_ALTITUDE_FMS);
             break;
         default:
             break;
         }
     }
 
-    auto raw_bps = raw.Bits(startbyte + 1, 5, startbyte + 2, 5);
-    if (raw_bps != 0)
-        barometric_pressure_setting = 800 + (raw_bps - 1) * 0.8;
+    auto raw_bps = raw.Field<startbyte + 1, 5, startbyte + 2, 5>();
+    if (raw_bps != 0) {
+        raw_pressure_setting_ = raw_bps;
+        Set(BAROMETRIC_PRESSURE_SETTING);
+    }
 
-    if (raw.Bit(startbyte + 2, 6)) {
-        int heading_sign = raw.Bit(startbyte + 2, 7) ? -1 : 1;
-        auto heading = RoundN(raw.Bits(startbyte + 2, 8, startbyte + 3, 7) * 180.0 / 256.0, 1);
-        selected_heading = heading_sign * heading;
+    if (raw.Bit<startbyte + 2, 6>()) {
+        int heading_sign = raw.Bit<startbyte + 2, 7>() ? -1 : 1;
+        selected_heading_e1_ = heading_sign * ScaledRound(raw.Field<startbyte + 2, 8, startbyte + 3, 7>() * 180.0 / 256.0, 1);
+        Set(SELECTED_HEADING);
     }
 
-    if (raw.Bit(startbyte + 3, 8)) {
-        mode_indicators.emplace();
-        mode_indicators->autopilot = raw.Bit(startbyte + 4, 1);
-        mode_indicators->vnav = raw.Bit(startbyte + 4, 2);
-        mode_indicators->altitude_hold = raw.Bit(startbyte + 4, 3);
-        mode_indicators->approach = raw.Bit(startbyte + 4, 4);
-        mode_indicators->lnav = raw.Bit(startbyte + 4, 5);
+    if (raw.Bit<startbyte + 3, 8>()) {
+        mode_indicators_.autopilot = raw.Bit<startbyte + 4, 1>();
+        mode_indicators_.vnav = raw.Bit<startbyte + 4, 2>();
+        mode_indicators_.altitude_hold = raw.Bit<startbyte + 4, 3>();
+        mode_indicators_.approach = raw.Bit<startbyte + 4, 4>();
+        mode_indicators_.lnav = raw.Bit<startbyte + 4, 5>();
+        Set(MODE_INDICATORS);
     }
 
     // 34,6 .. 34,8 reserved
@@ -348,143 +707,179 @@ void AdsbMessage::DecodeTS(const RawMessage &raw, unsigned startbyte) {
 
 static inline bool IsOctal(char ch) { return (ch >= '0' && ch <= '7'); }
 
-void AdsbMessage::DecodeMS(const RawMessage &raw) {
+void CompactAdsbMessage::DecodeMS(const RawMessage &raw) {
     static const char *base40_alphabet = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ *??";
-    auto raw1 = raw.Bits(18, 1, 19, 8);
-    auto raw2 = raw.Bits(20, 1, 21, 8);
-    auto raw3 = raw.Bits(22, 1, 23, 8);
-
-    emitter_category = (raw1 / 1600) % 40;
-
-    std::string raw_callsign;
-    raw_callsign.reserve(8);
-    raw_callsign.push_back(base40_alphabet[(raw1 / 40) % 40]);
-    raw_callsign.push_back(base40_alphabet[raw1 % 40]);
-    raw_callsign.push_back(base40_alphabet[(raw2 / 1600) % 40]);
-    raw_callsign.push_back(base40_alphabet[(raw2 / 40) % 40]);
-    raw_callsign.push_back(base40_alphabet[raw2 % 40]);
-    raw_callsign.push_back(base40_alphabet[(raw3 / 1600) % 40]);
-    raw_callsign.push_back(base40_alphabet[(raw3 / 40) % 40]);
-    raw_callsign.push_back(base40_alphabet[raw3 % 40]);
+    auto raw1 = raw.Field<18, 1, 19, 8>();
+    auto raw2 = raw.Field<20, 1, 21, 8>();
+    auto raw3 = raw.Field<22, 1, 23, 8>();
+
+    emitter_category_ = (raw1 / 1600) % 40;
+    Set(EMITTER_CATEGORY);
+
+    ident_[0] = base40_alphabet[(raw1 / 40) % 40];
+    ident_[1] = base40_alphabet[raw1 % 40];
+    ident_[2] = base40_alphabet[(raw2 / 1600) % 40];
+    ident_[3] = base40_alphabet[(raw2 / 40) % 40];
+    ident_[4] = base40_alphabet[raw2 % 40];
+    ident_[5] = base40_alphabet[(raw3 / 1600) % 40];
+    ident_[6] = base40_alphabet[(raw3 / 40) % 40];
+    ident_[7] = base40_alphabet[raw3 % 40];
 
     // trim trailing spaces and code 37
-    while (!raw_callsign.empty() && (raw_callsign.back() == ' ' || raw_callsign.back() == '*')) {
-        raw_callsign.pop_back();
+    unsigned length = sizeof(ident_);
+    while (length > 0 && (ident_[length - 1] == ' ' || ident_[length - 1] == '*')) {
+        --length;
     }
+    ident_length_ = length;
 
-    if (!raw_callsign.empty()) {
-        if (raw.Bit(27,
-                    7)) { // CSID field, 1 = callsign, 0 = flightplan ID (aka squawk)
-            callsign.emplace(std::move(raw_callsign));
+    if (length > 0) {
+        if (raw.Bit<27, 7>()) { // CSID field, 1 = callsign, 0 = flightplan ID (aka squawk)
+            Set(CALLSIGN);
         } else {
             // Enforce 4 digit octal squawk
-            if (raw_callsign.size() == 4 &&
-                IsOctal(raw_callsign[0]) &&
-                IsOctal(raw_callsign[1]) &&
-                IsOctal(raw_callsign[2]) &&
-                IsOctal(raw_callsign[3])) {
-                    flightplan_id.emplace(std::move(raw_callsign));
+            if (length == 4 &&
+                IsOctal(ident_[0]) &&
+                IsOctal(ident_[1]) &&
+                IsOctal(ident_[2]) &&
+                IsOctal(ident_[3])) {
+                    Set(FLIGHTPLAN_ID);
             }
         }
     }
 
-    emergency = static_cast<EmergencyPriorityStatus>(raw.Bits(24, 1, 24, 3));
-    mops_version = raw.Bits(24, 4, 24, 6);
-    sil = raw.Bits(24, 7, 24, 8);
-    transmit_mso = raw.Bits(25, 1, 25, 6);
-    sda = raw.Bits(25, 7, 25, 8);
-    nac_p = raw.Bits(26, 1, 26, 4);
-    nac_v = raw.Bits(26, 5, 26, 7);
-    nic_baro = raw.Bits(26, 8, 26, 8);
-
-    capability_codes.emplace();
-    capability_codes->uat_in = raw.Bit(27, 1);
-    capability_codes->es_in = raw.Bit(27, 2);
-    capability_codes->tcas_operational = raw.Bit(27, 3);
-
-    operational_modes.emplace();
-    operational_modes->tcas_ra_active = raw.Bit(27, 4);
-    operational_modes->ident_active = raw.Bit(27, 5);
-    operational_modes->atc_services = raw.Bit(27, 6);
-
-    sil_supplement = static_cast<SILSupplement>(raw.Bits(27, 8, 27, 8));
-    gva = raw.Bits(28, 1, 28, 2);
-    single_antenna = raw.Bit(28, 3);
-    nic_supplement = raw.Bit(28, 4);
+    emergency_ = static_cast<EmergencyPriorityStatus>(raw.Field<24, 1, 24, 3>());
+    mops_version_ = raw.Field<24, 4, 24, 6>();
+    sil_ = raw.Field<24, 7, 24, 8>();
+    transmit_mso_ = raw.Field<25, 1, 25, 6>();
+    sda_ = raw.Field<25, 7, 25, 8>();
+    nac_p_ = raw.Field<26, 1, 26, 4>();
+    nac_v_ = raw.Field<26, 5, 26, 7>();
+    nic_baro_ = raw.Field<26, 8, 26, 8>();
+
+    capability_codes_.uat_in = raw.Bit<27, 1>();
+    capability_codes_.es_in = raw.Bit<27, 2>();
+    capability_codes_.tcas_operational = raw.Bit<27, 3>();
+
+    operational_modes_.tcas_ra_active = raw.Bit<27, 4>();
+    operational_modes_.ident_active = raw.Bit<27, 5>();
+    operational_modes_.atc_services = raw.Bit<27, 6>();
+
+    sil_supplement_ = static_cast<SILSupplement>(raw.Field<27, 8, 27, 8>());
+    gva_ = raw.Field<28, 1, 28, 2>();
+    SetFlag(SINGLE_ANTENNA, FLAG_SINGLE_ANTENNA, raw.Bit<28, 3>());
+    SetFlag(NIC_SUPPLEMENT, FLAG_NIC_SUPPLEMENT, raw.Bit<28, 4>());
     // 28,5 .. 29,8 reserved
+
+    for (auto field : {EMERGENCY, MOPS_VERSION, SIL, TRANSMIT_MSO, SDA, NAC_P, NAC_V, NIC_BARO, CAPABILITY_CODES, OPERATIONAL_MODES, SIL_SUPPLEMENT, GVA}) {
+        Set(field);
+    }
 }
 
-void AdsbMessage::DecodeAUXSV(const RawMessage &raw) {
-    auto raw_alt = raw.Bits(30, 1, 31, 4);
+void CompactAdsbMessage::DecodeAUXSV(const RawMessage &raw) {
+    auto raw_alt = raw.Field<30, 1, 31, 4>();
     if (raw_alt != 0) {
-        auto altitude = (raw_alt - 41) * 25;
-        if (raw.Bit(10, 8)) { // 2.2.4.5.2.2 "ALTITUDE TYPE" field (in SV, which is
+        int altitude = (raw_alt - 41) * 25;
+        if (raw.Bit<10, 8>()) { // 2.2.4.5.2.2 "ALTITUDE TYPE" field (in SV, which is
             // always present when AUXSV is present)
-            pressure_altitude = altitude;
+            pressure_altitude_ = altitude;
+            Set(PRESSURE_ALTITUDE);
         } else {
-            geometric_altitude = altitude;
+            geometric_altitude_ = altitude;
+            Set(GEOMETRIC_ALTITUDE);
         }
     }
 }
 
-//
-// converting decoded messages to json
-//
+boost::optional<std::pair<double, double>> CompactAdsbMessage::aircraft_size() const {
+    if (!Has(AIRCRAFT_SIZE)) {
+        return boost::none;
+    }
 
-namespace airnav::uat {
-    // clang-format off
+    // DO-282B Table 2-35
+    static const std::array<std::pair<double, double>, 16> aircraft_sizes = {{{0, 0}, // no data
+                                                                              {15, 23},
+                                                                              {25, 28.5},
+                                                                              {25, 34},
+                                                                              {35, 33},
+                                                                              {35, 38},
+                                                                              {45, 39.5},
+                                                                              {45, 45},
+                                                                              {55, 45},
+                                                                              {55, 52},
+                                                                              {65, 59.5},
+                                                                              {65, 67},
+                                                                              {75, 72.5},
+                                                                              {75, 80},
+                                                                              {85, 80},
+                                                                              {85, 90}}};
+    return aircraft_sizes[raw_aircraft_size_];
+}
 
-    NLOHMANN_JSON_SERIALIZE_ENUM(AddressQualifier, {
-        {AddressQualifier::INVALID, "invalid"},
-        {AddressQualifier::ADSB_ICAO, "adsb_icao"},
-        {AddressQualifier::ADSB_OTHER, "adsb_other"},
-        {AddressQualifier::TISB_ICAO, "tisb_icao"},
-        {AddressQualifier::TISB_TRACKFILE, "tisb_trackfile"},
-        {AddressQualifier::VEHICLE, "vehicle"},
-        {AddressQualifier::FIXED_BEACON, "fixed_beacon"},
-        {AddressQualifier::ADSR_OTHER, "adsr_other"},
-        {AddressQualifier::RESERVED, "reserved"},
-    });
-
-    NLOHMANN_JSON_SERIALIZE_ENUM(AirGroundState, {
-        {AirGroundState::INVALID, "invalid"},
-        {AirGroundState::AIRBORNE_SUBSONIC, "airborne"},
-        {AirGroundState::AIRBORNE_SUPERSONIC, "supersonic"},
-        {AirGroundState::ON_GROUND, "ground"},
-        {AirGroundState::RESERVED, "reserved"}
-    });
-
-    NLOHMANN_JSON_SERIALIZE_ENUM(VerticalVelocitySource, {
-        {VerticalVelocitySource::INVALID, "invalid"},
-        {VerticalVelocitySource::GEOMETRIC, "geometric"},
-        {VerticalVelocitySource::BAROMETRIC, "barometric"}
-    });
-
-    NLOHMANN_JSON_SERIALIZE_ENUM(EmergencyPriorityStatus, {
-        {EmergencyPriorityStatus::INVALID, "invalid"},
-        {EmergencyPriorityStatus::NONE, "none"},
-        {EmergencyPriorityStatus::GENERAL, "general"},
-        {EmergencyPriorityStatus::MEDICAL, "medical"},
-        {EmergencyPriorityStatus::NORDO, "nordo"},
-        {EmergencyPriorityStatus::UNLAWFUL, "unlawful"},
-        {EmergencyPriorityStatus::DOWNED, "downed"},
-        {EmergencyPriorityStatus::RESERVED, "reserved"}
-    });
-
-    NLOHMANN_JSON_SERIALIZE_ENUM(SILSupplement, {
-        {SILSupplement::INVALID, "invalid"},
-        {SILSupplement::PER_HOUR, "per_hour"},
-        {SILSupplement::PER_SAMPLE, "per_sample"}
-    });
-
-    NLOHMANN_JSON_SERIALIZE_ENUM(SelectedAltitudeType, {
-        {SelectedAltitudeType::INVALID, "invalid"},
-        {SelectedAltitudeType::MCP_FCU, "mcp_fcu"},
-        {SelectedAltitudeType::FMS, "fms"}
-    });
+AdsbMessage::AdsbMessage(const CompactAdsbMessage &compact) {
+    received_at = compact.received_at;
+    raw_timestamp = compact.raw_timestamp;
+    errors = compact.errors;
+    rssi = compact.rssi;
+
+    payload_type = compact.payload_type;
+    address_qualifier = compact.address_qualifier;
+    address = compact.address;
+
+#define COPY(x) x = compact.x()
+
+    COPY(position);
+    COPY(pressure_altitude);
+    COPY(geometric_altitude);
+    COPY(nic);
+    COPY(airground_state);
+    COPY(north_velocity);
+    COPY(east_velocity);
+    COPY(vv_src);
+    COPY(vertical_velocity_barometric);
+    COPY(vertical_velocity_geometric);
+    COPY(ground_speed);
+    COPY(magnetic_heading);
+    COPY(true_heading);
+    COPY(true_track);
+    COPY(aircraft_size);
+    COPY(gps_lateral_offset);
+    COPY(gps_longitudinal_offset);
+    COPY(gps_position_offset_applied);
+    COPY(utc_coupled);
+    COPY(uplink_feedback);
+    COPY(tisb_site_id);
+
+    COPY(emitter_category);
+    COPY(callsign);
+    COPY(flightplan_id);
+    COPY(emergency);
+    COPY(mops_version);
+    COPY(sil);
+    COPY(transmit_mso);
+    COPY(sda);
+    COPY(nac_p);
+    COPY(nac_v);
+    COPY(nic_baro);
+    COPY(capability_codes);
+    COPY(operational_modes);
+    COPY(sil_supplement);
+    COPY(gva);
+    COPY(single_antenna);
+    COPY(nic_supplement);
+
+    COPY(selected_altitude_type);
+    COPY(selected_altitude_mcp);
+    COPY(selected_altitude_fms);
+    COPY(barometric_pressure_setting);
+    COPY(selected_heading);
+    COPY(mode_indicators);
+
+#undef COPY
+}
 
-    // clang-format on
-}; // namespace airnav::uat
+//
+// converting decoded messages to json
+//
 
 nlohmann::json AdsbMessage::ToJson() const {
     nlohmann::json o;
@@ -598,3 +993,477 @@ nlohmann::json AdsbMessage::ToJson() const {
 
     return o;
 }
+
+//
+// streaming json encoder
+//
+
+namespace {
+    // Writes compact JSON to a string, formatting values exactly as
+    // nlohmann::json::dump() does
+    class JsonWriter {
+      public:
+        explicit JsonWriter(std::string &out) : out_(out) {}
+
+        void BeginObject() {
+            out_ += '{';
+            first_ = true;
+        }
+
+        void EndObject() {
+            out_ += '}';
+            first_ = false;
+        }
+
+        JsonWriter &Key(const char *key) {
+            if (!first_)
+                out_ += ',';
+            first_ = false;
+            out_ += '"';
+            out_ += key;
+            out_ += "\":";
+            return *this;
+        }
+
+        void Value(bool b) { out_ += (b ? "true" : "false"); }
+        void Value(int i) { AppendSigned(out_, i); }
+        void Value(unsigned u) { AppendUnsigned(out_, u); }
+        void Value(std::uint64_t u) { AppendUnsigned(out_, u); }
+
+        void Value(double d) {
+            if (!std::isfinite(d)) {
+                out_ += "null";
+                return;
+            }
+
+            std::array<char, 64> buf;
+            char *end = nlohmann::detail::to_chars(buf.data(), buf.data() + buf.size(), d);
+            out_.append(buf.data(), end);
+        }
+
+        void Value(const std::string &s) {
+            out_ += '"';
+            for (char c : s) {
+                switch (c) {
+                case '\b':
+                    out_ += "\\b";
+                    break;
+                case '\t':
+                    out_ += "\\t";
+                    break;
+                case '\n':
+                    out_ += "\\n";
+                    break;
+                case '\f':
+                    out_ += "\\f";
+                    break;
+                case '\r':
+                    out_ += "\\r";
+                    break;
+                case '"':
+                    out_ += "\\\"";
+                    break;
+                case '\\':
+                    out_ += "\\\\";
+                    break;
+                default:
+                    if ((unsigned char)c <= 0x1F) {
+                        out_ += "\\u00";
+                        out_ += hex_digits[(unsigned char)c >> 4];
+                        out_ += hex_digits[c & 15];
+                    } else {
+                        out_ += c;
+                    }
+                    break;
+                }
+            }
+            out_ += '"';
+        }
+
+        // enums are written using the NLOHMANN_JSON_SERIALIZE_ENUM mappings
+        template <typename E> typename std::enable_if<std::is_enum<E>::value>::type Value(E e) { Value(EnumName(e)); }
+
+      private:
+        template <typename E> static const std::string &EnumName(E e) {
+            // built from the nlohmann mappings (including their fallback for
+            // unmapped values), so the names can't drift out of sync
+            static const std::array<std::string, 256> names = [] {
+                std::array<std::string, 256> n;
+                for (unsigned i = 0; i < n.size(); ++i) {
+                    nlohmann::json j = static_cast<E>(i);
+                    n[i] = j.get<std::string>();
+                }
+                return n;
+            }();
+            return names[static_cast<unsigned char>(e)];
+        }
+
+        std::string &out_;
+        bool first_ = true;
+    };
+}; // namespace
+
+void CompactAdsbMessage::EncodeJson(std::string &out) const {
+    JsonWriter w(out);
+
+    // nlohmann::json objects are ordered by key, so to produce the same
+    // output as ToJson().dump() the keys are written in sorted order
+
+#define EMIT(x)                          \
+    do {                                 \
+        if (auto x##_value = x()) {      \
+            w.Key(#x).Value(*x##_value); \
+        }                                \
+    } while (0)
+
+    w.BeginObject();
+
+    std::string hex_address(6, '0');
+    for (unsigned i = 0; i < 6; ++i) {
+        hex_address[i] = hex_digits[(address >> (20 - 4 * i)) & 15];
+    }
+    if (address > 0xFFFFFF) {
+        // wider than setw(6); never happens with a 24-bit address
+        std::ostringstream os;
+        os << std::hex << address;
+        hex_address = os.str();
+    }
+    w.Key("address").Value(hex_address);
+    w.Key("address_qualifier").Value(address_qualifier);
+
+    if (auto aircraft_size_value = aircraft_size()) {
+        w.Key("aircraft_size").BeginObject();
+        w.Key("length").Value(aircraft_size_value->first);
+        w.Key("width").Value(aircraft_size_value->second);
+        w.EndObject();
+    }
+
+    EMIT(airground_state);
+    EMIT(barometric_pressure_setting);
+    EMIT(callsign);
+
+    if (auto capability_codes_value = capability_codes()) {
+        w.Key("capability_codes").BeginObject();
+        w.Key("es_in").Value((bool)capability_codes_value->es_in);
+        w.Key("tcas_operational").Value((bool)capability_codes_value->tcas_operational);
+        w.Key("uat_in").Value((bool)capability_codes_value->uat_in);
+        w.EndObject();
+    }
+
+    EMIT(east_velocity);
+    EMIT(emergency);
+
+    if (auto emitter_category_value = emitter_category()) {
+        w.Key("emitter_category").Value(std::string{(char)('A' + (*emitter_category_value >> 3)), (char)('0' + (*emitter_category_value & 7))});
+    }
+
+    EMIT(flightplan_id);
+    EMIT(geometric_altitude);
+    EMIT(gps_lateral_offset);
+    EMIT(gps_longitudinal_offset);
+    EMIT(gps_position_offset_applied);
+    EMIT(ground_speed);
+    EMIT(gva);
+    EMIT(magnetic_heading);
+
+    w.Key("metadata").BeginObject();
+    w.Key("errors").Value(errors);
+    if (raw_timestamp != 0) {
+        w.Key("raw_timestamp").Value(raw_timestamp);
+    }
+    if (received_at != 0) {
+        w.Key("received_at").Value(received_at / 1000.0);
+    }
+    w.Key("rssi").Value(RoundN(rssi, 1));
+    w.EndObject();
+
+    if (auto mode_indicators_value = mode_indicators()) {
+        w.Key("mode_indicators").BeginObject();
+        w.Key("altitude_hold").Value((bool)mode_indicators_value->altitude_hold);
+        w.Key("approach").Value((bool)mode_indicators_value->approach);
+        w.Key("autopilot").Value((bool)mode_indicators_value->autopilot);
+        w.Key("lnav").Value((bool)mode_indicators_value->lnav);
+        w.Key("vnav").Value((bool)mode_indicators_value->vnav);
+        w.EndObject();
+    }
+
+    EMIT(mops_version);
+    EMIT(nac_p);
+    EMIT(nac_v);
+    EMIT(nic);
+    EMIT(nic_baro);
+    EMIT(nic_supplement);
+    EMIT(north_velocity);
+
+    if (auto operational_modes_value = operational_modes()) {
+        w.Key("operational_modes").BeginObject();
+        w.Key("atc_services").Value((bool)operational_modes_value->atc_services);
+        w.Key("ident_active").Value((bool)operational_modes_value->ident_active);
+        w.Key("tcas_ra_active").Value((bool)operational_modes_value->tcas_ra_active);
+        w.EndObject();
+    }
+
+    if (auto position_value = position()) {
+        w.Key("position").BeginObject();
+        w.Key("lat").Value(position_value->first);
+        w.Key("lon").Value(position_value->second);
+        w.EndObject();
+    }
+
+    EMIT(pressure_altitude);
+    EMIT(sda);
+    EMIT(selected_altitude_fms);
+    EMIT(selected_altitude_mcp);
+    EMIT(selected_altitude_type);
+    EMIT(selected_heading);
+    EMIT(sil);
+    EMIT(sil_supplement);
+    EMIT(single_antenna);
+    EMIT(tisb_site_id);
+    EMIT(transmit_mso);
+    EMIT(true_heading);
+    EMIT(true_track);
+    EMIT(uplink_feedback);
+    EMIT(utc_coupled);
+    EMIT(vertical_velocity_barometric);
+    EMIT(vertical_velocity_geometric);
+    EMIT(vv_src);
+
+#undef EMIT
+
+    w.EndObject();
+}
+
+//
+// uplink messages
+//
+
+UplinkMessage::UplinkMessage(const RawMessage &raw) {
+    if (raw.Type() != MessageType::UPLINK) {
+        throw std::logic_error("can't parse this sort of message as an uplink message");
+    }
+
+    const auto &payload = raw.Payload();
+    if (payload.size() < UPLINK_DATA_BYTES) {
+        throw std::out_of_range("payload too short for an uplink message");
+    }
+
+    // Metadata
+    received_at = raw.ReceivedAt();
+    raw_timestamp = raw.RawTimestamp();
+    errors = raw.Errors();
+    rssi = raw.Rssi();
+
+    // 2.2.3.2.2 UAT-specific header.
+    // The position often looks plausible even when it is flagged as
+    // invalid, so it is always decoded.
+    auto lat = raw.Field<1, 1, 3, 7>() * 360.0 / 16777216.0;
+    if (lat > 90)
+        lat -= 180;
+    auto lon = raw.Field<3, 8, 6, 7>() * 360.0 / 16777216.0;
+    if (lon > 180)
+        lon -= 360;
+    latitude = RoundN(lat, 5);
+    longitude = RoundN(lon, 5);
+
+    position_valid = raw.Bit<6, 8>();
+    utc_coupled = raw.Bit<7, 1>();
+    // 7,2 reserved
+    app_data_valid = raw.Bit<7, 3>();
+    slot_id = raw.Field<7, 4, 7, 8>();
+    tisb_site_id = raw.Field<8, 1, 8, 4>();
+
+    if (!app_data_valid) {
+        return;
+    }
+
+    // 2.2.3.2.3 Application data: a sequence of information frames, each
+    // a 2-byte header (9-bit length, 4-bit type) and `length` bytes of data
+    const std::uint8_t *data = payload.data() + 8;
+    const std::uint8_t *end = payload.data() + UPLINK_DATA_BYTES;
+    while (data + 2 <= end) {
+        InfoFrame frame;
+        frame.length = (data[0] << 1) | (data[1] >> 7);
+        frame.type = data[1] & 0x0F;
+        if (frame.length == 0 && frame.type == 0) {
+            break; // no more frames
+        }
+        if (data + 2 + frame.length > end) {
+            break; // overruns the application data
+        }
+
+        frame.data = data + 2;
+        frames_.push_back(frame);
+        data += 2 + frame.length;
+
+        if (frame.type != 0 || frame.length < 4) {
+            continue; // not FIS-B, or too short to be
+        }
+
+        // DO-358 APDU header
+        const std::uint8_t *d = frame.data;
+        FisbApdu apdu;
+        apdu.a_flag = (d[0] & 0x80) != 0;
+        apdu.g_flag = (d[0] & 0x40) != 0;
+        apdu.p_flag = (d[0] & 0x20) != 0;
+        apdu.product_id = ((d[0] & 0x1F) << 6) | (d[1] >> 2);
+        apdu.s_flag = (d[1] & 0x02) != 0;
+        apdu.month = apdu.day = apdu.seconds = 0;
+
+        unsigned header_length;
+        const unsigned t_opt = ((d[1] & 0x01) << 1) | (d[2] >> 7);
+        switch (t_opt) {
+        case 0: // hours, minutes
+            header_length = 4;
+            apdu.monthday_valid = false;
+            apdu.seconds_valid = false;
+            apdu.hours = (d[2] & 0x7C) >> 2;
+            apdu.minutes = ((d[2] & 0x03) << 4) | (d[3] >> 4);
+            break;
+        case 1: // hours, minutes, seconds
+            header_length = 5;
+            if (frame.length < header_length)
+                continue;
+            apdu.monthday_valid = false;
+            apdu.seconds_valid = true;
+            apdu.hours = (d[2] & 0x7C) >> 2;
+            apdu.minutes = ((d[2] & 0x03) << 4) | (d[3] >> 4);
+            apdu.seconds = ((d[3] & 0x0F) << 2) | (d[4] >> 6);
+            break;
+        case 2: // month, day, hours, minutes
+            header_length = 5;
+            if (frame.length < header_length)
+                continue;
+            apdu.monthday_valid = true;
+            apdu.seconds_valid = false;
+            apdu.month = (d[2] & 0x78) >> 3;
+            apdu.day = ((d[2] & 0x07) << 2) | (d[3] >> 6);
+            apdu.hours = (d[3] & 0x3E) >> 1;
+            apdu.minutes = ((d[3] & 0x01) << 5) | (d[4] >> 3);
+            break;
+        default: // month, day, hours, minutes, seconds
+            header_length = 6;
+            if (frame.length < header_length)
+                continue;
+            apdu.monthday_valid = true;
+            apdu.seconds_valid = true;
+            apdu.month = (d[2] & 0x78) >> 3;
+            apdu.day = ((d[2] & 0x07) << 2) | (d[3] >> 6);
+            apdu.hours = (d[3] & 0x3E) >> 1;
+            apdu.minutes = ((d[3] & 0x01) << 5) | (d[4] >> 3);
+            apdu.seconds = ((d[4] & 0x03) << 3) | (d[5] >> 5);
+            break;
+        }
+
+        apdu.data = d + header_length;
+        apdu.length = frame.length - header_length;
+        apdus_.push_back(apdu);
+    }
+}
+
+nlohmann::json UplinkMessage::ToJson() const {
+    nlohmann::json o;
+
+    o["metadata"]["received_at"] = received_at / 1000.0;
+    o["metadata"]["errors"] = errors;
+    o["metadata"]["rssi"] = RoundN(rssi, 1);
+    if (raw_timestamp) {
+        o["metadata"]["raw_timestamp"] = raw_timestamp;
+    }
+
+    if (position_valid) {
+        o["position"]["lat"] = latitude;
+        o["position"]["lon"] = longitude;
+    }
+    o["utc_coupled"] = utc_coupled;
+    o["slot_id"] = slot_id;
+    o["tisb_site_id"] = tisb_site_id;
+
+    if (app_data_valid) {
+        auto &apdus = o["apdus"] = nlohmann::json::array();
+        for (const auto &apdu : apdus_) {
+            nlohmann::json a;
+            a["product_id"] = apdu.product_id;
+            a["a_flag"] = apdu.a_flag;
+            a["g_flag"] = apdu.g_flag;
+            a["p_flag"] = apdu.p_flag;
+            a["s_flag"] = apdu.s_flag;
+            if (apdu.monthday_valid) {
+                a["month"] = apdu.month;
+                a["day"] = apdu.day;
+            }
+            a["hours"] = apdu.hours;
+            a["minutes"] = apdu.minutes;
+            if (apdu.seconds_valid) {
+                a["seconds"] = apdu.seconds;
+            }
+            a["length"] = apdu.length;
+            apdus.push_back(std::move(a));
+        }
+    }
+
+    return o;
+}
+
+std::string FisbApdu::DecodeText() const {
+    // DLAC 6-bit character set; code 28 is a tab, followed by a count of spaces
+    // (the alphabet is written as several literals so that no \x escape
+    // swallows the letters after it)
+    static const char dlac_alphabet[] = "\x03"
+                                        "ABCDEFGHIJKLMNOPQRSTUVWXYZ\x1A\t\x1E\n| !\"#$%&'()*+,-./0123456789:;<=>?";
+
+    std::string text;
+    text.reserve(length * 4 / 3);
+
+    bool tab = false;
+    const unsigned chars = length * 8 / 6;
+    for (unsigned i = 0; i < chars; ++i) {
+        // character i occupies bits [6i, 6i+6) of the payload
+        const unsigned bit = i * 6;
+        const unsigned byte = bit >> 3;
+        unsigned word = data[byte] << 8;
+        if (byte + 1 < length)
+            word |= data[byte + 1];
+        const unsigned ch = (word >> (10 - (bit & 7))) & 0x3F;
+
+        if (tab) {
+            text.append(ch, ' ');
+            tab = false;
+        } else if (ch == 28) {
+            tab = true;
+        } else {
+            text += dlac_alphabet[ch];
+        }
+    }
+
+    return text;
+}
+
+FisbProducts::FisbProducts(std::initializer_list<unsigned> product_ids, Handler handler) : wanted_(2048, false), handler_(handler) {
+    for (auto id : product_ids) {
+        if (id < wanted_.size()) {
+            wanted_[id] = true;
+        }
+    }
+}
+
+void FisbProducts::operator()(const MessageVector &messages) const {
+    bool any_uplink = false;
+    for (const auto &message : messages) {
+        if (message.Type() == MessageType::UPLINK) {
+            any_uplink = true;
+            break;
+        }
+    }
+    if (!any_uplink) {
+        return;
+    }
+
+    for (const auto &uplink : messages.DecodedUplink()) {
+        for (const auto &apdu : uplink.Apdus()) {
+            if (wanted_[apdu.product_id]) {
+                handler_(uplink, apdu);
+            }
+        }
+    }
+}
@@ -7,7 +7,18 @@
 #ifndef UAT_MESSAGE_H
 #define UAT_MESSAGE_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include <boost/optional.hpp>
@@ -18,55 +29,106 @@
 #include "uat_protocol.h"
 
 namespace airnav::uat {
+    // A message payload, held inline with room for the largest (uplink)
+    // payload, so that messages can be created, copied and queued without
+    // allocating. Copies copy only the bytes in use.
+    class MessagePayload {
+      public:
+        typedef std::uint8_t value_type;
+        typedef std::uint8_t *iterator;
+        typedef const std::uint8_t *const_iterator;
+
+        static const std::size_t CAPACITY = UPLINK_DATA_BYTES;
+
+        MessagePayload() {}
+        MessagePayload(const std::uint8_t *data, std::size_t size) { assign(data, size); }
+        template <class InputIterator> MessagePayload(InputIterator first, InputIterator last) { assign(first, last); }
+        MessagePayload(const Bytes &bytes) { assign(bytes.data(), bytes.size()); }
+
+        MessagePayload(const MessagePayload &other) { assign(other.data(), other.size()); }
+        MessagePayload &operator=(const MessagePayload &other) {
+            assign(other.data(), other.size());
+            return *this;
+        }
+
+        // Throws std::length_error if `size` exceeds CAPACITY
+        void assign(const std::uint8_t *data, std::size_t size) {
+            resize(size);
+            std::copy(data, data + size, data_);
+        }
+
+        template <class InputIterator> void assign(InputIterator first, InputIterator last) {
+            resize(std::distance(first, last));
+            std::copy(first, last, data_);
+        }
+
+        // Throws std::length_error if `size` exceeds CAPACITY; new bytes are zero
+        void resize(std::size_t size) {
+            if (size > CAPACITY)
+                throw std::length_error("message payload too large");
+            if (size > size_)
+                std::fill(data_ + size_, data_ + size, 0);
+            size_ = size;
+        }
+
+        std::size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        std::uint8_t *data() { return data_; }
+        const std::uint8_t *data() const { return data_; }
+
+        iterator begin() { return data_; }
+        iterator end() { return data_ + size_; }
+        const_iterator begin() const { return data_; }
+        const_iterator end() const { return data_ + size_; }
+
+        std::uint8_t &operator[](std::size_t i) { return data_[i]; }
+        const std::uint8_t &operator[](std::size_t i) const { return data_[i]; }
+
+        const std::uint8_t &at(std::size_t i) const {
+            if (i >= size_)
+                throw std::out_of_range("message payload index out of range");
+            return data_[i];
+        }
+
+        bool operator==(const MessagePayload &o) const { return size_ == o.size_ && std::equal(data_, data_ + size_, o.data_); }
+        bool operator!=(const MessagePayload &o) const { return !(*this == o); }
+        bool operator==(const Bytes &o) const { return size_ == o.size() && std::equal(data_, data_ + size_, o.data()); }
+        bool operator!=(const Bytes &o) const { return !(*this == o); }
+
+      private:
+        std::size_t size_ = 0;
+        std::uint8_t data_[CAPACITY];
+    };
+
     class RawMessage {
       public:
         using MetadataMap = std::map<std::string, std::string>;
 
         RawMessage() : type_(MessageType::INVALID), received_at_(0), errors_(0), rssi_(0), raw_timestamp_(0) {}
 
-        RawMessage(const Bytes &payload, std::uint64_t received_at, unsigned errors, float rssi, std::uint64_t raw_timestamp = 0) : payload_(payload), received_at_(received_at), errors_(errors), rssi_(rssi), raw_timestamp_(raw_timestamp) {
-            switch (payload_.size()) {
-            case DOWNLINK_SHORT_DATA_BYTES:
-                type_ = MessageType::DOWNLINK_SHORT;
-                break;
-            case DOWNLINK_LONG_DATA_BYTES:
-                type_ = MessageType::DOWNLINK_LONG;
-                break;
-            case UPLINK_DATA_BYTES:
-                type_ = MessageType::UPLINK;
-                break;
-            default:
-                type_ = MessageType::INVALID;
-                break;
-            }
+        // A payload that is not the size of any message type gives an
+        // INVALID message with no payload
+        RawMessage(const std::uint8_t *payload, std::size_t size, std::uint64_t received_at, unsigned errors, float rssi, std::uint64_t raw_timestamp = 0) : type_(TypeForSize(size)), received_at_(received_at), errors_(errors), rssi_(rssi), raw_timestamp_(raw_timestamp) {
+            if (type_ != MessageType::INVALID)
+                payload_.assign(payload, size);
         }
 
-        RawMessage(Bytes &&payload, std::uint64_t received_at, unsigned errors, float rssi, std::uint64_t raw_timestamp = 0) : payload_(std::move(payload)), received_at_(received_at), errors_(errors), rssi_(rssi), raw_timestamp_(raw_timestamp) {
-            switch (payload_.size()) {
-            case DOWNLINK_SHORT_DATA_BYTES:
-                type_ = MessageType::DOWNLINK_SHORT;
-                break;
-            case DOWNLINK_LONG_DATA_BYTES:
-                type_ = MessageType::DOWNLINK_LONG;
-                break;
-            case UPLINK_DATA_BYTES:
-                type_ = MessageType::UPLINK;
-                break;
-            default:
-                type_ = MessageType::INVALID;
-                break;
-            }
-        }
+        RawMessage(const MessagePayload &payload, std::uint64_t received_at, unsigned errors, float rssi, std::uint64_t raw_timestamp = 0) : RawMessage(payload.data(), payload.size(), received_at, errors, rssi, raw_timestamp) {}
 
-        RawMessage(MetadataMap &&metadata) : type_(MessageType::METADATA), received_at_(0), errors_(0), rssi_(0.0), raw_timestamp_(0), metadata_(std::move(metadata)) {}
+        RawMessage(const Bytes &payload, std::uint64_t received_at, unsigned errors, float rssi, std::uint64_t raw_timestamp = 0) : RawMessage(payload.data(), payload.size(), received_at, errors, rssi, raw_timestamp) {}
 
-        RawMessage(const MetadataMap &metadata) : type_(MessageType::METADATA), received_at_(0), errors_(0), rssi_(0.0), raw_timestamp_(0), metadata_(metadata) {}
+        // Metadata is rare (normally one header message per connection), so
+        // it is kept out of line and shared between copies
+        RawMessage(MetadataMap &&metadata) : type_(MessageType::METADATA), received_at_(0), errors_(0), rssi_(0.0), raw_timestamp_(0), metadata_(std::make_shared<const MetadataMap>(std::move(metadata))) {}
+
+        RawMessage(const MetadataMap &metadata) : type_(MessageType::METADATA), received_at_(0), errors_(0), rssi_(0.0), raw_timestamp_(0), metadata_(std::make_shared<const MetadataMap>(metadata)) {}
 
         MessageType Type() const { return type_; }
 
-        Bytes &Payload() { return payload_; }
+        MessagePayload &Payload() { return payload_; }
 
-        const Bytes &Payload() const { return payload_; }
+        const MessagePayload &Payload() const { return payload_; }
 
         std::uint64_t ReceivedAt() const { return received_at_; }
 
@@ -76,7 +138,12 @@ namespace airnav::uat {
 
         std::uint64_t RawTimestamp() const { return raw_timestamp_; }
 
-        const MetadataMap &Metadata() const { return metadata_; }
+        const MetadataMap &Metadata() const { return metadata_ ? *metadata_ : NoMetadata(); }
+
+        // How many copies of this message were received (from several
+        // receivers feeding one process) and merged into this one
+        unsigned Copies() const { return copies_; }
+        void SetCopies(unsigned copies) { copies_ = copies; }
 
         // Number of raw bits in the message, excluding the sync bits
         unsigned BitLength() const {
@@ -150,20 +217,73 @@ namespace airnav::uat {
             }
         }
 
+        // Compile-time specialised equivalents of Bit() and Bits(). The
+        // offsets are template parameters, so each use compiles to a few
+        // fixed loads, a shift and a mask. These do no bounds checking: the
+        // caller must already have checked that the payload is at least
+        // `last_byte` bytes long.
+        template <unsigned byte, unsigned bit> __attribute__((always_inline)) bool Bit() const {
+            static_assert(byte >= 1 && bit >= 1 && bit <= 8, "bad bit position");
+            return (payload_[byte - 1] & (0x80 >> (bit - 1))) != 0;
+        }
+
+        template <unsigned first_byte, unsigned first_bit, unsigned last_byte, unsigned last_bit> __attribute__((always_inline)) std::uint32_t Field() const {
+            static_assert(first_byte >= 1 && first_bit >= 1 && first_bit <= 8, "bad first bit position");
+            static_assert(last_byte >= 1 && last_bit >= 1 && last_bit <= 8, "bad last bit position");
+            static_assert((first_byte - 1) * 8 + first_bit <= (last_byte - 1) * 8 + last_bit, "field ends before it starts");
+            static_assert((last_byte - 1) * 8 + last_bit - ((first_byte - 1) * 8 + first_bit) < 32, "field is wider than 32 bits");
+
+            const unsigned nbi = (last_byte - 1) * 8 + last_bit - ((first_byte - 1) * 8 + first_bit) + 1;
+            const unsigned nby = last_byte - first_byte + 1;
+            const unsigned shift = 8 - last_bit;
+
+            const std::uint8_t *data = payload_.data() + first_byte - 1;
+            std::uint64_t value = 0;
+            for (unsigned i = 0; i < nby; ++i) {
+                value = (value << 8) | data[i];
+            }
+            return static_cast<std::uint32_t>((value >> shift) & ((UINT64_C(1) << nbi) - 1));
+        }
+
       private:
+        static MessageType TypeForSize(std::size_t size) {
+            switch (size) {
+            case DOWNLINK_SHORT_DATA_BYTES:
+                return MessageType::DOWNLINK_SHORT;
+            case DOWNLINK_LONG_DATA_BYTES:
+                return MessageType::DOWNLINK_LONG;
+            case UPLINK_DATA_BYTES:
+                return MessageType::UPLINK;
+            default:
+                return MessageType::INVALID;
+            }
+        }
+
+        static const MetadataMap &NoMetadata();
+
         MessageType type_;
-        Bytes payload_;
         std::uint64_t received_at_;
         unsigned errors_;
         float rssi_;
         std::uint64_t raw_timestamp_;
-        MetadataMap metadata_;
+        unsigned copies_ = 1;
+        std::shared_ptr<const MetadataMap> metadata_; // METADATA messages only
+        MessagePayload payload_;
     };
 
     std::ostream &operator<<(std::ostream &os, const RawMessage &message);
 
-    typedef std::vector<RawMessage> MessageVector;
-    typedef std::shared_ptr<MessageVector> SharedMessageVector;
+    // Append the raw line form of `message` (exactly what operator<< writes,
+    // with no trailing newline) to `out`
+    void EncodeRaw(const RawMessage &message, std::string &out);
+
+    // Monotonic times at which a message vector reached each point of the
+    // pipeline; points that were not recorded are left at the clock's epoch
+    struct MessageTiming {
+        std::chrono::steady_clock::time_point received;    // the sample source delivered the samples
+        std::chrono::steady_clock::time_point demodulated; // the receiver finished demodulating them
+        std::chrono::steady_clock::time_point dispatched;  // the vector was handed to the output clients
+    };
 
     // 2.2.4.5.1.2 "ADDRESS QUALIFIER" field
     enum class AddressQualifier : unsigned char { ADSB_ICAO = 0, ADSB_OTHER = 1, TISB_ICAO = 2, TISB_TRACKFILE = 3, VEHICLE = 4, FIXED_BEACON = 5, ADSR_OTHER = 6, RESERVED = 7, INVALID = 8 };
@@ -218,10 +338,262 @@ namespace airnav::uat {
         bool operator!=(const ModeIndicators &o) const { return !(*this == o); }
     };
 
+    // JSON names of the enumerated fields
+    // clang-format off
+
+    NLOHMANN_JSON_SERIALIZE_ENUM(AddressQualifier, {
+        {AddressQualifier::INVALID, "invalid"},
+        {AddressQualifier::ADSB_ICAO, "adsb_icao"},
+        {AddressQualifier::ADSB_OTHER, "adsb_other"},
+        {AddressQualifier::TISB_ICAO, "tisb_icao"},
+        {AddressQualifier::TISB_TRACKFILE, "tisb_trackfile"},
+        {AddressQualifier::VEHICLE, "vehicle"},
+        {AddressQualifier::FIXED_BEACON, "fixed_beacon"},
+        {AddressQualifier::ADSR_OTHER, "adsr_other"},
+        {AddressQualifier::RESERVED, "reserved"},
+    });
+
+    NLOHMANN_JSON_SERIALIZE_ENUM(AirGroundState, {
+        {AirGroundState::INVALID, "invalid"},
+        {AirGroundState::AIRBORNE_SUBSONIC, "airborne"},
+        {AirGroundState::AIRBORNE_SUPERSONIC, "supersonic"},
+        {AirGroundState::ON_GROUND, "ground"},
+        {AirGroundState::RESERVED, "reserved"}
+    });
+
+    NLOHMANN_JSON_SERIALIZE_ENUM(VerticalVelocitySource, {
+        {VerticalVelocitySource::INVALID, "invalid"},
+        {VerticalVelocitySource::GEOMETRIC, "geometric"},
+        {VerticalVelocitySource::BAROMETRIC, "barometric"}
+    });
+
+    NLOHMANN_JSON_SERIALIZE_ENUM(EmergencyPriorityStatus, {
+        {EmergencyPriorityStatus::INVALID, "invalid"},
+        {EmergencyPriorityStatus::NONE, "none"},
+        {EmergencyPriorityStatus::GENERAL, "general"},
+        {EmergencyPriorityStatus::MEDICAL, "medical"},
+        {EmergencyPriorityStatus::NORDO, "nordo"},
+        {EmergencyPriorityStatus::UNLAWFUL, "unlawful"},
+        {EmergencyPriorityStatus::DOWNED, "downed"},
+        {EmergencyPriorityStatus::RESERVED, "reserved"}
+    });
+
+    NLOHMANN_JSON_SERIALIZE_ENUM(SILSupplement, {
+        {SILSupplement::INVALID, "invalid"},
+        {SILSupplement::PER_HOUR, "per_hour"},
+        {SILSupplement::PER_SAMPLE, "per_sample"}
+    });
+
+    NLOHMANN_JSON_SERIALIZE_ENUM(SelectedAltitudeType, {
+        {SelectedAltitudeType::INVALID, "invalid"},
+        {SelectedAltitudeType::MCP_FCU, "mcp_fcu"},
+        {SelectedAltitudeType::FMS, "fms"}
+    });
+
+    // clang-format on
+
     typedef std::uint32_t AdsbAddress;
 
+    // A decoded downlink ADS-B message in a compact form: a bitmask of the
+    // fields that are present, plus the field values packed into small
+    // fixed-width members (angles, coordinates and other rounded values
+    // are kept as scaled integers), with no heap allocation. The accessors
+    // return the same values that the corresponding AdsbMessage fields
+    // hold, and an AdsbMessage can be constructed from one.
+    class CompactAdsbMessage {
+      public:
+        // Bit numbers in the presence mask
+        enum Field : unsigned {
+            POSITION,
+            PRESSURE_ALTITUDE,
+            GEOMETRIC_ALTITUDE,
+            NIC,
+            AIRGROUND_STATE,
+            NORTH_VELOCITY,
+            EAST_VELOCITY,
+            VV_SRC,
+            VERTICAL_VELOCITY_BAROMETRIC,
+            VERTICAL_VELOCITY_GEOMETRIC,
+            GROUND_SPEED,
+            MAGNETIC_HEADING,
+            TRUE_HEADING,
+            TRUE_TRACK,
+            AIRCRAFT_SIZE,
+            GPS_LATERAL_OFFSET,
+            GPS_LONGITUDINAL_OFFSET,
+            GPS_POSITION_OFFSET_APPLIED,
+            UTC_COUPLED,
+            UPLINK_FEEDBACK,
+            TISB_SITE_ID,
+            EMITTER_CATEGORY,
+            CALLSIGN,
+            FLIGHTPLAN_ID,
+            EMERGENCY,
+            MOPS_VERSION,
+            SIL,
+            TRANSMIT_MSO,
+            SDA,
+            NAC_P,
+            NAC_V,
+            NIC_BARO,
+            CAPABILITY_CODES,
+            OPERATIONAL_MODES,
+            SIL_SUPPLEMENT,
+            GVA,
+            SINGLE_ANTENNA,
+            NIC_SUPPLEMENT,
+            SELECTED_ALTITUDE_TYPE,
+            SELECTED_ALTITUDE_MCP,
+            SELECTED_ALTITUDE_FMS,
+            BAROMETRIC_PRESSURE_SETTING,
+            SELECTED_HEADING,
+            MODE_INDICATORS,
+            FIELD_COUNT
+        };
+
+        static_assert(FIELD_COUNT <= 64, "presence mask is too small");
+
+        explicit CompactAdsbMessage(const RawMessage &raw);
+
+        bool Has(Field field) const { return (present_ & (std::uint64_t(1) << field)) != 0; }
+
+        // Metadata copied from the raw message
+        std::uint64_t received_at;
+        std::uint64_t raw_timestamp;
+        float rssi;
+        std::uint8_t errors;
+
+        // 2.2.4.5 HEADER Element
+        std::uint8_t payload_type;
+        AddressQualifier address_qualifier;
+        AdsbAddress address;
+
+        // 2.2.4.5.2 STATE VECTOR Element (ADS-B)
+        // 2.2.4.5.3 STATE VECTOR Element (TIS-B/ADS-B)
+        boost::optional<std::pair<double, double>> position() const { return Get(POSITION, std::make_pair(latitude_e5_ / 1e5, longitude_e5_ / 1e5)); }
+        boost::optional<int> pressure_altitude() const { return Get<int>(PRESSURE_ALTITUDE, pressure_altitude_); }
+        boost::optional<int> geometric_altitude() const { return Get<int>(GEOMETRIC_ALTITUDE, geometric_altitude_); }
+        boost::optional<unsigned> nic() const { return Get<unsigned>(NIC, nic_); }
+        boost::optional<AirGroundState> airground_state() const { return Get(AIRGROUND_STATE, airground_state_); }
+        boost::optional<int> north_velocity() const { return Get<int>(NORTH_VELOCITY, north_velocity_); }
+        boost::optional<int> east_velocity() const { return Get<int>(EAST_VELOCITY, east_velocity_); }
+        boost::optional<VerticalVelocitySource> vv_src() const { return Get(VV_SRC, vv_src_); }
+        boost::optional<int> vertical_velocity_barometric() const { return Get<int>(VERTICAL_VELOCITY_BAROMETRIC, vertical_velocity_barometric_); }
+        boost::optional<int> vertical_velocity_geometric() const { return Get<int>(VERTICAL_VELOCITY_GEOMETRIC, vertical_velocity_geometric_); }
+        boost::optional<int> ground_speed() const { return Get<int>(GROUND_SPEED, ground_speed_); }
+        boost::optional<double> magnetic_heading() const { return Get(MAGNETIC_HEADING, magnetic_heading_e1_ / 10.0); }
+        boost::optional<double> true_heading() const { return Get(TRUE_HEADING, true_heading_e1_ / 10.0); }
+        boost::optional<double> true_track() const { return Get(TRUE_TRACK, true_track_e1_ / 10.0); }
+        boost::optional<std::pair<double, double>> aircraft_size() const; // length, width
+        boost::optional<double> gps_lateral_offset() const { return Get<double>(GPS_LATERAL_OFFSET, gps_lateral_offset_); }
+        boost::optional<double> gps_longitudinal_offset() const { return Get<double>(GPS_LONGITUDINAL_OFFSET, gps_longitudinal_offset_); }
+        boost::optional<bool> gps_position_offset_applied() const { return Get<bool>(GPS_POSITION_OFFSET_APPLIED, flags_ & FLAG_GPS_POSITION_OFFSET_APPLIED); }
+        boost::optional<bool> utc_coupled() const { return Get<bool>(UTC_COUPLED, flags_ & FLAG_UTC_COUPLED); }
+        boost::optional<unsigned> uplink_feedback() const { return Get<unsigned>(UPLINK_FEEDBACK, uplink_feedback_); }
+        boost::optional<unsigned> tisb_site_id() const { return Get<unsigned>(TISB_SITE_ID, tisb_site_id_); }
+
+        // 2.2.4.5.4 MODE STATUS element
+        boost::optional<unsigned> emitter_category() const { return Get<unsigned>(EMITTER_CATEGORY, emitter_category_); }
+        boost::optional<std::string> callsign() const { return Has(CALLSIGN) ? boost::optional<std::string>(Ident()) : boost::none; }
+        boost::optional<std::string> flightplan_id() const { return Has(FLIGHTPLAN_ID) ? boost::optional<std::string>(Ident()) : boost::none; } // aka Mode 3/A squawk
+        boost::optional<EmergencyPriorityStatus> emergency() const { return Get(EMERGENCY, emergency_); }
+        boost::optional<unsigned> mops_version() const { return Get<unsigned>(MOPS_VERSION, mops_version_); }
+        boost::optional<unsigned> sil() const { return Get<unsigned>(SIL, sil_); }
+        boost::optional<unsigned> transmit_mso() const { return Get<unsigned>(TRANSMIT_MSO, transmit_mso_); }
+        boost::optional<unsigned> sda() const { return Get<unsigned>(SDA, sda_); }
+        boost::optional<unsigned> nac_p() const { return Get<unsigned>(NAC_P, nac_p_); }
+        boost::optional<unsigned> nac_v() const { return Get<unsigned>(NAC_V, nac_v_); }
+        boost::optional<unsigned> nic_baro() const { return Get<unsigned>(NIC_BARO, nic_baro_); }
+        boost::optional<CapabilityCodes> capability_codes() const { return Get(CAPABILITY_CODES, capability_codes_); }
+        boost::optional<OperationalModes> operational_modes() const { return Get(OPERATIONAL_MODES, operational_modes_); }
+        boost::optional<SILSupplement> sil_supplement() const { return Get(SIL_SUPPLEMENT, sil_supplement_); }
+        boost::optional<unsigned> gva() const { return Get<unsigned>(GVA, gva_); }
+        boost::optional<bool> single_antenna() const { return Get<bool>(SINGLE_ANTENNA, flags_ & FLAG_SINGLE_ANTENNA); }
+        boost::optional<bool> nic_supplement() const { return Get<bool>(NIC_SUPPLEMENT, flags_ & FLAG_NIC_SUPPLEMENT); }
+
+        // 2.2.4.5.6 TARGET STATE element
+        boost::optional<SelectedAltitudeType> selected_altitude_type() const { return Get(SELECTED_ALTITUDE_TYPE, selected_altitude_type_); }
+        boost::optional<int> selected_altitude_mcp() const { return Get<int>(SELECTED_ALTITUDE_MCP, selected_altitude_mcp_); }
+        boost::optional<int> selected_altitude_fms() const { return Get<int>(SELECTED_ALTITUDE_FMS, selected_altitude_fms_); }
+        boost::optional<double> barometric_pressure_setting() const { return Get(BAROMETRIC_PRESSURE_SETTING, 800 + (raw_pressure_setting_ - 1) * 0.8); }
+        boost::optional<double> selected_heading() const { return Get(SELECTED_HEADING, selected_heading_e1_ / 10.0); }
+        boost::optional<ModeIndicators> mode_indicators() const { return Get(MODE_INDICATORS, mode_indicators_); }
+
+        // Append the compact JSON form of this message to `out`. The output
+        // is identical to AdsbMessage(*this).ToJson().dump(), but is written
+        // directly without building a json object first.
+        void EncodeJson(std::string &out) const;
+
+      private:
+        enum Flag : std::uint8_t { FLAG_GPS_POSITION_OFFSET_APPLIED = 1, FLAG_UTC_COUPLED = 2, FLAG_SINGLE_ANTENNA = 4, FLAG_NIC_SUPPLEMENT = 8 };
+
+        template <typename T> boost::optional<T> Get(Field field, const T &value) const { return Has(field) ? boost::optional<T>(value) : boost::none; }
+        void Set(Field field) { present_ |= (std::uint64_t(1) << field); }
+        void SetFlag(Field field, Flag flag, bool value) {
+            Set(field);
+            flags_ = (value ? flags_ | flag : flags_ & ~flag);
+        }
+
+        std::string Ident() const { return std::string(ident_, ident_length_); }
+
+        void DecodeSV(const RawMessage &raw);
+        template <unsigned startbyte> void DecodeTS(const RawMessage &raw);
+        void DecodeMS(const RawMessage &raw);
+        void DecodeAUXSV(const RawMessage &raw);
+
+        std::uint64_t present_ = 0;
+
+        std::int32_t latitude_e5_ = 0; // degrees * 1e5, as rounded to 5dp
+        std::int32_t longitude_e5_ = 0;
+        std::int32_t pressure_altitude_ = 0;
+        std::int32_t geometric_altitude_ = 0;
+        std::int32_t selected_altitude_mcp_ = 0;
+        std::int32_t selected_altitude_fms_ = 0;
+
+        std::int16_t north_velocity_ = 0;
+        std::int16_t east_velocity_ = 0;
+        std::int16_t vertical_velocity_barometric_ = 0;
+        std::int16_t vertical_velocity_geometric_ = 0;
+        std::int16_t ground_speed_ = 0;
+        std::uint16_t magnetic_heading_e1_ = 0; // degrees * 10, as rounded to 1dp
+        std::uint16_t true_heading_e1_ = 0;
+        std::uint16_t true_track_e1_ = 0;
+        std::int16_t selected_heading_e1_ = 0;
+        std::uint16_t raw_pressure_setting_ = 0; // as transmitted
+
+        std::uint8_t nic_ = 0;
+        AirGroundState airground_state_ = AirGroundState::INVALID;
+        VerticalVelocitySource vv_src_ = VerticalVelocitySource::INVALID;
+        std::uint8_t raw_aircraft_size_ = 0; // as transmitted
+        std::int8_t gps_lateral_offset_ = 0;
+        std::int8_t gps_longitudinal_offset_ = 0;
+        std::uint8_t uplink_feedback_ = 0;
+        std::uint8_t tisb_site_id_ = 0;
+        std::uint8_t flags_ = 0;
+
+        std::uint8_t emitter_category_ = 0;
+        EmergencyPriorityStatus emergency_ = EmergencyPriorityStatus::INVALID;
+        std::uint8_t mops_version_ = 0;
+        std::uint8_t sil_ = 0;
+        std::uint8_t transmit_mso_ = 0;
+        std::uint8_t sda_ = 0;
+        std::uint8_t nac_p_ = 0;
+        std::uint8_t nac_v_ = 0;
+        std::uint8_t nic_baro_ = 0;
+        CapabilityCodes capability_codes_ = {};
+        OperationalModes operational_modes_ = {};
+        SILSupplement sil_supplement_ = SILSupplement::INVALID;
+        std::uint8_t gva_ = 0;
+        SelectedAltitudeType selected_altitude_type_ = SelectedAltitudeType::INVALID;
+        ModeIndicators mode_indicators_ = {};
+
+        char ident_[8]; // callsign or flightplan ID, not terminated
+        std::uint8_t ident_length_ = 0;
+    };
+
     struct AdsbMessage {
-        AdsbMessage(const RawMessage &raw);
+        AdsbMessage(const RawMessage &raw) : AdsbMessage(CompactAdsbMessage(raw)) {}
+        AdsbMessage(const CompactAdsbMessage &compact);
 
         // Metadata copied from the raw message
         std::uint64_t received_at;
@@ -288,14 +660,186 @@ namespace airnav::uat {
         boost::optional<double> selected_heading;
         boost::optional<ModeIndicators> mode_indicators;
 
+        nlohmann::json ToJson() const;
+    };
+
+    // DO-358 FIS-B APDU header. Only the header is decoded here; the product
+    // payload is left in place for consumers of the product to decode.
+    struct FisbApdu {
+        bool a_flag;
+        bool g_flag;
+        bool p_flag;
+        bool s_flag;
+        bool monthday_valid;
+        bool seconds_valid;
+
+        std::uint16_t product_id;
+        std::uint8_t month;   // if monthday_valid
+        std::uint8_t day;     // if monthday_valid
+        std::uint8_t hours;
+        std::uint8_t minutes;
+        std::uint8_t seconds; // if seconds_valid
+
+        // The product payload, pointing into the uplink message's payload
+        const std::uint8_t *data;
+        std::uint16_t length;
+
+        // Decode the payload as DLAC text (used by the textual products)
+        std::string DecodeText() const;
+    };
+
+    // 2.2.3.2 ground uplink message: the UAT-specific header and the list
+    // of information frames. FIS-B APDU headers are decoded, APDU payloads
+    // are not.
+    //
+    // The frames and APDUs point into the payload of the RawMessage this
+    // was decoded from, so an UplinkMessage must not outlive it.
+    class UplinkMessage {
+      public:
+        // An information frame (2.2.3.2.3.2). Frames of type 0 carry a FIS-B APDU.
+        struct InfoFrame {
+            std::uint8_t type;
+            std::uint16_t length;
+            const std::uint8_t *data;
+        };
+
+        UplinkMessage(const RawMessage &raw);
+
+        // Metadata copied from the raw message
+        std::uint64_t received_at;
+        std::uint64_t raw_timestamp;
+        unsigned errors;
+        float rssi;
+
+        // 2.2.3.2.2 UAT-specific header
+        bool position_valid;
+        double latitude;
+        double longitude;
+        bool utc_coupled;
+        bool app_data_valid;
+        unsigned slot_id;
+        unsigned tisb_site_id;
+
+        // All information frames, in order (empty if !app_data_valid)
+        const std::vector<InfoFrame> &InfoFrames() const { return frames_; }
+
+        // The FIS-B APDUs from the information frames, in order
+        const std::vector<FisbApdu> &Apdus() const { return apdus_; }
+
         nlohmann::json ToJson() const;
 
       private:
-        void DecodeSV(const RawMessage &raw);
-        void DecodeTS(const RawMessage &raw, unsigned startbyte);
-        void DecodeMS(const RawMessage &raw);
-        void DecodeAUXSV(const RawMessage &raw);
+        std::vector<InfoFrame> frames_;
+        std::vector<FisbApdu> apdus_;
+    };
+
+    class MessageVector;
+
+    // Calls a handler for each FIS-B APDU, from a message vector's uplink
+    // messages, whose product ID is one of a chosen set. Uplinks are
+    // decoded only if the vector contains any; no APDU payload is touched
+    // unless the handler does so.
+    class FisbProducts {
+      public:
+        typedef std::function<void(const UplinkMessage &, const FisbApdu &)> Handler;
+
+        FisbProducts(std::initializer_list<unsigned> product_ids, Handler handler);
+
+        void operator()(const MessageVector &messages) const;
+
+      private:
+        std::vector<bool> wanted_; // indexed by product ID
+        Handler handler_;
+    };
+
+    // A batch of messages, normally everything demodulated from one block of samples
+    class MessageVector : public std::vector<RawMessage> {
+      public:
+        using std::vector<RawMessage>::vector;
+
+        MessageVector() = default;
+
+        // Copies and moves get their own (empty) decode cache
+        MessageVector(const MessageVector &other) : std::vector<RawMessage>(other), timing(other.timing), source(other.source) {}
+        MessageVector(MessageVector &&other) : std::vector<RawMessage>(std::move(other)), timing(other.timing), source(other.source) {}
+        MessageVector &operator=(const MessageVector &) = delete;
+        MessageVector &operator=(MessageVector &&) = delete;
+
+        // A new, empty vector. Vectors are recycled: when the last
+        // reference to one is dropped it is cleared (keeping its capacity)
+        // and returned to a pool shared by all threads, so steady-state
+        // batches do not allocate for their messages.
+        static std::shared_ptr<MessageVector> Create();
+
+        MessageTiming timing;
+
+        // Which input of a MergedMessageSource (counting from 0) the
+        // messages came from
+        unsigned source = 0;
+
+        // The downlink messages of the vector, decoded, in order. They are
+        // decoded by the first call, once for all consumers; later calls
+        // (from any thread) share the result. Do not modify the vector
+        // after calling this.
+        const std::vector<CompactAdsbMessage> &DecodedDownlink() const;
+
+        // The uplink messages of the vector, decoded in the same way as DecodedDownlink
+        const std::vector<UplinkMessage> &DecodedUplink() const;
+
+      private:
+        // Empty the vector and its decode caches for reuse, keeping their capacity
+        void Recycle();
+        static void Release(MessageVector *messages);
+
+        mutable std::mutex decode_mutex_;
+        mutable std::atomic<bool> decoded_ready_{false};
+        mutable std::vector<CompactAdsbMessage> decoded_;
+
+        mutable std::atomic<bool> decoded_uplink_ready_{false};
+        mutable std::vector<UplinkMessage> decoded_uplink_;
     };
+
+    // Append each of `messages` in raw form, one per line, skipping INVALID
+    // messages. If `latency` is set, each line except metadata also gets a
+    // lat= field: the number of microseconds since the samples were
+    // delivered (timing.received).
+    void EncodeRawLines(const MessageVector &messages, std::string &out, bool latency = false);
+
+    typedef std::shared_ptr<MessageVector> SharedMessageVector;
+
+    // Binary framing (--binary-port), a compact alternative to the raw
+    // line format for machine consumers. Each frame is a 16-bit length of
+    // the rest of the frame, then a type byte; multi-byte fields are
+    // big-endian. Message frames (types 1-3: short downlink, long
+    // downlink, uplink) continue with a fixed header and the payload:
+    //
+    //   u8  RS errors corrected
+    //   i16 RSSI in centi-dB (clamped to the 16-bit range)
+    //   u16 copies merged into this message (see RawMessage::Copies)
+    //   u64 receive time, ms since the Unix epoch (0 if unknown)
+    //   u64 hi-res sample timestamp (rt=, 0 if unknown)
+    //   payload bytes
+    //
+    // Metadata frames (type 0) carry the metadata as key=value; pairs, as
+    // in a raw metadata line without the leading '!'. Frames of unknown
+    // type should be skipped.
+    const std::size_t BINARY_LENGTH_BYTES = 2;
+    const std::size_t BINARY_MESSAGE_HEADER_BYTES = 1 + 1 + 2 + 2 + 8 + 8;
+
+    // Append the binary frame form of `message` to `out`
+    void EncodeBinary(const RawMessage &message, std::string &out);
+
+    // Append each of `messages` in binary form, skipping INVALID messages
+    void EncodeBinaryFrames(const MessageVector &messages, std::string &out);
+
+    // The size of the frame starting at `begin`, including its length
+    // field, or 0 if [begin, end) does not hold all of it yet
+    std::size_t BinaryFrameSize(const std::uint8_t *begin, const std::uint8_t *end);
+
+    // Decode one complete frame of `size` bytes. Returns a message of type
+    // INVALID for a frame of unknown type, or none if the frame is
+    // malformed.
+    boost::optional<RawMessage> DecodeBinary(const std::uint8_t *frame, std::size_t size);
 } // namespace airnav::uat
 
 #endif
@@ -0,0 +1,113 @@
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#include "udp_output.h"
+
+#include <boost/asio/ip/multicast.hpp>
+
+using namespace airnav::uat;
+using boost::asio::ip::udp;
+
+UdpOutput::UdpOutput(boost::asio::io_service &service, const std::vector<udp::endpoint> &destinations, Format format, std::size_t max_datagram, unsigned multicast_ttl) : destinations_(destinations), format_(format), max_datagram_(max_datagram), socket_v4_(service), socket_v6_(service) {
+    for (const auto &destination : destinations_) {
+        auto &socket = (destination.address().is_v4() ? socket_v4_ : socket_v6_);
+        if (!socket.is_open()) {
+            socket.open(destination.protocol());
+            socket.non_blocking(true);
+        }
+        if (destination.address().is_multicast()) {
+            socket.set_option(boost::asio::ip::multicast::hops(multicast_ttl));
+            socket.set_option(boost::asio::ip::multicast::enable_loopback(true));
+        }
+    }
+}
+
+udp::socket &UdpOutput::SocketFor(const udp::endpoint &destination) { return (destination.address().is_v4() ? socket_v4_ : socket_v6_); }
+
+void UdpOutput::HandleMessages(SharedMessageVector messages) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    packed_.clear();
+    ends_.clear();
+
+    for (const auto &message : *messages) {
+        if (message.Type() == MessageType::METADATA || message.Type() == MessageType::INVALID) {
+            continue;
+        }
+
+        scratch_.clear();
+        if (format_ == Format::BINARY) {
+            EncodeBinary(message, scratch_);
+        } else {
+            EncodeRaw(message, scratch_);
+            scratch_ += '\n';
+        }
+
+        // start a new datagram if this message does not fit in the current one
+        const std::size_t datagram_start = (ends_.empty() ? 0 : ends_.back());
+        if (packed_.size() > datagram_start && packed_.size() - datagram_start + scratch_.size() > max_datagram_) {
+            ends_.push_back(packed_.size());
+        }
+        packed_ += scratch_;
+    }
+
+    if (packed_.empty()) {
+        return;
+    }
+    ends_.push_back(packed_.size());
+
+    for (const auto &destination : destinations_) {
+        Send(SocketFor(destination), destination);
+    }
+}
+
+void UdpOutput::Send(udp::socket &socket, const udp::endpoint &destination) {
+#ifdef __linux__
+    // one syscall for all the datagrams
+    const std::size_t count = ends_.size();
+    if (iovecs_.size() < count) {
+        iovecs_.resize(count);
+        headers_.resize(count);
+    }
+
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        iovecs_[i].iov_base = &packed_[start];
+        iovecs_[i].iov_len = ends_[i] - start;
+        headers_[i] = {};
+        headers_[i].msg_hdr.msg_name = const_cast<void *>(static_cast<const void *>(destination.data()));
+        headers_[i].msg_hdr.msg_namelen = destination.size();
+        headers_[i].msg_hdr.msg_iov = &iovecs_[i];
+        headers_[i].msg_hdr.msg_iovlen = 1;
+        start = ends_[i];
+    }
+
+    std::size_t sent = 0;
+    while (sent < count) {
+        const int result = ::sendmmsg(socket.native_handle(), &headers_[sent], count - sent, MSG_DONTWAIT);
+        if (result <= 0) {
+            break; // EAGAIN, or an error such as no route: drop the rest
+        }
+        for (int i = 0; i < result; ++i) {
+            bytes_sent_ += headers_[sent + i].msg_len;
+        }
+        sent += result;
+    }
+    datagrams_sent_ += sent;
+    datagrams_dropped_ += count - sent;
+#else
+    std::size_t start = 0;
+    for (auto end : ends_) {
+        boost::system::error_code ec;
+        const std::size_t len = socket.send_to(boost::asio::buffer(&packed_[start], end - start), destination, 0, ec);
+        if (ec) {
+            ++datagrams_dropped_;
+        } else {
+            ++datagrams_sent_;
+            bytes_sent_ += len;
+        }
+        start = end;
+    }
+#endif
+}
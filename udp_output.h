@@ -0,0 +1,81 @@
+// -*- c++ -*-
+
+// Copyright (c) 2019, FlightAware LLC.
+// All rights reserved.
+// Licensed under the 2-clause BSD license; see the LICENSE file
+
+#ifndef DUMP978_UDP_OUTPUT_H
+#define DUMP978_UDP_OUTPUT_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#include "uat_message.h"
+
+namespace airnav::uat {
+    // Sends messages as UDP datagrams to a fixed set of unicast or
+    // multicast destinations. Unlike the TCP outputs there is no per-client
+    // state: each message vector is encoded once, packed into as few
+    // datagrams as fit within `max_datagram` bytes (a message is never
+    // split across datagrams), and all the datagrams for each destination
+    // are handed to the kernel in a single sendmmsg call where available.
+    //
+    // Sends never block; datagrams the kernel will not take immediately are
+    // dropped and counted. There is no metadata header, as there is no
+    // connection to send it on.
+    class UdpOutput : public std::enable_shared_from_this<UdpOutput> {
+      public:
+        typedef std::shared_ptr<UdpOutput> Pointer;
+        enum class Format { RAW, BINARY };
+
+        // factory method, this class must always be constructed via make_shared
+        static Pointer Create(boost::asio::io_service &service, const std::vector<boost::asio::ip::udp::endpoint> &destinations, Format format, std::size_t max_datagram = 1400, unsigned multicast_ttl = 1) { return Pointer(new UdpOutput(service, destinations, format, max_datagram, multicast_ttl)); }
+
+        // A MessageDispatch handler
+        void HandleMessages(SharedMessageVector messages);
+
+        std::uint64_t DatagramsSent() const { return datagrams_sent_; }
+        std::uint64_t BytesSent() const { return bytes_sent_; }
+        std::uint64_t DatagramsDropped() const { return datagrams_dropped_; }
+
+      private:
+        UdpOutput(boost::asio::io_service &service, const std::vector<boost::asio::ip::udp::endpoint> &destinations, Format format, std::size_t max_datagram, unsigned multicast_ttl);
+
+        boost::asio::ip::udp::socket &SocketFor(const boost::asio::ip::udp::endpoint &destination);
+        void Send(boost::asio::ip::udp::socket &socket, const boost::asio::ip::udp::endpoint &destination);
+
+        std::vector<boost::asio::ip::udp::endpoint> destinations_;
+        Format format_;
+        std::size_t max_datagram_;
+
+        boost::asio::ip::udp::socket socket_v4_;
+        boost::asio::ip::udp::socket socket_v6_;
+
+        std::mutex mutex_;               // serializes HandleMessages
+        std::string packed_;             // the datagrams for the current vector, back to back
+        std::vector<std::size_t> ends_;  // where each datagram in packed_ ends
+        std::string scratch_;            // one encoded message
+#ifdef __linux__
+        // sendmmsg arguments, reused across calls
+        std::vector<struct iovec> iovecs_;
+        std::vector<struct mmsghdr> headers_;
+#endif
+
+        std::atomic<std::uint64_t> datagrams_sent_{0};
+        std::atomic<std::uint64_t> bytes_sent_{0};
+        std::atomic<std::uint64_t> datagrams_dropped_{0};
+    };
+}; // namespace airnav::uat
+
+#endif